@@ -37,14 +37,51 @@
 #include "paramset.h"
 #include "stats.h"
 #include "parallel.h"
+#include "shapes/triangle.h"
 #include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef PBRT_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 namespace pbrt {
 
 STAT_MEMORY_COUNTER("Memory/BVH tree", treeBytes);
+STAT_MEMORY_COUNTER("Memory/BVH nodes", bvhNodeBytes);
 STAT_RATIO("BVH/Primitives per leaf node", totalPrimitives, totalLeafNodes);
 STAT_COUNTER("BVH/Interior nodes", interiorNodes);
 STAT_COUNTER("BVH/Leaf nodes", leafNodes);
+STAT_COUNTER("BVH/Ray packets traversed", packetTraversals);
+STAT_PERCENT("BVH/Packet rays traced individually", singlePacketRays,
+             totalPacketRays);
+STAT_COUNTER("BVH/Wide nodes", totalWideNodes);
+#ifdef PBRT_BVH_TRAVERSAL_STATS
+// Updating the distribution costs several thread-local stores per ray, so
+// it is only compiled in on request
+STAT_INT_DISTRIBUTION("BVH/Nodes visited per ray", nodesVisitedPerRay);
+#define REPORT_NODES_VISITED(n) ReportValue(nodesVisitedPerRay, n)
+#else
+#define REPORT_NODES_VISITED(n) ((void)(n))
+#endif
+STAT_COUNTER("BVH/Cache hits", cacheHits);
+STAT_COUNTER("BVH/Cache misses", cacheMisses);
+STAT_COUNTER("BVH/SBVH spatial splits", sbvhSpatialSplits);
+STAT_COUNTER("BVH/Refits", bvhRefits);
+STAT_PERCENT("BVH/Primitives intersected as leaf triangles", leafTriangleCount,
+             leafPrimitiveCount);
+STAT_RATIO("BVH/SBVH references per primitive", sbvhReferences,
+           sbvhPrimitives);
+STAT_FLOAT_DISTRIBUTION("BVH/HLBVH Morton code generation (ms)",
+                        hlbvhMortonTime);
+STAT_FLOAT_DISTRIBUTION("BVH/HLBVH radix sort (ms)", hlbvhSortTime);
+STAT_FLOAT_DISTRIBUTION("BVH/HLBVH treelet emission (ms)", hlbvhEmitTime);
+STAT_FLOAT_DISTRIBUTION("BVH/HLBVH upper SAH build (ms)", hlbvhUpperSAHTime);
+STAT_FLOAT_DISTRIBUTION("BVH/Build time (ms)", bvhBuildTime);
 
 // BVHAccel Local Declarations
 struct BVHPrimitiveInfo {
@@ -82,6 +119,30 @@ struct BVHBuildNode {
     int splitAxis, firstPrimOffset, nPrimitives;
 };
 
+// Returns the milliseconds elapsed since _*start_ and resets it to the
+// current time.
+static double ElapsedMS(std::chrono::steady_clock::time_point *start) {
+    std::chrono::steady_clock::time_point now =
+        std::chrono::steady_clock::now();
+    double ms =
+        std::chrono::duration<double, std::milli>(now - *start).count();
+    *start = now;
+    return ms;
+}
+
+struct BVHBuildTask {
+    BVHBuildNode *node;
+    int start, end;
+};
+
+struct SBVHBuildState {
+    // Surface area of the root node's bounds
+    Float rootArea;
+    // Number of additional primitive references spatial splits may still
+    // create
+    int64_t duplicatesLeft;
+};
+
 struct MortonPrimitive {
     int primitiveIndex;
     uint32_t mortonCode;
@@ -103,6 +164,206 @@ struct LinearBVHNode {
     uint8_t pad[1];        // ensure 32 byte total size
 };
 
+// Tests a ray against the bounds of up to _Width_ children stored as
+// structure-of-arrays, _bounds[pMin/pMax][axis][child]_.  Returns a bit
+// mask of the children that are hit and their entry distances in _tNear_.
+template <int Width>
+inline uint32_t IntersectChildBounds(const Float bounds[2][3][Width],
+                                     int nChildren, const Point3f &o,
+                                     const Vector3f &invDir,
+                                     const int dirIsNeg[3], Float rayTMax,
+                                     Float tNear[Width]) {
+    // Compute slab intervals for all children
+    // As with _RayPacket::IntersectP()_, this matches
+    // _Bounds3::IntersectP()_, so the wide and binary trees agree on
+    // which boxes a ray hits.
+    const Float gammaScale = 1 + 2 * gamma(3);
+    Float tMin[Width], tFar[Width];
+    for (int i = 0; i < Width; ++i) {
+        tMin[i] = (bounds[dirIsNeg[0]][0][i] - o.x) * invDir.x;
+        tFar[i] =
+            (bounds[1 - dirIsNeg[0]][0][i] - o.x) * invDir.x * gammaScale;
+    }
+    for (int axis = 1; axis < 3; ++axis) {
+        for (int i = 0; i < Width; ++i) {
+            Float t0 =
+                (bounds[dirIsNeg[axis]][axis][i] - o[axis]) * invDir[axis];
+            Float t1 = (bounds[1 - dirIsNeg[axis]][axis][i] - o[axis]) *
+                       invDir[axis] * gammaScale;
+            bool overlap = !(tMin[i] > t1 || t0 > tFar[i]);
+            tMin[i] = overlap && t0 > tMin[i] ? t0 : tMin[i];
+            tFar[i] = overlap && t1 < tFar[i] ? t1 : tFar[i];
+            // Mark children whose slabs don't overlap as missed
+            tFar[i] = overlap ? tFar[i] : -Infinity;
+        }
+    }
+    uint32_t hitMask = 0;
+    for (int i = 0; i < Width; ++i) {
+        tNear[i] = tMin[i];
+        if (tMin[i] < rayTMax && tFar[i] > 0) hitMask |= 1u << i;
+    }
+    return hitMask & ((1u << nChildren) - 1);
+}
+
+// Node of a BVH with up to _Width_ children, built by collapsing the binary
+// tree.  Child bounds are stored as structure-of-arrays so that a ray can be
+// tested against all of them at once; leaf children are stored inline.
+template <int Width_>
+struct
+#ifdef PBRT_HAVE_ALIGNAS
+alignas(PBRT_L1_CACHE_LINE_SIZE)
+#endif // PBRT_HAVE_ALIGNAS
+WideBVHNode {
+    static PBRT_CONSTEXPR int Width = Width_;
+    // WideBVHNode Public Methods
+    WideBVHNode() {
+        // Give unused child slots empty bounds that no ray can hit
+        for (int i = 0; i < Width; ++i) {
+            for (int axis = 0; axis < 3; ++axis) {
+                bounds[0][axis][i] = Infinity;
+                bounds[1][axis][i] = -Infinity;
+            }
+            childOffset[i] = 0;
+            nPrimitives[i] = 0;
+        }
+        nChildren = 0;
+    }
+    uint32_t IntersectP(const Point3f &o, const Vector3f &invDir,
+                        const int dirIsNeg[3], Float rayTMax,
+                        Float tNear[Width]) const {
+        return IntersectChildBounds<Width>(bounds, nChildren, o, invDir,
+                                           dirIsNeg, rayTMax, tNear);
+    }
+    Float bounds[2][3][Width];  // [pMin/pMax][axis][child]
+    int childOffset[Width];     // interior child: node index; leaf: primitives
+    uint16_t nPrimitives[Width];  // 0 -> interior child
+    uint8_t nChildren;
+};
+
+// 8-wide BVH node with child bounds quantized to _T_ (8 or 16 bits) on a
+// grid spanning the node's own bounds.  Quantized bounds are rounded
+// outward, so they always contain the exact ones.  Leaves already address
+// _BVHAccel::primitives_ with 32-bit offsets; a separate 32-bit index array
+// would only save memory over that vector where SBVH splits duplicate
+// references, and would add an indirection to every leaf.
+template <typename T>
+struct
+#ifdef PBRT_HAVE_ALIGNAS
+alignas(PBRT_L1_CACHE_LINE_SIZE)
+#endif // PBRT_HAVE_ALIGNAS
+QuantizedBVHNode {
+    static PBRT_CONSTEXPR int Width = 8;
+    static PBRT_CONSTEXPR int maxQ = std::numeric_limits<T>::max();
+    // QuantizedBVHNode Public Methods
+    explicit QuantizedBVHNode(const WideBVHNode<Width> &node);
+    Float Dequantize(int axis, int q) const {
+        return origin[axis] + q * scale[axis];
+    }
+    uint32_t IntersectP(const Point3f &o, const Vector3f &invDir,
+                        const int dirIsNeg[3], Float rayTMax,
+                        Float tNear[Width]) const {
+        Float bounds[2][3][Width];
+        for (int axis = 0; axis < 3; ++axis)
+            for (int i = 0; i < Width; ++i) {
+                bounds[0][axis][i] = Dequantize(axis, qBounds[0][axis][i]);
+                bounds[1][axis][i] = Dequantize(axis, qBounds[1][axis][i]);
+            }
+        return IntersectChildBounds<Width>(bounds, nChildren, o, invDir,
+                                           dirIsNeg, rayTMax, tNear);
+    }
+    Float origin[3], scale[3];  // scale: power of two
+    T qBounds[2][3][Width];     // [pMin/pMax][axis][child]
+    int childOffset[Width];     // interior child: node index; leaf: primitives
+    uint16_t nPrimitives[Width];  // 0 -> interior child
+    uint8_t nChildren;
+};
+
+template <typename T>
+QuantizedBVHNode<T>::QuantizedBVHNode(const WideBVHNode<Width> &node) {
+    nChildren = node.nChildren;
+    for (int i = 0; i < Width; ++i) {
+        childOffset[i] = node.childOffset[i];
+        nPrimitives[i] = node.nPrimitives[i];
+    }
+    for (int axis = 0; axis < 3; ++axis) {
+        // Find the node's extent along _axis_ and choose the grid spacing
+        Float lo = Infinity, hi = -Infinity;
+        for (int i = 0; i < nChildren; ++i) {
+            lo = std::min(lo, node.bounds[0][axis][i]);
+            hi = std::max(hi, node.bounds[1][axis][i]);
+        }
+        origin[axis] = lo;
+        int exponent;
+        std::frexp((hi - lo) / maxQ, &exponent);
+        scale[axis] = std::ldexp(Float(1), exponent);
+        while (Dequantize(axis, maxQ) < hi) scale[axis] *= 2;
+
+        // Quantize child bounds, rounding outward
+        for (int i = 0; i < Width; ++i) {
+            if (i >= nChildren) {
+                qBounds[0][axis][i] = qBounds[1][axis][i] = 0;
+                continue;
+            }
+            Float cLo = node.bounds[0][axis][i], cHi = node.bounds[1][axis][i];
+            int qLo = Clamp(int(std::floor((cLo - lo) / scale[axis])), 0, maxQ);
+            while (qLo > 0 && Dequantize(axis, qLo) > cLo) --qLo;
+            int qHi = Clamp(int(std::ceil((cHi - lo) / scale[axis])), 0, maxQ);
+            while (qHi < maxQ && Dequantize(axis, qHi) < cHi) ++qHi;
+            CHECK_LE(Dequantize(axis, qLo), cLo);
+            CHECK_GE(Dequantize(axis, qHi), cHi);
+            qBounds[0][axis][i] = qLo;
+            qBounds[1][axis][i] = qHi;
+        }
+    }
+}
+
+// Structure-of-arrays layout of the rays passed to
+// _BVHAccel::IntersectPacket()_, so that bounding box tests for all of them
+// can be done together in a loop the compiler can vectorize.
+struct RayPacket {
+    // RayPacket Public Methods
+    uint32_t IntersectP(const Bounds3f &bounds, const int dirIsNeg[3],
+                        uint32_t activeMask, int *nActive) const {
+        // Compute slab intervals for all rays in the packet
+        // This follows _Bounds3::IntersectP()_ exactly, including its
+        // rounding error bounds, so that a ray in a packet visits the same
+        // nodes as it would if it were traced on its own.
+        const Float gammaScale = 1 + 2 * gamma(3);
+        bool hit[MaxRayPacketSize];
+        for (int i = 0; i < MaxRayPacketSize; ++i) {
+            Float tMin = (bounds[dirIsNeg[0]].x - o[0][i]) * invDir[0][i];
+            Float tFar = (bounds[1 - dirIsNeg[0]].x - o[0][i]) * invDir[0][i];
+            Float tyMin = (bounds[dirIsNeg[1]].y - o[1][i]) * invDir[1][i];
+            Float tyMax = (bounds[1 - dirIsNeg[1]].y - o[1][i]) * invDir[1][i];
+            Float tzMin = (bounds[dirIsNeg[2]].z - o[2][i]) * invDir[2][i];
+            Float tzMax = (bounds[1 - dirIsNeg[2]].z - o[2][i]) * invDir[2][i];
+            tFar *= gammaScale;
+            tyMax *= gammaScale;
+            tzMax *= gammaScale;
+            bool miss = tMin > tyMax || tyMin > tFar;
+            tMin = (tyMin > tMin) ? tyMin : tMin;
+            tFar = (tyMax < tFar) ? tyMax : tFar;
+            miss |= tMin > tzMax || tzMin > tFar;
+            tMin = (tzMin > tMin) ? tzMin : tMin;
+            tFar = (tzMax < tFar) ? tzMax : tFar;
+            hit[i] = !miss && (tMin < tMax[i]) && (tFar > 0);
+        }
+        uint32_t hitMask = 0;
+        *nActive = 0;
+        for (int i = 0; i < nRays; ++i)
+            if (hit[i] && (activeMask & (1u << i))) {
+                hitMask |= 1u << i;
+                ++*nActive;
+            }
+        return hitMask;
+    }
+
+    // RayPacket Public Data
+    Float o[3][MaxRayPacketSize], invDir[3][MaxRayPacketSize];
+    Float tMax[MaxRayPacketSize];
+    int nRays;
+};
+
 // BVHAccel Utility Functions
 inline uint32_t LeftShift3(uint32_t x) {
     CHECK_LE(x, (1 << 10));
@@ -143,6 +404,14 @@ static void RadixSort(std::vector<MortonPrimitive> *v) {
     static_assert((nBits % bitsPerPass) == 0,
                   "Radix sort bitsPerPass must evenly divide nBits");
     PBRT_CONSTEXPR int nPasses = nBits / bitsPerPass;
+    PBRT_CONSTEXPR int nBuckets = 1 << bitsPerPass;
+    PBRT_CONSTEXPR int bitMask = (1 << bitsPerPass) - 1;
+
+    // Split the array into chunks that are counted and scattered in parallel
+    PBRT_CONSTEXPR int chunkSize = 16 * 1024;
+    int nItems = v->size();
+    int nChunks = (nItems + chunkSize - 1) / chunkSize;
+    std::vector<int> chunkBucketIndex(nChunks * nBuckets);
 
     for (int pass = 0; pass < nPasses; ++pass) {
         // Perform one pass of radix sort, sorting _bitsPerPass_ bits
@@ -152,41 +421,322 @@ static void RadixSort(std::vector<MortonPrimitive> *v) {
         std::vector<MortonPrimitive> &in = (pass & 1) ? tempVector : *v;
         std::vector<MortonPrimitive> &out = (pass & 1) ? *v : tempVector;
 
-        // Count number of zero bits in array for current radix sort bit
-        PBRT_CONSTEXPR int nBuckets = 1 << bitsPerPass;
-        int bucketCount[nBuckets] = {0};
-        PBRT_CONSTEXPR int bitMask = (1 << bitsPerPass) - 1;
-        for (const MortonPrimitive &mp : in) {
-            int bucket = (mp.mortonCode >> lowBit) & bitMask;
-            CHECK_GE(bucket, 0);
-            CHECK_LT(bucket, nBuckets);
-            ++bucketCount[bucket];
-        }
+        // Count number of items in each bucket for each chunk
+        ParallelFor([&](int64_t c) {
+            int *bucketCount = &chunkBucketIndex[c * nBuckets];
+            std::fill(bucketCount, bucketCount + nBuckets, 0);
+            int end = std::min<int>((c + 1) * chunkSize, nItems);
+            for (int i = c * chunkSize; i < end; ++i) {
+                int bucket = (in[i].mortonCode >> lowBit) & bitMask;
+                CHECK_GE(bucket, 0);
+                CHECK_LT(bucket, nBuckets);
+                ++bucketCount[bucket];
+            }
+        }, nChunks);
 
-        // Compute starting index in output array for each bucket
-        int outIndex[nBuckets];
-        outIndex[0] = 0;
-        for (int i = 1; i < nBuckets; ++i)
-            outIndex[i] = outIndex[i - 1] + bucketCount[i - 1];
+        // Compute starting index in output array for each chunk's bucket;
+        // chunks are laid out in order within each bucket so that the sort
+        // stays stable
+        int outIndex = 0;
+        for (int bucket = 0; bucket < nBuckets; ++bucket)
+            for (int c = 0; c < nChunks; ++c) {
+                int count = chunkBucketIndex[c * nBuckets + bucket];
+                chunkBucketIndex[c * nBuckets + bucket] = outIndex;
+                outIndex += count;
+            }
 
         // Store sorted values in output array
-        for (const MortonPrimitive &mp : in) {
-            int bucket = (mp.mortonCode >> lowBit) & bitMask;
-            out[outIndex[bucket]++] = mp;
-        }
+        ParallelFor([&](int64_t c) {
+            int *outIndex = &chunkBucketIndex[c * nBuckets];
+            int end = std::min<int>((c + 1) * chunkSize, nItems);
+            for (int i = c * chunkSize; i < end; ++i) {
+                int bucket = (in[i].mortonCode >> lowBit) & bitMask;
+                out[outIndex[bucket]++] = in[i];
+            }
+        }, nChunks);
     }
     // Copy final result from _tempVector_, if needed
     if (nPasses & 1) std::swap(*v, tempVector);
 }
 
+// Converts the binary tree rooted at _node_ into wide nodes, opening the
+// interior child with the largest surface area until each node has _Width_
+// children.  Returns the index of the node created for _node_.
+template <int Width>
+static int CollapseBVH(const BVHBuildNode *node,
+                       std::vector<WideBVHNode<Width>> *wideNodes) {
+    int nodeIndex = wideNodes->size();
+    wideNodes->push_back(WideBVHNode<Width>());
+    ++totalWideNodes;
+    const BVHBuildNode *children[Width];
+    int nChildren = 0;
+    if (node->nPrimitives > 0)
+        children[nChildren++] = node;
+    else {
+        children[nChildren++] = node->children[0];
+        children[nChildren++] = node->children[1];
+        while (nChildren < Width) {
+            int largest = -1;
+            Float largestArea = -1;
+            for (int i = 0; i < nChildren; ++i)
+                if (children[i]->nPrimitives == 0 &&
+                    children[i]->bounds.SurfaceArea() > largestArea) {
+                    largest = i;
+                    largestArea = children[i]->bounds.SurfaceArea();
+                }
+            if (largest == -1) break;
+            const BVHBuildNode *opened = children[largest];
+            children[largest] = opened->children[0];
+            children[nChildren++] = opened->children[1];
+        }
+    }
+
+    WideBVHNode<Width> wideNode;
+    wideNode.nChildren = nChildren;
+    for (int i = 0; i < nChildren; ++i) {
+        for (int axis = 0; axis < 3; ++axis) {
+            wideNode.bounds[0][axis][i] = children[i]->bounds.pMin[axis];
+            wideNode.bounds[1][axis][i] = children[i]->bounds.pMax[axis];
+        }
+        if (children[i]->nPrimitives > 0) {
+            CHECK_LT(children[i]->nPrimitives, 65536);
+            wideNode.childOffset[i] = children[i]->firstPrimOffset;
+            wideNode.nPrimitives[i] = children[i]->nPrimitives;
+        } else
+            wideNode.childOffset[i] = CollapseBVH(children[i], wideNodes);
+    }
+    (*wideNodes)[nodeIndex] = wideNode;
+    return nodeIndex;
+}
+
+template <int Width>
+static WideBVHNode<Width> *FlattenWideBVH(const BVHBuildNode *root,
+                                          int *nNodes) {
+    std::vector<WideBVHNode<Width>> wideNodes;
+    CollapseBVH(root, &wideNodes);
+    *nNodes = wideNodes.size();
+    LOG(INFO) << StringPrintf("BVH collapsed to %d %d-wide nodes (%.2f MB)",
+                              (int)wideNodes.size(), Width,
+                              float(wideNodes.size() *
+                                    sizeof(WideBVHNode<Width>)) /
+                                  (1024.f * 1024.f));
+    treeBytes += wideNodes.size() * sizeof(WideBVHNode<Width>);
+    bvhNodeBytes += wideNodes.size() * sizeof(WideBVHNode<Width>);
+    size_t bytes = wideNodes.size() * sizeof(WideBVHNode<Width>);
+    WideBVHNode<Width> *nodes =
+        AllocAligned<WideBVHNode<Width>>(wideNodes.size());
+    ParallelFirstTouch(nodes, bytes);
+    std::copy(wideNodes.begin(), wideNodes.end(), nodes);
+    ReportNumaPlacement("BVH nodes", nodes, bytes);
+    return nodes;
+}
+
+template <typename T>
+static QuantizedBVHNode<T> *FlattenQuantizedBVH(const BVHBuildNode *root,
+                                                int *nNodes) {
+    std::vector<WideBVHNode<8>> wideNodes;
+    CollapseBVH(root, &wideNodes);
+    *nNodes = wideNodes.size();
+    LOG(INFO) << StringPrintf("BVH collapsed to %d %d-bit quantized nodes "
+                              "(%.2f MB)",
+                              (int)wideNodes.size(), int(8 * sizeof(T)),
+                              float(wideNodes.size() *
+                                    sizeof(QuantizedBVHNode<T>)) /
+                                  (1024.f * 1024.f));
+    treeBytes += wideNodes.size() * sizeof(QuantizedBVHNode<T>);
+    bvhNodeBytes += wideNodes.size() * sizeof(QuantizedBVHNode<T>);
+    size_t bytes = wideNodes.size() * sizeof(QuantizedBVHNode<T>);
+    QuantizedBVHNode<T> *nodes =
+        AllocAligned<QuantizedBVHNode<T>>(wideNodes.size());
+    ParallelFirstTouch(nodes, bytes);
+    for (size_t i = 0; i < wideNodes.size(); ++i)
+        new (&nodes[i]) QuantizedBVHNode<T>(wideNodes[i]);
+    ReportNumaPlacement("BVH nodes", nodes, bytes);
+    return nodes;
+}
+
+// World-space vertices of a triangle, stored in the order of
+// _BVHAccel::primitives_ so that leaves can be intersected without going
+// through _Primitive_ and _Shape_.
+struct LeafTriangle {
+    Point3f p0, p1, p2;
+    // False if the primitive has to be intersected through _Primitive_
+    bool isTriangle;
+};
+
+// The closest hit found so far on a leaf triangle.  Its
+// _SurfaceInteraction_ is only computed once traversal is done, from the
+// barycentrics of the hit.
+struct DeferredHit {
+    int primitiveIndex = -1;
+    Float b0, b1, b2;
+};
+
+static inline bool IntersectLeaf(
+    const std::vector<std::shared_ptr<Primitive>> &primitives,
+    const LeafTriangle *leafTriangles, int first, int nPrimitives,
+    const Ray &ray, SurfaceInteraction *isect, DeferredHit *deferred) {
+    bool hit = false;
+    for (int i = first; i < first + nPrimitives; ++i) {
+        if (leafTriangles && leafTriangles[i].isTriangle) {
+            const LeafTriangle &tri = leafTriangles[i];
+            Float t;
+            DeferredHit d;
+            if (IntersectTriangle(ray, tri.p0, tri.p1, tri.p2, &t, &d.b0,
+                                  &d.b1, &d.b2)) {
+                d.primitiveIndex = i;
+                *deferred = d;
+                ray.tMax = t;
+                hit = true;
+            }
+        } else if (primitives[i]->Intersect(ray, isect)) {
+            deferred->primitiveIndex = -1;
+            hit = true;
+        }
+    }
+    return hit;
+}
+
+static inline bool IntersectPLeaf(
+    const std::vector<std::shared_ptr<Primitive>> &primitives,
+    const LeafTriangle *leafTriangles, int first, int nPrimitives,
+    const Ray &ray) {
+    for (int i = first; i < first + nPrimitives; ++i) {
+        Float t, b0, b1, b2;
+        if (leafTriangles && leafTriangles[i].isTriangle) {
+            const LeafTriangle &tri = leafTriangles[i];
+            if (IntersectTriangle(ray, tri.p0, tri.p1, tri.p2, &t, &b0, &b1,
+                                  &b2))
+                return true;
+        } else if (primitives[i]->IntersectP(ray))
+            return true;
+    }
+    return false;
+}
+
+// Computes the _SurfaceInteraction_ for a deferred leaf triangle hit;
+// _ray.tMax_ is already the hit's $t$.  Leaf triangles are only created for
+// triangles of _GeometricPrimitive_s, so the casts are safe.
+static inline void ResolveDeferredHit(
+    const std::vector<std::shared_ptr<Primitive>> &primitives,
+    const DeferredHit &deferred, const Ray &ray, SurfaceInteraction *isect) {
+    if (deferred.primitiveIndex == -1) return;
+    const GeometricPrimitive *prim = static_cast<const GeometricPrimitive *>(
+        primitives[deferred.primitiveIndex].get());
+    const Triangle *tri = static_cast<const Triangle *>(prim->GetShape());
+    bool hit = tri->InteractionFromHit(ray, deferred.b0, deferred.b1,
+                                       deferred.b2, isect);
+    CHECK(hit);
+    prim->FinishIntersection(ray, ray.tMax, isect);
+}
+
+template <typename Node>
+static bool IntersectWideBVH(
+    const Node *nodes,
+    const std::vector<std::shared_ptr<Primitive>> &primitives,
+    const LeafTriangle *leafTriangles, const Ray &ray,
+    SurfaceInteraction *isect, int *nodesVisited) {
+    PBRT_CONSTEXPR int Width = Node::Width;
+    bool hit = false;
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    // Follow ray through wide BVH nodes to find primitive intersections
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[64 * Width];
+    DeferredHit deferred;
+    while (true) {
+        const Node &node = nodes[currentNodeIndex];
+        ++*nodesVisited;
+        Float tNear[Width];
+        uint32_t hitMask =
+            node.IntersectP(ray.o, invDir, dirIsNeg, ray.tMax, tNear);
+        // Intersect leaf children and sort interior ones far to near
+        int interior[Width], nInterior = 0;
+        for (int c = 0; c < Width; ++c) {
+            if (!(hitMask & (1u << c))) continue;
+            if (node.nPrimitives[c] > 0) {
+                if (IntersectLeaf(primitives, leafTriangles,
+                                  node.childOffset[c], node.nPrimitives[c],
+                                  ray, isect, &deferred))
+                    hit = true;
+            } else {
+                int j = nInterior++;
+                while (j > 0 && tNear[interior[j - 1]] < tNear[c]) {
+                    interior[j] = interior[j - 1];
+                    --j;
+                }
+                interior[j] = c;
+            }
+        }
+
+        // Push all but the nearest interior child, skipping any that start
+        // beyond a hit found in this node's leaves
+        int nearest = -1;
+        for (int j = 0; j < nInterior; ++j) {
+            int c = interior[j];
+            if (tNear[c] >= ray.tMax) continue;
+            if (nearest != -1)
+                nodesToVisit[toVisitOffset++] = node.childOffset[nearest];
+            nearest = c;
+        }
+        if (nearest != -1)
+            currentNodeIndex = node.childOffset[nearest];
+        else {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    ResolveDeferredHit(primitives, deferred, ray, isect);
+    return hit;
+}
+
+template <typename Node>
+static bool IntersectPWideBVH(
+    const Node *nodes,
+    const std::vector<std::shared_ptr<Primitive>> &primitives,
+    const LeafTriangle *leafTriangles, const Ray &ray, int *nodesVisited) {
+    PBRT_CONSTEXPR int Width = Node::Width;
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[64 * Width];
+    while (true) {
+        const Node &node = nodes[currentNodeIndex];
+        ++*nodesVisited;
+        Float tNear[Width];
+        uint32_t hitMask =
+            node.IntersectP(ray.o, invDir, dirIsNeg, ray.tMax, tNear);
+        for (int c = 0; c < Width; ++c) {
+            if (!(hitMask & (1u << c))) continue;
+            if (node.nPrimitives[c] > 0) {
+                if (IntersectPLeaf(primitives, leafTriangles,
+                                   node.childOffset[c], node.nPrimitives[c],
+                                   ray))
+                    return true;
+            } else
+                nodesToVisit[toVisitOffset++] = node.childOffset[c];
+        }
+        if (toVisitOffset == 0) break;
+        currentNodeIndex = nodesToVisit[--toVisitOffset];
+    }
+    return false;
+}
+
 // BVHAccel Method Definitions
 BVHAccel::BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
-                   int maxPrimsInNode, SplitMethod splitMethod)
+                   int maxPrimsInNode, SplitMethod splitMethod,
+                   Layout layout, const std::string &cacheDir,
+                   Float splitBudget, bool leafTriangles)
     : maxPrimsInNode(std::min(255, maxPrimsInNode)),
       splitMethod(splitMethod),
+      layout(layout),
+      splitBudget(std::max(Float(0), splitBudget)),
+      useLeafTriangles(leafTriangles),
       primitives(std::move(p)) {
     ProfilePhase _(Prof::AccelConstruction);
     if (primitives.empty()) return;
+    std::chrono::steady_clock::time_point buildStart =
+        std::chrono::steady_clock::now();
     // Build BVH from _primitives_
 
     // Initialize _primitiveInfo_ array for primitives
@@ -194,38 +744,135 @@ BVHAccel::BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
     for (size_t i = 0; i < primitives.size(); ++i)
         primitiveInfo[i] = {i, primitives[i]->WorldBound()};
 
+    // Try to load the BVH from the cache
+    std::string cacheFilename;
+    uint64_t buildHash = 0;
+    if (!cacheDir.empty()) {
+        buildHash = hashBuildInputs(primitiveInfo);
+        cacheFilename = cacheDir + StringPrintf("/bvh-%016" PRIx64 ".cache",
+                                                buildHash);
+        if (readCache(cacheFilename, buildHash)) {
+            ++cacheHits;
+            updateLeafTriangles();
+            computeBoundsCut();
+            return;
+        }
+        ++cacheMisses;
+    }
+
     // Build BVH tree for primitives using _primitiveInfo_
     MemoryArena arena(1024 * 1024);
     int totalNodes = 0;
-    std::vector<std::shared_ptr<Primitive>> orderedPrims;
-    orderedPrims.reserve(primitives.size());
+    std::vector<int> orderedPrimIndices(primitives.size());
     BVHBuildNode *root;
+    // Per-thread arenas for nodes of subtrees built in parallel
+    std::vector<MemoryArena> perThreadArenas(MaxThreadIndex());
     if (splitMethod == SplitMethod::HLBVH)
-        root = HLBVHBuild(arena, primitiveInfo, &totalNodes, orderedPrims);
-    else
+        root =
+            HLBVHBuild(arena, primitiveInfo, &totalNodes, orderedPrimIndices);
+    else if (splitMethod == SplitMethod::SBVH) {
+        // Spatial splits may reference a primitive from several leaves, so
+        // the leaves append their primitives to _orderedPrimIndices_
+        Bounds3f rootBounds;
+        for (const BVHPrimitiveInfo &pi : primitiveInfo)
+            rootBounds = Union(rootBounds, pi.bounds);
+        SBVHBuildState state;
+        state.rootArea = rootBounds.SurfaceArea();
+        state.duplicatesLeft = int64_t(splitBudget * primitives.size());
+        orderedPrimIndices.clear();
+        root = sbvhBuild(arena, primitiveInfo, 0, &totalNodes,
+                         orderedPrimIndices, state);
+        sbvhPrimitives += primitives.size();
+        sbvhReferences += orderedPrimIndices.size();
+    } else {
+        // Build upper levels of the tree, deferring smaller subtrees
+        int subtreeTaskSize =
+            std::max(4096, int(primitives.size() / (16 * MaxThreadIndex())));
+        std::vector<BVHBuildTask> subtreeTasks;
         root = recursiveBuild(arena, primitiveInfo, 0, primitives.size(),
-                              &totalNodes, orderedPrims);
+                              &totalNodes, orderedPrimIndices, &subtreeTasks,
+                              subtreeTaskSize);
+
+        // Build the deferred subtrees in parallel.  Each one covers its own
+        // range of _primitiveInfo_ and _orderedPrimIndices_, so the tree is
+        // the same as if it had been built serially.
+        std::atomic<int> atomicTotal(totalNodes);
+        ParallelFor([&](int64_t i) {
+            int nodesCreated = 0;
+            BVHBuildTask &task = subtreeTasks[i];
+            *task.node = *recursiveBuild(perThreadArenas[ThreadIndex],
+                                         primitiveInfo, task.start, task.end,
+                                         &nodesCreated, orderedPrimIndices);
+            atomicTotal += nodesCreated;
+        }, subtreeTasks.size());
+        totalNodes = atomicTotal;
+    }
+    // Primitives are copied rather than moved since an SBVH may reference
+    // the same primitive more than once
+    std::vector<std::shared_ptr<Primitive>> orderedPrims(
+        orderedPrimIndices.size());
+    for (size_t i = 0; i < orderedPrimIndices.size(); ++i)
+        orderedPrims[i] = primitives[orderedPrimIndices[i]];
     primitives.swap(orderedPrims);
     primitiveInfo.resize(0);
-    LOG(INFO) << StringPrintf("BVH created with %d nodes for %d "
-                              "primitives (%.2f MB), arena allocated %.2f MB",
-                              totalNodes, (int)primitives.size(),
-                              float(totalNodes * sizeof(LinearBVHNode)) /
-                              (1024.f * 1024.f),
-                              float(arena.TotalAllocated()) /
-                              (1024.f * 1024.f));
+    updateLeafTriangles();
+    bounds = root->bounds;
+    treeBytes += sizeof(*this) + primitives.size() * sizeof(primitives[0]);
+    if (layout == Layout::BVH4)
+        // Collapse the binary tree into a 4- or 8-wide BVH
+        nodes4 = FlattenWideBVH<4>(root, &nNodes);
+    else if (layout == Layout::BVH8)
+        nodes8 = FlattenWideBVH<8>(root, &nNodes);
+    else if (layout == Layout::BVH8Quant8)
+        qnodes8 = FlattenQuantizedBVH<uint8_t>(root, &nNodes);
+    else if (layout == Layout::BVH8Quant16)
+        qnodes16 = FlattenQuantizedBVH<uint16_t>(root, &nNodes);
+    else {
+        size_t arenaBytes = arena.TotalAllocated();
+        for (const MemoryArena &a : perThreadArenas)
+            arenaBytes += a.TotalAllocated();
+        LOG(INFO) << StringPrintf("BVH created with %d nodes for %d "
+                                  "primitives (%.2f MB), arena allocated "
+                                  "%.2f MB",
+                                  totalNodes, (int)primitives.size(),
+                                  float(totalNodes * sizeof(LinearBVHNode)) /
+                                      (1024.f * 1024.f),
+                                  float(arenaBytes) / (1024.f * 1024.f));
 
-    // Compute representation of depth-first traversal of BVH tree
-    treeBytes += totalNodes * sizeof(LinearBVHNode) + sizeof(*this) +
-                 primitives.size() * sizeof(primitives[0]);
-    nodes = AllocAligned<LinearBVHNode>(totalNodes);
-    int offset = 0;
-    flattenBVHTree(root, &offset);
-    CHECK_EQ(totalNodes, offset);
+        // Compute representation of depth-first traversal of BVH tree
+        treeBytes += totalNodes * sizeof(LinearBVHNode);
+        bvhNodeBytes += totalNodes * sizeof(LinearBVHNode);
+        // Zero the nodes from all threads first so that their pages are
+        // spread over the NUMA nodes
+        nodes = AllocAligned<LinearBVHNode>(totalNodes);
+        ParallelFirstTouch(nodes, totalNodes * sizeof(LinearBVHNode));
+        int offset = 0;
+        flattenBVHTree(root, &offset);
+        CHECK_EQ(totalNodes, offset);
+        ReportNumaPlacement("BVH nodes", nodes,
+                            totalNodes * sizeof(LinearBVHNode));
+        nNodes = totalNodes;
+    }
+
+    computeBoundsCut();
+    ReportValue(bvhBuildTime, ElapsedMS(&buildStart));
+
+    if (!cacheFilename.empty())
+        writeCache(cacheFilename, buildHash, orderedPrimIndices);
 }
 
-Bounds3f BVHAccel::WorldBound() const {
-    return nodes ? nodes[0].bounds : Bounds3f();
+Bounds3f BVHAccel::WorldBound() const { return bounds; }
+
+bool BVHAccel::SameNodes(const BVHAccel &bvh) const {
+    if (nNodes != bvh.nNodes || primitives != bvh.primitives) return false;
+    for (int i = 0; i < nNodes; ++i) {
+        const LinearBVHNode &a = nodes[i], &b = bvh.nodes[i];
+        if (a.bounds != b.bounds || a.nPrimitives != b.nPrimitives ||
+            a.primitivesOffset != b.primitivesOffset)
+            return false;
+        if (a.nPrimitives == 0 && a.axis != b.axis) return false;
+    }
+    return true;
 }
 
 struct BucketInfo {
@@ -233,43 +880,78 @@ struct BucketInfo {
     Bounds3f bounds;
 };
 
+// Ranges of primitives at least this large in the upper levels of the tree
+// have their bounds and SAH buckets computed in parallel.  Since _Union()_
+// is exact, the result does not depend on how the range is split among
+// threads.
+static PBRT_CONSTEXPR int parallelBinThreshold = 64 * 1024;
+static PBRT_CONSTEXPR int parallelBinChunkSize = 16 * 1024;
+
+// Returns the bounds of either the primitives or their centroids in
+// _[start, end)_.
+static Bounds3f ComputeBounds(
+    const std::vector<BVHPrimitiveInfo> &primitiveInfo, int start, int end,
+    bool centroids, bool parallel) {
+    auto boundRange = [&](int first, int last) {
+        Bounds3f b;
+        for (int i = first; i < last; ++i)
+            b = centroids ? Union(b, primitiveInfo[i].centroid)
+                          : Union(b, primitiveInfo[i].bounds);
+        return b;
+    };
+    if (!parallel || end - start < parallelBinThreshold)
+        return boundRange(start, end);
+    int nChunks =
+        (end - start + parallelBinChunkSize - 1) / parallelBinChunkSize;
+    std::vector<Bounds3f> chunkBounds(nChunks);
+    ParallelFor([&](int64_t c) {
+        int first = start + c * parallelBinChunkSize;
+        chunkBounds[c] =
+            boundRange(first, std::min(first + parallelBinChunkSize, end));
+    }, nChunks);
+    Bounds3f bounds;
+    for (const Bounds3f &b : chunkBounds) bounds = Union(bounds, b);
+    return bounds;
+}
+
 BVHBuildNode *BVHAccel::recursiveBuild(
     MemoryArena &arena, std::vector<BVHPrimitiveInfo> &primitiveInfo, int start,
     int end, int *totalNodes,
-    std::vector<std::shared_ptr<Primitive>> &orderedPrims) {
+    std::vector<int> &orderedPrimIndices,
+    std::vector<BVHBuildTask> *subtreeTasks, int subtreeTaskSize) {
     CHECK_NE(start, end);
     BVHBuildNode *node = arena.Alloc<BVHBuildNode>();
-    (*totalNodes)++;
     // Compute bounds of all primitives in BVH node
-    Bounds3f bounds;
-    for (int i = start; i < end; ++i)
-        bounds = Union(bounds, primitiveInfo[i].bounds);
+    bool parallel = subtreeTasks != nullptr;
+    Bounds3f bounds = ComputeBounds(primitiveInfo, start, end, false, parallel);
     int nPrimitives = end - start;
+    if (subtreeTasks && nPrimitives <= subtreeTaskSize) {
+        // Defer building the subtree under _node_ to a parallel task
+        node->bounds = bounds;
+        subtreeTasks->push_back({node, start, end});
+        return node;
+    }
+    (*totalNodes)++;
     if (nPrimitives == 1) {
         // Create leaf _BVHBuildNode_
-        int firstPrimOffset = orderedPrims.size();
-        for (int i = start; i < end; ++i) {
-            int primNum = primitiveInfo[i].primitiveNumber;
-            orderedPrims.push_back(primitives[primNum]);
-        }
+        int firstPrimOffset = start;
+        for (int i = start; i < end; ++i)
+            orderedPrimIndices[i] = primitiveInfo[i].primitiveNumber;
         node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
         return node;
     } else {
         // Compute bound of primitive centroids, choose split dimension _dim_
-        Bounds3f centroidBounds;
-        for (int i = start; i < end; ++i)
-            centroidBounds = Union(centroidBounds, primitiveInfo[i].centroid);
+        Bounds3f centroidBounds =
+            ComputeBounds(primitiveInfo, start, end, true, parallel);
         int dim = centroidBounds.MaximumExtent();
 
         // Partition primitives into two sets and build children
         int mid = (start + end) / 2;
         if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim]) {
             // Create leaf _BVHBuildNode_
-            int firstPrimOffset = orderedPrims.size();
-            for (int i = start; i < end; ++i) {
-                int primNum = primitiveInfo[i].primitiveNumber;
-                orderedPrims.push_back(primitives[primNum]);
-            }
+            int firstPrimOffset = start;
+            for (int i = start; i < end; ++i)
+                orderedPrimIndices[i] = primitiveInfo[i].primitiveNumber;
             node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
             return node;
         } else {
@@ -321,16 +1003,44 @@ BVHBuildNode *BVHAccel::recursiveBuild(
                     BucketInfo buckets[nBuckets];
 
                     // Initialize _BucketInfo_ for SAH partition buckets
-                    for (int i = start; i < end; ++i) {
-                        int b = nBuckets *
-                                centroidBounds.Offset(
-                                    primitiveInfo[i].centroid)[dim];
-                        if (b == nBuckets) b = nBuckets - 1;
-                        CHECK_GE(b, 0);
-                        CHECK_LT(b, nBuckets);
-                        buckets[b].count++;
-                        buckets[b].bounds =
-                            Union(buckets[b].bounds, primitiveInfo[i].bounds);
+                    auto binRange = [&](int first, int last,
+                                        BucketInfo *buckets) {
+                        for (int i = first; i < last; ++i) {
+                            int b = nBuckets *
+                                    centroidBounds.Offset(
+                                        primitiveInfo[i].centroid)[dim];
+                            if (b == nBuckets) b = nBuckets - 1;
+                            CHECK_GE(b, 0);
+                            CHECK_LT(b, nBuckets);
+                            buckets[b].count++;
+                            buckets[b].bounds = Union(buckets[b].bounds,
+                                                      primitiveInfo[i].bounds);
+                        }
+                    };
+                    if (!parallel || nPrimitives < parallelBinThreshold)
+                        binRange(start, end, buckets);
+                    else {
+                        // Bin chunks of primitives in parallel and merge
+                        // their buckets
+                        int nChunks =
+                            (nPrimitives + parallelBinChunkSize - 1) /
+                            parallelBinChunkSize;
+                        std::vector<BucketInfo> chunkBuckets(nChunks *
+                                                             nBuckets);
+                        ParallelFor([&](int64_t c) {
+                            int first = start + c * parallelBinChunkSize;
+                            int last =
+                                std::min(first + parallelBinChunkSize, end);
+                            binRange(first, last, &chunkBuckets[c * nBuckets]);
+                        }, nChunks);
+                        for (int c = 0; c < nChunks; ++c)
+                            for (int b = 0; b < nBuckets; ++b) {
+                                const BucketInfo &cb =
+                                    chunkBuckets[c * nBuckets + b];
+                                buckets[b].count += cb.count;
+                                buckets[b].bounds =
+                                    Union(buckets[b].bounds, cb.bounds);
+                            }
                     }
 
                     // Compute costs for splitting after each bucket
@@ -379,11 +1089,10 @@ BVHBuildNode *BVHAccel::recursiveBuild(
                         mid = pmid - &primitiveInfo[0];
                     } else {
                         // Create leaf _BVHBuildNode_
-                        int firstPrimOffset = orderedPrims.size();
-                        for (int i = start; i < end; ++i) {
-                            int primNum = primitiveInfo[i].primitiveNumber;
-                            orderedPrims.push_back(primitives[primNum]);
-                        }
+                        int firstPrimOffset = start;
+                        for (int i = start; i < end; ++i)
+                            orderedPrimIndices[i] =
+                                primitiveInfo[i].primitiveNumber;
                         node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
                         return node;
                     }
@@ -391,24 +1100,234 @@ BVHBuildNode *BVHAccel::recursiveBuild(
                 break;
             }
             }
-            node->InitInterior(dim,
-                               recursiveBuild(arena, primitiveInfo, start, mid,
-                                              totalNodes, orderedPrims),
-                               recursiveBuild(arena, primitiveInfo, mid, end,
-                                              totalNodes, orderedPrims));
+            node->InitInterior(
+                dim,
+                recursiveBuild(arena, primitiveInfo, start, mid, totalNodes,
+                               orderedPrimIndices, subtreeTasks,
+                               subtreeTaskSize),
+                recursiveBuild(arena, primitiveInfo, mid, end, totalNodes,
+                               orderedPrimIndices, subtreeTasks,
+                               subtreeTaskSize));
         }
     }
     return node;
 }
 
+// Returns true if _b_ is the empty box, e.g. as returned by _Intersect()_
+// for boxes that don't overlap.
+static bool IsEmpty(const Bounds3f &b) {
+    return b.pMin.x > b.pMax.x || b.pMin.y > b.pMax.y || b.pMin.z > b.pMax.z;
+}
+
+// Spatial splits are only tried in nodes whose children from the best
+// object split overlap by more than this fraction of the root's surface
+// area, and no deeper than _sbvhMaxSpatialDepth_.
+static PBRT_CONSTEXPR Float sbvhOverlapThreshold = 1e-5f;
+static PBRT_CONSTEXPR int sbvhMaxSpatialDepth = 48;
+
+BVHBuildNode *BVHAccel::sbvhBuild(MemoryArena &arena,
+                                  std::vector<BVHPrimitiveInfo> &refs,
+                                  int depth, int *totalNodes,
+                                  std::vector<int> &orderedPrimIndices,
+                                  SBVHBuildState &state) const {
+    CHECK(!refs.empty());
+    BVHBuildNode *node = arena.Alloc<BVHBuildNode>();
+    (*totalNodes)++;
+    Bounds3f bounds, centroidBounds;
+    for (const BVHPrimitiveInfo &ref : refs) {
+        bounds = Union(bounds, ref.bounds);
+        centroidBounds = Union(centroidBounds, ref.centroid);
+    }
+    int nRefs = refs.size();
+    auto createLeaf = [&]() {
+        int firstPrimOffset = orderedPrimIndices.size();
+        for (const BVHPrimitiveInfo &ref : refs)
+            orderedPrimIndices.push_back(ref.primitiveNumber);
+        node->InitLeaf(firstPrimOffset, nRefs, bounds);
+        return node;
+    };
+    if (nRefs == 1) return createLeaf();
+    PBRT_CONSTEXPR int nBuckets = 12;
+    Float area = bounds.SurfaceArea();
+
+    // Find the best object split along the centroid bounds' maximum extent
+    int objectDim = centroidBounds.MaximumExtent();
+    Float objectCost = Infinity;
+    int objectSplitBucket = -1;
+    Float objectOverlap = 0;
+    auto objectBucket = [&](const BVHPrimitiveInfo &ref) {
+        int b = nBuckets * centroidBounds.Offset(ref.centroid)[objectDim];
+        return std::min(b, nBuckets - 1);
+    };
+    if (centroidBounds.pMax[objectDim] > centroidBounds.pMin[objectDim]) {
+        BucketInfo buckets[nBuckets];
+        for (const BVHPrimitiveInfo &ref : refs) {
+            int b = objectBucket(ref);
+            buckets[b].count++;
+            buckets[b].bounds = Union(buckets[b].bounds, ref.bounds);
+        }
+        for (int i = 0; i < nBuckets - 1; ++i) {
+            Bounds3f b0, b1;
+            int count0 = 0, count1 = 0;
+            for (int j = 0; j <= i; ++j) {
+                b0 = Union(b0, buckets[j].bounds);
+                count0 += buckets[j].count;
+            }
+            for (int j = i + 1; j < nBuckets; ++j) {
+                b1 = Union(b1, buckets[j].bounds);
+                count1 += buckets[j].count;
+            }
+            if (count0 == 0 || count1 == 0) continue;
+            Float cost = 1 + (count0 * b0.SurfaceArea() +
+                              count1 * b1.SurfaceArea()) / area;
+            if (cost < objectCost) {
+                objectCost = cost;
+                objectSplitBucket = i;
+                Bounds3f overlap = pbrt::Intersect(b0, b1);
+                objectOverlap = IsEmpty(overlap) ? 0 : overlap.SurfaceArea();
+            }
+        }
+    }
+
+    // Find the best spatial split if the object split's children overlap
+    Float spatialCost = Infinity;
+    int spatialDim = -1;
+    Float spatialSplitPos = 0;
+    if (state.duplicatesLeft > 0 && depth < sbvhMaxSpatialDepth &&
+        (objectSplitBucket == -1 ||
+         objectOverlap > sbvhOverlapThreshold * state.rootArea)) {
+        for (int dim = 0; dim < 3; ++dim) {
+            Float extent = bounds.pMax[dim] - bounds.pMin[dim];
+            if (extent <= 0) continue;
+            // Chop each reference into the bins it overlaps, counting it as
+            // entering its first bin and exiting its last one
+            Bounds3f binBounds[nBuckets];
+            int nEnter[nBuckets] = {0}, nExit[nBuckets] = {0};
+            auto binPlane = [&](int i) {
+                return i == nBuckets
+                           ? bounds.pMax[dim]
+                           : Lerp(Float(i) / nBuckets, bounds.pMin[dim],
+                                  bounds.pMax[dim]);
+            };
+            auto bin = [&](Float p) {
+                int b = nBuckets * (p - bounds.pMin[dim]) / extent;
+                return Clamp(b, 0, nBuckets - 1);
+            };
+            for (const BVHPrimitiveInfo &ref : refs) {
+                int first = bin(ref.bounds.pMin[dim]);
+                int last = bin(ref.bounds.pMax[dim]);
+                nEnter[first]++;
+                nExit[last]++;
+                if (first == last) {
+                    binBounds[first] = Union(binBounds[first], ref.bounds);
+                    continue;
+                }
+                const Primitive &prim = *primitives[ref.primitiveNumber];
+                for (int b = first; b <= last; ++b) {
+                    Bounds3f clip = ref.bounds;
+                    clip.pMin[dim] = std::max(clip.pMin[dim], binPlane(b));
+                    clip.pMax[dim] = std::min(clip.pMax[dim], binPlane(b + 1));
+                    Bounds3f chopped = prim.ClippedWorldBound(clip);
+                    if (!IsEmpty(chopped))
+                        binBounds[b] = Union(binBounds[b], chopped);
+                }
+            }
+
+            // Compute costs for splitting at each bin boundary
+            for (int i = 0; i < nBuckets - 1; ++i) {
+                Bounds3f b0, b1;
+                int count0 = 0, count1 = 0;
+                for (int j = 0; j <= i; ++j) {
+                    b0 = Union(b0, binBounds[j]);
+                    count0 += nEnter[j];
+                }
+                for (int j = i + 1; j < nBuckets; ++j) {
+                    b1 = Union(b1, binBounds[j]);
+                    count1 += nExit[j];
+                }
+                if (count0 == 0 || count1 == 0 ||
+                    count0 + count1 - nRefs > state.duplicatesLeft)
+                    continue;
+                Float cost = 1 + (count0 * b0.SurfaceArea() +
+                                  count1 * b1.SurfaceArea()) / area;
+                if (cost < spatialCost) {
+                    spatialCost = cost;
+                    spatialDim = dim;
+                    spatialSplitPos = binPlane(i + 1);
+                }
+            }
+        }
+    }
+
+    // Create a leaf if splitting doesn't pay off
+    Float leafCost = nRefs;
+    Float minCost = std::min(objectCost, spatialCost);
+    if (minCost == Infinity || (nRefs <= maxPrimsInNode && leafCost <= minCost))
+        return createLeaf();
+
+    std::vector<BVHPrimitiveInfo> left, right;
+    int dim;
+    if (spatialCost < objectCost) {
+        // Split references at _spatialSplitPos_, clipping the ones that
+        // straddle it to each side
+        dim = spatialDim;
+        int nDuplicates = 0;
+        for (const BVHPrimitiveInfo &ref : refs) {
+            if (ref.bounds.pMax[dim] <= spatialSplitPos)
+                left.push_back(ref);
+            else if (ref.bounds.pMin[dim] >= spatialSplitPos)
+                right.push_back(ref);
+            else {
+                const Primitive &prim = *primitives[ref.primitiveNumber];
+                Bounds3f clip0 = ref.bounds, clip1 = ref.bounds;
+                clip0.pMax[dim] = clip1.pMin[dim] = spatialSplitPos;
+                Bounds3f b0 = prim.ClippedWorldBound(clip0);
+                Bounds3f b1 = prim.ClippedWorldBound(clip1);
+                if (!IsEmpty(b0)) left.push_back({ref.primitiveNumber, b0});
+                if (!IsEmpty(b1)) right.push_back({ref.primitiveNumber, b1});
+                if (!IsEmpty(b0) && !IsEmpty(b1)) ++nDuplicates;
+                // Keep a reference whose clipped bounds are empty due to
+                // round-off error rather than losing the primitive
+                if (IsEmpty(b0) && IsEmpty(b1)) left.push_back(ref);
+            }
+        }
+        if (left.empty() || right.empty()) {
+            // Fall back to the object split or a leaf
+            left.clear();
+            right.clear();
+            if (objectSplitBucket == -1) return createLeaf();
+        } else {
+            ++sbvhSpatialSplits;
+            state.duplicatesLeft -= nDuplicates;
+        }
+    }
+    if (left.empty()) {
+        // Partition references at the object split's bucket
+        dim = objectDim;
+        for (const BVHPrimitiveInfo &ref : refs)
+            (objectBucket(ref) <= objectSplitBucket ? left : right)
+                .push_back(ref);
+    }
+
+    // Free this node's references before building the children
+    std::vector<BVHPrimitiveInfo>().swap(refs);
+    BVHBuildNode *c0 = sbvhBuild(arena, left, depth + 1, totalNodes,
+                                 orderedPrimIndices, state);
+    BVHBuildNode *c1 = sbvhBuild(arena, right, depth + 1, totalNodes,
+                                 orderedPrimIndices, state);
+    node->InitInterior(dim, c0, c1);
+    return node;
+}
+
 BVHBuildNode *BVHAccel::HLBVHBuild(
     MemoryArena &arena, const std::vector<BVHPrimitiveInfo> &primitiveInfo,
     int *totalNodes,
-    std::vector<std::shared_ptr<Primitive>> &orderedPrims) const {
+    std::vector<int> &orderedPrimIndices) const {
+    std::chrono::steady_clock::time_point phaseStart =
+        std::chrono::steady_clock::now();
     // Compute bounding box of all primitive centroids
-    Bounds3f bounds;
-    for (const BVHPrimitiveInfo &pi : primitiveInfo)
-        bounds = Union(bounds, pi.centroid);
+    Bounds3f bounds =
+        ComputeBounds(primitiveInfo, 0, primitiveInfo.size(), true, true);
 
     // Compute Morton indices of primitives
     std::vector<MortonPrimitive> mortonPrims(primitiveInfo.size());
@@ -420,73 +1339,96 @@ BVHBuildNode *BVHAccel::HLBVHBuild(
         Vector3f centroidOffset = bounds.Offset(primitiveInfo[i].centroid);
         mortonPrims[i].mortonCode = EncodeMorton3(centroidOffset * mortonScale);
     }, primitiveInfo.size(), 512);
+    ReportValue(hlbvhMortonTime, ElapsedMS(&phaseStart));
 
     // Radix sort primitive Morton indices
     RadixSort(&mortonPrims);
+    ReportValue(hlbvhSortTime, ElapsedMS(&phaseStart));
 
     // Create LBVH treelets at bottom of BVH
 
     // Find intervals of primitives for each treelet
-    std::vector<LBVHTreelet> treeletsToBuild;
-    for (int start = 0, end = 1; end <= (int)mortonPrims.size(); ++end) {
 #ifdef PBRT_HAVE_BINARY_CONSTANTS
-      uint32_t mask = 0b00111111111111000000000000000000;
+    uint32_t mask = 0b00111111111111000000000000000000;
 #else
-      uint32_t mask = 0x3ffc0000;
+    uint32_t mask = 0x3ffc0000;
 #endif
-      if (end == (int)mortonPrims.size() ||
-            ((mortonPrims[start].mortonCode & mask) !=
-             (mortonPrims[end].mortonCode & mask))) {
-            // Add entry to _treeletsToBuild_ for this treelet
-            int nPrimitives = end - start;
-            int maxBVHNodes = 2 * nPrimitives;
-            BVHBuildNode *nodes = arena.Alloc<BVHBuildNode>(maxBVHNodes, false);
-            treeletsToBuild.push_back({start, nPrimitives, nodes});
-            start = end;
+    // Find the treelet boundaries in each chunk of _mortonPrims_ in parallel
+    PBRT_CONSTEXPR int chunkSize = 16 * 1024;
+    int nMortonPrims = mortonPrims.size();
+    int nChunks = (nMortonPrims + chunkSize - 1) / chunkSize;
+    std::vector<std::vector<int>> chunkTreeletStarts(nChunks);
+    ParallelFor([&](int64_t c) {
+        int end = std::min<int>((c + 1) * chunkSize, nMortonPrims);
+        for (int i = c * chunkSize; i < end; ++i)
+            if (i == 0 || ((mortonPrims[i - 1].mortonCode & mask) !=
+                           (mortonPrims[i].mortonCode & mask)))
+                chunkTreeletStarts[c].push_back(i);
+    }, nChunks);
+    std::vector<LBVHTreelet> treeletsToBuild;
+    for (const std::vector<int> &starts : chunkTreeletStarts)
+        for (int start : starts) {
+            if (!treeletsToBuild.empty()) {
+                LBVHTreelet &prev = treeletsToBuild.back();
+                prev.nPrimitives = start - prev.startIndex;
+            }
+            treeletsToBuild.push_back({start, nMortonPrims - start, nullptr});
         }
+    for (LBVHTreelet &treelet : treeletsToBuild) {
+        // Allocate nodes for this treelet
+        int maxBVHNodes = 2 * treelet.nPrimitives;
+        treelet.buildNodes = arena.Alloc<BVHBuildNode>(maxBVHNodes, false);
     }
 
-    // Create LBVHs for treelets in parallel
-    std::atomic<int> atomicTotal(0), orderedPrimsOffset(0);
-    orderedPrims.resize(primitives.size());
+    // Create LBVHs for treelets in parallel, largest first so that a big
+    // treelet doesn't end up running alone at the end
+    std::vector<int> treeletOrder(treeletsToBuild.size());
+    for (size_t i = 0; i < treeletOrder.size(); ++i) treeletOrder[i] = i;
+    std::sort(treeletOrder.begin(), treeletOrder.end(), [&](int a, int b) {
+        return treeletsToBuild[a].nPrimitives > treeletsToBuild[b].nPrimitives;
+    });
+    std::atomic<int> atomicTotal(0);
+    orderedPrimIndices.resize(primitives.size());
     ParallelFor([&](int i) {
         // Generate _i_th LBVH treelet
         int nodesCreated = 0;
         const int firstBitIndex = 29 - 12;
-        LBVHTreelet &tr = treeletsToBuild[i];
+        LBVHTreelet &tr = treeletsToBuild[treeletOrder[i]];
         tr.buildNodes =
             emitLBVH(tr.buildNodes, primitiveInfo, &mortonPrims[tr.startIndex],
-                     tr.nPrimitives, &nodesCreated, orderedPrims,
-                     &orderedPrimsOffset, firstBitIndex);
+                     tr.nPrimitives, &nodesCreated, orderedPrimIndices,
+                     tr.startIndex, firstBitIndex);
         atomicTotal += nodesCreated;
     }, treeletsToBuild.size());
     *totalNodes = atomicTotal;
+    ReportValue(hlbvhEmitTime, ElapsedMS(&phaseStart));
 
     // Create and return SAH BVH from LBVH treelets
     std::vector<BVHBuildNode *> finishedTreelets;
     finishedTreelets.reserve(treeletsToBuild.size());
     for (LBVHTreelet &treelet : treeletsToBuild)
         finishedTreelets.push_back(treelet.buildNodes);
-    return buildUpperSAH(arena, finishedTreelets, 0, finishedTreelets.size(),
-                         totalNodes);
+    BVHBuildNode *root = buildUpperSAH(arena, finishedTreelets, 0,
+                                       finishedTreelets.size(), totalNodes);
+    ReportValue(hlbvhUpperSAHTime, ElapsedMS(&phaseStart));
+    return root;
 }
 
 BVHBuildNode *BVHAccel::emitLBVH(
     BVHBuildNode *&buildNodes,
     const std::vector<BVHPrimitiveInfo> &primitiveInfo,
     MortonPrimitive *mortonPrims, int nPrimitives, int *totalNodes,
-    std::vector<std::shared_ptr<Primitive>> &orderedPrims,
-    std::atomic<int> *orderedPrimsOffset, int bitIndex) const {
+    std::vector<int> &orderedPrimIndices,
+    int firstPrimOffset, int bitIndex) const {
     CHECK_GT(nPrimitives, 0);
     if (bitIndex == -1 || nPrimitives < maxPrimsInNode) {
         // Create and return leaf node of LBVH treelet
         (*totalNodes)++;
         BVHBuildNode *node = buildNodes++;
         Bounds3f bounds;
-        int firstPrimOffset = orderedPrimsOffset->fetch_add(nPrimitives);
         for (int i = 0; i < nPrimitives; ++i) {
             int primitiveIndex = mortonPrims[i].primitiveIndex;
-            orderedPrims[firstPrimOffset + i] = primitives[primitiveIndex];
+            orderedPrimIndices[firstPrimOffset + i] = primitiveIndex;
             bounds = Union(bounds, primitiveInfo[primitiveIndex].bounds);
         }
         node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
@@ -497,7 +1439,7 @@ BVHBuildNode *BVHAccel::emitLBVH(
         if ((mortonPrims[0].mortonCode & mask) ==
             (mortonPrims[nPrimitives - 1].mortonCode & mask))
             return emitLBVH(buildNodes, primitiveInfo, mortonPrims, nPrimitives,
-                            totalNodes, orderedPrims, orderedPrimsOffset,
+                            totalNodes, orderedPrimIndices, firstPrimOffset,
                             bitIndex - 1);
 
         // Find LBVH split point for this dimension
@@ -524,11 +1466,12 @@ BVHBuildNode *BVHAccel::emitLBVH(
         BVHBuildNode *node = buildNodes++;
         BVHBuildNode *lbvh[2] = {
             emitLBVH(buildNodes, primitiveInfo, mortonPrims, splitOffset,
-                     totalNodes, orderedPrims, orderedPrimsOffset,
+                     totalNodes, orderedPrimIndices, firstPrimOffset,
                      bitIndex - 1),
             emitLBVH(buildNodes, primitiveInfo, &mortonPrims[splitOffset],
-                     nPrimitives - splitOffset, totalNodes, orderedPrims,
-                     orderedPrimsOffset, bitIndex - 1)};
+                     nPrimitives - splitOffset, totalNodes,
+                     orderedPrimIndices, firstPrimOffset + splitOffset,
+                     bitIndex - 1)};
         int axis = bitIndex % 3;
         node->InitInterior(axis, lbvh[0], lbvh[1]);
         return node;
@@ -657,27 +1600,324 @@ int BVHAccel::flattenBVHTree(BVHBuildNode *node, int *offset) {
     return myOffset;
 }
 
-BVHAccel::~BVHAccel() { FreeAligned(nodes); }
+// Header of a BVH cache file.  It is followed by the original index of each
+// primitive reference in BVH order and then, starting at _nodesOffset_, by
+// the flattened nodes.
+struct BVHCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t layout, nodeSize;
+    int32_t nNodes;
+    uint64_t buildHash, nReferences, nodesOffset;
+    Bounds3f bounds;
+};
+
+static const char bvhCacheMagic[8] = "pbrtBVH";
+static PBRT_CONSTEXPR uint32_t bvhCacheVersion = 2;
+
+static size_t NodeSize(BVHAccel::Layout layout) {
+    switch (layout) {
+    case BVHAccel::Layout::BVH4:
+        return sizeof(WideBVHNode<4>);
+    case BVHAccel::Layout::BVH8:
+        return sizeof(WideBVHNode<8>);
+    case BVHAccel::Layout::BVH8Quant8:
+        return sizeof(QuantizedBVHNode<uint8_t>);
+    case BVHAccel::Layout::BVH8Quant16:
+        return sizeof(QuantizedBVHNode<uint16_t>);
+    default:
+        return sizeof(LinearBVHNode);
+    }
+}
+
+// 64-bit FNV-1a hash of _size_ bytes at _data_, continuing from _hash_.
+static uint64_t HashBytes(const void *data, size_t size, uint64_t hash) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+uint64_t BVHAccel::hashBuildInputs(
+    const std::vector<BVHPrimitiveInfo> &primitiveInfo) const {
+    // The tree depends on the build parameters and the world-space bounds
+    // of the primitives, which account for both their geometry and their
+    // transformations.
+    uint64_t hash = 0xcbf29ce484222325ull;
+    int32_t params[5] = {(int32_t)sizeof(Float), (int32_t)primitives.size(),
+                         maxPrimsInNode, (int32_t)splitMethod,
+                         (int32_t)layout};
+    hash = HashBytes(params, sizeof(params), hash);
+    for (const BVHPrimitiveInfo &pi : primitiveInfo)
+        hash = HashBytes(&pi.bounds, sizeof(pi.bounds), hash);
+    if (splitMethod != SplitMethod::SBVH) return hash;
+
+    // SBVH node bounds also come from clipping triangles against the split
+    // planes, so different triangles with the same bounds give different
+    // trees; triangles are the only shapes that clip more than their
+    // bounds.
+    hash = HashBytes(&splitBudget, sizeof(splitBudget), hash);
+    for (const std::shared_ptr<Primitive> &prim : primitives) {
+        const GeometricPrimitive *gp =
+            dynamic_cast<const GeometricPrimitive *>(prim.get());
+        const Triangle *tri =
+            gp ? dynamic_cast<const Triangle *>(gp->GetShape()) : nullptr;
+        if (!tri) continue;
+        Point3f p[3];
+        tri->GetVertices(&p[0], &p[1], &p[2]);
+        hash = HashBytes(p, sizeof(p), hash);
+    }
+    return hash;
+}
+
+bool BVHAccel::readCache(const std::string &filename, uint64_t buildHash) {
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) return false;
+
+    // Read and validate the cache file header
+    BVHCacheHeader header;
+    size_t nPrimitives = primitives.size();
+    bool valid = fread(&header, sizeof(header), 1, f) == 1 &&
+                 memcmp(header.magic, bvhCacheMagic,
+                        sizeof(bvhCacheMagic)) == 0 &&
+                 header.version == bvhCacheVersion &&
+                 header.buildHash == buildHash &&
+                 header.layout == (uint32_t)layout &&
+                 header.nodeSize == NodeSize(layout) &&
+                 header.nReferences >= nPrimitives &&
+                 header.nReferences <= 0x7fffffff && header.nNodes > 0;
+    size_t nodeBytes = size_t(header.nNodes) * header.nodeSize;
+    size_t nReferences = header.nReferences;
+    if (valid) {
+        fseek(f, 0, SEEK_END);
+        long fileLength = ftell(f);
+        valid = fileLength >= 0 &&
+                sizeof(header) + nReferences * sizeof(uint32_t) <=
+                    header.nodesOffset &&
+                header.nodesOffset + nodeBytes <= (uint64_t)fileLength;
+        fseek(f, sizeof(header), SEEK_SET);
+    }
+
+    // Read the primitive references and check that they cover every
+    // primitive; only SBVHs reference a primitive more than once
+    std::vector<uint32_t> primIndices;
+    if (valid) {
+        primIndices.resize(nReferences);
+        valid = fread(&primIndices[0], sizeof(uint32_t), nReferences, f) ==
+                nReferences;
+    }
+    if (valid) {
+        std::vector<bool> seen(nPrimitives, false);
+        size_t nSeen = 0;
+        for (uint32_t index : primIndices) {
+            if (index >= nPrimitives) {
+                valid = false;
+                break;
+            }
+            if (!seen[index]) ++nSeen;
+            seen[index] = true;
+        }
+        valid = valid && nSeen == nPrimitives;
+    }
+    if (!valid) {
+        fclose(f);
+        LOG(INFO) << "Ignoring stale or invalid BVH cache " << filename;
+        return false;
+    }
+
+    // Map or read the flattened nodes
+    void *nodeMemory;
+#ifdef PBRT_HAVE_MMAP
+    fclose(f);
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1) return false;
+    size_t mappingLength = header.nodesOffset + nodeBytes;
+    // Map privately so that writes to the nodes don't reach the file
+    void *ptr = mmap(0, mappingLength, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                     fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) return false;
+    cacheMapping = ptr;
+    cacheMappingLength = mappingLength;
+    nodeMemory = (char *)ptr + header.nodesOffset;
+#else
+    nodeMemory = AllocAligned(nodeBytes);
+    fseek(f, header.nodesOffset, SEEK_SET);
+    valid = fread(nodeMemory, 1, nodeBytes, f) == nodeBytes;
+    fclose(f);
+    if (!valid) {
+        FreeAligned(nodeMemory);
+        return false;
+    }
+#endif
+    if (layout == Layout::BVH4)
+        nodes4 = (WideBVHNode<4> *)nodeMemory;
+    else if (layout == Layout::BVH8)
+        nodes8 = (WideBVHNode<8> *)nodeMemory;
+    else if (layout == Layout::BVH8Quant8)
+        qnodes8 = (QuantizedBVHNode<uint8_t> *)nodeMemory;
+    else if (layout == Layout::BVH8Quant16)
+        qnodes16 = (QuantizedBVHNode<uint16_t> *)nodeMemory;
+    else
+        nodes = (LinearBVHNode *)nodeMemory;
+    nNodes = header.nNodes;
+    bounds = header.bounds;
+
+    // Reorder _primitives_ to match the cached tree
+    std::vector<std::shared_ptr<Primitive>> orderedPrims(nReferences);
+    for (size_t i = 0; i < nReferences; ++i)
+        orderedPrims[i] = primitives[primIndices[i]];
+    primitives.swap(orderedPrims);
+    treeBytes += sizeof(*this) + nReferences * sizeof(primitives[0]) +
+                 nodeBytes;
+    bvhNodeBytes += nodeBytes;
+    LOG(INFO) << StringPrintf("BVH with %d nodes loaded from cache %s",
+                              nNodes, filename.c_str());
+    return true;
+}
+
+void BVHAccel::writeCache(const std::string &filename, uint64_t buildHash,
+                          const std::vector<int> &orderedPrimIndices) const {
+    BVHCacheHeader header;
+    memcpy(header.magic, bvhCacheMagic, sizeof(bvhCacheMagic));
+    header.version = bvhCacheVersion;
+    header.layout = (uint32_t)layout;
+    header.nodeSize = NodeSize(layout);
+    header.nNodes = nNodes;
+    header.buildHash = buildHash;
+    header.nReferences = primitives.size();
+    // Start the nodes on a cache line boundary so that they can be used
+    // directly from the mapped file
+    size_t primIndicesEnd =
+        sizeof(header) + primitives.size() * sizeof(uint32_t);
+    header.nodesOffset =
+        (primIndicesEnd + PBRT_L1_CACHE_LINE_SIZE - 1) &
+        ~size_t(PBRT_L1_CACHE_LINE_SIZE - 1);
+    header.bounds = bounds;
+    const void *nodeMemory = nodes4     ? (const void *)nodes4
+                           : nodes8   ? (const void *)nodes8
+                           : qnodes8  ? (const void *)qnodes8
+                           : qnodes16 ? (const void *)qnodes16
+                                      : (const void *)nodes;
+
+    // Write to a temporary file and rename it so that other pbrt processes
+    // never see a partially-written cache
+    std::string tempFilename = filename + ".tmp";
+    FILE *f = fopen(tempFilename.c_str(), "wb");
+    if (!f) {
+        Warning("%s: unable to create BVH cache file: %s",
+                tempFilename.c_str(), strerror(errno));
+        return;
+    }
+    std::vector<uint32_t> primIndices(orderedPrimIndices.begin(),
+                                      orderedPrimIndices.end());
+    std::vector<char> padding(header.nodesOffset - primIndicesEnd, 0);
+    size_t nodeBytes = size_t(nNodes) * header.nodeSize;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(&primIndices[0], sizeof(uint32_t), primIndices.size(),
+                     f) == primIndices.size() &&
+              (padding.empty() ||
+               fwrite(&padding[0], 1, padding.size(), f) == padding.size()) &&
+              fwrite(nodeMemory, 1, nodeBytes, f) == nodeBytes;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tempFilename.c_str(), filename.c_str()) != 0) {
+        Warning("%s: unable to write BVH cache file: %s", filename.c_str(),
+                strerror(errno));
+        remove(tempFilename.c_str());
+        return;
+    }
+    LOG(INFO) << "Wrote BVH cache " << filename;
+}
+
+void BVHAccel::updateLeafTriangles() {
+    if (!useLeafTriangles) return;
+    bool allocate = !leafTriangles;
+    if (allocate) {
+        leafTriangles = AllocAligned<LeafTriangle>(primitives.size());
+        ParallelFirstTouch(leafTriangles,
+                           primitives.size() * sizeof(LeafTriangle));
+        leafPrimitiveCount += primitives.size();
+        treeBytes += primitives.size() * sizeof(LeafTriangle);
+    }
+    for (size_t i = 0; i < primitives.size(); ++i) {
+        LeafTriangle &tri = leafTriangles[i];
+        const GeometricPrimitive *gp =
+            dynamic_cast<const GeometricPrimitive *>(primitives[i].get());
+        const Triangle *shape =
+            gp ? dynamic_cast<const Triangle *>(gp->GetShape()) : nullptr;
+        tri.isTriangle =
+            shape && shape->GetIntersectionVertices(&tri.p0, &tri.p1, &tri.p2);
+        if (allocate && tri.isTriangle) ++leafTriangleCount;
+    }
+    if (allocate)
+        ReportNumaPlacement("BVH leaf triangles", leafTriangles,
+                            primitives.size() * sizeof(LeafTriangle));
+}
+
+BVHAccel::~BVHAccel() {
+    FreeAligned(leafTriangles);
+#ifdef PBRT_HAVE_MMAP
+    if (cacheMapping) {
+        // The nodes live in memory mapped from the BVH cache file
+        munmap(cacheMapping, cacheMappingLength);
+        return;
+    }
+#endif
+    FreeAligned(nodes);
+    FreeAligned(nodes4);
+    FreeAligned(nodes8);
+    FreeAligned(qnodes8);
+    FreeAligned(qnodes16);
+}
 
 bool BVHAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
-    if (!nodes) return false;
     ProfilePhase p(Prof::AccelIntersect);
+    int nodesVisited = 0;
+    bool hit;
+    if (nodes4)
+        hit = IntersectWideBVH(nodes4, primitives, leafTriangles, ray, isect,
+                               &nodesVisited);
+    else if (nodes8)
+        hit = IntersectWideBVH(nodes8, primitives, leafTriangles, ray, isect,
+                               &nodesVisited);
+    else if (qnodes8)
+        hit = IntersectWideBVH(qnodes8, primitives, leafTriangles, ray, isect,
+                               &nodesVisited);
+    else if (qnodes16)
+        hit = IntersectWideBVH(qnodes16, primitives, leafTriangles, ray,
+                               isect, &nodesVisited);
+    else if (nodes) {
+        DeferredHit deferred;
+        hit = intersectSubtree(ray, isect, 0, &nodesVisited, &deferred);
+        ResolveDeferredHit(primitives, deferred, ray, isect);
+    } else
+        return false;
+    REPORT_NODES_VISITED(nodesVisited);
+    return hit;
+}
+
+bool BVHAccel::intersectSubtree(const Ray &ray, SurfaceInteraction *isect,
+                                int rootNodeIndex, int *nodesVisited,
+                                DeferredHit *deferred) const {
     bool hit = false;
     Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
     int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
     // Follow ray through BVH nodes to find primitive intersections
-    int toVisitOffset = 0, currentNodeIndex = 0;
+    int toVisitOffset = 0, currentNodeIndex = rootNodeIndex;
     int nodesToVisit[64];
     while (true) {
         const LinearBVHNode *node = &nodes[currentNodeIndex];
+        ++*nodesVisited;
         // Check ray against BVH node
         if (node->bounds.IntersectP(ray, invDir, dirIsNeg)) {
             if (node->nPrimitives > 0) {
                 // Intersect ray with primitives in leaf BVH node
-                for (int i = 0; i < node->nPrimitives; ++i)
-                    if (primitives[node->primitivesOffset + i]->Intersect(
-                            ray, isect))
-                        hit = true;
+                if (IntersectLeaf(primitives, leafTriangles,
+                                  node->primitivesOffset, node->nPrimitives,
+                                  ray, isect, deferred))
+                    hit = true;
                 if (toVisitOffset == 0) break;
                 currentNodeIndex = nodesToVisit[--toVisitOffset];
             } else {
@@ -699,24 +1939,190 @@ bool BVHAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
     return hit;
 }
 
+void BVHAccel::IntersectPacket(const Ray *rays, int nRays,
+                               SurfaceInteraction *isects, bool *hits) const {
+    CHECK_LE(nRays, MaxRayPacketSize);
+    if (layout != Layout::Binary) {
+        // Packet traversal is only implemented for the binary tree
+        Primitive::IntersectPacket(rays, nRays, isects, hits);
+        return;
+    }
+    for (int i = 0; i < nRays; ++i) hits[i] = false;
+    if (!nodes || nRays == 0) return;
+    ProfilePhase p(Prof::AccelIntersect);
+
+    // Initialize _RayPacket_ and check that rays share a direction octant
+    RayPacket packet;
+    packet.nRays = nRays;
+    for (int i = 0; i < nRays; ++i) {
+        packet.o[0][i] = rays[i].o.x;
+        packet.o[1][i] = rays[i].o.y;
+        packet.o[2][i] = rays[i].o.z;
+        packet.invDir[0][i] = 1 / rays[i].d.x;
+        packet.invDir[1][i] = 1 / rays[i].d.y;
+        packet.invDir[2][i] = 1 / rays[i].d.z;
+        packet.tMax[i] = rays[i].tMax;
+    }
+    // Give unused lanes valid values; their results are masked off
+    for (int i = nRays; i < MaxRayPacketSize; ++i) {
+        for (int axis = 0; axis < 3; ++axis) {
+            packet.o[axis][i] = packet.o[axis][0];
+            packet.invDir[axis][i] = packet.invDir[axis][0];
+        }
+        packet.tMax[i] = 0;
+    }
+    int dirIsNeg[3] = {packet.invDir[0][0] < 0, packet.invDir[1][0] < 0,
+                       packet.invDir[2][0] < 0};
+    bool coherent = true;
+    for (int i = 1; i < nRays; ++i)
+        for (int axis = 0; axis < 3; ++axis)
+            if ((packet.invDir[axis][i] < 0) != (dirIsNeg[axis] != 0))
+                coherent = false;
+    totalPacketRays += nRays;
+    if (!coherent || nRays == 1) {
+        // Trace rays individually if traversal order differs among them
+        for (int i = 0; i < nRays; ++i) {
+            int nodesVisited = 0;
+            DeferredHit deferred;
+            hits[i] = intersectSubtree(rays[i], &isects[i], 0, &nodesVisited,
+                                       &deferred);
+            ResolveDeferredHit(primitives, deferred, rays[i], &isects[i]);
+            REPORT_NODES_VISITED(nodesVisited);
+        }
+        singlePacketRays += nRays;
+        return;
+    }
+    ++packetTraversals;
+
+    // Follow packet through BVH nodes, tracking the set of active rays
+    // Fall back to single-ray traversal of a subtree once so few rays
+    // remain active that testing the others is mostly wasted work.
+    int minActiveRays = std::max(2, nRays / 4 + 1);
+    struct StackEntry {
+        int nodeIndex;
+        uint32_t activeMask;
+    };
+    StackEntry nodesToVisit[64];
+    DeferredHit deferred[MaxRayPacketSize];
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    uint32_t activeMask = (1u << nRays) - 1;
+    while (true) {
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        int nActive;
+        uint32_t hitMask =
+            packet.IntersectP(node->bounds, dirIsNeg, activeMask, &nActive);
+        if (nActive >= minActiveRays) {
+            if (node->nPrimitives > 0) {
+                // Intersect active rays with primitives in leaf BVH node
+                for (int r = 0; r < nRays; ++r) {
+                    if (!(hitMask & (1u << r))) continue;
+                    if (IntersectLeaf(primitives, leafTriangles,
+                                      node->primitivesOffset,
+                                      node->nPrimitives, rays[r], &isects[r],
+                                      &deferred[r]))
+                        hits[r] = true;
+                    packet.tMax[r] = rays[r].tMax;
+                }
+            } else {
+                // Put far BVH node on _nodesToVisit_ stack, advance to near
+                // node
+                if (dirIsNeg[node->axis]) {
+                    nodesToVisit[toVisitOffset++] = {currentNodeIndex + 1,
+                                                     hitMask};
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = {node->secondChildOffset,
+                                                     hitMask};
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+                activeMask = hitMask;
+                continue;
+            }
+        } else if (nActive > 0) {
+            // Finish the remaining rays' traversal of this subtree one at a
+            // time
+            for (int r = 0; r < nRays; ++r) {
+                if (!(hitMask & (1u << r))) continue;
+                int nodesVisited = 0;
+                if (intersectSubtree(rays[r], &isects[r], currentNodeIndex,
+                                     &nodesVisited, &deferred[r]))
+                    hits[r] = true;
+                packet.tMax[r] = rays[r].tMax;
+                ++singlePacketRays;
+            }
+        }
+        if (toVisitOffset == 0) break;
+        --toVisitOffset;
+        currentNodeIndex = nodesToVisit[toVisitOffset].nodeIndex;
+        activeMask = nodesToVisit[toVisitOffset].activeMask;
+    }
+    for (int r = 0; r < nRays; ++r)
+        ResolveDeferredHit(primitives, deferred[r], rays[r], &isects[r]);
+}
+
 bool BVHAccel::IntersectP(const Ray &ray) const {
-    if (!nodes) return false;
     ProfilePhase p(Prof::AccelIntersectP);
+    int nodesVisited = 0;
+    bool hit;
+    if (nodes4)
+        hit = IntersectPWideBVH(nodes4, primitives, leafTriangles, ray,
+                                &nodesVisited);
+    else if (nodes8)
+        hit = IntersectPWideBVH(nodes8, primitives, leafTriangles, ray,
+                                &nodesVisited);
+    else if (qnodes8)
+        hit = IntersectPWideBVH(qnodes8, primitives, leafTriangles, ray,
+                                &nodesVisited);
+    else if (qnodes16)
+        hit = IntersectPWideBVH(qnodes16, primitives, leafTriangles, ray,
+                                &nodesVisited);
+    else if (nodes)
+        hit = intersectPBinary(ray, &nodesVisited);
+    else
+        return false;
+    REPORT_NODES_VISITED(nodesVisited);
+    return hit;
+}
+
+void BVHAccel::IntersectPBatch(const Ray *rays, int nRays,
+                               bool *occluded) const {
+    // Trace the rays of each chunk in order of direction octant, so that
+    // consecutive rays visit the children of each node in the same order
+    // and mostly touch nodes that are already in the cache. Each ray uses
+    // the any-hit traversal of _IntersectP()_; tracing octants as packets
+    // was slower, since most rays of a packet finish early.
+    const int chunkSize = 64;
+    for (int start = 0; start < nRays; start += chunkSize) {
+        int n = std::min(chunkSize, nRays - start);
+        int octant[chunkSize], octantStart[9] = {0};
+        for (int i = 0; i < n; ++i) {
+            const Vector3f &d = rays[start + i].d;
+            octant[i] = (d.x < 0) | ((d.y < 0) << 1) | ((d.z < 0) << 2);
+            ++octantStart[octant[i] + 1];
+        }
+        for (int o = 0; o < 8; ++o) octantStart[o + 1] += octantStart[o];
+        int order[chunkSize];
+        for (int i = 0; i < n; ++i) order[octantStart[octant[i]]++] = start + i;
+        for (int i = 0; i < n; ++i)
+            occluded[order[i]] = IntersectP(rays[order[i]]);
+    }
+}
+
+bool BVHAccel::intersectPBinary(const Ray &ray, int *nodesVisited) const {
     Vector3f invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
     int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
     int nodesToVisit[64];
     int toVisitOffset = 0, currentNodeIndex = 0;
     while (true) {
         const LinearBVHNode *node = &nodes[currentNodeIndex];
+        ++*nodesVisited;
         if (node->bounds.IntersectP(ray, invDir, dirIsNeg)) {
             // Process BVH node _node_ for traversal
             if (node->nPrimitives > 0) {
-                for (int i = 0; i < node->nPrimitives; ++i) {
-                    if (primitives[node->primitivesOffset + i]->IntersectP(
-                            ray)) {
-                        return true;
-                    }
-                }
+                if (IntersectPLeaf(primitives, leafTriangles,
+                                   node->primitivesOffset, node->nPrimitives,
+                                   ray))
+                    return true;
                 if (toVisitOffset == 0) break;
                 currentNodeIndex = nodesToVisit[--toVisitOffset];
             } else {
@@ -737,6 +2143,174 @@ bool BVHAccel::IntersectP(const Ray &ray) const {
     return false;
 }
 
+template <int Width>
+static Bounds3f ChildBounds(const WideBVHNode<Width> &node, int c) {
+    return Bounds3f(
+        Point3f(node.bounds[0][0][c], node.bounds[0][1][c],
+                node.bounds[0][2][c]),
+        Point3f(node.bounds[1][0][c], node.bounds[1][1][c],
+                node.bounds[1][2][c]));
+}
+
+template <typename T>
+static Bounds3f ChildBounds(const QuantizedBVHNode<T> &node, int c) {
+    return Bounds3f(Point3f(node.Dequantize(0, node.qBounds[0][0][c]),
+                            node.Dequantize(1, node.qBounds[0][1][c]),
+                            node.Dequantize(2, node.qBounds[0][2][c])),
+                    Point3f(node.Dequantize(0, node.qBounds[1][0][c]),
+                            node.Dequantize(1, node.qBounds[1][1][c]),
+                            node.Dequantize(2, node.qBounds[1][2][c])));
+}
+
+template <int Width>
+static void SetChildBounds(WideBVHNode<Width> *node,
+                           const Bounds3f *childBounds) {
+    for (int c = 0; c < node->nChildren; ++c)
+        for (int axis = 0; axis < 3; ++axis) {
+            node->bounds[0][axis][c] = childBounds[c].pMin[axis];
+            node->bounds[1][axis][c] = childBounds[c].pMax[axis];
+        }
+}
+
+template <typename T>
+static void SetChildBounds(QuantizedBVHNode<T> *node,
+                           const Bounds3f *childBounds) {
+    // Quantize the node again for its new child bounds
+    WideBVHNode<8> wideNode;
+    wideNode.nChildren = node->nChildren;
+    for (int c = 0; c < node->nChildren; ++c) {
+        wideNode.childOffset[c] = node->childOffset[c];
+        wideNode.nPrimitives[c] = node->nPrimitives[c];
+    }
+    SetChildBounds(&wideNode, childBounds);
+    *node = QuantizedBVHNode<T>(wideNode);
+}
+
+// Collects the bounds of the wide BVH's nodes two levels below the root.
+template <typename Node>
+static void WideBoundsCut(const Node *nodes, std::vector<Bounds3f> *cut) {
+    const Node &root = nodes[0];
+    for (int c = 0; c < root.nChildren; ++c) {
+        if (root.nPrimitives[c] > 0) {
+            cut->push_back(ChildBounds(root, c));
+            continue;
+        }
+        const Node &child = nodes[root.childOffset[c]];
+        for (int g = 0; g < child.nChildren; ++g)
+            cut->push_back(ChildBounds(child, g));
+    }
+}
+
+// Collects the bounds of the binary BVH's nodes _depth_ levels below
+// _nodes[nodeIndex]_, or of leaves above that level.
+static void BinaryBoundsCut(const LinearBVHNode *nodes, int nodeIndex,
+                            int depth, std::vector<Bounds3f> *cut) {
+    const LinearBVHNode &node = nodes[nodeIndex];
+    if (node.nPrimitives > 0 || depth == 0) {
+        cut->push_back(node.bounds);
+        return;
+    }
+    BinaryBoundsCut(nodes, nodeIndex + 1, depth - 1, cut);
+    BinaryBoundsCut(nodes, node.secondChildOffset, depth - 1, cut);
+}
+
+void BVHAccel::computeBoundsCut() {
+    boundsCut.clear();
+    if (nodes4)
+        WideBoundsCut(nodes4, &boundsCut);
+    else if (nodes8)
+        WideBoundsCut(nodes8, &boundsCut);
+    else if (qnodes8)
+        WideBoundsCut(qnodes8, &boundsCut);
+    else if (qnodes16)
+        WideBoundsCut(qnodes16, &boundsCut);
+    else if (nodes)
+        BinaryBoundsCut(nodes, 0, 4, &boundsCut);
+}
+
+Bounds3f BVHAccel::TransformedWorldBound(const Transform &t) const {
+    // Transforming the bounds of nodes below the root rather than the
+    // BVH's overall bounds gives much tighter bounds under rotations.
+    Bounds3f b;
+    for (const Bounds3f &cb : boundsCut) b = Union(b, t(cb));
+    return b;
+}
+
+// Refits the child bounds of the wide BVH's nodes; returns the bounds of
+// the root.
+template <typename Node, typename LeafBoundsFunc>
+static Bounds3f RefitWideBVH(Node *nodes, int nNodes,
+                             const LeafBoundsFunc &leafBounds) {
+    // Nodes are stored in depth-first order, so visiting them in reverse
+    // refits every node after its children
+    std::vector<Bounds3f> nodeBounds(nNodes);
+    for (int i = nNodes - 1; i >= 0; --i) {
+        Node &node = nodes[i];
+        Bounds3f childBounds[Node::Width];
+        for (int c = 0; c < node.nChildren; ++c) {
+            childBounds[c] =
+                node.nPrimitives[c] > 0
+                    ? leafBounds(node.childOffset[c], node.nPrimitives[c])
+                    : nodeBounds[node.childOffset[c]];
+            nodeBounds[i] = Union(nodeBounds[i], childBounds[c]);
+        }
+        SetChildBounds(&node, childBounds);
+    }
+    return nodeBounds[0];
+}
+
+void BVHAccel::Refit() {
+    ProfilePhase _(Prof::AccelConstruction);
+    if (primitives.empty()) return;
+    ++bvhRefits;
+    std::vector<Bounds3f> primBounds(primitives.size());
+    ParallelFor([&](int64_t i) { primBounds[i] = primitives[i]->WorldBound(); },
+                primitives.size(), 4096);
+    auto leafBounds = [&](int first, int nPrimitives) {
+        Bounds3f b;
+        for (int i = first; i < first + nPrimitives; ++i)
+            b = Union(b, primBounds[i]);
+        return b;
+    };
+    if (nodes4)
+        bounds = RefitWideBVH(nodes4, nNodes, leafBounds);
+    else if (nodes8)
+        bounds = RefitWideBVH(nodes8, nNodes, leafBounds);
+    else if (qnodes8)
+        bounds = RefitWideBVH(qnodes8, nNodes, leafBounds);
+    else if (qnodes16)
+        bounds = RefitWideBVH(qnodes16, nNodes, leafBounds);
+    else {
+        // Children follow their parent in _nodes_; refit in reverse order
+        for (int i = nNodes - 1; i >= 0; --i) {
+            LinearBVHNode &node = nodes[i];
+            if (node.nPrimitives > 0)
+                node.bounds =
+                    leafBounds(node.primitivesOffset, node.nPrimitives);
+            else
+                node.bounds = Union(nodes[i + 1].bounds,
+                                    nodes[node.secondChildOffset].bounds);
+        }
+        bounds = nodes[0].bounds;
+    }
+    updateLeafTriangles();
+    computeBoundsCut();
+}
+
+bool BVHAccel::SetTimeRange(Float t0, Float t1) {
+    // Aggregates shared by several instances see the same range once per
+    // instance; only the first call needs to do any work.
+    if (t0 == time0 && t1 == time1) return animatedBounds;
+    time0 = t0;
+    time1 = t1;
+    // Primitives may share children, so they're updated serially.
+    animatedBounds = false;
+    for (const std::shared_ptr<Primitive> &p : primitives)
+        if (p->SetTimeRange(t0, t1)) animatedBounds = true;
+    if (animatedBounds) Refit();
+    return animatedBounds;
+}
+
 std::shared_ptr<BVHAccel> CreateBVHAccelerator(
     std::vector<std::shared_ptr<Primitive>> prims, const ParamSet &ps) {
     std::string splitMethodName = ps.FindOneString("splitmethod", "sah");
@@ -749,14 +2323,41 @@ std::shared_ptr<BVHAccel> CreateBVHAccelerator(
         splitMethod = BVHAccel::SplitMethod::Middle;
     else if (splitMethodName == "equal")
         splitMethod = BVHAccel::SplitMethod::EqualCounts;
+    else if (splitMethodName == "sbvh")
+        splitMethod = BVHAccel::SplitMethod::SBVH;
     else {
         Warning("BVH split method \"%s\" unknown.  Using \"sah\".",
                 splitMethodName.c_str());
         splitMethod = BVHAccel::SplitMethod::SAH;
     }
 
+    std::string layoutName = ps.FindOneString("layout", "binary");
+    BVHAccel::Layout layout;
+    if (layoutName == "binary")
+        layout = BVHAccel::Layout::Binary;
+    else if (layoutName == "bvh4")
+        layout = BVHAccel::Layout::BVH4;
+    else if (layoutName == "bvh8")
+        layout = BVHAccel::Layout::BVH8;
+    else if (layoutName == "bvh8-quant8")
+        layout = BVHAccel::Layout::BVH8Quant8;
+    else if (layoutName == "bvh8-quant16")
+        layout = BVHAccel::Layout::BVH8Quant16;
+    else {
+        Warning("BVH layout \"%s\" unknown.  Using \"binary\".",
+                layoutName.c_str());
+        layout = BVHAccel::Layout::Binary;
+    }
+
     int maxPrimsInNode = ps.FindOneInt("maxnodeprims", 4);
-    return std::make_shared<BVHAccel>(std::move(prims), maxPrimsInNode, splitMethod);
+    std::string cacheDir = ps.FindOneFilename("cachedir", "");
+    Float splitBudget = ps.FindOneFloat("splitbudget", .3f);
+    // Copying every triangle's vertices into leaf order costs 40 bytes per
+    // primitive (with 32-bit floats) and speeds up leaf tests
+    bool leafTriangles = ps.FindOneBool("leaftriangles", false);
+    return std::make_shared<BVHAccel>(std::move(prims), maxPrimsInNode,
+                                      splitMethod, layout, cacheDir,
+                                      splitBudget, leafTriangles);
 }
 
 }  // namespace pbrt
@@ -48,50 +48,117 @@ struct BVHBuildNode;
 
 // BVHAccel Forward Declarations
 struct BVHPrimitiveInfo;
+struct BVHBuildTask;
+struct SBVHBuildState;
 struct MortonPrimitive;
 struct LinearBVHNode;
+struct LeafTriangle;
+struct DeferredHit;
+template <int Width>
+struct WideBVHNode;
+template <typename T>
+struct QuantizedBVHNode;
 
 // BVHAccel Declarations
 class BVHAccel : public Aggregate {
   public:
     // BVHAccel Public Types
-    enum class SplitMethod { SAH, HLBVH, Middle, EqualCounts };
+    enum class SplitMethod { SAH, HLBVH, Middle, EqualCounts, SBVH };
+    enum class Layout { Binary, BVH4, BVH8, BVH8Quant8, BVH8Quant16 };
 
     // BVHAccel Public Methods
     BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
              int maxPrimsInNode = 1,
-             SplitMethod splitMethod = SplitMethod::SAH);
+             SplitMethod splitMethod = SplitMethod::SAH,
+             Layout layout = Layout::Binary,
+             const std::string &cacheDir = "",
+             Float splitBudget = .3f, bool leafTriangles = false);
     Bounds3f WorldBound() const;
+    Bounds3f TransformedWorldBound(const Transform &t) const;
+    // Recomputes the bounds of the BVH's nodes bottom-up after its
+    // primitives have moved, keeping the structure of the tree
+    void Refit();
+    bool SetTimeRange(Float time0, Float time1);
+    // Returns true if both BVHs have the same binary nodes (bounds, child
+    // and primitive offsets, split axes) over the same primitive order
+    bool SameNodes(const BVHAccel &bvh) const;
     ~BVHAccel();
     bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
     bool IntersectP(const Ray &ray) const;
+    void IntersectPacket(const Ray *rays, int nRays,
+                         SurfaceInteraction *isects, bool *hits) const;
+    void IntersectPBatch(const Ray *rays, int nRays, bool *occluded) const;
 
   private:
     // BVHAccel Private Methods
     BVHBuildNode *recursiveBuild(
         MemoryArena &arena, std::vector<BVHPrimitiveInfo> &primitiveInfo,
         int start, int end, int *totalNodes,
-        std::vector<std::shared_ptr<Primitive>> &orderedPrims);
+        std::vector<int> &orderedPrimIndices,
+        std::vector<BVHBuildTask> *subtreeTasks = nullptr,
+        int subtreeTaskSize = 0);
+    BVHBuildNode *sbvhBuild(MemoryArena &arena,
+                            std::vector<BVHPrimitiveInfo> &refs, int depth,
+                            int *totalNodes,
+                            std::vector<int> &orderedPrimIndices,
+                            SBVHBuildState &state) const;
     BVHBuildNode *HLBVHBuild(
         MemoryArena &arena, const std::vector<BVHPrimitiveInfo> &primitiveInfo,
         int *totalNodes,
-        std::vector<std::shared_ptr<Primitive>> &orderedPrims) const;
+        std::vector<int> &orderedPrimIndices) const;
     BVHBuildNode *emitLBVH(
         BVHBuildNode *&buildNodes,
         const std::vector<BVHPrimitiveInfo> &primitiveInfo,
         MortonPrimitive *mortonPrims, int nPrimitives, int *totalNodes,
-        std::vector<std::shared_ptr<Primitive>> &orderedPrims,
-        std::atomic<int> *orderedPrimsOffset, int bitIndex) const;
+        std::vector<int> &orderedPrimIndices,
+        int firstPrimOffset, int bitIndex) const;
     BVHBuildNode *buildUpperSAH(MemoryArena &arena,
                                 std::vector<BVHBuildNode *> &treeletRoots,
                                 int start, int end, int *totalNodes) const;
     int flattenBVHTree(BVHBuildNode *node, int *offset);
+    bool intersectSubtree(const Ray &ray, SurfaceInteraction *isect,
+                          int rootNodeIndex, int *nodesVisited,
+                          DeferredHit *deferred) const;
+    bool intersectPBinary(const Ray &ray, int *nodesVisited) const;
+    uint64_t hashBuildInputs(
+        const std::vector<BVHPrimitiveInfo> &primitiveInfo) const;
+    bool readCache(const std::string &filename, uint64_t buildHash);
+    void writeCache(const std::string &filename, uint64_t buildHash,
+                    const std::vector<int> &orderedPrimIndices) const;
+    void updateLeafTriangles();
+    void computeBoundsCut();
 
     // BVHAccel Private Data
     const int maxPrimsInNode;
     const SplitMethod splitMethod;
+    const Layout layout;
+    // Extra primitive references that SBVH spatial splits may create, as a
+    // fraction of the number of primitives
+    const Float splitBudget;
+    // Whether leaves intersect triangles on a copy of their vertices
+    const bool useLeafTriangles;
     std::vector<std::shared_ptr<Primitive>> primitives;
+    Bounds3f bounds;
     LinearBVHNode *nodes = nullptr;
+    WideBVHNode<4> *nodes4 = nullptr;
+    WideBVHNode<8> *nodes8 = nullptr;
+    QuantizedBVHNode<uint8_t> *qnodes8 = nullptr;
+    QuantizedBVHNode<uint16_t> *qnodes16 = nullptr;
+    int nNodes = 0;
+    // Triangle vertices in the order of _primitives_, for intersecting
+    // leaves without virtual calls; only allocated if _useLeafTriangles_
+    LeafTriangle *leafTriangles = nullptr;
+    // Bounds of the nodes a few levels below the root, which give tight
+    // bounds for transformed instances of the BVH
+    std::vector<Bounds3f> boundsCut;
+    // Time range passed to the last _SetTimeRange()_ call and whether it
+    // changed the bounds of any primitive; NaN until the first call
+    Float time0 = std::numeric_limits<Float>::quiet_NaN();
+    Float time1 = std::numeric_limits<Float>::quiet_NaN();
+    bool animatedBounds = false;
+    // Memory mapped from the BVH cache file that holds the nodes, if any
+    void *cacheMapping = nullptr;
+    size_t cacheMappingLength = 0;
 };
 
 std::shared_ptr<BVHAccel> CreateBVHAccelerator(
@@ -35,11 +35,21 @@
 #include "accelerators/kdtreeaccel.h"
 #include "paramset.h"
 #include "interaction.h"
+#include "parallel.h"
 #include "stats.h"
 #include <algorithm>
+#include <chrono>
 
 namespace pbrt {
 
+STAT_MEMORY_COUNTER("Memory/Kd-tree nodes", kdNodeBytes);
+STAT_COUNTER("Kd-Tree/Interior nodes", kdInteriorNodes);
+STAT_COUNTER("Kd-Tree/Leaf nodes", kdLeafNodes);
+STAT_RATIO("Kd-Tree/Primitive references per leaf node", kdLeafPrimitives,
+           kdTotalLeafNodes);
+STAT_COUNTER("Kd-Tree/Parallel subtree builds", kdSubtreeTasks);
+STAT_FLOAT_DISTRIBUTION("Kd-Tree/Build time (ms)", kdBuildTime);
+
 // KdTreeAccel Local Declarations
 struct KdAccelNode {
     // KdAccelNode Methods
@@ -80,10 +90,54 @@ struct BoundEdge {
     EdgeType type;
 };
 
+// A subtree of the kd-tree that is built by _KdTreeAccel::binnedBuild()_
+// in parallel with the others, into its own node and index arrays.
+struct KdBuildTask {
+    // Node of the upper levels of the tree that the subtree replaces
+    int nodeNum;
+    Bounds3f bounds;
+    std::vector<int> primNums;
+    int depth, badRefines;
+    std::vector<KdAccelNode> nodes;
+    std::vector<int> primitiveIndices;
+};
+
+// Number of candidate split planes per axis, plus one, used by the binned
+// builder
+static PBRT_CONSTEXPR int kdNumBins = 32;
+
+// Nodes with at most this many primitives are split by sweeping over their
+// sorted edges instead of binning
+static PBRT_CONSTEXPR int kdExactSplitThreshold = 128;
+
+// Nodes with at least this many primitives have them binned in parallel
+static PBRT_CONSTEXPR int kdParallelBinThreshold = 64 * 1024;
+static PBRT_CONSTEXPR int kdParallelBinChunkSize = 16 * 1024;
+
+// Counts of the primitives whose bounds start and end in each bin along
+// each axis, and the bounds of the primitives.
+struct KdBinCounts {
+    KdBinCounts() {
+        for (int axis = 0; axis < 3; ++axis)
+            for (int b = 0; b < kdNumBins; ++b)
+                start[axis][b] = end[axis][b] = 0;
+    }
+    void Merge(const KdBinCounts &c) {
+        for (int axis = 0; axis < 3; ++axis)
+            for (int b = 0; b < kdNumBins; ++b) {
+                start[axis][b] += c.start[axis][b];
+                end[axis][b] += c.end[axis][b];
+            }
+        primBounds = Union(primBounds, c.primBounds);
+    }
+    int start[3][kdNumBins], end[3][kdNumBins];
+    Bounds3f primBounds;
+};
+
 // KdTreeAccel Method Definitions
 KdTreeAccel::KdTreeAccel(std::vector<std::shared_ptr<Primitive>> p,
                          int isectCost, int traversalCost, Float emptyBonus,
-                         int maxPrims, int maxDepth)
+                         int maxPrims, int maxDepth, SplitMethod splitMethod)
     : isectCost(isectCost),
       traversalCost(traversalCost),
       maxPrims(maxPrims),
@@ -91,33 +145,52 @@ KdTreeAccel::KdTreeAccel(std::vector<std::shared_ptr<Primitive>> p,
       primitives(std::move(p)) {
     // Build kd-tree for accelerator
     ProfilePhase _(Prof::AccelConstruction);
+    std::chrono::steady_clock::time_point buildStart =
+        std::chrono::steady_clock::now();
     nextFreeNode = nAllocedNodes = 0;
     if (maxDepth <= 0)
         maxDepth = std::round(8 + 1.3f * Log2Int(int64_t(primitives.size())));
 
     // Compute bounds for kd-tree construction
-    std::vector<Bounds3f> primBounds;
-    primBounds.reserve(primitives.size());
-    for (const std::shared_ptr<Primitive> &prim : primitives) {
-        Bounds3f b = prim->WorldBound();
-        bounds = Union(bounds, b);
-        primBounds.push_back(b);
-    }
-
-    // Allocate working memory for kd-tree construction
-    std::unique_ptr<BoundEdge[]> edges[3];
-    for (int i = 0; i < 3; ++i)
-        edges[i].reset(new BoundEdge[2 * primitives.size()]);
-    std::unique_ptr<int[]> prims0(new int[primitives.size()]);
-    std::unique_ptr<int[]> prims1(new int[(maxDepth + 1) * primitives.size()]);
+    std::vector<Bounds3f> primBounds(primitives.size());
+    ParallelFor([&](int64_t i) { primBounds[i] = primitives[i]->WorldBound(); },
+                primitives.size(), 4096);
+    for (const Bounds3f &b : primBounds) bounds = Union(bounds, b);
 
-    // Initialize _primNums_ for kd-tree construction
-    std::unique_ptr<int[]> primNums(new int[primitives.size()]);
-    for (size_t i = 0; i < primitives.size(); ++i) primNums[i] = i;
+    if (splitMethod == SplitMethod::BinnedSAH)
+        parallelBuild(primBounds, maxDepth);
+    else {
+        // Allocate working memory for kd-tree construction
+        std::unique_ptr<BoundEdge[]> edges[3];
+        for (int i = 0; i < 3; ++i)
+            edges[i].reset(new BoundEdge[2 * primitives.size()]);
+        std::unique_ptr<int[]> prims0(new int[primitives.size()]);
+        std::unique_ptr<int[]> prims1(
+            new int[(maxDepth + 1) * primitives.size()]);
+
+        // Initialize _primNums_ for kd-tree construction
+        std::unique_ptr<int[]> primNums(new int[primitives.size()]);
+        for (size_t i = 0; i < primitives.size(); ++i) primNums[i] = i;
+
+        // Start recursive construction of kd-tree
+        buildTree(0, bounds, primBounds, primNums.get(), primitives.size(),
+                  maxDepth, edges, prims0.get(), prims1.get());
+    }
 
-    // Start recursive construction of kd-tree
-    buildTree(0, bounds, primBounds, primNums.get(), primitives.size(),
-              maxDepth, edges, prims0.get(), prims1.get());
+    // Report statistics for the tree
+    for (int i = 0; i < nextFreeNode; ++i)
+        if (nodes[i].IsLeaf()) {
+            ++kdLeafNodes;
+            ++kdTotalLeafNodes;
+            kdLeafPrimitives += nodes[i].nPrimitives();
+        } else
+            ++kdInteriorNodes;
+    kdNodeBytes += nextFreeNode * sizeof(KdAccelNode) +
+                   primitiveIndices.size() * sizeof(int);
+    double buildMS = std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - buildStart)
+                         .count();
+    ReportValue(kdBuildTime, buildMS);
 }
 
 void KdAccelNode::InitLeaf(int *primNums, int np,
@@ -262,6 +335,279 @@ retrySplit:
               prims0, prims1 + nPrimitives, badRefines);
 }
 
+// Returns the bin along _axis_ of _nodeBounds_ that the coordinate _v_
+// falls in; coordinates outside the node go to the first or last bin.
+static inline int KdBinIndex(const Bounds3f &nodeBounds, const Vector3f &d,
+                             int axis, Float v) {
+    int b = int(kdNumBins * ((v - nodeBounds.pMin[axis]) / d[axis]));
+    return Clamp(b, 0, kdNumBins - 1);
+}
+
+// Bins the primitives in _primNums[start, end)_ along each axis of
+// _nodeBounds_ that has a nonzero extent.
+static void KdBinPrimitives(const Bounds3f &nodeBounds,
+                            const std::vector<Bounds3f> &allPrimBounds,
+                            const int *primNums, int start, int end,
+                            KdBinCounts *counts) {
+    Vector3f d = nodeBounds.Diagonal();
+    for (int i = start; i < end; ++i) {
+        const Bounds3f &b = allPrimBounds[primNums[i]];
+        counts->primBounds = Union(counts->primBounds, b);
+        for (int axis = 0; axis < 3; ++axis) {
+            if (d[axis] <= 0) continue;
+            int startBin = KdBinIndex(nodeBounds, d, axis, b.pMin[axis]);
+            int endBin = KdBinIndex(nodeBounds, d, axis, b.pMax[axis]);
+            ++counts->start[axis][startBin];
+            ++counts->end[axis][endBin];
+        }
+    }
+}
+
+void KdTreeAccel::binnedBuild(const Bounds3f &nodeBounds,
+                              const std::vector<Bounds3f> &allPrimBounds,
+                              std::vector<int> &primNums, int depth,
+                              int badRefines,
+                              std::vector<KdAccelNode> *buildNodes,
+                              std::vector<int> *buildPrimIndices,
+                              std::vector<KdBuildTask> *subtreeTasks,
+                              int subtreeTaskSize) const {
+    int nodeNum = buildNodes->size();
+    buildNodes->push_back(KdAccelNode());
+    int nPrimitives = primNums.size();
+
+    // Initialize leaf node if termination criteria met
+    if (nPrimitives <= maxPrims || depth == 0) {
+        (*buildNodes)[nodeNum].InitLeaf(primNums.data(), nPrimitives,
+                                        buildPrimIndices);
+        return;
+    }
+    if (subtreeTasks && nPrimitives <= subtreeTaskSize) {
+        // Defer building the subtree to a parallel task; the node is a
+        // placeholder until the subtree replaces it
+        (*buildNodes)[nodeNum].InitLeaf(nullptr, 0, buildPrimIndices);
+        KdBuildTask task;
+        task.nodeNum = nodeNum;
+        task.bounds = nodeBounds;
+        task.primNums.swap(primNums);
+        task.depth = depth;
+        task.badRefines = badRefines;
+        subtreeTasks->push_back(std::move(task));
+        return;
+    }
+
+    // Choose split axis position for interior node
+    int bestAxis = -1;
+    Float bestSplit = 0;
+    Float bestCost = Infinity;
+    Float oldCost = isectCost * Float(nPrimitives);
+    Float invTotalSA = 1 / nodeBounds.SurfaceArea();
+    Vector3f d = nodeBounds.Diagonal();
+    auto considerSplit = [&](int axis, Float t, int nBelow, int nAbove) {
+        if (t <= nodeBounds.pMin[axis] || t >= nodeBounds.pMax[axis]) return;
+        // Compute cost for split at _t_ as in _buildTree()_
+        int otherAxis0 = (axis + 1) % 3, otherAxis1 = (axis + 2) % 3;
+        Float belowSA =
+            2 * (d[otherAxis0] * d[otherAxis1] +
+                 (t - nodeBounds.pMin[axis]) * (d[otherAxis0] + d[otherAxis1]));
+        Float aboveSA =
+            2 * (d[otherAxis0] * d[otherAxis1] +
+                 (nodeBounds.pMax[axis] - t) * (d[otherAxis0] + d[otherAxis1]));
+        Float pBelow = belowSA * invTotalSA;
+        Float pAbove = aboveSA * invTotalSA;
+        Float eb = (nAbove == 0 || nBelow == 0) ? emptyBonus : 0;
+        Float cost = traversalCost +
+                     isectCost * (1 - eb) * (pBelow * nBelow + pAbove * nAbove);
+        if (cost < bestCost) {
+            bestCost = cost;
+            bestAxis = axis;
+            bestSplit = t;
+        }
+    };
+
+    if (nPrimitives <= kdExactSplitThreshold) {
+        // Small nodes are cheaper to split by sweeping over the sorted
+        // primitive edges along the longest axis, as _buildTree()_ does,
+        // which also finds better splits
+        std::vector<BoundEdge> edges(2 * nPrimitives);
+        int firstAxis = nodeBounds.MaximumExtent();
+        for (int retries = 0; retries < 3 && bestAxis == -1; ++retries) {
+            int axis = (firstAxis + retries) % 3;
+            if (d[axis] <= 0) continue;
+            for (int i = 0; i < nPrimitives; ++i) {
+                const Bounds3f &b = allPrimBounds[primNums[i]];
+                edges[2 * i] = BoundEdge(b.pMin[axis], primNums[i], true);
+                edges[2 * i + 1] = BoundEdge(b.pMax[axis], primNums[i], false);
+            }
+            std::sort(edges.begin(), edges.end(),
+                      [](const BoundEdge &e0, const BoundEdge &e1) -> bool {
+                          if (e0.t == e1.t)
+                              return (int)e0.type < (int)e1.type;
+                          else
+                              return e0.t < e1.t;
+                      });
+            int nBelow = 0, nAbove = nPrimitives;
+            for (const BoundEdge &e : edges) {
+                if (e.type == EdgeType::End) --nAbove;
+                considerSplit(axis, e.t, nBelow, nAbove);
+                if (e.type == EdgeType::Start) ++nBelow;
+            }
+        }
+    } else {
+        // Count the primitives that start and end in each bin, in parallel
+        // for the largest nodes
+        KdBinCounts counts;
+        if (subtreeTasks && nPrimitives >= kdParallelBinThreshold) {
+            int nChunks = (nPrimitives + kdParallelBinChunkSize - 1) /
+                          kdParallelBinChunkSize;
+            std::vector<KdBinCounts> chunkCounts(nChunks);
+            ParallelFor([&](int64_t c) {
+                int start = c * kdParallelBinChunkSize;
+                KdBinPrimitives(
+                    nodeBounds, allPrimBounds, primNums.data(), start,
+                    std::min(start + kdParallelBinChunkSize, nPrimitives),
+                    &chunkCounts[c]);
+            }, nChunks);
+            for (const KdBinCounts &c : chunkCounts) counts.Merge(c);
+        } else
+            KdBinPrimitives(nodeBounds, allPrimBounds, primNums.data(), 0,
+                            nPrimitives, &counts);
+        for (int axis = 0; axis < 3; ++axis) {
+            if (d[axis] <= 0) continue;
+            // Planes that tightly cut off the empty space around the
+            // primitives
+            considerSplit(axis, counts.primBounds.pMin[axis], 0, nPrimitives);
+            considerSplit(axis, counts.primBounds.pMax[axis], nPrimitives, 0);
+            // Planes at the boundaries between bins
+            int nBelow = 0, nAbove = nPrimitives;
+            for (int b = 1; b < kdNumBins; ++b) {
+                nBelow += counts.start[axis][b - 1];
+                nAbove -= counts.end[axis][b - 1];
+                considerSplit(axis,
+                              nodeBounds.pMin[axis] + d[axis] * b / kdNumBins,
+                              nBelow, nAbove);
+            }
+        }
+    }
+
+    // Create leaf if no good splits were found
+    if (bestCost > oldCost) ++badRefines;
+    if ((bestCost > 4 * oldCost && nPrimitives < 16) || bestAxis == -1 ||
+        badRefines == 3) {
+        (*buildNodes)[nodeNum].InitLeaf(primNums.data(), nPrimitives,
+                                        buildPrimIndices);
+        return;
+    }
+
+    // Classify primitives with respect to split; primitives lying in the
+    // split plane go to both children
+    std::vector<int> prims0, prims1;
+    prims0.reserve(nPrimitives);
+    prims1.reserve(nPrimitives);
+    for (int pn : primNums) {
+        const Bounds3f &b = allPrimBounds[pn];
+        bool below = b.pMin[bestAxis] < bestSplit;
+        bool above = b.pMax[bestAxis] > bestSplit;
+        if (below || !above) prims0.push_back(pn);
+        if (above || !below) prims1.push_back(pn);
+    }
+    std::vector<int>().swap(primNums);
+
+    // Recursively initialize children nodes
+    Bounds3f bounds0 = nodeBounds, bounds1 = nodeBounds;
+    bounds0.pMax[bestAxis] = bounds1.pMin[bestAxis] = bestSplit;
+    binnedBuild(bounds0, allPrimBounds, prims0, depth - 1, badRefines,
+                buildNodes, buildPrimIndices, subtreeTasks, subtreeTaskSize);
+    int aboveChild = buildNodes->size();
+    (*buildNodes)[nodeNum].InitInterior(bestAxis, aboveChild, bestSplit);
+    binnedBuild(bounds1, allPrimBounds, prims1, depth - 1, badRefines,
+                buildNodes, buildPrimIndices, subtreeTasks, subtreeTaskSize);
+}
+
+// Appends the subtree rooted at _upperNodes[nodeNum]_ to _nodes_ and
+// _primitiveIndices_, replacing placeholder nodes with the subtrees of
+// their _KdBuildTask_s.
+static void EmitKdSubtree(const std::vector<KdAccelNode> &upperNodes,
+                          const std::vector<int> &upperPrimIndices,
+                          const std::vector<int> &nodeTask,
+                          const std::vector<KdBuildTask> &tasks, int nodeNum,
+                          std::vector<KdAccelNode> *nodes,
+                          std::vector<int> *primitiveIndices) {
+    const KdAccelNode &node = upperNodes[nodeNum];
+    if (nodeTask[nodeNum] >= 0) {
+        // Copy the task's nodes, offsetting their references to other nodes
+        // and to primitive indices
+        const KdBuildTask &task = tasks[nodeTask[nodeNum]];
+        int nodeOffset = nodes->size();
+        int indexOffset = primitiveIndices->size();
+        for (KdAccelNode n : task.nodes) {
+            if (!n.IsLeaf())
+                n.InitInterior(n.SplitAxis(), n.AboveChild() + nodeOffset,
+                               n.SplitPos());
+            else if (n.nPrimitives() > 1)
+                n.primitiveIndicesOffset += indexOffset;
+            nodes->push_back(n);
+        }
+        primitiveIndices->insert(primitiveIndices->end(),
+                                 task.primitiveIndices.begin(),
+                                 task.primitiveIndices.end());
+    } else if (node.IsLeaf()) {
+        KdAccelNode n = node;
+        if (n.nPrimitives() > 1) {
+            n.primitiveIndicesOffset = primitiveIndices->size();
+            primitiveIndices->insert(
+                primitiveIndices->end(),
+                &upperPrimIndices[node.primitiveIndicesOffset],
+                &upperPrimIndices[node.primitiveIndicesOffset] +
+                    node.nPrimitives());
+        }
+        nodes->push_back(n);
+    } else {
+        int offset = nodes->size();
+        nodes->push_back(node);
+        EmitKdSubtree(upperNodes, upperPrimIndices, nodeTask, tasks,
+                      nodeNum + 1, nodes, primitiveIndices);
+        (*nodes)[offset].InitInterior(node.SplitAxis(), nodes->size(),
+                                      node.SplitPos());
+        EmitKdSubtree(upperNodes, upperPrimIndices, nodeTask, tasks,
+                      node.AboveChild(), nodes, primitiveIndices);
+    }
+}
+
+void KdTreeAccel::parallelBuild(const std::vector<Bounds3f> &primBounds,
+                                int maxDepth) {
+    // Build upper levels of the tree, deferring smaller subtrees
+    std::vector<int> primNums(primitives.size());
+    for (size_t i = 0; i < primitives.size(); ++i) primNums[i] = i;
+    int subtreeTaskSize =
+        std::max(4096, int(primitives.size() / (16 * MaxThreadIndex())));
+    std::vector<KdAccelNode> upperNodes;
+    std::vector<int> upperPrimIndices;
+    std::vector<KdBuildTask> tasks;
+    binnedBuild(bounds, primBounds, primNums, maxDepth, 0, &upperNodes,
+                &upperPrimIndices, &tasks, subtreeTaskSize);
+
+    // Build the deferred subtrees in parallel.  Subtrees are built the same
+    // way as the upper levels, so the tree doesn't depend on the number of
+    // threads.
+    kdSubtreeTasks += tasks.size();
+    ParallelFor([&](int64_t i) {
+        KdBuildTask &task = tasks[i];
+        binnedBuild(task.bounds, primBounds, task.primNums, task.depth,
+                    task.badRefines, &task.nodes, &task.primitiveIndices);
+    }, tasks.size());
+
+    // Assemble the depth-first node array from the upper levels and the
+    // subtrees
+    std::vector<int> nodeTask(upperNodes.size(), -1);
+    for (size_t i = 0; i < tasks.size(); ++i) nodeTask[tasks[i].nodeNum] = i;
+    std::vector<KdAccelNode> allNodes;
+    EmitKdSubtree(upperNodes, upperPrimIndices, nodeTask, tasks, 0, &allNodes,
+                  &primitiveIndices);
+    nodes = AllocAligned<KdAccelNode>(allNodes.size());
+    std::copy(allNodes.begin(), allNodes.end(), nodes);
+    nAllocedNodes = nextFreeNode = allNodes.size();
+}
+
 bool KdTreeAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
     ProfilePhase p(Prof::AccelIntersect);
     // Compute initial parametric range of ray inside kd-tree extent
@@ -437,8 +783,19 @@ std::shared_ptr<KdTreeAccel> CreateKdTreeAccelerator(
     Float emptyBonus = ps.FindOneFloat("emptybonus", 0.5f);
     int maxPrims = ps.FindOneInt("maxprims", 1);
     int maxDepth = ps.FindOneInt("maxdepth", -1);
+    std::string splitMethodName = ps.FindOneString("splitmethod", "sah");
+    KdTreeAccel::SplitMethod splitMethod;
+    if (splitMethodName == "sah")
+        splitMethod = KdTreeAccel::SplitMethod::SAH;
+    else if (splitMethodName == "binned")
+        splitMethod = KdTreeAccel::SplitMethod::BinnedSAH;
+    else {
+        Warning("Kd-tree split method \"%s\" unknown.  Using \"sah\".",
+                splitMethodName.c_str());
+        splitMethod = KdTreeAccel::SplitMethod::SAH;
+    }
     return std::make_shared<KdTreeAccel>(std::move(prims), isectCost, travCost, emptyBonus,
-                                         maxPrims, maxDepth);
+                                         maxPrims, maxDepth, splitMethod);
 }
 
 }  // namespace pbrt
@@ -47,12 +47,20 @@ namespace pbrt {
 // KdTreeAccel Declarations
 struct KdAccelNode;
 struct BoundEdge;
+struct KdBuildTask;
 class KdTreeAccel : public Aggregate {
   public:
+    // KdTreeAccel Public Types
+    // _SAH_ evaluates every primitive edge as a split candidate; _BinnedSAH_
+    // only evaluates the boundaries of a fixed number of bins and builds
+    // subtrees in parallel.
+    enum class SplitMethod { SAH, BinnedSAH };
+
     // KdTreeAccel Public Methods
     KdTreeAccel(std::vector<std::shared_ptr<Primitive>> p,
                 int isectCost = 80, int traversalCost = 1,
-                Float emptyBonus = 0.5, int maxPrims = 1, int maxDepth = -1);
+                Float emptyBonus = 0.5, int maxPrims = 1, int maxDepth = -1,
+                SplitMethod splitMethod = SplitMethod::SAH);
     Bounds3f WorldBound() const { return bounds; }
     ~KdTreeAccel();
     bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
@@ -65,6 +73,15 @@ class KdTreeAccel : public Aggregate {
                    int nprims, int depth,
                    const std::unique_ptr<BoundEdge[]> edges[3], int *prims0,
                    int *prims1, int badRefines = 0);
+    void binnedBuild(const Bounds3f &nodeBounds,
+                     const std::vector<Bounds3f> &allPrimBounds,
+                     std::vector<int> &primNums, int depth, int badRefines,
+                     std::vector<KdAccelNode> *buildNodes,
+                     std::vector<int> *buildPrimIndices,
+                     std::vector<KdBuildTask> *subtreeTasks = nullptr,
+                     int subtreeTaskSize = 0) const;
+    void parallelBuild(const std::vector<Bounds3f> &primBounds,
+                       int maxDepth);
 
     // KdTreeAccel Private Data
     const int isectCost, traversalCost, maxPrims;
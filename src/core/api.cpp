@@ -59,6 +59,7 @@
 #include "integrators/path.h"
 #include "integrators/sppm.h"
 #include "integrators/volpath.h"
+#include "integrators/wavefront.h"
 #include "integrators/whitted.h"
 #include "lights/diffuse.h"
 #include "lights/distant.h"
@@ -157,9 +158,11 @@ struct TransformSet {
 
 struct RenderOptions {
     // RenderOptions Public Methods
-    Integrator *MakeIntegrator() const;
+    // A non-negative _frame_ creates the camera and film of that shutter
+    // slice of the _PbrtOptions.nFrames_ that are rendered
+    Integrator *MakeIntegrator(int frame = -1) const;
     Scene *MakeScene();
-    Camera *MakeCamera() const;
+    Camera *MakeCamera(int frame = -1) const;
 
     // RenderOptions Public Data
     Float transformStartTime = 0, transformEndTime = 1;
@@ -861,10 +864,10 @@ std::unique_ptr<Filter> MakeFilter(const std::string &name,
 }
 
 Film *MakeFilm(const std::string &name, const ParamSet &paramSet,
-               std::unique_ptr<Filter> filter) {
+               std::unique_ptr<Filter> filter, int frame = -1) {
     Film *film = nullptr;
     if (name == "image")
-        film = CreateFilm(paramSet, std::move(filter));
+        film = CreateFilm(paramSet, std::move(filter), frame);
     else
         Warning("Film \"%s\" unknown.", name.c_str());
     paramSet.ReportUnused();
@@ -1586,11 +1589,58 @@ void pbrtObjectInstance(const std::string &name) {
     AnimatedTransform animatedInstanceToWorld(
         InstanceToWorld[0], renderOptions->transformStartTime,
         InstanceToWorld[1], renderOptions->transformEndTime);
-    std::shared_ptr<Primitive> prim(
-        std::make_shared<TransformedPrimitive>(in[0], animatedInstanceToWorld));
+    std::shared_ptr<Primitive> prim;
+    if (!animatedInstanceToWorld.IsAnimated() &&
+        InstancePrimitive::IsAffine(*InstanceToWorld[0]))
+        // Use the compact representation for static instances; the scene's
+        // accelerator then forms the top level over the instances' own
+        // accelerators
+        prim = std::make_shared<InstancePrimitive>(in[0], *InstanceToWorld[0]);
+    else
+        prim = std::make_shared<TransformedPrimitive>(in[0],
+                                                      animatedInstanceToWorld);
     renderOptions->primitives.push_back(prim);
 }
 
+// Returns the part of the camera's shutter interval that frame _frame_ of
+// _nFrames_ shutter slices covers
+static void FrameShutter(const ParamSet &cameraParams, int frame, int nFrames,
+                         Float *time0, Float *time1) {
+    // Same defaults as the cameras' "shutteropen" and "shutterclose"
+    Float shutterOpen = cameraParams.FindOneFloat("shutteropen", 0.f);
+    Float shutterClose = cameraParams.FindOneFloat("shutterclose", 1.f);
+    if (shutterClose < shutterOpen) std::swap(shutterOpen, shutterClose);
+    *time0 = Lerp(Float(frame) / nFrames, shutterOpen, shutterClose);
+    *time1 = Lerp(Float(frame + 1) / nFrames, shutterOpen, shutterClose);
+}
+
+// Renders the scene as _nFrames_ shutter slices: frame $i$ covers the $i$th
+// of _nFrames_ equal parts of the camera's shutter interval. This isn't
+// keyframed animation; the camera and the shapes only move as described by
+// the scene's two transform times, and each frame sees a part of that
+// motion. The scene and its acceleration structures stay resident and only
+// the bounds of animated primitives are updated per frame; the camera,
+// film and integrator are created for each frame with its shutter interval
+// and file name. _integrator_ renders the first frame; like the integrator
+// of a single image, it is created before the scene.
+static void RenderShutterSlices(std::unique_ptr<Integrator> integrator,
+                                Scene &scene, int nFrames) {
+    for (int frame = 0; frame < nFrames; ++frame) {
+        Float time0, time1;
+        FrameShutter(renderOptions->CameraParams, frame, nFrames, &time0,
+                     &time1);
+        LOG(INFO) << StringPrintf("Rendering frame %d, times [%f, %f]", frame,
+                                  time0, time1);
+        if (frame > 0) {
+            integrator.reset();
+            integrator.reset(renderOptions->MakeIntegrator(frame));
+        }
+        if (!integrator) return;
+        scene.SetTimeRange(time0, time1);
+        integrator->Render(scene);
+    }
+}
+
 void pbrtWorldEnd() {
     VERIFY_WORLD("WorldEnd");
     // Ensure there are no pushed graphics states
@@ -1608,7 +1658,8 @@ void pbrtWorldEnd() {
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         printf("%*sWorldEnd\n", catIndentCount, "");
     } else {
-        std::unique_ptr<Integrator> integrator(renderOptions->MakeIntegrator());
+        std::unique_ptr<Integrator> integrator(
+            renderOptions->MakeIntegrator(PbrtOptions.nFrames > 1 ? 0 : -1));
         std::unique_ptr<Scene> scene(renderOptions->MakeScene());
 
         // This is kind of ugly; we directly override the current profiler
@@ -1620,7 +1671,13 @@ void pbrtWorldEnd() {
         CHECK_EQ(CurrentProfilerState(), ProfToBits(Prof::SceneConstruction));
         ProfilerState = ProfToBits(Prof::IntegratorRender);
 
-        if (scene && integrator) integrator->Render(*scene);
+        if (scene && integrator) {
+            if (PbrtOptions.nFrames > 1)
+                RenderShutterSlices(std::move(integrator), *scene,
+                                    PbrtOptions.nFrames);
+            else
+                integrator->Render(*scene);
+        }
 
         CHECK_EQ(CurrentProfilerState(), ProfToBits(Prof::IntegratorRender));
         ProfilerState = ProfToBits(Prof::SceneConstruction);
@@ -1663,8 +1720,8 @@ Scene *RenderOptions::MakeScene() {
     return scene;
 }
 
-Integrator *RenderOptions::MakeIntegrator() const {
-    std::shared_ptr<const Camera> camera(MakeCamera());
+Integrator *RenderOptions::MakeIntegrator(int frame) const {
+    std::shared_ptr<const Camera> camera(MakeCamera(frame));
     if (!camera) {
         Error("Unable to create camera");
         return nullptr;
@@ -1687,6 +1744,9 @@ Integrator *RenderOptions::MakeIntegrator() const {
         integrator = CreatePathIntegrator(IntegratorParams, sampler, camera);
     else if (IntegratorName == "volpath")
         integrator = CreateVolPathIntegrator(IntegratorParams, sampler, camera);
+    else if (IntegratorName == "wavefrontpath")
+        integrator =
+            CreateWavefrontPathIntegrator(IntegratorParams, sampler, camera);
     else if (IntegratorName == "bdpt") {
         integrator = CreateBDPTIntegrator(IntegratorParams, sampler, camera);
     } else if (IntegratorName == "mlt") {
@@ -1700,6 +1760,42 @@ Integrator *RenderOptions::MakeIntegrator() const {
         return nullptr;
     }
 
+    // The --time-limit command-line option overrides the integrator's
+    // "timelimit" parameter
+    Float timeLimit = IntegratorParams.FindOneFloat("timelimit", 0);
+    if (PbrtOptions.timeLimit > 0) timeLimit = PbrtOptions.timeLimit;
+    if (timeLimit > 0 && IntegratorName != "mlt")
+        integrator->SetTimeLimit(timeLimit);
+    else if (timeLimit > 0)
+        Warning("\"mlt\" integrator doesn't support a time limit. Ignoring.");
+
+    // Adaptive sampling is supported by the integrators that derive from
+    // SamplerIntegrator
+    Float adaptiveError = IntegratorParams.FindOneFloat("adaptiveerror", 0);
+    int adaptiveMinSamples =
+        IntegratorParams.FindOneInt("adaptiveminsamples", 16);
+    if (adaptiveError > 0) {
+        SamplerIntegrator *samplerIntegrator =
+            dynamic_cast<SamplerIntegrator *>(integrator);
+        if (samplerIntegrator)
+            samplerIntegrator->SetAdaptiveSampling(adaptiveError,
+                                                   adaptiveMinSamples);
+        else
+            Warning("\"%s\" integrator doesn't support adaptive sampling. "
+                    "Ignoring \"adaptiveerror\".", IntegratorName.c_str());
+    }
+
+    // So is sorted shading; the wavefront integrator always sorts its hits
+    if (IntegratorParams.FindOneBool("sortshading", false)) {
+        SamplerIntegrator *samplerIntegrator =
+            dynamic_cast<SamplerIntegrator *>(integrator);
+        if (samplerIntegrator)
+            samplerIntegrator->SetSortedShading(true);
+        else if (IntegratorName != "wavefrontpath")
+            Warning("\"%s\" integrator doesn't support sorted shading. "
+                    "Ignoring \"sortshading\".", IntegratorName.c_str());
+    }
+
     if (renderOptions->haveScatteringMedia && IntegratorName != "volpath" &&
         IntegratorName != "bdpt" && IntegratorName != "mlt") {
         Warning(
@@ -1709,22 +1805,36 @@ Integrator *RenderOptions::MakeIntegrator() const {
     }
 
     IntegratorParams.ReportUnused();
-    // Warn if no light sources are defined
-    if (lights.empty())
+    // Warn if no light sources are defined; the scene has taken the lights
+    // by the time later shutter slices are created
+    if (lights.empty() && frame <= 0)
         Warning(
             "No light sources defined in scene; "
             "rendering a black image.");
     return integrator;
 }
 
-Camera *RenderOptions::MakeCamera() const {
+Camera *RenderOptions::MakeCamera(int frame) const {
     std::unique_ptr<Filter> filter = MakeFilter(FilterName, FilterParams);
-    Film *film = MakeFilm(FilmName, FilmParams, std::move(filter));
+    Film *film = MakeFilm(FilmName, FilmParams, std::move(filter), frame);
     if (!film) {
         Error("Unable to create film.");
         return nullptr;
     }
-    Camera *camera = pbrt::MakeCamera(CameraName, CameraParams, CameraToWorld,
+    // A shutter slice opens and closes the shutter within the frame's part
+    // of the shutter interval
+    ParamSet cameraParams = CameraParams;
+    if (frame >= 0) {
+        Float time0, time1;
+        FrameShutter(CameraParams, frame, PbrtOptions.nFrames, &time0, &time1);
+        cameraParams.AddFloat("shutteropen",
+                              std::unique_ptr<Float[]>(new Float[1]{time0}),
+                              1);
+        cameraParams.AddFloat("shutterclose",
+                              std::unique_ptr<Float[]>(new Float[1]{time1}),
+                              1);
+    }
+    Camera *camera = pbrt::MakeCamera(CameraName, cameraParams, CameraToWorld,
                                   renderOptions->transformStartTime,
                                   renderOptions->transformEndTime, film);
     return camera;
@@ -238,7 +238,7 @@ Spectrum SeparableBSSRDF::Sample_S(const Scene &scene, Float u1,
     if (!Sp.IsBlack()) {
         // Initialize material model at sampled surface interaction
         si->bsdf = ARENA_ALLOC(arena, BSDF)(*si);
-        si->bsdf->Add(ARENA_ALLOC(arena, SeparableBSSRDFAdapter)(this));
+        si->bsdf->Emplace<SeparableBSSRDFAdapter>(arena, this);
         si->wo = Vector3f(si->shading.n);
     }
     return Sp;
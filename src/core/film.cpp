@@ -34,24 +34,81 @@
 #include "film.h"
 #include "paramset.h"
 #include "imageio.h"
+#include "fileutil.h"
 #include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef PBRT_HAVE_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 namespace pbrt
 {
 
 STAT_MEMORY_COUNTER("Memory/Film pixels", filmPixelMemory);
+STAT_PERCENT("Film/Contended row locks in tile merges", nContendedRowLocks,
+             nRowLocks);
+STAT_MEMORY_COUNTER("Memory/Film streaming blocks (peak)", streamBlockMemory);
+
+// Allocates _bytes_ of zeroed memory that is backed by an unlinked
+// temporary file in _$TMPDIR_, so that the OS can page it out instead of
+// running out of memory
+static void *MapTemporaryFile(size_t bytes)
+{
+#ifdef PBRT_HAVE_MMAP
+    const char *dir = getenv("TMPDIR");
+    std::string path = std::string(dir ? dir : "/tmp") + "/pbrt-film-XXXXXX";
+    void *ptr = MAP_FAILED;
+    int fd = mkstemp(&path[0]);
+    if (fd != -1)
+    {
+        unlink(path.c_str());
+        if (ftruncate(fd, bytes) == 0)
+            ptr = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+    if (ptr == MAP_FAILED)
+    {
+        Warning("Unable to map a temporary file of %zu bytes in \"%s\"; "
+                "keeping the streamed image in memory.",
+                bytes, dir ? dir : "/tmp");
+        ptr = mmap(0, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED)
+            LOG(FATAL) << "Unable to allocate " << bytes << " bytes";
+    }
+    return ptr;
+#else
+    void *ptr = AllocAligned(bytes);
+    memset(ptr, 0, bytes);
+    return ptr;
+#endif
+}
+
+static void UnmapTemporaryFile(void *ptr, size_t bytes)
+{
+#ifdef PBRT_HAVE_MMAP
+    munmap(ptr, bytes);
+#else
+    FreeAligned(ptr);
+#endif
+}
 
 // Film Method Definitions
 // Film 方法定义
 Film::Film(const Point2i &resolution, const Bounds2f &cropWindow,
            std::unique_ptr<Filter> filt, Float diagonal,
-           const std::string &filename, Float scale, Float maxSampleLuminance)
+           const std::string &filename, Float scale, Float maxSampleLuminance,
+           SplatMode splatMode, bool streaming)
     : fullResolution(resolution),
       diagonal(diagonal * .001),
       filter(std::move(filt)),
       filename(filename),
       scale(scale),
-      maxSampleLuminance(maxSampleLuminance)
+      maxSampleLuminance(maxSampleLuminance),
+      splatMode(splatMode),
+      streaming(streaming)
 {
     // Compute film image bounds
     // 计算 film 图片边界，ceil - 向上取整
@@ -62,10 +119,42 @@ Film::Film(const Point2i &resolution, const Bounds2f &cropWindow,
                          std::ceil(fullResolution.y * cropWindow.pMax.y)));
     LOG(INFO) << "Created film with full resolution " << resolution << ". Crop window of " << cropWindow << " -> croppedPixelBounds " << croppedPixelBounds;
 
-    // Allocate film image storage
-    // 配置 film 图片的内存
-    pixels = std::unique_ptr<Pixel[]>(new Pixel[croppedPixelBounds.Area()]);
-    filmPixelMemory += croppedPixelBounds.Area() * sizeof(Pixel);
+    if (streaming)
+    {
+        // Only the blocks' bookkeeping is allocated up front; their pixels
+        // are allocated when the first tile is merged into them
+        // 预先只分配像素块的记录，像素在第一个图像块合并时才分配
+        Vector2i extent = croppedPixelBounds.Diagonal();
+        nStreamBlocks = Point2i(
+            (extent.x + streamBlockSize - 1) / streamBlockSize,
+            (extent.y + streamBlockSize - 1) / streamBlockSize);
+        streamBlocks.reset(
+            new StreamBlock[nStreamBlocks.x * nStreamBlocks.y]);
+        pixels = nullptr;
+    }
+    else
+    {
+        // Allocate film image storage, zeroing it from all threads first
+        // so that its pages are spread over the NUMA nodes
+        // 配置 film 图片的内存，先由所有线程清零使其内存页分布到各NUMA节点
+        size_t pixelBytes = croppedPixelBounds.Area() * sizeof(Pixel);
+        pixels = AllocAligned<Pixel>(croppedPixelBounds.Area());
+        ParallelFirstTouch(pixels, pixelBytes);
+        for (int i = 0; i < croppedPixelBounds.Area(); ++i)
+            new (&pixels[i]) Pixel();
+        ReportNumaPlacement("Film pixels", pixels, pixelBytes);
+        filmPixelMemory += pixelBytes;
+    }
+    rowLocks.reset(new RowLock[croppedPixelBounds.pMax.y -
+                               croppedPixelBounds.pMin.y]);
+    // The records of each splat buffer are allocated by its thread when it
+    // first adds a splat
+    // 每个 splat 缓冲区的记录由其线程在第一次添加 splat 时分配
+    if (splatMode == SplatMode::PerThread)
+    {
+        nSplatBuffers = MaxThreadIndex();
+        splatBuffers.reset(new SplatBuffer[nSplatBuffers]);
+    }
 
     // Precompute filter weight table
     int offset = 0;
@@ -98,7 +187,7 @@ Bounds2f Film::GetPhysicalExtent() const
     return Bounds2f(Point2f(-x / 2, -y / 2), Point2f(x / 2, y / 2));
 }
 
-std::unique_ptr<FilmTile> Film::GetFilmTile(const Bounds2i &sampleBounds)
+Bounds2i Film::TilePixelBounds(const Bounds2i &sampleBounds) const
 {
     // Bound image pixels that samples in _sampleBounds_ contribute to
     Vector2f halfPixel = Vector2f(0.5f, 0.5f);
@@ -106,14 +195,60 @@ std::unique_ptr<FilmTile> Film::GetFilmTile(const Bounds2i &sampleBounds)
     Point2i p0 = (Point2i)Ceil(floatBounds.pMin - halfPixel - filter->radius);
     Point2i p1 = (Point2i)Floor(floatBounds.pMax - halfPixel + filter->radius) +
                  Point2i(1, 1);
-    Bounds2i tilePixelBounds = Intersect(Bounds2i(p0, p1), croppedPixelBounds);
+    return Intersect(Bounds2i(p0, p1), croppedPixelBounds);
+}
+
+std::unique_ptr<FilmTile> Film::GetFilmTile(const Bounds2i &sampleBounds)
+{
     return std::unique_ptr<FilmTile>(new FilmTile(
-        tilePixelBounds, filter->radius, filterTable, filterTableWidth,
-        maxSampleLuminance));
+        TilePixelBounds(sampleBounds), filter->radius, filterTable,
+        filterTableWidth, maxSampleLuminance, pixelStatistics != nullptr));
+}
+
+void Film::EnablePixelStatistics()
+{
+    CHECK(!streaming);
+    if (pixelStatistics)
+        return;
+    pixelStatistics.reset(new PixelConvergence[croppedPixelBounds.Area()]);
+    filmPixelMemory += croppedPixelBounds.Area() * sizeof(PixelConvergence);
+}
+
+Film::~Film()
+{
+    FreeAligned(pixels);
+    if (streamRGB)
+        UnmapTemporaryFile(streamRGB, streamMappingBytes);
 }
 
 void Film::Clear()
 {
+    if (streaming)
+    {
+        for (int i = 0; i < nStreamBlocks.x * nStreamBlocks.y; ++i)
+        {
+            StreamBlock &block = streamBlocks[i];
+            block.pixels.reset();
+            block.pendingTiles = -1;
+            block.finished = false;
+        }
+        nResidentStreamBlocks = nFinishedStreamBlocks = 0;
+        streamWriter.reset();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            streamHeaderWritten = false;
+        }
+        if (streamRGB)
+        {
+            UnmapTemporaryFile(streamRGB, streamMappingBytes);
+            streamRGB = nullptr;
+            streamSplatXYZ = nullptr;
+            streamSplats = false;
+        }
+        for (int i = 0; i < nSplatBuffers; ++i)
+            splatBuffers[i].nSplats = 0;
+        return;
+    }
     for (Point2i p : croppedPixelBounds)
     {
         Pixel &pixel = GetPixel(p);
@@ -121,32 +256,155 @@ void Film::Clear()
             pixel.splatXYZ[c] = pixel.xyz[c] = 0;
         pixel.filterWeightSum = 0;
     }
+    if (pixelStatistics)
+        for (int i = 0; i < croppedPixelBounds.Area(); ++i)
+            pixelStatistics[i] = PixelConvergence();
+    for (int i = 0; i < nSplatBuffers; ++i)
+        splatBuffers[i].nSplats = 0;
 }
 
 void Film::MergeFilmTile(std::unique_ptr<FilmTile> tile)
 {
     ProfilePhase p(Prof::MergeFilmTile);
     VLOG(1) << "Merging film tile " << tile->pixelBounds;
-    std::lock_guard<std::mutex> lock(mutex);
-    for (Point2i pixel : tile->GetPixelBounds())
+    if (streaming)
     {
-        // Merge _pixel_ into _Film::pixels_
-        const FilmTilePixel &tilePixel = tile->GetPixel(pixel);
-        Pixel &mergePixel = GetPixel(pixel);
-        Float xyz[3];
-        tilePixel.contribSum.ToXYZ(xyz);
-        for (int i = 0; i < 3; ++i)
-            mergePixel.xyz[i] += xyz[i];
-        mergePixel.filterWeightSum += tilePixel.filterWeightSum;
+        // Merge the tile into each block it overlaps under the block's
+        // lock, and finish the blocks that it was the last tile of
+        // 在每个相交像素块的锁内合并图像块，并完成以它为最后一块的像素块
+        Bounds2i tileBounds = tile->GetPixelBounds();
+        for (Point2i b : StreamBlocksOverlapping(tileBounds))
+        {
+            StreamBlock &block = GetStreamBlock(b);
+            std::lock_guard<std::mutex> lock(block.mutex);
+            if (block.finished)
+            {
+                LOG(ERROR) << "Ignoring tile " << tileBounds
+                           << " merged into streamed block " << b
+                           << " after it was written";
+                continue;
+            }
+            Bounds2i blockBounds = StreamBlockBounds(b);
+            int width = blockBounds.pMax.x - blockBounds.pMin.x;
+            if (!block.pixels)
+            {
+                block.pixels.reset(new StreamPixel[blockBounds.Area()]);
+                int nResident = ++nResidentStreamBlocks;
+                int maxResident = maxResidentStreamBlocks;
+                while (nResident > maxResident &&
+                       !maxResidentStreamBlocks.compare_exchange_weak(
+                           maxResident, nResident))
+                    ;
+            }
+            for (Point2i pixel : Intersect(blockBounds, tileBounds))
+            {
+                const FilmTilePixel &tilePixel = tile->GetPixel(pixel);
+                StreamPixel &mergePixel =
+                    block.pixels[(pixel.x - blockBounds.pMin.x) +
+                                 (pixel.y - blockBounds.pMin.y) * width];
+                Float xyz[3];
+                tilePixel.contribSum.ToXYZ(xyz);
+                for (int i = 0; i < 3; ++i)
+                    mergePixel.xyz[i] += xyz[i];
+                mergePixel.filterWeightSum += tilePixel.filterWeightSum;
+            }
+            if (block.pendingTiles > 0 && --block.pendingTiles == 0)
+                FinishStreamBlock(b);
+        }
+        return;
     }
+    // Merge the tile one row at a time, holding only that row's lock; rows
+    // are locked in increasing order, one at a time
+    // 逐行合并图像块，只持有当前行的锁
+    Bounds2i tileBounds = tile->GetPixelBounds();
+    for (int y = tileBounds.pMin.y; y < tileBounds.pMax.y; ++y)
+    {
+        std::mutex &rowMutex = rowLocks[y - croppedPixelBounds.pMin.y].mutex;
+        ++nRowLocks;
+        if (!rowMutex.try_lock())
+        {
+            ++nContendedRowLocks;
+            rowMutex.lock();
+        }
+        std::lock_guard<std::mutex> lock(rowMutex, std::adopt_lock);
+        for (int x = tileBounds.pMin.x; x < tileBounds.pMax.x; ++x)
+        {
+            // Merge _pixel_ into _Film::pixels_
+            Point2i pixel(x, y);
+            const FilmTilePixel &tilePixel = tile->GetPixel(pixel);
+            Pixel &mergePixel = GetPixel(pixel);
+            Float xyz[3];
+            tilePixel.contribSum.ToXYZ(xyz);
+            for (int i = 0; i < 3; ++i)
+                mergePixel.xyz[i] += xyz[i];
+            mergePixel.filterWeightSum += tilePixel.filterWeightSum;
+            if (pixelStatistics)
+                pixelStatistics[PixelOffset(pixel)].Merge(
+                    *tile->GetPixelStatistics(pixel));
+        }
+    }
+}
+
+void Film::SetImage(const Spectrum *img)
+{
+    SetImageRows(croppedPixelBounds.pMin.y, croppedPixelBounds.pMax.y, img);
 }
 
-void Film::SetImage(const Spectrum *img) const
+int Film::ImageBandHeight() const
 {
-    int nPixels = croppedPixelBounds.Area();
-    for (int i = 0; i < nPixels; ++i)
+    return streaming ? streamBlockSize
+                     : croppedPixelBounds.pMax.y - croppedPixelBounds.pMin.y;
+}
+
+void Film::SetImageRows(int y0, int y1, const Spectrum *img)
+{
+    int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
+    if (streaming)
     {
-        Pixel &p = pixels[i];
+        // The rows must cover whole blocks. Without splats, each block is
+        // finished and written right away; with them, it stays resident
+        // until the splats are added in the next _WriteImage()_.
+        // 这些行必须覆盖完整的像素块。没有 splat 时每块立即完成并写出；
+        // 有 splat 时保留在内存中，直到下一次 _WriteImage()_ 加上 splat
+        CHECK_EQ((y0 - croppedPixelBounds.pMin.y) % streamBlockSize, 0);
+        CHECK(y1 == croppedPixelBounds.pMax.y ||
+              (y1 - croppedPixelBounds.pMin.y) % streamBlockSize == 0);
+        Bounds2i rows(Point2i(croppedPixelBounds.pMin.x, y0),
+                      Point2i(croppedPixelBounds.pMax.x, y1));
+        for (Point2i b : StreamBlocksOverlapping(rows))
+        {
+            StreamBlock &block = GetStreamBlock(b);
+            std::lock_guard<std::mutex> lock(block.mutex);
+            Bounds2i blockBounds = StreamBlockBounds(b);
+            if (!block.pixels)
+            {
+                block.pixels.reset(new StreamPixel[blockBounds.Area()]);
+                ++nResidentStreamBlocks;
+                maxResidentStreamBlocks = std::max<int>(
+                    maxResidentStreamBlocks, nResidentStreamBlocks);
+            }
+            int i = 0;
+            for (Point2i p : blockBounds)
+            {
+                StreamPixel &pixel = block.pixels[i++];
+                img[(p.y - y0) * width + (p.x - croppedPixelBounds.pMin.x)]
+                    .ToXYZ(pixel.xyz);
+                pixel.filterWeightSum = 1;
+                if (streamSplats)
+                    for (int c = 0; c < 3; ++c)
+                        SplatXYZ(PixelOffset(p))[c] = 0;
+            }
+            block.pendingTiles = -1;
+            block.finished = false;
+            if (!streamSplats)
+                FinishStreamBlock(b);
+        }
+        return;
+    }
+    Pixel *rowPixels = &pixels[(y0 - croppedPixelBounds.pMin.y) * width];
+    for (int i = 0; i < (y1 - y0) * width; ++i)
+    {
+        Pixel &p = rowPixels[i];
         img[i].ToXYZ(p.xyz);
         p.filterWeightSum = 1;
         p.splatXYZ[0] = p.splatXYZ[1] = p.splatXYZ[2] = 0;
@@ -181,47 +439,177 @@ void Film::AddSplat(const Point2f &p, Spectrum v)
 
     if (!InsideExclusive((Point2i)p, croppedPixelBounds))
         return;
+    if (streaming && !streamSplats)
+        EnableStreamSplats();
     if (v.y() > maxSampleLuminance)
         v *= maxSampleLuminance / v.y();
     Float xyz[3];
     v.ToXYZ(xyz);
-    Pixel &pixel = GetPixel((Point2i)p);
+
+    // Record the splat in the thread's buffer, if there is one
+    // 如果当前线程有缓冲区，就把 splat 记录到缓冲区中
+    if (splatMode == SplatMode::PerThread && ThreadIndex < nSplatBuffers)
+    {
+        SplatBuffer &buffer = splatBuffers[ThreadIndex];
+        if (!buffer.splats)
+        {
+            buffer.splats.reset(new SplatRecord[splatBufferSize]);
+            buffer.sorted.reset(new SplatRecord[splatBufferSize]);
+        }
+        SplatRecord &record = buffer.splats[buffer.nSplats++];
+        record.offset = PixelOffset((Point2i)p);
+        for (int i = 0; i < 3; ++i)
+            record.xyz[i] = xyz[i];
+        if (buffer.nSplats == splatBufferSize)
+            FlushSplatBuffer(buffer);
+        return;
+    }
+
+    AtomicFloat *splatXYZ = SplatXYZ(PixelOffset((Point2i)p));
     for (int i = 0; i < 3; ++i)
-        pixel.splatXYZ[i].Add(xyz[i]);
+        splatXYZ[i].Add(xyz[i]);
+}
+
+void Film::FlushSplatBuffer(SplatBuffer &buffer)
+{
+    // Sort the splats by row with a counting sort
+    // 用计数排序把 splat 按行排序
+    int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
+    int height = croppedPixelBounds.pMax.y - croppedPixelBounds.pMin.y;
+    std::vector<int> &rowStart = buffer.rowStart;
+    rowStart.assign(height + 1, 0);
+    for (int i = 0; i < buffer.nSplats; ++i)
+        ++rowStart[buffer.splats[i].offset / width + 1];
+    for (int y = 0; y < height; ++y)
+        rowStart[y + 1] += rowStart[y];
+    for (int i = 0; i < buffer.nSplats; ++i)
+    {
+        const SplatRecord &record = buffer.splats[i];
+        buffer.sorted[rowStart[record.offset / width]++] = record;
+    }
+
+    // Add each row's splats to the pixels while holding the row's lock;
+    // after the sort, _rowStart[y]_ is the end of row _y_'s splats. The
+    // atomic adds are uncontended but keep splats added by threads without
+    // a buffer correct.
+    // 持有每一行的锁，把该行的 splat 加到像素上；排序后 _rowStart[y]_ 是
+    // 第 _y_ 行 splat 的结束位置
+    int start = 0;
+    for (int y = 0; y < height; ++y)
+    {
+        int end = rowStart[y];
+        if (start == end)
+            continue;
+        std::lock_guard<std::mutex> lock(rowLocks[y].mutex);
+        for (int i = start; i < end; ++i)
+        {
+            const SplatRecord &record = buffer.sorted[i];
+            AtomicFloat *splatXYZ = SplatXYZ(record.offset);
+            for (int c = 0; c < 3; ++c)
+                splatXYZ[c].Add(record.xyz[c]);
+        }
+        start = end;
+    }
+    buffer.nSplats = 0;
+}
+
+void Film::MergeSplatBuffers()
+{
+    for (int i = 0; i < nSplatBuffers; ++i)
+        FlushSplatBuffer(splatBuffers[i]);
+}
+
+void Film::NormalizedRGB(const Float xyz[3], Float filterWeightSum,
+                         Float rgb[3]) const
+{
+    // Convert pixel XYZ color to RGB
+    XYZToRGB(xyz, rgb);
+
+    // Normalize pixel with weight sum
+    if (filterWeightSum != 0)
+    {
+        Float invWt = (Float)1 / filterWeightSum;
+        for (int c = 0; c < 3; ++c)
+            rgb[c] = std::max((Float)0, rgb[c] * invWt);
+    }
+}
+
+void Film::AddSplatRGB(const AtomicFloat splatXYZ[3], Float splatScale,
+                       Float rgb[3]) const
+{
+    Float splatRGB[3];
+    Float xyz[3] = {splatXYZ[0], splatXYZ[1], splatXYZ[2]};
+    XYZToRGB(xyz, splatRGB);
+    for (int c = 0; c < 3; ++c)
+        rgb[c] += splatScale * splatRGB[c];
 }
 
 void Film::WriteImage(Float splatScale)
 {
+    MergeSplatBuffers();
+    if (streaming)
+    {
+        // Finish the blocks that are still in memory, then, with splats,
+        // add them to the finished blocks and write all of the blocks
+        // 完成仍在内存中的像素块；有 splat 时再把 splat 加到已完成的块上，
+        // 并写出所有像素块
+        for (Point2i b : Bounds2i(Point2i(0, 0), nStreamBlocks))
+        {
+            StreamBlock &block = GetStreamBlock(b);
+            std::lock_guard<std::mutex> lock(block.mutex);
+            if (!block.finished)
+                FinishStreamBlock(b);
+        }
+        if (streamSplats)
+        {
+            std::unique_ptr<Float[]> rgb(
+                new Float[3 * streamBlockSize * streamBlockSize]);
+            for (Point2i b : Bounds2i(Point2i(0, 0), nStreamBlocks))
+            {
+                int i = 0;
+                for (Point2i p : StreamBlockBounds(b))
+                {
+                    int offset = PixelOffset(p);
+                    Float *pixelRGB = &rgb[3 * i++];
+                    for (int c = 0; c < 3; ++c)
+                        pixelRGB[c] = streamRGB[3 * offset + c];
+                    AddSplatRGB(SplatXYZ(offset), splatScale, pixelRGB);
+                    for (int c = 0; c < 3; ++c)
+                        pixelRGB[c] *= scale;
+                }
+                WriteStreamBlock(b, rgb.get());
+            }
+        }
+        streamBlockMemory += maxResidentStreamBlocks * streamBlockSize *
+                             streamBlockSize * sizeof(StreamPixel);
+        LOG(INFO) << "Finished writing image " << filename << " with at most "
+                  << maxResidentStreamBlocks << " blocks in memory";
+        std::lock_guard<std::mutex> lock(streamMutex);
+        streamWriter.reset();
+        std::lock_guard<std::mutex> metadataLock(mutex);
+        streamHeaderWritten = false;
+        return;
+    }
+
     // Convert image to RGB and compute final pixel values
     LOG(INFO) << "Converting image to RGB and computing final weighted pixel values";
     std::unique_ptr<Float[]> rgb(new Float[3 * croppedPixelBounds.Area()]);
     int offset = 0;
+    // Hold each row's merge lock while reading it so that images written
+    // while rendering is still in progress don't include partially merged
+    // pixels
+    // 读取每一行时持有该行的合并锁，使渲染过程中写出的图像不包含合并了一半的像素
+    std::unique_lock<std::mutex> rowLock;
     for (Point2i p : croppedPixelBounds)
     {
-        // Convert pixel XYZ color to RGB
+        if (p.x == croppedPixelBounds.pMin.x)
+            rowLock = std::unique_lock<std::mutex>(
+                rowLocks[p.y - croppedPixelBounds.pMin.y].mutex);
         Pixel &pixel = GetPixel(p);
-        XYZToRGB(pixel.xyz, &rgb[3 * offset]);
-
-        // Normalize pixel with weight sum
-        Float filterWeightSum = pixel.filterWeightSum;
-        if (filterWeightSum != 0)
-        {
-            Float invWt = (Float)1 / filterWeightSum;
-            rgb[3 * offset] = std::max((Float)0, rgb[3 * offset] * invWt);
-            rgb[3 * offset + 1] =
-                std::max((Float)0, rgb[3 * offset + 1] * invWt);
-            rgb[3 * offset + 2] =
-                std::max((Float)0, rgb[3 * offset + 2] * invWt);
-        }
+        NormalizedRGB(pixel.xyz, pixel.filterWeightSum, &rgb[3 * offset]);
 
         // Add splat value at pixel
-        Float splatRGB[3];
-        Float splatXYZ[3] = {pixel.splatXYZ[0], pixel.splatXYZ[1],
-                             pixel.splatXYZ[2]};
-        XYZToRGB(splatXYZ, splatRGB);
-        rgb[3 * offset] += splatScale * splatRGB[0];
-        rgb[3 * offset + 1] += splatScale * splatRGB[1];
-        rgb[3 * offset + 2] += splatScale * splatRGB[2];
+        AddSplatRGB(pixel.splatXYZ, splatScale, &rgb[3 * offset]);
 
         // Scale pixel value by _scale_
         rgb[3 * offset] *= scale;
@@ -229,13 +617,169 @@ void Film::WriteImage(Float splatScale)
         rgb[3 * offset + 2] *= scale;
         ++offset;
     }
+    if (rowLock.owns_lock())
+        rowLock.unlock();
+    std::unique_lock<std::mutex> lock(mutex);
+    std::map<std::string, std::string> imageMetadata = metadata;
+    lock.unlock();
 
     // Write RGB image
     LOG(INFO) << "Writing image " << filename << " with bounds " << croppedPixelBounds;
-    pbrt::WriteImage(filename, &rgb[0], croppedPixelBounds, fullResolution);
+    pbrt::WriteImage(filename, &rgb[0], croppedPixelBounds, fullResolution,
+                     imageMetadata);
+}
+
+void Film::SetMetadata(const std::string &name, const std::string &value)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    // A streamed EXR file's header is written with its first block, so
+    // values that are set or changed after that aren't in the file
+    // 流式EXR文件的文件头随第一个像素块写出，之后设置或修改的值不会写入文件
+    auto iter = metadata.find(name);
+    if (streamHeaderWritten &&
+        (iter == metadata.end() || iter->second != value))
+        Warning("Streaming film \"%s\" has already written its header; "
+                "\"%s\" = \"%s\" is missing from the image's metadata.",
+                filename.c_str(), name.c_str(), value.c_str());
+    metadata[name] = value;
+}
+
+Bounds2i Film::StreamBlockBounds(const Point2i &block) const
+{
+    Point2i pMin = croppedPixelBounds.pMin + Vector2i(block) * streamBlockSize;
+    return Intersect(
+        Bounds2i(pMin, pMin + Vector2i(streamBlockSize, streamBlockSize)),
+        croppedPixelBounds);
+}
+
+Bounds2i Film::StreamBlocksOverlapping(const Bounds2i &pixelBounds) const
+{
+    if (pixelBounds.pMin.x >= pixelBounds.pMax.x ||
+        pixelBounds.pMin.y >= pixelBounds.pMax.y)
+        return Bounds2i(Point2i(0, 0), Point2i(0, 0));
+    Vector2i pMin = pixelBounds.pMin - croppedPixelBounds.pMin;
+    Vector2i pMax = pixelBounds.pMax - croppedPixelBounds.pMin;
+    return Bounds2i(Point2i(pMin.x / streamBlockSize,
+                            pMin.y / streamBlockSize),
+                    Point2i((pMax.x + streamBlockSize - 1) / streamBlockSize,
+                            (pMax.y + streamBlockSize - 1) / streamBlockSize));
+}
+
+void Film::StreamTiles(const std::vector<Bounds2i> &tileSampleBounds,
+                       bool splats)
+{
+    if (!streaming)
+        return;
+    if (splats && !streamSplats)
+        EnableStreamSplats();
+    std::vector<int> pendingTiles(nStreamBlocks.x * nStreamBlocks.y, 0);
+    for (const Bounds2i &sampleBounds : tileSampleBounds)
+        for (Point2i b :
+             StreamBlocksOverlapping(TilePixelBounds(sampleBounds)))
+            ++pendingTiles[b.y * nStreamBlocks.x + b.x];
+    for (size_t i = 0; i < pendingTiles.size(); ++i)
+        streamBlocks[i].pendingTiles = pendingTiles[i];
+}
+
+void Film::EnableStreamSplats()
+{
+    std::lock_guard<std::mutex> lock(streamMutex);
+    if (streamSplats)
+        return;
+    // The mapping is zero, which is also the bit pattern of _AtomicFloat_
+    // zero, so its splats aren't constructed; that would touch every page
+    // 映射的内存全为零，与 _AtomicFloat_ 的零值相同，因此不逐个构造 splat，
+    // 以免访问每一页
+    size_t nPixels = croppedPixelBounds.Area();
+    streamMappingBytes = nPixels * 3 * (sizeof(Float) + sizeof(AtomicFloat));
+    streamRGB = (Float *)MapTemporaryFile(streamMappingBytes);
+    streamSplatXYZ = (AtomicFloat *)(streamRGB + 3 * nPixels);
+    streamSplats = true;
+    // Blocks that finish from here on see _streamSplats_; any block that
+    // already counted itself as finished may have been written without
+    // its splats
+    if (nFinishedStreamBlocks > 0)
+        Warning("Splats were added to streaming film \"%s\" after some of "
+                "its blocks were written; those blocks are missing them.",
+                filename.c_str());
 }
 
-Film *CreateFilm(const ParamSet &params, std::unique_ptr<Filter> filter)
+// Called with the block's lock held
+void Film::FinishStreamBlock(const Point2i &b)
+{
+    StreamBlock &block = GetStreamBlock(b);
+    ++nFinishedStreamBlocks;
+    bool splats = streamSplats;
+    Bounds2i blockBounds = StreamBlockBounds(b);
+    std::unique_ptr<Float[]> rgb;
+    if (!splats)
+        rgb.reset(new Float[3 * blockBounds.Area()]);
+    int i = 0;
+    for (Point2i p : blockBounds)
+    {
+        // Without splats, the block's final values are written right away;
+        // with them, its normalized values wait for the splats to be added
+        Float *pixelRGB = splats ? &streamRGB[3 * PixelOffset(p)] : &rgb[3 * i];
+        if (block.pixels)
+            NormalizedRGB(block.pixels[i].xyz, block.pixels[i].filterWeightSum,
+                          pixelRGB);
+        else
+            pixelRGB[0] = pixelRGB[1] = pixelRGB[2] = 0;
+        if (!splats)
+            for (int c = 0; c < 3; ++c)
+                pixelRGB[c] *= scale;
+        ++i;
+    }
+    if (!splats)
+        WriteStreamBlock(b, rgb.get());
+    if (block.pixels)
+    {
+        block.pixels.reset();
+        --nResidentStreamBlocks;
+    }
+    block.finished = true;
+}
+
+void Film::WriteStreamBlock(const Point2i &block, const Float *rgb)
+{
+    // Create the EXR file when the first block is written, with the
+    // metadata that has been set so far
+    // 写出第一个像素块时创建EXR文件，包含此时已设置的元数据
+    std::unique_lock<std::mutex> lock(streamMutex);
+    if (!streamWriter)
+    {
+        std::unique_lock<std::mutex> metadataLock(mutex);
+        std::map<std::string, std::string> imageMetadata = metadata;
+        streamHeaderWritten = true;
+        metadataLock.unlock();
+        LOG(INFO) << "Streaming image " << filename << " with bounds "
+                  << croppedPixelBounds;
+        streamWriter.reset(new TiledImageWriter(filename, croppedPixelBounds,
+                                                fullResolution,
+                                                streamBlockSize,
+                                                imageMetadata));
+    }
+    TiledImageWriter *writer = streamWriter.get();
+    lock.unlock();
+    writer->WriteTile(block, rgb);
+}
+
+// Returns _filename_ with the frame number inserted before its extension
+// 在文件扩展名之前插入帧号
+static std::string FrameFilename(const std::string &filename, int frame)
+{
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "_%04d", frame);
+    size_t dot = filename.find_last_of('.');
+    size_t slash = filename.find_last_of("/\\");
+    if (dot == std::string::npos ||
+        (slash != std::string::npos && dot < slash))
+        return filename + suffix;
+    return filename.substr(0, dot) + suffix + filename.substr(dot);
+}
+
+Film *CreateFilm(const ParamSet &params, std::unique_ptr<Filter> filter,
+                 int frame)
 {
     std::string filename;
     if (PbrtOptions.imageFile != "")
@@ -250,6 +794,8 @@ Film *CreateFilm(const ParamSet &params, std::unique_ptr<Filter> filter)
     }
     else
         filename = params.FindOneString("filename", "pbrt.exr");
+    if (frame >= 0)
+        filename = FrameFilename(filename, frame);
 
     int xres = params.FindOneInt("xresolution", 1280);
     int yres = params.FindOneInt("yresolution", 720);
@@ -279,8 +825,23 @@ Film *CreateFilm(const ParamSet &params, std::unique_ptr<Filter> filter)
     Float diagonal = params.FindOneFloat("diagonal", 35.);
     Float maxSampleLuminance = params.FindOneFloat("maxsampleluminance",
                                                    Infinity);
+    bool streaming = params.FindOneBool("streaming", false);
+    if (streaming && !HasExtension(filename, ".exr"))
+    {
+        Warning("Film \"streaming\" needs an EXR output file; writing \"%s\" "
+                "from memory.",
+                filename.c_str());
+        streaming = false;
+    }
+    std::string splatMode = params.FindOneString("splatmode", "atomic");
+    Film::SplatMode mode = Film::SplatMode::Atomic;
+    if (splatMode == "perthread")
+        mode = Film::SplatMode::PerThread;
+    else if (splatMode != "atomic")
+        Warning("Film \"splatmode\" \"%s\" unknown. Using \"atomic\".",
+                splatMode.c_str());
     return new Film(Point2i(xres, yres), crop, std::move(filter), diagonal,
-                    filename, scale, maxSampleLuminance);
+                    filename, scale, maxSampleLuminance, mode, streaming);
 }
 
 } // namespace pbrt
@@ -45,10 +45,108 @@
 #include "filter.h"
 #include "stats.h"
 #include "parallel.h"
+#include <map>
 
 namespace pbrt
 {
 
+class TiledImageWriter;
+
+// VarianceEstimator Declarations
+// Running mean and variance of the luminance of the samples taken in a
+// pixel, updated with Welford's algorithm; estimators of disjoint sets of
+// samples are combined with _Merge()_.
+// 像素内采样亮度的滑动均值与方差（Welford算法），_Merge()_ 合并两组采样的估计
+struct VarianceEstimator
+{
+    void Add(Float x)
+    {
+        ++n;
+        Float delta = x - mean;
+        mean += delta / n;
+        m2 += delta * (x - mean);
+    }
+    void Merge(const VarianceEstimator &ve)
+    {
+        if (ve.n == 0)
+            return;
+        int64_t nSum = n + ve.n;
+        Float delta = ve.mean - mean;
+        mean += delta * ve.n / nSum;
+        m2 += ve.m2 + delta * delta * ((Float)n * (Float)ve.n / nSum);
+        n = nSum;
+    }
+    Float Variance() const { return n > 1 ? m2 / (n - 1) : 0; }
+
+    Float mean = 0, m2 = 0;
+    int64_t n = 0;
+};
+
+// PixelConvergence Declarations
+// Statistics that adaptive sampling uses to decide whether a pixel has
+// converged. Successive samples go alternately to two halves, which are
+// independent estimates of the pixel's mean; a pixel has converged once
+// they agree and the standard error of the mean over all of its samples
+// is small enough.
+// 自适应采样判断像素是否收敛所用的统计。相继的采样交替计入两半，两半是像素
+// 均值的独立估计；两者一致且全部采样均值的标准误差足够小时，像素才算收敛
+struct PixelConvergence
+{
+    void Add(Float x) { halves[(halves[0].n + halves[1].n) & 1].Add(x); }
+    void Merge(const PixelConvergence &pc)
+    {
+        // Keep the halves balanced when a tile added an odd count
+        // 图像块的采样数为奇数时交换两半，保持两半的采样数平衡
+        bool swap =
+            halves[0].n > halves[1].n && pc.halves[0].n > pc.halves[1].n;
+        halves[0].Merge(pc.halves[swap ? 1 : 0]);
+        halves[1].Merge(pc.halves[swap ? 0 : 1]);
+    }
+    int64_t SampleCount() const { return halves[0].n + halves[1].n; }
+    // Larger of the relative standard error of the mean and half of the
+    // relative difference between the halves' means (the difference of
+    // two half-size estimates has twice the standard error). Pixels whose
+    // samples have all had the same value have no estimate and return
+    // infinity; dark pixels are measured relative to a small absolute
+    // luminance.
+    // 均值的相对标准误差与两半均值相对差的一半中的较大者。所有采样值都相同的
+    // 像素没有误差估计，返回无穷大；暗像素相对于一个小的绝对亮度
+    Float RelativeError() const
+    {
+        if (halves[0].n < 2 || halves[1].n < 2)
+            return Infinity;
+        VarianceEstimator all = halves[0];
+        all.Merge(halves[1]);
+        if (!(all.Variance() > 0))
+            return Infinity;
+        Float scale = 1 / std::max(std::abs(all.mean), (Float)1e-3);
+        Float standardError = std::sqrt(all.Variance() / all.n) * scale;
+        Float halfDifference =
+            std::abs(halves[0].mean - halves[1].mean) * scale / 2;
+        return std::max(standardError, halfDifference);
+    }
+    // Whether the pixel's relative error is below _maxError_. A pixel whose
+    // samples have all had the same value, such as a flat sky or a caustic
+    // that no sample has hit yet, converges once it has $3 / maxError^2$
+    // samples: by the rule of three, a value that none of $n$ samples had
+    // has a probability below $3 / n$.
+    // 像素的相对误差是否低于 _maxError_。所有采样值都相同的像素（例如平坦的
+    // 天空，或还没有采样命中的焦散）在采样数达到 $3 / maxError^2$ 后收敛：
+    // 根据三分法则，$n$ 个采样都未出现的值的概率低于 $3 / n$
+    bool Converged(Float maxError) const
+    {
+        Float error = RelativeError();
+        if (error < Infinity)
+            return error < maxError;
+        VarianceEstimator all = halves[0];
+        all.Merge(halves[1]);
+        return all.n >= 2 && !(all.Variance() > 0) &&
+               all.n >= 3 / (maxError * maxError);
+    }
+
+    VarianceEstimator halves[2];
+};
+
 // FilmTilePixel Declarations
 // FilmTilePixel 声明
 struct FilmTilePixel
@@ -62,20 +160,74 @@ struct FilmTilePixel
 class Film
 {
 public:
+    // Film Public Types
+    // How _AddSplat()_ accumulates splats: with atomic adds to the film's
+    // pixels, or in per-thread buffers that are added to the pixels in
+    // batches sorted by row
+    // _AddSplat()_ 的累加方式：原子地加到像素上，或先存入每个线程的缓冲区，
+    // 再按行排序后批量加到像素上
+    enum class SplatMode { Atomic, PerThread };
+
     // Film Public Methods
     // Film 公有方法
     Film(const Point2i &resolution, const Bounds2f &cropWindow,
          std::unique_ptr<Filter> filter, Float diagonal,
          const std::string &filename, Float scale,
-         Float maxSampleLuminance = Infinity);
+         Float maxSampleLuminance = Infinity,
+         SplatMode splatMode = SplatMode::Atomic, bool streaming = false);
     Bounds2i GetSampleBounds() const;
     Bounds2f GetPhysicalExtent() const;
     std::unique_ptr<FilmTile> GetFilmTile(const Bounds2i &sampleBounds);
     void MergeFilmTile(std::unique_ptr<FilmTile> tile);
-    void SetImage(const Spectrum *img) const;
+    void SetImage(const Spectrum *img);
+    // Sets the pixels of rows $[y_0, y_1)$ of the image to the values in
+    // _img_, which holds just those rows. A streaming film writes each
+    // block as soon as its rows are set, so setting the image in bands of
+    // _ImageBandHeight()_ rows only keeps one band of blocks in memory.
+    // 将图像第 [y0, y1) 行设为 _img_ 中的值（_img_ 只包含这些行）。流式 film
+    // 在像素块的行全部设置后立即写出，因此按 _ImageBandHeight()_ 行分段设置
+    // 时内存中只保留一段像素块
+    void SetImageRows(int y0, int y1, const Spectrum *img);
+    int ImageBandHeight() const;
     void AddSplat(const Point2f &p, Spectrum v);
+    // Adds the splats in the per-thread buffers to the pixels; must not be
+    // called concurrently with _AddSplat()_. _WriteImage()_ calls it.
+    // 把每个线程缓冲区中的 splat 加到像素上；不能与 _AddSplat()_ 并发调用
+    void MergeSplatBuffers();
     void WriteImage(Float splatScale = 1);
+    // Adds a name/value pair to the metadata of the written image, for the
+    // file formats that support it
+    // 为写出的图像添加元数据（仅部分文件格式支持）
+    void SetMetadata(const std::string &name, const std::string &value);
+    // Makes the film and its tiles keep _PixelConvergence_ statistics of
+    // the samples taken inside each pixel, for adaptive sampling; they
+    // cost memory and time for every sample, so they are off by default
+    // 让 film 及其图像块为每个像素记录 _PixelConvergence_ 统计，供自适应采样
+    // 使用；它们会增加内存和每个采样的开销，因此默认关闭
+    void EnablePixelStatistics();
+    // Statistics of the samples taken inside pixel _p_; not thread-safe
+    // with respect to _MergeFilmTile()_ calls for tiles that include _p_
+    // 像素 _p_ 内采样的统计；与 _MergeFilmTile()_ 并发调用不安全
+    const PixelConvergence &PixelStatistics(const Point2i &p) const
+    {
+        CHECK(pixelStatistics);
+        return pixelStatistics[PixelOffset(p)];
+    }
+    // Whether the film keeps only the blocks of pixels that tiles are
+    // being merged into and writes each block to a tiled EXR file as soon
+    // as it is finished, instead of holding the whole image in memory
+    // 流式模式：只保留正在合并的像素块，每块完成后立即写入分块EXR文件
+    bool Streaming() const { return streaming; }
+    // Tells a streaming film the sample bounds of all of the tiles that
+    // will be passed to _GetFilmTile()_ and merged, each once; a block is
+    // finished once all of the tiles that overlap it have been merged.
+    // _splats_ tells whether _AddSplat()_ will be called as well.
+    // 告知流式 film 将要合并的所有图像块的采样范围（每块合并一次）；
+    // _splats_ 表示是否还会调用 _AddSplat()_
+    void StreamTiles(const std::vector<Bounds2i> &tileSampleBounds,
+                     bool splats);
     void Clear();
+    ~Film();
 
     // Film Public Data
     // Film 公有数据
@@ -96,23 +248,111 @@ private:
         AtomicFloat splatXYZ[3];
         Float pad;
     };
-    std::unique_ptr<Pixel[]> pixels;
+    Pixel *pixels;
+    std::unique_ptr<PixelConvergence[]> pixelStatistics;
     static PBRT_CONSTEXPR int filterTableWidth = 16;
     Float filterTable[filterTableWidth * filterTableWidth];
-    std::mutex mutex;
+    // Locks for the rows of _pixels_; tiles that are merged at the same
+    // time only wait for each other while they update the same row
+    // 每行像素一把锁；同时合并的图像块只在更新同一行时互相等待
+    struct RowLock
+    {
+        std::mutex mutex;
+        char pad[PBRT_L1_CACHE_LINE_SIZE]; // 使相邻的锁位于不同缓存行
+    };
+    std::unique_ptr<RowLock[]> rowLocks;
+    std::mutex mutex; // 保护 _metadata_
+    std::map<std::string, std::string> metadata;
     const Float scale;
     const Float maxSampleLuminance;
+    // Splats that a thread added in _SplatMode::PerThread_ and that
+    // haven't been added to _pixels_ yet; only the thread with the
+    // buffer's index touches it while splats are added
+    // 某个线程在 _SplatMode::PerThread_ 模式下尚未加到像素上的 splat
+    struct SplatRecord
+    {
+        int offset;
+        Float xyz[3];
+    };
+    struct SplatBuffer
+    {
+        std::unique_ptr<SplatRecord[]> splats, sorted;
+        int nSplats = 0;
+        std::vector<int> rowStart;
+        char pad[PBRT_L1_CACHE_LINE_SIZE]; // 避免相邻线程的缓冲区伪共享
+    };
+    static PBRT_CONSTEXPR int splatBufferSize = 8192;
+    const SplatMode splatMode;
+    std::unique_ptr<SplatBuffer[]> splatBuffers;
+    int nSplatBuffers = 0;
+    // In streaming mode, the pixels are only allocated for the blocks
+    // that tiles are being merged into; each block is converted to RGB and
+    // written as a tile of the EXR file once its last tile has been merged.
+    // Splats can land anywhere at any time, so with splats the finished
+    // blocks and the splats are kept in temporary files that the OS pages
+    // in and out, and the image is written at the end.
+    // 流式模式下只为正在合并的像素块分配内存，每块在最后一个图像块合并后转为
+    // RGB 并写成EXR文件的一个块。splat 可能随时落在任何位置，因此有 splat 时
+    // 已完成的块与 splat 保存在由操作系统换入换出的临时文件中，最后再写出图像
+    struct StreamPixel
+    {
+        Float xyz[3] = {0, 0, 0};
+        Float filterWeightSum = 0;
+    };
+    struct StreamBlock
+    {
+        std::mutex mutex;
+        std::unique_ptr<StreamPixel[]> pixels;
+        int pendingTiles = -1; // 尚未合并的相交图像块数，-1 表示未知
+        bool finished = false;
+    };
+    static PBRT_CONSTEXPR int streamBlockSize = 64;
+    const bool streaming;
+    Point2i nStreamBlocks;
+    std::unique_ptr<StreamBlock[]> streamBlocks;
+    std::mutex streamMutex; // 保护 _streamWriter_ 的创建与临时文件的映射
+    std::unique_ptr<TiledImageWriter> streamWriter;
+    std::atomic<int> nFinishedStreamBlocks{0};
+    // Whether the EXR file's header, and with it the metadata, has been
+    // written; guarded by _mutex_
+    // EXR 文件头（包括元数据）是否已写出；由 _mutex_ 保护
+    bool streamHeaderWritten = false;
+    std::atomic<bool> streamSplats{false};
+    Float *streamRGB = nullptr; // 有 splat 时已完成块的RGB
+    AtomicFloat *streamSplatXYZ = nullptr;
+    size_t streamMappingBytes = 0;
+    std::atomic<int> nResidentStreamBlocks{0}, maxResidentStreamBlocks{0};
 
     // Film Private Methods
     // File 私有方法
-    Pixel &GetPixel(const Point2i &p)
+    int PixelOffset(const Point2i &p) const
     {
         CHECK(InsideExclusive(p, croppedPixelBounds));
         int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
-        int offset = (p.x - croppedPixelBounds.pMin.x) +
-                     (p.y - croppedPixelBounds.pMin.y) * width;
-        return pixels[offset];
+        return (p.x - croppedPixelBounds.pMin.x) +
+               (p.y - croppedPixelBounds.pMin.y) * width;
+    }
+    Pixel &GetPixel(const Point2i &p) { return pixels[PixelOffset(p)]; }
+    AtomicFloat *SplatXYZ(int offset)
+    {
+        return streaming ? &streamSplatXYZ[3 * offset]
+                         : pixels[offset].splatXYZ;
     }
+    void FlushSplatBuffer(SplatBuffer &buffer);
+    Bounds2i TilePixelBounds(const Bounds2i &sampleBounds) const;
+    void NormalizedRGB(const Float xyz[3], Float filterWeightSum,
+                       Float rgb[3]) const;
+    void AddSplatRGB(const AtomicFloat splatXYZ[3], Float splatScale,
+                     Float rgb[3]) const;
+    Bounds2i StreamBlockBounds(const Point2i &block) const;
+    Bounds2i StreamBlocksOverlapping(const Bounds2i &pixelBounds) const;
+    StreamBlock &GetStreamBlock(const Point2i &block)
+    {
+        return streamBlocks[block.y * nStreamBlocks.x + block.x];
+    }
+    void EnableStreamSplats();
+    void FinishStreamBlock(const Point2i &block);
+    void WriteStreamBlock(const Point2i &block, const Float *rgb);
 };
 
 class FilmTile
@@ -122,7 +362,7 @@ public:
     // FilmTile 公有方法
     FilmTile(const Bounds2i &pixelBounds, const Vector2f &filterRadius,
              const Float *filterTable, int filterTableSize,
-             Float maxSampleLuminance)
+             Float maxSampleLuminance, bool keepStatistics = false)
         : pixelBounds(pixelBounds),
           filterRadius(filterRadius),
           invFilterRadius(1 / filterRadius.x, 1 / filterRadius.y),
@@ -131,6 +371,8 @@ public:
           maxSampleLuminance(maxSampleLuminance)
     {
         pixels = std::vector<FilmTilePixel>(std::max(0, pixelBounds.Area()));
+        if (keepStatistics)
+            statistics.resize(pixels.size());
     }
     void AddSample(const Point2f &pFilm, Spectrum L,
                    Float sampleWeight = 1.)
@@ -138,6 +380,13 @@ public:
         ProfilePhase _(Prof::AddFilmSample);
         if (L.y() > maxSampleLuminance)
             L *= maxSampleLuminance / L.y();
+        // Record the sample's value in the statistics of its pixel
+        if (!statistics.empty())
+        {
+            Point2i pPixel = (Point2i)Floor(pFilm);
+            if (InsideExclusive(pPixel, pixelBounds))
+                statistics[PixelOffset(pPixel)].Add(L.y() * sampleWeight);
+        }
         // Compute sample's raster bounds
         Point2f pFilmDiscrete = pFilm - Vector2f(0.5f, 0.5f);
         Point2i p0 = (Point2i)Ceil(pFilmDiscrete - filterRadius);
@@ -180,19 +429,18 @@ public:
     }
     FilmTilePixel &GetPixel(const Point2i &p)
     {
-        CHECK(InsideExclusive(p, pixelBounds));
-        int width = pixelBounds.pMax.x - pixelBounds.pMin.x;
-        int offset =
-            (p.x - pixelBounds.pMin.x) + (p.y - pixelBounds.pMin.y) * width;
-        return pixels[offset];
+        return pixels[PixelOffset(p)];
     }
     const FilmTilePixel &GetPixel(const Point2i &p) const
     {
-        CHECK(InsideExclusive(p, pixelBounds));
-        int width = pixelBounds.pMax.x - pixelBounds.pMin.x;
-        int offset =
-            (p.x - pixelBounds.pMin.x) + (p.y - pixelBounds.pMin.y) * width;
-        return pixels[offset];
+        return pixels[PixelOffset(p)];
+    }
+    // Statistics of the samples taken inside pixel _p_, or nullptr if the
+    // tile doesn't keep them
+    // 像素 _p_ 内采样的统计；图像块不记录统计时返回 nullptr
+    const PixelConvergence *GetPixelStatistics(const Point2i &p) const
+    {
+        return statistics.empty() ? nullptr : &statistics[PixelOffset(p)];
     }
     Bounds2i GetPixelBounds() const { return pixelBounds; }
 
@@ -203,11 +451,24 @@ private:
     const Float *filterTable;
     const int filterTableSize;
     std::vector<FilmTilePixel> pixels;
+    std::vector<PixelConvergence> statistics;
     const Float maxSampleLuminance;
     friend class Film;
+
+    // FilmTile Private Methods
+    int PixelOffset(const Point2i &p) const
+    {
+        CHECK(InsideExclusive(p, pixelBounds));
+        int width = pixelBounds.pMax.x - pixelBounds.pMin.x;
+        return (p.x - pixelBounds.pMin.x) + (p.y - pixelBounds.pMin.y) * width;
+    }
 };
 
-Film *CreateFilm(const ParamSet &params, std::unique_ptr<Filter> filter);
+// Creates the film described by _params_; if _frame_ isn't negative, the
+// frame number is added to the file name for rendering shutter slices
+// 根据 _params_ 创建 film；_frame_ 非负时在文件名中加入帧号，用于分段渲染快门时间
+Film *CreateFilm(const ParamSet &params, std::unique_ptr<Filter> filter,
+                 int frame = -1);
 
 } // namespace pbrt
 
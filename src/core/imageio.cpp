@@ -37,15 +37,22 @@
 #include "fileutil.h"
 #include "spectrum.h"
 
+#include <ImfHeader.h>
 #include <ImfRgba.h>
 #include <ImfRgbaFile.h>
+#include <ImfStringAttribute.h>
+#include <ImfTiledRgbaFile.h>
 
 namespace pbrt {
 
 // ImageIO Local Declarations
-static void WriteImageEXR(const std::string &name, const Float *pixels,
-                          int xRes, int yRes, int totalXRes, int totalYRes,
-                          int xOffset, int yOffset);
+static void WriteImageEXR(
+    const std::string &name, const Float *pixels, int xRes, int yRes,
+    int totalXRes, int totalYRes, int xOffset, int yOffset,
+    const std::map<std::string, std::string> &metadata);
+static void WriteImagePNG(const std::string &name, const uint8_t *pixels,
+                          int xRes, int yRes,
+                          const std::map<std::string, std::string> &metadata);
 static void WriteImageTGA(const std::string &name, const uint8_t *pixels,
                           int xRes, int yRes, int totalXRes, int totalYRes,
                           int xOffset, int yOffset);
@@ -79,12 +86,13 @@ std::unique_ptr<RGBSpectrum[]> ReadImage(const std::string &name,
 }
 
 void WriteImage(const std::string &name, const Float *rgb,
-                const Bounds2i &outputBounds, const Point2i &totalResolution) {
+                const Bounds2i &outputBounds, const Point2i &totalResolution,
+                const std::map<std::string, std::string> &metadata) {
     Vector2i resolution = outputBounds.Diagonal();
     if (HasExtension(name, ".exr")) {
         WriteImageEXR(name, rgb, resolution.x, resolution.y, totalResolution.x,
                       totalResolution.y, outputBounds.pMin.x,
-                      outputBounds.pMin.y);
+                      outputBounds.pMin.y, metadata);
     } else if (HasExtension(name, ".pfm")) {
         WriteImagePFM(name, rgb, resolution.x, resolution.y);
     } else if (HasExtension(name, ".tga") || HasExtension(name, ".png")) {
@@ -108,13 +116,9 @@ void WriteImage(const std::string &name, const Float *rgb,
             WriteImageTGA(name, rgb8.get(), resolution.x, resolution.y,
                           totalResolution.x, totalResolution.y,
                           outputBounds.pMin.x, outputBounds.pMin.y);
-        else {
-            unsigned int error = lodepng_encode24_file(
-                name.c_str(), rgb8.get(), resolution.x, resolution.y);
-            if (error != 0)
-                Error("Error writing PNG \"%s\": %s", name.c_str(),
-                      lodepng_error_text(error));
-        }
+        else
+            WriteImagePNG(name, rgb8.get(), resolution.x, resolution.y,
+                          metadata);
     } else {
         Error("Can't determine image file type from suffix of filename \"%s\"",
               name.c_str());
@@ -161,9 +165,10 @@ RGBSpectrum *ReadImageEXR(const std::string &name, int *width, int *height,
     return NULL;
 }
 
-static void WriteImageEXR(const std::string &name, const Float *pixels,
-                          int xRes, int yRes, int totalXRes, int totalYRes,
-                          int xOffset, int yOffset) {
+static void WriteImageEXR(
+    const std::string &name, const Float *pixels, int xRes, int yRes,
+    int totalXRes, int totalYRes, int xOffset, int yOffset,
+    const std::map<std::string, std::string> &metadata) {
     using namespace Imf;
     using namespace Imath;
 
@@ -177,8 +182,10 @@ static void WriteImageEXR(const std::string &name, const Float *pixels,
                      V2i(xOffset + xRes - 1, yOffset + yRes - 1));
 
     try {
-        RgbaOutputFile file(name.c_str(), displayWindow, dataWindow,
-                            WRITE_RGB);
+        Header header(displayWindow, dataWindow);
+        for (const auto &entry : metadata)
+            header.insert(entry.first, StringAttribute(entry.second));
+        RgbaOutputFile file(name.c_str(), header, WRITE_RGB);
         file.setFrameBuffer(hrgba - xOffset - yOffset * xRes, 1, xRes);
         file.writePixels(yRes);
     } catch (const std::exception &exc) {
@@ -188,6 +195,97 @@ static void WriteImageEXR(const std::string &name, const Float *pixels,
     delete[] hrgba;
 }
 
+// TiledImageWriter Method Definitions
+struct TiledImageWriter::EXRFile {
+    EXRFile(const std::string &name, const Imf::Header &header, int tileSize)
+        : file(name.c_str(), header, Imf::WRITE_RGB, tileSize, tileSize,
+               Imf::ONE_LEVEL) {}
+    Imf::TiledRgbaOutputFile file;
+};
+
+TiledImageWriter::TiledImageWriter(
+    const std::string &name, const Bounds2i &outputBounds,
+    const Point2i &totalResolution, int tileSize,
+    const std::map<std::string, std::string> &metadata)
+    : name(name), outputBounds(outputBounds), tileSize(tileSize) {
+    using namespace Imf;
+    using namespace Imath;
+
+    // OpenEXR uses inclusive pixel bounds.
+    Box2i displayWindow(V2i(0, 0),
+                        V2i(totalResolution.x - 1, totalResolution.y - 1));
+    Box2i dataWindow(V2i(outputBounds.pMin.x, outputBounds.pMin.y),
+                     V2i(outputBounds.pMax.x - 1, outputBounds.pMax.y - 1));
+    try {
+        Header header(displayWindow, dataWindow);
+        for (const auto &entry : metadata)
+            header.insert(entry.first, StringAttribute(entry.second));
+        // With increasing-y order, tiles written out of order are kept in
+        // memory until the tiles before them arrive
+        header.lineOrder() = RANDOM_Y;
+        file.reset(new EXRFile(name, header, tileSize));
+    } catch (const std::exception &exc) {
+        Error("Error writing \"%s\": %s", name.c_str(), exc.what());
+    }
+}
+
+TiledImageWriter::~TiledImageWriter() {}
+
+Point2i TiledImageWriter::NTiles() const {
+    Vector2i extent = outputBounds.Diagonal();
+    return Point2i((extent.x + tileSize - 1) / tileSize,
+                   (extent.y + tileSize - 1) / tileSize);
+}
+
+Bounds2i TiledImageWriter::TileBounds(const Point2i &tile) const {
+    Point2i pMin = outputBounds.pMin + Vector2i(tile) * tileSize;
+    return Intersect(Bounds2i(pMin, pMin + Vector2i(tileSize, tileSize)),
+                     outputBounds);
+}
+
+void TiledImageWriter::WriteTile(const Point2i &tile, const Float *rgb) {
+    using namespace Imf;
+
+    Bounds2i bounds = TileBounds(tile);
+    Vector2i res = bounds.Diagonal();
+    std::unique_ptr<Rgba[]> hrgba(new Rgba[res.x * res.y]);
+    for (int i = 0; i < res.x * res.y; ++i)
+        hrgba[i] = Rgba(rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2]);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file) return;
+    try {
+        file->file.setFrameBuffer(
+            hrgba.get() - bounds.pMin.x - bounds.pMin.y * res.x, 1, res.x);
+        file->file.writeTile(tile.x, tile.y);
+    } catch (const std::exception &exc) {
+        Error("Error writing \"%s\": %s", name.c_str(), exc.what());
+    }
+}
+
+// PNG Function Definitions
+static void WriteImagePNG(const std::string &name, const uint8_t *pixels,
+                          int xRes, int yRes,
+                          const std::map<std::string, std::string> &metadata) {
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.info_raw.colortype = LCT_RGB;
+    state.info_png.color.colortype = LCT_RGB;
+    for (const auto &entry : metadata)
+        lodepng_add_text(&state.info_png, entry.first.c_str(),
+                         entry.second.c_str());
+    unsigned char *png = nullptr;
+    size_t pngSize = 0;
+    unsigned int error =
+        lodepng_encode(&png, &pngSize, pixels, xRes, yRes, &state);
+    if (error == 0) error = lodepng_save_file(png, pngSize, name.c_str());
+    if (error != 0)
+        Error("Error writing PNG \"%s\": %s", name.c_str(),
+              lodepng_error_text(error));
+    free(png);
+    lodepng_state_cleanup(&state);
+}
+
 // TGA Function Definitions
 void WriteImageTGA(const std::string &name, const uint8_t *pixels, int xRes,
                    int yRes, int totalXRes, int totalYRes, int xOffset,
@@ -42,6 +42,8 @@
 #include "pbrt.h"
 #include "geometry.h"
 #include <cctype>
+#include <map>
+#include <mutex>
 
 namespace pbrt {
 
@@ -52,8 +54,38 @@ RGBSpectrum *ReadImageEXR(const std::string &name, int *width,
                           int *height, Bounds2i *dataWindow = nullptr,
                           Bounds2i *displayWindow = nullptr);
 
+// The _metadata_ name/value pairs are stored as string attributes in EXR
+// files and as text chunks in PNG files; other formats ignore them.
 void WriteImage(const std::string &name, const Float *rgb,
-                const Bounds2i &outputBounds, const Point2i &totalResolution);
+                const Bounds2i &outputBounds, const Point2i &totalResolution,
+                const std::map<std::string, std::string> &metadata = {});
+
+// TiledImageWriter Declarations
+// Writes a tiled OpenEXR image one square tile of pixels at a time, so
+// that the whole image never has to be in memory. Tiles are indexed from
+// the upper-left corner of _outputBounds_ and may be written in any order
+// and from any thread; the file is complete once every tile has been
+// written and the writer has been destroyed.
+class TiledImageWriter {
+  public:
+    TiledImageWriter(const std::string &name, const Bounds2i &outputBounds,
+                     const Point2i &totalResolution, int tileSize,
+                     const std::map<std::string, std::string> &metadata = {});
+    ~TiledImageWriter();
+    Point2i NTiles() const;
+    // Pixels covered by _tile_, clipped to _outputBounds_
+    Bounds2i TileBounds(const Point2i &tile) const;
+    // _rgb_ holds the pixels of _TileBounds(tile)_ in scanline order
+    void WriteTile(const Point2i &tile, const Float *rgb);
+
+  private:
+    struct EXRFile;
+    const std::string name;
+    const Bounds2i outputBounds;
+    const int tileSize;
+    std::unique_ptr<EXRFile> file;
+    std::mutex mutex;
+};
 
 }  // namespace pbrt
 
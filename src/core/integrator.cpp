@@ -42,11 +42,16 @@
 #include "sampling.h"
 #include "scene.h"
 #include "stats.h"
+#include <chrono>
 
 namespace pbrt
 {
 
 STAT_COUNTER("Integrator/Camera rays traced", nCameraRays);
+STAT_FLOAT_DISTRIBUTION("Integrator/Samples per pixel achieved",
+                        samplesPerPixelAchieved);
+STAT_PERCENT("Integrator/Pixels converged by adaptive sampling",
+             nConvergedPixels, nAdaptivePixels);
 
 // Integrator Method Definitions
 // Integrator 方法定义
@@ -54,38 +59,222 @@ Integrator::~Integrator() {}
 
 // Integrator Utility Functions
 // Integrator 实用函数
+
+// The light sampling half of _EstimateDirect()_. Returns the sample's
+// contribution as if the light were visible; if _handleMedia_ is false, the
+// contribution only counts if _*shadowRay_ is unoccluded, which is then
+// indicated by _*traceShadowRay_.
+// _EstimateDirect()_ 中对光源采样的部分，返回假设光源可见时的贡献；
+// 若不处理介质，则仅当 _*shadowRay_ 未被遮挡时该贡献才有效
+static Spectrum EstimateDirectLight(const Interaction &it, const Light &light,
+                                    const Point2f &uLight, const Scene &scene,
+                                    Sampler &sampler, bool handleMedia,
+                                    BxDFType bsdfFlags, Ray *shadowRay,
+                                    bool *traceShadowRay)
+{
+    *traceShadowRay = false;
+    Spectrum Ld(0.f);
+    Vector3f wi;
+    Float lightPdf = 0, scatteringPdf = 0;
+    VisibilityTester visibility;
+    Spectrum Li = light.Sample_Li(it, uLight, &wi, &lightPdf, &visibility);
+    VLOG(2) << "EstimateDirect uLight:" << uLight << " -> Li: " << Li
+            << ", wi: " << wi << ", pdf: " << lightPdf;
+    if (lightPdf > 0 && !Li.IsBlack())
+    {
+        // Compute BSDF or phase function's value for light sample
+        Spectrum f;
+        if (it.IsSurfaceInteraction())
+        {
+            // Evaluate BSDF for light sampling strategy
+            const SurfaceInteraction &isect = (const SurfaceInteraction &)it;
+            f = isect.bsdf->f(isect.wo, wi, bsdfFlags) * AbsDot(wi, isect.shading.n);
+            scatteringPdf = isect.bsdf->Pdf(isect.wo, wi, bsdfFlags);
+            VLOG(2) << "  surf f*dot :" << f << ", scatteringPdf: " << scatteringPdf;
+        }
+        else
+        {
+            // Evaluate phase function for light sampling strategy
+            const MediumInteraction &mi = (const MediumInteraction &)it;
+            Float p = mi.phase->p(mi.wo, wi);
+            f = Spectrum(p);
+            scatteringPdf = p;
+            VLOG(2) << "  medium p: " << p;
+        }
+        if (!f.IsBlack())
+        {
+            // Compute effect of visibility for light source sample
+            if (handleMedia)
+            {
+                Li *= visibility.Tr(scene, sampler);
+                VLOG(2) << "  after Tr, Li: " << Li;
+            }
+
+            // Add light's contribution to reflected radiance
+            if (!Li.IsBlack())
+            {
+                if (IsDeltaLight(light.flags))
+                    Ld += f * Li / lightPdf;
+                else
+                {
+                    Float weight = PowerHeuristic(1, lightPdf, 1, scatteringPdf);
+                    Ld += f * Li * weight / lightPdf;
+                }
+                if (!handleMedia)
+                {
+                    *shadowRay = visibility.P0().SpawnRayTo(visibility.P1());
+                    *traceShadowRay = true;
+                }
+            }
+        }
+    }
+    return Ld;
+}
+
+// The BSDF sampling half of _EstimateDirect()_
+// _EstimateDirect()_ 中对 BSDF 采样的部分
+static Spectrum EstimateDirectBSDF(const Interaction &it,
+                                   const Point2f &uScattering,
+                                   const Light &light, const Scene &scene,
+                                   Sampler &sampler, bool handleMedia,
+                                   BxDFType bsdfFlags)
+{
+    Spectrum Ld(0.f);
+    if (IsDeltaLight(light.flags))
+        return Ld;
+    Vector3f wi;
+    Float lightPdf = 0, scatteringPdf = 0;
+    Spectrum f;
+    bool sampledSpecular = false;
+    if (it.IsSurfaceInteraction())
+    {
+        // Sample scattered direction for surface interactions
+        BxDFType sampledType;
+        const SurfaceInteraction &isect = (const SurfaceInteraction &)it;
+        f = isect.bsdf->Sample_f(isect.wo, &wi, uScattering, &scatteringPdf,
+                                 bsdfFlags, &sampledType);
+        f *= AbsDot(wi, isect.shading.n);
+        sampledSpecular = (sampledType & BSDF_SPECULAR) != 0;
+    }
+    else
+    {
+        // Sample scattered direction for medium interactions
+        const MediumInteraction &mi = (const MediumInteraction &)it;
+        Float p = mi.phase->Sample_p(mi.wo, &wi, uScattering);
+        f = Spectrum(p);
+        scatteringPdf = p;
+    }
+    VLOG(2) << "  BSDF / phase sampling f: " << f
+            << ", scatteringPdf: " << scatteringPdf;
+    if (!f.IsBlack() && scatteringPdf > 0)
+    {
+        // Account for light contributions along sampled direction _wi_
+        Float weight = 1;
+        if (!sampledSpecular)
+        {
+            lightPdf = light.Pdf_Li(it, wi);
+            if (lightPdf == 0)
+                return Ld;
+            weight = PowerHeuristic(1, scatteringPdf, 1, lightPdf);
+        }
+
+        // Find intersection and compute transmittance
+        SurfaceInteraction lightIsect;
+        Ray ray = it.SpawnRay(wi);
+        Spectrum Tr(1.f);
+        bool foundSurfaceInteraction =
+            handleMedia ? scene.IntersectTr(ray, sampler, &lightIsect, &Tr)
+                        : scene.Intersect(ray, &lightIsect);
+
+        // Add light contribution from material sampling
+        Spectrum Li(0.f);
+        if (foundSurfaceInteraction)
+        {
+            if (lightIsect.primitive->GetAreaLight() == &light)
+                Li = lightIsect.Le(-wi);
+        }
+        else
+            Li = light.Le(ray);
+        if (!Li.IsBlack())
+            Ld += f * Li * Tr * weight / scatteringPdf;
+    }
+    return Ld;
+}
+
 Spectrum UniformSampleAllLights(const Interaction &it, const Scene &scene,
                                 MemoryArena &arena, Sampler &sampler,
                                 const std::vector<int> &nLightSamples,
                                 bool handleMedia)
 {
     ProfilePhase p(Prof::DirectLighting);
-    Spectrum L(0.f);
+    BxDFType bsdfFlags = BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
+    // Estimate every light sample's contribution, deferring shadow rays so
+    // that they can be traced together
+    // 估计每个光源采样的贡献，推迟阴影光线以便一起追踪
+    int nTotalSamples = 0;
+    for (size_t j = 0; j < scene.lights.size(); ++j)
+        nTotalSamples += std::max(1, nLightSamples[j]);
+    Spectrum *lightLd = arena.Alloc<Spectrum>(nTotalSamples);
+    Spectrum *bsdfLd = arena.Alloc<Spectrum>(nTotalSamples);
+    Ray *shadowRays = arena.Alloc<Ray>(nTotalSamples);
+    int *shadowSample = arena.Alloc<int>(nTotalSamples);
+    bool *usedArrays = arena.Alloc<bool>(scene.lights.size());
+    int n = 0, nShadowRays = 0;
     for (size_t j = 0; j < scene.lights.size(); ++j)
     {
-        // Accumulate contribution of _j_th light to _L_
-        const std::shared_ptr<Light> &light = scene.lights[j];
+        // Sample the _j_th light
+        const Light &light = *scene.lights[j];
         int nSamples = nLightSamples[j];
         const Point2f *uLightArray = sampler.Get2DArray(nSamples);
         const Point2f *uScatteringArray = sampler.Get2DArray(nSamples);
+        Point2f uLight, uScattering;
         if (!uLightArray || !uScatteringArray)
         {
             // Use a single sample for illumination from _light_
-            Point2f uLight = sampler.Get2D();
-            Point2f uScattering = sampler.Get2D();
-            L += EstimateDirect(it, uScattering, *light, uLight, scene, sampler,
-                                arena, handleMedia);
+            uLight = sampler.Get2D();
+            uScattering = sampler.Get2D();
+            uLightArray = &uLight;
+            uScatteringArray = &uScattering;
         }
-        else
+        usedArrays[j] = uLightArray != &uLight;
+        for (int k = 0; k < (usedArrays[j] ? nSamples : 1); ++k, ++n)
         {
-            // Estimate direct lighting using sample arrays
-            Spectrum Ld(0.f);
-            for (int k = 0; k < nSamples; ++k)
-                Ld += EstimateDirect(it, uScatteringArray[k], *light, uLightArray[k],
-                                     scene, sampler, arena, handleMedia);
-            L += Ld / nSamples;
+            bool traceShadowRay;
+            lightLd[n] = EstimateDirectLight(
+                it, light, uLightArray[k], scene, sampler, handleMedia,
+                bsdfFlags, &shadowRays[nShadowRays], &traceShadowRay);
+            if (traceShadowRay)
+                shadowSample[nShadowRays++] = n;
+            bsdfLd[n] = EstimateDirectBSDF(it, uScatteringArray[k], light,
+                                           scene, sampler, handleMedia,
+                                           bsdfFlags);
         }
     }
+
+    // Trace the shadow rays and accumulate the unoccluded contributions
+    // 追踪阴影光线并累加未被遮挡的贡献
+    bool *occluded = arena.Alloc<bool>(nShadowRays);
+    scene.IntersectPBatch(shadowRays, nShadowRays, occluded);
+    for (int i = 0; i < nShadowRays; ++i)
+        if (occluded[i])
+            lightLd[shadowSample[i]] = Spectrum(0.f);
+    Spectrum L(0.f);
+    n = 0;
+    for (size_t j = 0; j < scene.lights.size(); ++j)
+    {
+        if (!usedArrays[j])
+        {
+            L += lightLd[n] + bsdfLd[n];
+            ++n;
+            continue;
+        }
+        // Estimate direct lighting using sample arrays
+        int nSamples = nLightSamples[j];
+        Spectrum Ld(0.f);
+        for (int k = 0; k < nSamples; ++k, ++n)
+            Ld += lightLd[n] + bsdfLd[n];
+        L += Ld / nSamples;
+    }
     return L;
 }
 
@@ -127,274 +316,717 @@ Spectrum EstimateDirect(const Interaction &it, const Point2f &uScattering,
 {
     BxDFType bsdfFlags =
         specular ? BSDF_ALL : BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
-    Spectrum Ld(0.f);
     // Sample light source with multiple importance sampling
-    Vector3f wi;
-    Float lightPdf = 0, scatteringPdf = 0;
-    VisibilityTester visibility;
-    Spectrum Li = light.Sample_Li(it, uLight, &wi, &lightPdf, &visibility);
-    VLOG(2) << "EstimateDirect uLight:" << uLight << " -> Li: " << Li
-            << ", wi: " << wi << ", pdf: " << lightPdf;
-    if (lightPdf > 0 && !Li.IsBlack())
+    Ray shadowRay;
+    bool traceShadowRay;
+    Spectrum Ld = EstimateDirectLight(it, light, uLight, scene, sampler,
+                                      handleMedia, bsdfFlags, &shadowRay,
+                                      &traceShadowRay);
+    if (traceShadowRay)
     {
-        // Compute BSDF or phase function's value for light sample
-        Spectrum f;
-        if (it.IsSurfaceInteraction())
+        // Test the shadow ray through the same any-hit path as batches
+        bool occluded;
+        scene.IntersectPBatch(&shadowRay, 1, &occluded);
+        if (occluded)
         {
-            // Evaluate BSDF for light sampling strategy
-            const SurfaceInteraction &isect = (const SurfaceInteraction &)it;
-            f = isect.bsdf->f(isect.wo, wi, bsdfFlags) * AbsDot(wi, isect.shading.n);
-            scatteringPdf = isect.bsdf->Pdf(isect.wo, wi, bsdfFlags);
-            VLOG(2) << "  surf f*dot :" << f << ", scatteringPdf: " << scatteringPdf;
+            VLOG(2) << "  shadow ray blocked";
+            Ld = Spectrum(0.f);
         }
-        else
-        {
-            // Evaluate phase function for light sampling strategy
-            const MediumInteraction &mi = (const MediumInteraction &)it;
-            Float p = mi.phase->p(mi.wo, wi);
-            f = Spectrum(p);
-            scatteringPdf = p;
-            VLOG(2) << "  medium p: " << p;
-        }
-        if (!f.IsBlack())
+    }
+
+    // Sample BSDF with multiple importance sampling
+    return Ld + EstimateDirectBSDF(it, uScattering, light, scene, sampler,
+                                   handleMedia, bsdfFlags);
+}
+
+std::unique_ptr<Distribution1D> ComputeLightPowerDistribution(
+    const Scene &scene)
+{
+    if (scene.lights.empty())
+        return nullptr;
+    std::vector<Float> lightPower;
+    for (const auto &light : scene.lights)
+        lightPower.push_back(light->Power().y());
+    return std::unique_ptr<Distribution1D>(
+        new Distribution1D(&lightPower[0], lightPower.size()));
+}
+
+// SamplerIntegrator Method Definitions
+// SamplerIntegrator 方法定义
+Spectrum CheckRadiance(const Spectrum &L, const Point2i &pixel,
+                       int64_t sampleNum)
+{
+    if (L.HasNaNs()) // 如果采样结果不是数字
+    {
+        LOG(ERROR) << StringPrintf(
+            "Not-a-number radiance value returned "
+            "for pixel (%d, %d), sample %d. Setting to black.",
+            pixel.x, pixel.y, (int)sampleNum);
+        return Spectrum(0.f);
+    }
+    else if (L.y() < -1e-5) // 如果采样结果为负
+    {
+        LOG(ERROR) << StringPrintf(
+            "Negative luminance value, %f, returned "
+            "for pixel (%d, %d), sample %d. Setting to black.",
+            L.y(), pixel.x, pixel.y, (int)sampleNum);
+        return Spectrum(0.f);
+    }
+    else if (std::isinf(L.y())) // 如果采样结果无穷大
+    {
+        LOG(ERROR) << StringPrintf(
+            "Infinite luminance value returned "
+            "for pixel (%d, %d), sample %d. Setting to black.",
+            pixel.x, pixel.y, (int)sampleNum);
+        return Spectrum(0.f);
+    }
+    return L;
+}
+
+int64_t SamplerIntegrator::RenderTilePackets(
+    const Scene &scene, const Bounds2i &tileBounds, int64_t firstSample,
+    int64_t endSample, const std::vector<uint8_t> &pixelDone,
+    FilmTile &filmTile, MemoryArena &arena) const
+{
+    // Like _RenderTileSorted()_, give each pixel a sampler of its own, so
+    // that the same sample of neighbouring pixels can share a packet
+    // 与 _RenderTileSorted()_ 相同，每个像素使用单独的采样器，
+    // 使相邻像素的同一个采样可以放入同一组光线
+    int width = pixelBounds.pMax.x - pixelBounds.pMin.x;
+    std::vector<Point2i> pixels;
+    std::vector<std::unique_ptr<Sampler>> pixelSamplers;
+    for (Point2i pixel : tileBounds)
+    {
+        if (!InsideExclusive(pixel, pixelBounds))
+            continue;
+        int index = (pixel.y - pixelBounds.pMin.y) * width +
+                    (pixel.x - pixelBounds.pMin.x);
+        if (!pixelDone.empty() && pixelDone[index])
+            continue;
+        pixels.push_back(pixel);
+        pixelSamplers.push_back(sampler->Clone(index));
+        ProfilePhase pp(Prof::StartPixel);
+        pixelSamplers.back()->StartPixel(pixel);
+    }
+
+    // Each packet holds one sample of up to _packetSize_ consecutive
+    // pixels of the tile
+    // 每组光线包含图像块中至多 _packetSize_ 个相邻像素的同一个采样
+    int64_t spp = sampler->samplesPerPixel;
+    int nPixels = (int)pixels.size();
+    for (int64_t s = firstSample; s < endSample; ++s)
+        for (int first = 0; first < nPixels; first += packetSize)
         {
-            // Compute effect of visibility for light source sample
-            if (handleMedia)
+            int n = std::min(packetSize, nPixels - first);
+
+            // Generate camera rays for the packet's pixels
+            // 为这一组像素生成相机光线
+            CameraSample cameraSamples[MaxRayPacketSize];
+            RayDifferential rays[MaxRayPacketSize];
+            Float rayWeights[MaxRayPacketSize];
+            Ray packet[MaxRayPacketSize];
+            int nPacketRays = 0;
+            for (int i = 0; i < n; ++i)
             {
-                Li *= visibility.Tr(scene, sampler);
-                VLOG(2) << "  after Tr, Li: " << Li;
+                Sampler &pixelSampler = *pixelSamplers[first + i];
+                pixelSampler.SetSampleNumber(s);
+                cameraSamples[i] =
+                    pixelSampler.GetCameraSample(pixels[first + i]);
+                rayWeights[i] = camera->GenerateRayDifferential(
+                    cameraSamples[i], &rays[i]);
+                rays[i].ScaleDifferentials(1 / std::sqrt((Float)spp));
+                ++nCameraRays;
+                if (rayWeights[i] > 0)
+                    packet[nPacketRays++] = rays[i];
             }
-            else
+
+            // Find the first intersections of all of the camera rays at once
+            SurfaceInteraction isects[MaxRayPacketSize];
+            bool hits[MaxRayPacketSize];
+            scene.IntersectPacket(packet, nPacketRays, isects, hits);
+
+            // Evaluate radiance for each pixel, starting from its intersection
+            for (int i = 0, p = 0; i < n; ++i)
             {
-                if (!visibility.Unoccluded(scene))
+                const Point2i &pixel = pixels[first + i];
+                Sampler &pixelSampler = *pixelSamplers[first + i];
+                // Redraw the camera sample so that _LiFromHit()_ sees the
+                // sampler in the same state as it does when samples are
+                // traced one by one
+                pixelSampler.SetSampleNumber(s);
+                pixelSampler.GetCameraSample(pixel);
+                Spectrum L(0.f);
+                if (rayWeights[i] > 0)
                 {
-                    VLOG(2) << "  shadow ray blocked";
-                    Li = Spectrum(0.f);
+                    rays[i].tMax = packet[p].tMax;
+                    L = LiFromHit(rays[i], hits[p], isects[p], scene,
+                                  pixelSampler, arena);
+                    ++p;
                 }
-                else
-                    VLOG(2) << "  shadow ray unoccluded";
+                L = CheckRadiance(L, pixel, s);
+                VLOG(1) << "Camera sample: " << cameraSamples[i]
+                        << " -> ray: " << rays[i] << " -> L = " << L;
+                filmTile.AddSample(cameraSamples[i].pFilm, L, rayWeights[i]);
+                arena.Reset();
+            }
+        }
+    return (int64_t)nPixels * (endSample - firstSample);
+}
+
+// Number of samples that _RenderTileSorted()_ traces before shading them
+static PBRT_CONSTEXPR int SortedShadingBatchSize = 4096;
+
+int64_t SamplerIntegrator::RenderTileSorted(
+    const Scene &scene, const Bounds2i &tileBounds, int64_t firstSample,
+    int64_t endSample, const std::vector<uint8_t> &pixelDone,
+    FilmTile &filmTile, MemoryArena &arena) const
+{
+    // Give each pixel a sampler of its own, so that its samples can be
+    // shaded in any order; the seed doesn't depend on the tile size
+    // 每个像素使用单独的采样器，因而其采样可以按任意顺序着色
+    int width = pixelBounds.pMax.x - pixelBounds.pMin.x;
+    std::vector<Point2i> pixels;
+    std::vector<std::unique_ptr<Sampler>> pixelSamplers;
+    for (Point2i pixel : tileBounds)
+    {
+        if (!InsideExclusive(pixel, pixelBounds))
+            continue;
+        int index = (pixel.y - pixelBounds.pMin.y) * width +
+                    (pixel.x - pixelBounds.pMin.x);
+        if (!pixelDone.empty() && pixelDone[index])
+            continue;
+        pixels.push_back(pixel);
+        pixelSamplers.push_back(sampler->Clone(index));
+        ProfilePhase pp(Prof::StartPixel);
+        pixelSamplers.back()->StartPixel(pixel);
+    }
+    if (pixels.empty())
+        return 0;
+
+    // Each batch holds the samples $[s_0, s_1)$ of all of the pixels
+    int64_t spp = sampler->samplesPerPixel;
+    int64_t batchSamples =
+        std::max<int64_t>(1, SortedShadingBatchSize / pixels.size());
+    int maxBatch = (int)(pixels.size() *
+                         std::min(batchSamples, endSample - firstSample));
+    std::vector<int> pixelIndex(maxBatch);
+    std::vector<int64_t> sampleNum(maxBatch);
+    std::vector<CameraSample> cameraSamples(maxBatch);
+    std::vector<RayDifferential> rays(maxBatch);
+    std::vector<Float> rayWeights(maxBatch);
+    std::vector<SurfaceInteraction> isects(maxBatch);
+    std::vector<uint8_t> hits(maxBatch);
+    std::vector<std::pair<ShadingSortKey, int>> order(maxBatch);
+    for (int64_t s0 = firstSample; s0 < endSample; s0 += batchSamples)
+    {
+        int64_t s1 = std::min(endSample, s0 + batchSamples);
+
+        // Generate the batch's camera rays
+        // 生成这一批采样的相机光线
+        int n = 0;
+        for (size_t p = 0; p < pixels.size(); ++p)
+            for (int64_t s = s0; s < s1; ++s, ++n)
+            {
+                Sampler &pixelSampler = *pixelSamplers[p];
+                pixelSampler.SetSampleNumber(s);
+                pixelIndex[n] = p;
+                sampleNum[n] = s;
+                cameraSamples[n] = pixelSampler.GetCameraSample(pixels[p]);
+                rayWeights[n] = camera->GenerateRayDifferential(
+                    cameraSamples[n], &rays[n]);
+                rays[n].ScaleDifferentials(1 / std::sqrt((Float)spp));
+                ++nCameraRays;
             }
 
-            // Add light's contribution to reflected radiance
-            if (!Li.IsBlack())
+        // Find the first intersections of the camera rays, in packets if
+        // requested
+        // 求相机光线的第一个交点，如有要求则打包求交
+        for (int first = 0; first < n; first += packetSize)
+        {
+            int end = std::min(n, first + packetSize);
+            if (packetSize == 1)
             {
-                if (IsDeltaLight(light.flags))
-                    Ld += f * Li / lightPdf;
-                else
+                hits[first] = rayWeights[first] > 0 &&
+                              scene.Intersect(rays[first], &isects[first]);
+                continue;
+            }
+            Ray packet[MaxRayPacketSize];
+            SurfaceInteraction packetIsects[MaxRayPacketSize];
+            bool packetHits[MaxRayPacketSize];
+            int nPacketRays = 0;
+            for (int i = first; i < end; ++i)
+                if (rayWeights[i] > 0)
+                    packet[nPacketRays++] = rays[i];
+            scene.IntersectPacket(packet, nPacketRays, packetIsects,
+                                  packetHits);
+            for (int i = first, p = 0; i < end; ++i)
+            {
+                hits[i] = false;
+                if (rayWeights[i] > 0)
                 {
-                    Float weight = PowerHeuristic(1, lightPdf, 1, scatteringPdf);
-                    Ld += f * Li * weight / lightPdf;
+                    rays[i].tMax = packet[p].tMax;
+                    hits[i] = packetHits[p];
+                    if (hits[i])
+                        isects[i] = packetIsects[p];
+                    ++p;
                 }
             }
         }
+
+        // Shade the hits in sorted order; misses sort first
+        // 按排序后的顺序为交点着色；未命中的采样排在最前
+        for (int i = 0; i < n; ++i)
+            order[i] = std::make_pair(
+                hits[i] ? ShadingSortKey(isects[i]) : ShadingSortKey(), i);
+        std::sort(order.begin(), order.begin() + n,
+                  [](const std::pair<ShadingSortKey, int> &a,
+                     const std::pair<ShadingSortKey, int> &b) {
+                      return a.first < b.first ||
+                             (!(b.first < a.first) && a.second < b.second);
+                  });
+        for (int j = 0; j < n; ++j)
+        {
+            int i = order[j].second;
+            const Point2i &pixel = pixels[pixelIndex[i]];
+            Sampler &pixelSampler = *pixelSamplers[pixelIndex[i]];
+            // Redraw the camera sample so that _LiFromHit()_ sees the
+            // sampler in the same state as in unsorted rendering
+            pixelSampler.SetSampleNumber(sampleNum[i]);
+            pixelSampler.GetCameraSample(pixel);
+            Spectrum L(0.f);
+            if (rayWeights[i] > 0)
+                L = LiFromHit(rays[i], hits[i], isects[i], scene,
+                              pixelSampler, arena);
+            L = CheckRadiance(L, pixel, sampleNum[i]);
+            filmTile.AddSample(cameraSamples[i].pFilm, L, rayWeights[i]);
+            arena.Reset();
+        }
     }
+    return (int64_t)pixels.size() * (endSample - firstSample);
+}
 
-    // Sample BSDF with multiple importance sampling
-    if (!IsDeltaLight(light.flags))
+// ShadingSortKey Method Definitions
+ShadingSortKey::ShadingSortKey(const SurfaceInteraction &isect)
+    : material(isect.primitive ? isect.primitive->GetMaterial() : nullptr)
+{
+    // Quantize the fractional parts of $u$ and $v$ to 10 bits each and
+    // interleave them
+    // 将 $u$、$v$ 的小数部分各量化为10位并交错排列
+    auto quantize = [](Float x) {
+        Float f = x - std::floor(x);
+        if (!(f >= 0 && f < 1))
+            f = 0;
+        return std::min<uint32_t>(1023, (uint32_t)(f * 1024));
+    };
+    uint32_t u = quantize(isect.uv[0]), v = quantize(isect.uv[1]);
+    for (int i = 0; i < 10; ++i)
+        uvCode |= (((u >> i) & 1) << (2 * i)) | (((v >> i) & 1) << (2 * i + 1));
+}
+
+// TileSchedule Method Definitions
+// Converts a distance along the Hilbert curve that fills an _n_ by _n_
+// grid, with _n_ a power of two, to the cell's coordinates
+// 将 n×n 网格（n为2的幂）中希尔伯特曲线上的距离转换为网格坐标
+static Point2i HilbertToPoint(int n, int d)
+{
+    Point2i p(0, 0);
+    for (int s = 1; s < n; s *= 2)
     {
-        Spectrum f;
-        bool sampledSpecular = false;
-        if (it.IsSurfaceInteraction())
+        int rx = 1 & (d / 2), ry = 1 & (d ^ rx);
+        if (ry == 0)
         {
-            // Sample scattered direction for surface interactions
-            BxDFType sampledType;
-            const SurfaceInteraction &isect = (const SurfaceInteraction &)it;
-            f = isect.bsdf->Sample_f(isect.wo, &wi, uScattering, &scatteringPdf,
-                                     bsdfFlags, &sampledType);
-            f *= AbsDot(wi, isect.shading.n);
-            sampledSpecular = (sampledType & BSDF_SPECULAR) != 0;
+            if (rx == 1)
+            {
+                p.x = s - 1 - p.x;
+                p.y = s - 1 - p.y;
+            }
+            std::swap(p.x, p.y);
         }
-        else
+        p.x += s * rx;
+        p.y += s * ry;
+        d /= 4;
+    }
+    return p;
+}
+
+int TileSchedule::AdaptiveTileSize(const Vector2i &sampleExtent, int nThreads)
+{
+    int tileSize = 64;
+    while (tileSize > 8)
+    {
+        int64_t nTiles = int64_t((sampleExtent.x + tileSize - 1) / tileSize) *
+                         ((sampleExtent.y + tileSize - 1) / tileSize);
+        if (nTiles >= 16 * nThreads)
+            break;
+        tileSize /= 2;
+    }
+    return tileSize;
+}
+
+TileSchedule::TileSchedule(const Bounds2i &sampleBounds, TileOrder order,
+                           int tileSize)
+    : sampleBounds(sampleBounds), tileSize(tileSize)
+{
+    Vector2i sampleExtent = sampleBounds.Diagonal();
+    if (this->tileSize <= 0)
+        this->tileSize = AdaptiveTileSize(sampleExtent, MaxThreadIndex());
+    nTiles = Point2i((sampleExtent.x + this->tileSize - 1) / this->tileSize,
+                     (sampleExtent.y + this->tileSize - 1) / this->tileSize);
+    tiles.reserve(nTiles.x * nTiles.y);
+    switch (order)
+    {
+    case TileOrder::Scanline:
+        for (int y = 0; y < nTiles.y; ++y)
+            for (int x = 0; x < nTiles.x; ++x)
+                tiles.push_back(Point2i(x, y));
+        break;
+    case TileOrder::Hilbert:
+    {
+        // Walk the curve over the smallest power-of-two grid that covers
+        // the tiles and skip the cells outside the image
+        int n = RoundUpPow2(std::max(nTiles.x, nTiles.y));
+        for (int d = 0; d < n * n; ++d)
         {
-            // Sample scattered direction for medium interactions
-            const MediumInteraction &mi = (const MediumInteraction &)it;
-            Float p = mi.phase->Sample_p(mi.wo, &wi, uScattering);
-            f = Spectrum(p);
-            scatteringPdf = p;
+            Point2i tile = HilbertToPoint(n, d);
+            if (tile.x < nTiles.x && tile.y < nTiles.y)
+                tiles.push_back(tile);
         }
-        VLOG(2) << "  BSDF / phase sampling f: " << f
-                << ", scatteringPdf: " << scatteringPdf;
-        if (!f.IsBlack() && scatteringPdf > 0)
+        break;
+    }
+    case TileOrder::Spiral:
+    {
+        // Sort the tiles by the square ring around the center of the image
+        // that they lie on, and by angle within each ring
+        // 按图像块所在的、围绕图像中心的方形环排序，环内按角度排序
+        for (int y = 0; y < nTiles.y; ++y)
+            for (int x = 0; x < nTiles.x; ++x)
+                tiles.push_back(Point2i(x, y));
+        Vector2f center((nTiles.x - 1) * .5f, (nTiles.y - 1) * .5f);
+        auto ring = [&](const Point2i &t) {
+            return std::max(std::abs(t.x - center.x), std::abs(t.y - center.y));
+        };
+        auto angle = [&](const Point2i &t) {
+            return std::atan2(t.y - center.y, t.x - center.x);
+        };
+        std::stable_sort(tiles.begin(), tiles.end(),
+                         [&](const Point2i &a, const Point2i &b) {
+                             Float ra = ring(a), rb = ring(b);
+                             if (ra != rb)
+                                 return ra < rb;
+                             return angle(a) < angle(b);
+                         });
+        break;
+    }
+    }
+    CHECK_EQ(tiles.size(), nTiles.x * nTiles.y);
+}
+
+Point2i TileSchedule::NextTile()
+{
+    int index = nextTile++;
+    CHECK_LT(index, tiles.size());
+    return tiles[index];
+}
+
+Bounds2i TileSchedule::TileBounds(const Point2i &tile) const
+{
+    int x0 = sampleBounds.pMin.x + tile.x * tileSize;
+    int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
+    int y0 = sampleBounds.pMin.y + tile.y * tileSize;
+    int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
+    return Bounds2i(Point2i(x0, y0), Point2i(x1, y1));
+}
+
+// RenderBudget Method Definitions
+RenderBudget::RenderBudget(Float timeLimit, int64_t samplesPerPixel,
+                           bool passes)
+    : timeLimit(timeLimit),
+      samplesPerPixel(samplesPerPixel),
+      passes(passes || timeLimit > 0),
+      startTime(std::chrono::steady_clock::now()) {}
+
+double RenderBudget::ElapsedSeconds() const
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         startTime).count();
+}
+
+int64_t RenderBudget::PassEnd(int64_t firstSample) const
+{
+    if (!passes)
+        return samplesPerPixel;
+    return std::min(samplesPerPixel, std::max<int64_t>(1, 2 * firstSample));
+}
+
+bool RenderBudget::OutOfTime(int64_t firstSample) const
+{
+    return firstSample > 0 && Limited() && ElapsedSeconds() >= timeLimit;
+}
+
+void RenderBudget::Report(Film *film, int64_t nPixels) const
+{
+    Float spp = SamplesPerPixel(nPixels);
+    ReportValue(samplesPerPixelAchieved, spp);
+    LOG(INFO) << "Rendered " << spp << " samples per pixel in "
+              << ElapsedSeconds() << " seconds";
+    film->SetMetadata("pbrt.samplesPerPixel", StringPrintf("%f", spp));
+    film->SetMetadata("pbrt.renderTime",
+                      StringPrintf("%f", ElapsedSeconds()));
+}
+
+void RenderBudget::ReportPlanned(Film *film) const
+{
+    CHECK(!Limited());
+    film->SetMetadata("pbrt.samplesPerPixel",
+                      StringPrintf("%f", (Float)samplesPerPixel));
+}
+
+int64_t SamplerIntegrator::RenderTile(
+    const Scene &scene, const TileSchedule &schedule, const Point2i &tile,
+    int64_t firstSample, int64_t endSample,
+    const std::vector<uint8_t> &pixelDone, MemoryArena &arena) const
+{
+    // Get sampler instance for tile
+    // 获得采样器实例。每一遍都重新克隆，并用 SetSampleNumber() 定位到
+    // _firstSample_，因此各遍使用的采样值与一次渲染完所有采样时完全相同
+    int seed = schedule.Seed(tile);                              // seed表示当前是第几个tile
+    std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed); // 因为Sampler会被并发调用，所以必须为每个线程单独拷贝一份
+
+    // Compute sample bounds for tile
+    // 计算当前tile的边界，图像边缘的tile可能不足 tileSize 个像素
+    Bounds2i tileBounds = schedule.TileBounds(tile);
+    LOG(INFO) << "Starting image tile " << tileBounds << ", samples "
+              << firstSample << " to " << endSample;
+
+    // Get _FilmTile_ for tile
+    // FilmTile是对应块的渲染结果，即最终图像的一部分
+    std::unique_ptr<FilmTile> filmTile = camera->film->GetFilmTile(tileBounds);
+
+    if (sortShading || packetSize > 1)
+    {
+        int64_t nSamples =
+            sortShading
+                ? RenderTileSorted(scene, tileBounds, firstSample, endSample,
+                                   pixelDone, *filmTile, arena)
+                : RenderTilePackets(scene, tileBounds, firstSample, endSample,
+                                    pixelDone, *filmTile, arena);
+        LOG(INFO) << "Finished image tile " << tileBounds;
+        camera->film->MergeFilmTile(std::move(filmTile));
+        return nSamples;
+    }
+
+    // Loop over pixels in tile to render them
+    // 循环，渲染tile里每个像素
+    int64_t nSamples = 0;
+    for (Point2i pixel : tileBounds)
+    {
         {
-            // Account for light contributions along sampled direction _wi_
-            Float weight = 1;
-            if (!sampledSpecular)
-            {
-                lightPdf = light.Pdf_Li(it, wi);
-                if (lightPdf == 0)
-                    return Ld;
-                weight = PowerHeuristic(1, scatteringPdf, 1, lightPdf);
-            }
+            ProfilePhase pp(Prof::StartPixel);
+            tileSampler->StartPixel(pixel);
+        }
 
-            // Find intersection and compute transmittance
-            SurfaceInteraction lightIsect;
-            Ray ray = it.SpawnRay(wi);
-            Spectrum Tr(1.f);
-            bool foundSurfaceInteraction =
-                handleMedia ? scene.IntersectTr(ray, sampler, &lightIsect, &Tr)
-                            : scene.Intersect(ray, &lightIsect);
-
-            // Add light contribution from material sampling
-            Spectrum Li(0.f);
-            if (foundSurfaceInteraction)
-            {
-                if (lightIsect.primitive->GetAreaLight() == &light)
-                    Li = lightIsect.Le(-wi);
-            }
-            else
-                Li = light.Le(ray);
-            if (!Li.IsBlack())
-                Ld += f * Li * Tr * weight / scatteringPdf;
+        // Do this check after the StartPixel() call; this keeps
+        // the usage of RNG values from (most) Samplers that use
+        // RNGs consistent, which improves reproducability /
+        // debugging.
+        if (!InsideExclusive(pixel, pixelBounds))
+            continue;
+        // Skip pixels that adaptive sampling found to be converged
+        // 跳过自适应采样判定已收敛的像素
+        if (!pixelDone.empty())
+        {
+            int width = pixelBounds.pMax.x - pixelBounds.pMin.x;
+            if (pixelDone[(pixel.y - pixelBounds.pMin.y) * width +
+                          (pixel.x - pixelBounds.pMin.x)])
+                continue;
         }
+        nSamples += endSample - firstSample;
+
+        if (firstSample > 0)
+            tileSampler->SetSampleNumber(firstSample);
+        do
+        {
+            // Initialize _CameraSample_ for current sample
+            // 初始化CameraSample，它存储了当前在film平面上的采样点，以便于生成采样光线；
+            // 存储了采样时间，用于模拟运动物体；存储了镜片位置，用于模拟光圈虚化。
+            CameraSample cameraSample = tileSampler->GetCameraSample(pixel);
+
+            // Generate camera ray for current sample
+            // 为当前采样点生成采样光线，RayDifferential相比Ray多了两条光线，它们分别在x方向和y方向上偏移一些，用于纹理抗锯齿
+            RayDifferential ray;
+            Float rayWeight = camera->GenerateRayDifferential(cameraSample, &ray); // rayWeight为权重
+            ray.ScaleDifferentials(1 / std::sqrt((Float)tileSampler->samplesPerPixel));
+            ++nCameraRays;
+
+            // Evaluate radiance along camera ray
+            Spectrum L(0.f);
+            if (rayWeight > 0)
+                L = Li(ray, scene, *tileSampler, arena);
+
+            // Issue warning if unexpected radiance value returned
+            // 如果采样结果错误，输出警告
+            L = CheckRadiance(L, pixel, tileSampler->CurrentSampleNumber());
+            VLOG(1) << "Camera sample: " << cameraSample << " -> ray: " << ray << " -> L = " << L;
+
+            // Add camera ray's contribution to image
+            // 添加采样光线对图像的贡献
+            filmTile->AddSample(cameraSample.pFilm, L, rayWeight);
+
+            // Free _MemoryArena_ memory from computing image sample value
+            // 释放内存池
+            arena.Reset();
+        } while (tileSampler->StartNextSample() &&
+                 tileSampler->CurrentSampleNumber() < endSample);
     }
-    return Ld;
+    LOG(INFO) << "Finished image tile " << tileBounds;
+
+    // Merge image tile into _Film_
+    // 用右值引用，把filmtile里的动态资源转移过去
+    camera->film->MergeFilmTile(std::move(filmTile));
+    return nSamples;
 }
 
-std::unique_ptr<Distribution1D> ComputeLightPowerDistribution(
-    const Scene &scene)
+void SamplerIntegrator::UpdateConvergedPixels(
+    std::vector<uint8_t> *pixelDone) const
 {
-    if (scene.lights.empty())
-        return nullptr;
-    std::vector<Float> lightPower;
-    for (const auto &light : scene.lights)
-        lightPower.push_back(light->Power().y());
-    return std::unique_ptr<Distribution1D>(
-        new Distribution1D(&lightPower[0], lightPower.size()));
+    // Pixels outside the film only add filtered samples to the pixels at its
+    // edges, so they follow the nearest pixel of the film
+    // 图像之外的像素只通过滤波影响边缘像素，因此跟随最近的图像像素
+    const Film *film = camera->film;
+    Bounds2i filmBounds = film->croppedPixelBounds;
+    int width = pixelBounds.pMax.x - pixelBounds.pMin.x;
+    ParallelFor([&](int64_t row) {
+        int y = pixelBounds.pMin.y + (int)row;
+        for (int x = pixelBounds.pMin.x; x < pixelBounds.pMax.x; ++x)
+        {
+            uint8_t &done =
+                (*pixelDone)[row * width + (x - pixelBounds.pMin.x)];
+            if (done)
+                continue;
+            Point2i p(Clamp(x, filmBounds.pMin.x, filmBounds.pMax.x - 1),
+                      Clamp(y, filmBounds.pMin.y, filmBounds.pMax.y - 1));
+            done = film->PixelStatistics(p).Converged(adaptiveError);
+        }
+    }, pixelBounds.pMax.y - pixelBounds.pMin.y);
 }
 
-// SamplerIntegrator Method Definitions
-// SamplerIntegrator 方法定义
 void SamplerIntegrator::Render(const Scene &scene)
 {
     Preprocess(scene, *sampler); // 预处理
     // Render image tiles in parallel
     // 并行渲染图像块
 
-    // Compute number of tiles, _nTiles_, to use for parallel rendering
-    // 计算图像块的数量 _nTiles_, 用于并行渲染
+    // Partition the image into tiles, which are handed out in the order
+    // given by the options
+    // 将图像划分为图像块，按选项给定的顺序分发
     Bounds2i sampleBounds = camera->film->GetSampleBounds(); // sampleBounds表示采样范围的边界
-    Vector2i sampleExtent = sampleBounds.Diagonal();         // 采样范围的长宽
-    const int tileSize = 16;                                 // 每个图像块长宽16像素
-    // 计算长宽各有多少块
-    Point2i nTiles((sampleExtent.x + tileSize - 1) / tileSize,
-                   (sampleExtent.y + tileSize - 1) / tileSize);
-    ProgressReporter reporter(nTiles.x * nTiles.y, "Rendering"); // 进度汇报器
+    TileSchedule schedule(sampleBounds);
 
+    // In progressive mode, every tile gets samples $[0,1)$, then $[1,2)$,
+    // $[2,4)$, $[4,8)$ and so forth, and the image is written after each
+    // pass and every _PbrtOptions.writeInterval_ seconds. A time limit
+    // renders the same passes, stopping when the time is spent. Adaptive
+    // sampling also renders them and stops sampling converged pixels
+    // between passes; decisions made at pass boundaries don't depend on
+    // the order in which tiles are rendered.
+    // 渐进模式下，所有图像块依次渲染第 [0,1)、[1,2)、[2,4)、[4,8)... 个采样，
+    // 每一遍结束后以及每隔 _PbrtOptions.writeInterval_ 秒写出一次图像。
+    // 设置时间上限时也按同样的方式分遍渲染，时间用完即停止。自适应采样同样
+    // 分遍渲染，并在两遍之间停止对已收敛像素的采样，判定与图像块渲染顺序无关
+    bool progressive = PbrtOptions.progressive;
+    bool adaptive = adaptiveError > 0;
+    Float limit = timeLimit;
+    Film *film = camera->film;
+    if (film->Streaming())
     {
+        // A streaming film writes each block of pixels once every tile
+        // that overlaps it has been merged, so tiles are rendered in a
+        // single pass
+        // 流式 film 在所有相交图像块合并后即写出像素块，因此只渲染一遍
+        if (progressive || adaptive || limit > 0)
+            Warning("Ignoring the progressive mode, time limit and adaptive "
+                    "sampling, which the streaming film doesn't support.");
+        progressive = adaptive = false;
+        limit = 0;
+        std::vector<Bounds2i> tileBounds;
+        for (const Point2i &tile : schedule.Tiles())
+            tileBounds.push_back(schedule.TileBounds(tile));
+        film->StreamTiles(tileBounds, false);
+    }
+    if (adaptive)
+        film->EnablePixelStatistics();
+    const int64_t spp = sampler->samplesPerPixel;
+    RenderBudget budget(limit, spp, progressive || adaptive);
+    if (film->Streaming())
+        budget.ReportPlanned(film);
+    const bool passes = progressive || adaptive || budget.Limited();
+    std::vector<uint8_t> pixelDone(adaptive ? pixelBounds.Area() : 0, 0);
+    ProgressReporter reporter(schedule.TileCount() * (passes ? spp : 1),
+                              "Rendering"); // 进度汇报器
+    std::atomic<double> lastWriteTime{0};
+    std::atomic<bool> writingImage{false};
+    // Each thread reuses one _MemoryArena_ for all of its tiles and passes,
+    // so that its blocks are allocated and paged in only once
+    // 每个线程的所有图像块和各遍渲染复用同一个内存池，其内存块只需分配一次
+    std::vector<MemoryArena> arenas(MaxThreadIndex());
+    auto writeImage = [&]() {
+        camera->film->WriteImage();
+        lastWriteTime = budget.ElapsedSeconds();
+    };
+
+    int64_t firstSample = 0;
+    while (firstSample < spp && !budget.OutOfTime(firstSample))
+    {
+        int64_t endSample = budget.PassEnd(firstSample);
+        if (adaptive && firstSample >= adaptiveMinSamples)
+            UpdateConvergedPixels(&pixelDone);
+        schedule.Reset();
         // 传递一个lambda表达式给线程池，类似传递一个函数指针，这个函数会被调用多次（一个tile一次）
-        ParallelFor2D(
-            [&](Point2i tile) {
-                // Render section of image corresponding to _tile_
-                // 渲染对应的图像块
-
-                // Allocate _MemoryArena_ for tile
-                // 为图像块配置内存池
-                MemoryArena arena;
-
-                // Get sampler instance for tile
-                // 获得采样器实例
-                int seed = tile.y * nTiles.x + tile.x;                       // seed表示当前是第几个tile
-                std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed); // 因为Sampler会被并发调用，所以必须为每个线程单独拷贝一份
-
-                // Compute sample bounds for tile
-                // 计算当前tile的边界
-                int x0 = sampleBounds.pMin.x + tile.x * tileSize;      // tile左边界
-                int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x); // tile右边界，需要和最大值比对，存在剩余像素不足一个tile的情况
-                int y0 = sampleBounds.pMin.y + tile.y * tileSize;      // tile上边界
-                int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y); // tile下边界，需要和最大值比对，存在不足一个tile的情况
-                Bounds2i tileBounds(Point2i(x0, y0), Point2i(x1, y1)); // 当前tile的边界
-                LOG(INFO) << "Starting image tile " << tileBounds;
-
-                // Get _FilmTile_ for tile
-                // FilmTile是对应块的渲染结果，即最终图像的一部分
-                std::unique_ptr<FilmTile> filmTile = camera->film->GetFilmTile(tileBounds);
-
-                // Loop over pixels in tile to render them
-                // 循环，渲染tile里每个像素
-                for (Point2i pixel : tileBounds)
+        ParallelFor(
+            [&](int64_t) {
+                // Render section of image corresponding to the next tile
+                // 渲染下一个图像块；时间用完后跳过本遍剩余的图像块
+                Point2i tile = schedule.NextTile();
+                if (budget.OutOfTime(firstSample))
+                    return;
+                budget.AddSamples(RenderTile(scene, schedule, tile,
+                                             firstSample, endSample, pixelDone,
+                                             arenas[ThreadIndex]));
+                reporter.Update(passes ? endSample - firstSample : 1);
+
+                // Write the partially rendered image if it's time to, from
+                // only one thread at a time
+                bool notWriting = false;
+                if (progressive &&
+                    budget.ElapsedSeconds() - lastWriteTime >=
+                        PbrtOptions.writeInterval &&
+                    writingImage.compare_exchange_strong(notWriting, true))
                 {
-                    {
-                        ProfilePhase pp(Prof::StartPixel);
-                        tileSampler->StartPixel(pixel);
-                    }
-
-                    // Do this check after the StartPixel() call; this keeps
-                    // the usage of RNG values from (most) Samplers that use
-                    // RNGs consistent, which improves reproducability /
-                    // debugging.
-                    if (!InsideExclusive(pixel, pixelBounds))
-                        continue;
-
-                    do
-                    {
-                        // Initialize _CameraSample_ for current sample
-                        // 初始化CameraSample，它存储了当前在film平面上的采样点，以便于生成采样光线；
-                        // 存储了采样时间，用于模拟运动物体；存储了镜片位置，用于模拟光圈虚化。
-                        CameraSample cameraSample = tileSampler->GetCameraSample(pixel);
-
-                        // Generate camera ray for current sample
-                        // 为当前采样点生成采样光线，RayDifferential相比Ray多了两条光线，它们分别在x方向和y方向上偏移一些，用于纹理抗锯齿
-                        RayDifferential ray;
-                        Float rayWeight = camera->GenerateRayDifferential(cameraSample, &ray); // rayWeight为权重
-                        ray.ScaleDifferentials(1 / std::sqrt((Float)tileSampler->samplesPerPixel));
-                        ++nCameraRays;
-
-                        // Evaluate radiance along camera ray
-                        Spectrum L(0.f);
-                        if (rayWeight > 0)
-                            L = Li(ray, scene, *tileSampler, arena);
-
-                        // Issue warning if unexpected radiance value returned
-                        // 如果采样结果错误，输出警告
-                        if (L.HasNaNs()) // 如果采样结果不是数字
-                        {
-                            LOG(ERROR) << StringPrintf(
-                                "Not-a-number radiance value returned "
-                                "for pixel (%d, %d), sample %d. Setting to black.",
-                                pixel.x, pixel.y,
-                                (int)tileSampler->CurrentSampleNumber());
-                            L = Spectrum(0.f);
-                        }
-                        else if (L.y() < -1e-5) // 如果采样结果为负
-                        {
-                            LOG(ERROR) << StringPrintf(
-                                "Negative luminance value, %f, returned "
-                                "for pixel (%d, %d), sample %d. Setting to black.",
-                                L.y(), pixel.x, pixel.y,
-                                (int)tileSampler->CurrentSampleNumber());
-                            L = Spectrum(0.f);
-                        }
-                        else if (std::isinf(L.y())) // 如果采样结果无穷大
-                        {
-                            LOG(ERROR) << StringPrintf(
-                                "Infinite luminance value returned "
-                                "for pixel (%d, %d), sample %d. Setting to black.",
-                                pixel.x, pixel.y,
-                                (int)tileSampler->CurrentSampleNumber());
-                            L = Spectrum(0.f);
-                        }
-                        VLOG(1) << "Camera sample: " << cameraSample << " -> ray: " << ray << " -> L = " << L;
-
-                        // Add camera ray's contribution to image
-                        // 添加采样光线对图像的贡献
-                        filmTile->AddSample(cameraSample.pFilm, L, rayWeight);
-
-                        // Free _MemoryArena_ memory from computing image sample value
-                        // 释放内存池
-                        arena.Reset();
-                    } while (tileSampler->StartNextSample());
+                    writeImage();
+                    writingImage = false;
                 }
-                LOG(INFO) << "Finished image tile " << tileBounds;
-
-                // Merge image tile into _Film_
-                // 用右值引用，把filmtile里的动态资源转移过去
-                camera->film->MergeFilmTile(std::move(filmTile));
-                reporter.Update();
             },
-            nTiles);
-        reporter.Done();
+            schedule.TileCount());
+        firstSample = endSample;
+        if (progressive && firstSample < spp)
+        {
+            LOG(INFO) << "Finished progressive pass with " << firstSample
+                      << " samples per pixel";
+            writeImage();
+        }
     }
+    reporter.Done();
     LOG(INFO) << "Rendering finished";
+    // Each pixel is normalized by its own filter weight sum, so tiles that
+    // missed the last pass need no further correction
+    // 每个像素按自身的滤波权重和归一化，因此缺少最后一遍的图像块无需额外校正
+    budget.Report(camera->film, pixelBounds.Area());
+    if (adaptive)
+    {
+        nAdaptivePixels += pixelDone.size();
+        nConvergedPixels +=
+            std::count(pixelDone.begin(), pixelDone.end(), (uint8_t)1);
+    }
 
     // Save final image after rendering
     camera->film->WriteImage();
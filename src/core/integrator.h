@@ -46,6 +46,8 @@
 #include "reflection.h"
 #include "sampler.h"
 #include "material.h"
+#include <atomic>
+#include <chrono>
 
 namespace pbrt
 {
@@ -59,6 +61,14 @@ public:
     // Integrator 接口
     virtual ~Integrator();                       // 虚析构函数
     virtual void Render(const Scene &scene) = 0; // 纯虚函数
+    // Sets the wall-clock budget of _Render()_ in seconds; 0 means no limit
+    // 设置 _Render()_ 的时间预算（秒），0表示不限制
+    void SetTimeLimit(Float seconds) { timeLimit = seconds; }
+
+protected:
+    // Integrator Protected Data
+    // Integrator 受保护数据
+    Float timeLimit = PbrtOptions.timeLimit; // 渲染时间上限（秒）
 };
 
 Spectrum UniformSampleAllLights(const Interaction &it, const Scene &scene,
@@ -76,6 +86,140 @@ Spectrum EstimateDirect(const Interaction &it, const Point2f &uShading,
                         bool specular = false);
 std::unique_ptr<Distribution1D> ComputeLightPowerDistribution(
     const Scene &scene);
+// Returns _L_, or black with an error message if it is not a number,
+// negative or infinite
+// 返回 _L_；若其为非数、负值或无穷大，则报错并返回黑色
+Spectrum CheckRadiance(const Spectrum &L, const Point2i &pixel,
+                       int64_t sampleNum);
+
+// Orders surface hits by material and then by texture coordinates, so
+// that hits that are shaded one after another use the same material and
+// nearby parts of its textures
+// 按材质、再按纹理坐标对表面交点排序，使相继着色的交点使用同一材质及其纹理中相邻的部分
+struct ShadingSortKey
+{
+    ShadingSortKey() = default;
+    explicit ShadingSortKey(const SurfaceInteraction &isect);
+    bool operator<(const ShadingSortKey &k) const
+    {
+        return material < k.material ||
+               (material == k.material && uvCode < k.uvCode);
+    }
+
+    const Material *material = nullptr;
+    // Morton code of the fractional parts of $(u,v)$, which is where
+    // repeating textures are looked up
+    // $(u,v)$ 小数部分的 Morton 编码，即重复纹理的查找位置
+    uint32_t uvCode = 0;
+};
+
+// TileSchedule Declarations
+// Hands out the tiles of an image to the rendering threads in the order
+// given by _PbrtOptions.tileOrder_. Each call to _NextTile()_ returns a
+// different tile, so tiles that are rendered at the same time are close
+// together along the order and share cached geometry and textures.
+// 图像块调度：按 _PbrtOptions.tileOrder_ 的顺序把图像块分发给渲染线程。
+// 同时渲染的图像块在顺序上相邻，因而能共享缓存中的几何与纹理数据
+class TileSchedule
+{
+public:
+    // TileSchedule Public Methods
+    // TileSchedule 公有方法
+    TileSchedule(const Bounds2i &sampleBounds,
+                 TileOrder order = PbrtOptions.tileOrder,
+                 int tileSize = PbrtOptions.tileSize);
+    int TileCount() const { return tiles.size(); }
+    const Point2i &NTiles() const { return nTiles; }
+    int TileSize() const { return tileSize; }
+    // Thread-safe; must be called at most _TileCount()_ times
+    // 线程安全；最多调用 _TileCount()_ 次
+    Point2i NextTile();
+    // Starts handing out the tiles from the first one again; not
+    // thread-safe
+    // 重新从第一个图像块开始分发；非线程安全
+    void Reset() { nextTile = 0; }
+    Bounds2i TileBounds(const Point2i &tile) const;
+    // Seed for the tile's sampler, which does not depend on the order
+    // 图像块采样器的种子，与渲染顺序无关
+    int Seed(const Point2i &tile) const { return tile.y * nTiles.x + tile.x; }
+    const std::vector<Point2i> &Tiles() const { return tiles; }
+
+    // Returns the largest power-of-two tile size between 8 and 64 pixels
+    // that still gives each thread at least 16 tiles to balance the load
+    // 返回8到64像素之间最大的2的幂次边长，且保证每个线程至少有16个图像块
+    static int AdaptiveTileSize(const Vector2i &sampleExtent, int nThreads);
+
+private:
+    // TileSchedule Private Data
+    // TileSchedule 私有数据
+    const Bounds2i sampleBounds;
+    int tileSize;
+    Point2i nTiles;
+    std::vector<Point2i> tiles;
+    std::atomic<int> nextTile{0};
+};
+
+// RenderBudget Declarations
+// Wall-clock budget of a rendering. With a time limit, the samples of each
+// pixel are rendered in passes of doubling size, $[0,1)$, $[1,2)$,
+// $[2,4)$, ..., and no new tiles are started once the time is spent; the
+// first pass always finishes so that every pixel has a sample.
+// 渲染时间预算。设置时间上限后，每个像素的采样按 [0,1)、[1,2)、[2,4)...
+// 分遍渲染，时间用完后不再开始新的图像块；第一遍总会完成，保证每个像素都有采样
+class RenderBudget
+{
+public:
+    // RenderBudget Public Methods
+    // RenderBudget 公有方法
+    RenderBudget(Float timeLimit, int64_t samplesPerPixel,
+                 bool passes = false);
+    bool Limited() const { return timeLimit > 0; }
+    double ElapsedSeconds() const;
+    // Returns the end of the pass that starts at _firstSample_; without
+    // passes, all samples are rendered at once
+    // 返回从 _firstSample_ 开始的这一遍的结束位置
+    int64_t PassEnd(int64_t firstSample) const;
+    // Returns true if no more work of the pass starting at _firstSample_
+    // should be started
+    // 返回是否应停止开始从 _firstSample_ 起的这一遍的新工作
+    bool OutOfTime(int64_t firstSample) const;
+    // Thread-safe; records _n_ more samples taken in the image's pixels
+    // 线程安全；记录图像像素中又完成了 _n_ 个采样
+    void AddSamples(int64_t n) { samplesTaken += n; }
+    Float SamplesPerPixel(int64_t nPixels) const
+    {
+        return nPixels > 0 ? (Float)samplesTaken / (Float)nPixels : 0;
+    }
+    // Records the samples per pixel achieved in the statistics and in the
+    // metadata of the film's image
+    // 在统计信息和图像元数据中记录实际达到的每像素采样数
+    void Report(Film *film, int64_t nPixels) const;
+    // Records the sample count in the metadata of the film's image before
+    // rendering; without a time limit, every pixel gets all of them. A
+    // streaming film writes the metadata with its first block, long
+    // before _Report()_ is called.
+    // 在渲染前把采样数记录到图像元数据中；没有时间限制时每个像素都会完成全部采样。
+    // 流式 film 随第一个像素块写出元数据，远早于 _Report()_ 的调用
+    void ReportPlanned(Film *film) const;
+
+private:
+    // RenderBudget Private Data
+    // RenderBudget 私有数据
+    const Float timeLimit;
+    const int64_t samplesPerPixel;
+    const bool passes;
+    const std::chrono::steady_clock::time_point startTime;
+    std::atomic<int64_t> samplesTaken{0};
+};
+
+// Returns the number of pixels that _b1_ and _b2_ have in common
+// 返回两个包围盒共有的像素数
+inline int64_t OverlapArea(const Bounds2i &b1, const Bounds2i &b2)
+{
+    Bounds2i b = Intersect(b1, b2);
+    return (b.pMax.x > b.pMin.x && b.pMax.y > b.pMin.y) ? (int64_t)b.Area()
+                                                       : 0;
+}
 
 // SamplerIntegrator Declarations
 // SamplerIntegrator 声明
@@ -86,13 +230,45 @@ public:
     // SamplerIntegrator 公有方法
     SamplerIntegrator(std::shared_ptr<const Camera> camera,
                       std::shared_ptr<Sampler> sampler,
-                      const Bounds2i &pixelBounds)
-        : camera(camera), sampler(sampler), pixelBounds(pixelBounds) {}
+                      const Bounds2i &pixelBounds, int packetSize = 1)
+        : camera(camera), sampler(sampler), pixelBounds(pixelBounds),
+          packetSize(Clamp(packetSize, 1, MaxRayPacketSize)) {}
     virtual void Preprocess(const Scene &scene, Sampler &sampler) {} // 预处理，可选择性实现
     void Render(const Scene &scene);
+    // Enables adaptive sampling: once a pixel has at least _minSamples_
+    // samples, it stops getting more after the pass in which the relative
+    // error of its mean drops below _maxRelativeError_ (see
+    // _PixelConvergence_); pixels whose samples all had the same value stop
+    // once they have $3 / maxRelativeError^2$ samples
+    // 启用自适应采样：像素采样数达到 _minSamples_ 后，其均值的相对误差
+    // 低于 _maxRelativeError_ 的那一遍之后不再增加采样（见
+    // _PixelConvergence_）；所有采样值都相同的像素在采样数达到
+    // $3 / maxRelativeError^2$ 后停止
+    void SetAdaptiveSampling(Float maxRelativeError, int minSamples)
+    {
+        adaptiveError = maxRelativeError;
+        adaptiveMinSamples = std::max(minSamples, 2);
+    }
+    // Enables sorted shading: the camera rays of a batch of samples of
+    // each tile are traced first, and their hits are then shaded in the
+    // order of their _ShadingSortKey_
+    // 启用排序着色：先追踪每个图像块一批采样的相机光线，再按
+    // _ShadingSortKey_ 的顺序为交点着色
+    void SetSortedShading(bool sort) { sortShading = sort; }
     virtual Spectrum Li(const RayDifferential &ray, const Scene &scene,
                         Sampler &sampler, MemoryArena &arena,
                         int depth = 0) const = 0;
+    // Integrators that can start from a camera ray intersection found by
+    // packet traversal override this; by default the ray is traced again.
+    // 从已求得的相机光线交点开始计算辐射度，默认实现重新求交
+    virtual Spectrum LiFromHit(const RayDifferential &ray,
+                               bool foundIntersection,
+                               const SurfaceInteraction &isect,
+                               const Scene &scene, Sampler &sampler,
+                               MemoryArena &arena) const
+    {
+        return Li(ray, scene, sampler, arena);
+    }
     Spectrum SpecularReflect(const RayDifferential &ray,
                              const SurfaceInteraction &isect,
                              const Scene &scene, Sampler &sampler,
@@ -108,10 +284,46 @@ protected:
     std::shared_ptr<const Camera> camera; // 相机
 
 private:
+    // SamplerIntegrator Private Methods
+    // SamplerIntegrator 私有方法
+    // Renders samples $[firstSample, endSample)$ of each pixel of _tile_
+    // that isn't marked in _pixelDone_, merges them into the film and
+    // returns the number of samples taken; _arena_ is the calling thread's
+    // and is reset after each sample
+    // 渲染图像块中每个未在 _pixelDone_ 中标记的像素的第
+    // [firstSample, endSample) 个采样并合并到 film，返回采样数；
+    // _arena_ 属于调用线程，每个采样后都会重置
+    int64_t RenderTile(const Scene &scene, const TileSchedule &schedule,
+                       const Point2i &tile, int64_t firstSample,
+                       int64_t endSample,
+                       const std::vector<uint8_t> &pixelDone,
+                       MemoryArena &arena) const;
+    // Marks the pixels whose relative error is below _adaptiveError_
+    // 标记相对误差已低于 _adaptiveError_ 的像素
+    void UpdateConvergedPixels(std::vector<uint8_t> *pixelDone) const;
+    // Renders the tile's samples like _RenderTile()_, shading the hits
+    // in sorted order
+    // 与 _RenderTile()_ 相同，但按排序后的顺序为交点着色
+    int64_t RenderTileSorted(const Scene &scene, const Bounds2i &tileBounds,
+                             int64_t firstSample, int64_t endSample,
+                             const std::vector<uint8_t> &pixelDone,
+                             FilmTile &filmTile, MemoryArena &arena) const;
+    // Renders the tile's samples like _RenderTile()_, intersecting the
+    // camera rays of neighbouring pixels in packets of _packetSize_
+    // 与 _RenderTile()_ 相同，但将相邻像素的相机光线按 _packetSize_ 打包求交
+    int64_t RenderTilePackets(const Scene &scene, const Bounds2i &tileBounds,
+                              int64_t firstSample, int64_t endSample,
+                              const std::vector<uint8_t> &pixelDone,
+                              FilmTile &filmTile, MemoryArena &arena) const;
+
     // SamplerIntegrator Private Data
     // SamplerIntegrator 私有数据
     std::shared_ptr<Sampler> sampler; // 采样器
     const Bounds2i pixelBounds;       // 包围盒，平面，int型
+    const int packetSize;             // 一起求交的相机光线数量，1表示逐条追踪
+    Float adaptiveError = 0;          // 自适应采样的目标相对误差，0表示关闭
+    int adaptiveMinSamples = 16;      // 自适应采样判断收敛前的最少采样数
+    bool sortShading = false;         // 是否按材质排序后再着色
 };
 
 } // namespace pbrt
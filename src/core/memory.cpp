@@ -32,10 +32,13 @@
 
 // core/memory.cpp*
 #include "memory.h"
+#include "stats.h"
 
 namespace pbrt
 {
 
+STAT_INT_DISTRIBUTION("Memory/Arena peak usage (kB)", arenaPeakUsage);
+
 // Memory Allocation Functions
 void *AllocAligned(size_t size)
 {
@@ -62,4 +65,18 @@ void FreeAligned(void *ptr)
 #endif
 }
 
+// MemoryArena Method Definitions
+MemoryArena::~MemoryArena()
+{
+    if (PeakUsage() > 0)
+        ReportValue(arenaPeakUsage, (PeakUsage() + 1023) / 1024);
+    FreeAligned(currentBlock);
+    for (auto &block : usedBlocks)
+        FreeAligned(block.second);
+    for (uint8_t *block : availableBlocks)
+        FreeAligned(block);
+    for (auto &block : availableLargeBlocks)
+        FreeAligned(block.second);
+}
+
 } // namespace pbrt
@@ -40,6 +40,7 @@
 
 // core/memory.h*
 #include "pbrt.h"
+#include "parallel.h"
 #include <list>
 #include <cstddef>
 
@@ -69,14 +70,7 @@ class
 public:
     // MemoryArena 公有方法
     MemoryArena(size_t blockSize = 262144) : blockSize(blockSize) {}
-    ~MemoryArena()
-    {
-        FreeAligned(currentBlock);
-        for (auto &block : usedBlocks)
-            FreeAligned(block.second);
-        for (auto &block : availableBlocks)
-            FreeAligned(block.second);
-    }
+    ~MemoryArena();
 
     void *Alloc(size_t nBytes)
     {
@@ -100,22 +94,34 @@ public:
             {
                 usedBlocks.push_back(
                     std::make_pair(currentAllocSize, currentBlock));
+                usedBytes += currentBlockPos;
                 currentBlock = nullptr;
                 currentAllocSize = 0;
             }
 
             // Get new block of memory for _MemoryArena_
 
-            // Try to get memory block from _availableBlocks_
-            for (auto iter = availableBlocks.begin();
-                 iter != availableBlocks.end(); ++iter)
+            // Blocks of the standard size are reused in constant time; only
+            // allocations larger than that search the larger blocks
+            // 标准大小的块以常数时间复用；只有更大的分配才需查找更大的块
+            if (nBytes <= blockSize && !availableBlocks.empty())
+            {
+                currentAllocSize = blockSize;
+                currentBlock = availableBlocks.back();
+                availableBlocks.pop_back();
+            }
+            else if (nBytes > blockSize)
             {
-                if (iter->first >= nBytes)
+                for (size_t i = 0; i < availableLargeBlocks.size(); ++i)
                 {
-                    currentAllocSize = iter->first;
-                    currentBlock = iter->second;
-                    availableBlocks.erase(iter);
-                    break;
+                    if (availableLargeBlocks[i].first >= nBytes)
+                    {
+                        currentAllocSize = availableLargeBlocks[i].first;
+                        currentBlock = availableLargeBlocks[i].second;
+                        availableLargeBlocks[i] = availableLargeBlocks.back();
+                        availableLargeBlocks.pop_back();
+                        break;
+                    }
                 }
             }
             if (!currentBlock)
@@ -142,8 +148,17 @@ public:
 
     void Reset()
     {
+        peakUsage = PeakUsage();
+        usedBytes = 0;
         currentBlockPos = 0;
-        availableBlocks.splice(availableBlocks.begin(), usedBlocks);
+        for (const auto &block : usedBlocks)
+        {
+            if (block.first == blockSize)
+                availableBlocks.push_back(block.second);
+            else
+                availableLargeBlocks.push_back(block);
+        }
+        usedBlocks.clear();
     }
 
     size_t TotalAllocated() const
@@ -151,11 +166,20 @@ public:
         size_t total = currentAllocSize;
         for (const auto &alloc : usedBlocks)
             total += alloc.first;
-        for (const auto &alloc : availableBlocks)
+        total += availableBlocks.size() * blockSize;
+        for (const auto &alloc : availableLargeBlocks)
             total += alloc.first;
         return total;
     }
 
+    // Returns the most memory that has been allocated from the arena
+    // between two calls to _Reset()_
+    // 返回两次 _Reset()_ 之间从内存池分配的最大内存量
+    size_t PeakUsage() const
+    {
+        return std::max(peakUsage, usedBytes + currentBlockPos);
+    }
+
 private:
     MemoryArena(const MemoryArena &) = delete;            // 删除拷贝构造函数
     MemoryArena &operator=(const MemoryArena &) = delete; // 删除赋值函数
@@ -164,8 +188,14 @@ private:
     // MemoryArena 私有数据
     const size_t blockSize; // 块的数量
     size_t currentBlockPos = 0, currentAllocSize = 0;
-    uint8_t *currentBlock = nullptr;                                     //
-    std::list<std::pair<size_t, uint8_t *>> usedBlocks, availableBlocks; // 已用块，可用块
+    uint8_t *currentBlock = nullptr;                         //
+    std::vector<std::pair<size_t, uint8_t *>> usedBlocks;    // 已用块
+    std::vector<uint8_t *> availableBlocks;                  // 可用的标准大小块
+    std::vector<std::pair<size_t, uint8_t *>> availableLargeBlocks; // 可用的更大块
+    // Bytes allocated from _usedBlocks_, and the most allocated since the
+    // arena was created
+    // _usedBlocks_ 中已分配的字节数，以及创建以来的最大分配量
+    size_t usedBytes = 0, peakUsage = 0;
 };
 
 template <typename T, int logBlockSize>
@@ -178,6 +208,10 @@ public:
     {
         int nAlloc = RoundUp(uRes) * RoundUp(vRes);
         data = AllocAligned<T>(nAlloc);
+        // Spread the pages over the NUMA nodes before constructing the
+        // elements
+        // 构造元素之前先把内存页分布到各NUMA节点
+        ParallelFirstTouch(data, nAlloc * sizeof(T));
         for (int i = 0; i < nAlloc; ++i)
             new (&data[i]) T();
         if (d)
@@ -216,6 +250,11 @@ public:
         offset += BlockSize() * ov + ou;
         return data[offset];
     }
+    void ReportNumaPlacement(const char *title) const
+    {
+        pbrt::ReportNumaPlacement(title, data,
+                                  RoundUp(uRes) * RoundUp(vRes) * sizeof(T));
+    }
     void GetLinearArray(T *a) const
     {
         for (int v = 0; v < vRes; ++v)
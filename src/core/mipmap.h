@@ -215,6 +215,8 @@ MIPMap<T>::MIPMap(const Point2i &res, const T *img, bool doTrilinear,
         }
     }
     mipMapMemory += (4 * resolution[0] * resolution[1] * sizeof(T)) / 3;
+    for (const auto &level : pyramid)
+        level->ReportNumaPlacement("MIPMap texels");
 }
 
 template <typename T>
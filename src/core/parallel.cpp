@@ -35,65 +35,259 @@
 #include "parallel.h"
 #include "memory.h"
 #include "stats.h"
-#include <list>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
 #include <thread>
 #include <condition_variable>
+#ifdef PBRT_HAVE_PTHREAD_AFFINITY
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 namespace pbrt {
 
 // Parallel Local Definitions
 static std::vector<std::thread> threads;
-static bool shutdownThreads = false;
-class ParallelForLoop;
-static ParallelForLoop *workList = nullptr;
-static std::mutex workListMutex;
+static std::atomic<bool> shutdownThreads{false};
+
+// NUMA nodes that have CPUs the process may run on
+struct NumaNode {
+    int id;
+    std::vector<int> cpus;
+};
+static std::vector<NumaNode> numaNodes;
+#ifdef PBRT_HAVE_PTHREAD_AFFINITY
+// CPUs the main thread could run on before it was pinned
+static cpu_set_t mainThreadAffinity;
+static bool mainThreadPinned = false;
+#endif
+
+// Bytes of the memory passed to _ReportNumaPlacement()_ found on each NUMA
+// node, and the number of threads pinned to each node. These are not per
+// thread, so they are only reported to the stats from the main thread.
+static std::mutex numaStatsMutex;
+static std::map<std::string, int64_t> numaPlacementBytes;
+static std::map<int, int64_t> numaPinnedThreads;
+
+static void ReportNumaStats(StatsAccumulator &accum) {
+    if (ThreadIndex != 0) return;
+    std::lock_guard<std::mutex> lock(numaStatsMutex);
+    for (const auto &placement : numaPlacementBytes)
+        accum.ReportMemoryCounter(placement.first, placement.second);
+    for (const auto &pinned : numaPinnedThreads)
+        accum.ReportCounter(
+            StringPrintf("NUMA/Threads pinned to node %d", pinned.first),
+            pinned.second);
+    numaPlacementBytes.clear();
+    numaPinnedThreads.clear();
+}
+
+static StatRegisterer numaStatsRegisterer(ReportNumaStats);
+
+// Work is divided into _Task_s.  Each thread has its own deque of tasks that
+// it pushes and pops at the back; idle threads steal from the front of other
+// threads' deques, which holds the oldest and usually largest tasks.
+class Task {
+  public:
+    Task(std::atomic<int64_t> *pending)
+        : pending(pending), profilerState(CurrentProfilerState()) {}
+    virtual ~Task() {}
+    virtual void Run() = 0;
+
+    // Number of unfinished tasks of the loop or _TaskGroup_ the task
+    // belongs to
+    std::atomic<int64_t> *pending;
+    uint64_t profilerState;
+};
+
+// Deques are allocated separately so that threads don't contend for the
+// same cache lines
+struct TaskDeque {
+    std::mutex mutex;
+    std::deque<Task *> tasks;
+    // Number of tasks in _tasks_, readable without holding _mutex_
+    std::atomic<int> size{0};
+};
+static std::vector<std::unique_ptr<TaskDeque>> taskDeques;
+static int nTaskDeques = 0;
+
+// Idle worker threads sleep on _idleCondition_ until tasks are spawned.
+static std::mutex idleMutex;
+static std::condition_variable idleCondition;
+static std::atomic<int> nSleeping{0};
 
 // Bookkeeping variables to help with the implementation of
-// MergeWorkerThreadStats().
-static std::atomic<bool> reportWorkerStats{false};
+// MergeWorkerThreadStats().  Workers report their stats once each time
+// _statsGeneration_ is incremented.
+static std::atomic<int> statsGeneration{0};
 // Number of workers that still need to report their stats.
 static std::atomic<int> reporterCount;
 // After kicking the workers to report their stats, the main thread waits
 // on this condition variable until they've all done so.
 static std::condition_variable reportDoneCondition;
-static std::mutex reportDoneMutex;
 
 class ParallelForLoop {
   public:
     // ParallelForLoop Public Methods
-    ParallelForLoop(std::function<void(int64_t)> func1D, int64_t maxIndex,
-                    int chunkSize, uint64_t profilerState)
-        : func1D(std::move(func1D)),
-          maxIndex(maxIndex),
-          chunkSize(chunkSize),
-          profilerState(profilerState) {}
-    ParallelForLoop(const std::function<void(Point2i)> &f, const Point2i &count,
-                    uint64_t profilerState)
-        : func2D(f),
-          maxIndex(count.x * count.y),
-          chunkSize(1),
-          profilerState(profilerState) {
-        nX = count.x;
-    }
+    ParallelForLoop(std::function<void(int64_t)> func1D, int chunkSize)
+        : func1D(std::move(func1D)), chunkSize(chunkSize) {}
+    ParallelForLoop(std::function<void(Point2i)> func2D, int nX)
+        : func2D(std::move(func2D)), chunkSize(1), nX(nX) {}
 
-  public:
-    // ParallelForLoop Private Data
+    // ParallelForLoop Public Data
     std::function<void(int64_t)> func1D;
     std::function<void(Point2i)> func2D;
-    const int64_t maxIndex;
     const int chunkSize;
-    uint64_t profilerState;
-    int64_t nextIndex = 0;
-    int activeWorkers = 0;
-    ParallelForLoop *next = nullptr;
     int nX = -1;
+    std::atomic<int64_t> pending{0};
+};
 
-    // ParallelForLoop Private Methods
-    bool Finished() const {
-        return nextIndex >= maxIndex && activeWorkers == 0;
+static void Spawn(Task *task);
+
+static bool OwnDequeEmpty();
+
+// Runs the loop iterations _[start, end)_ one chunk at a time.  Before each
+// chunk, if the thread's deque is empty--typically because another thread
+// stole the last task it split off--the upper half of the remaining range is
+// split off into a new task for other threads to steal.  Loops are thus only
+// divided into more tasks when there are idle threads to run them.
+class ParallelForTask : public Task {
+  public:
+    ParallelForTask(ParallelForLoop *loop, int64_t start, int64_t end)
+        : Task(&loop->pending), loop(loop), start(start), end(end) {}
+    void Run() {
+        while (start < end) {
+            if (end - start > loop->chunkSize && OwnDequeEmpty()) {
+                int64_t nChunks = (end - start + loop->chunkSize - 1) /
+                                  loop->chunkSize;
+                int64_t mid = start + (nChunks / 2) * loop->chunkSize;
+                Spawn(new ParallelForTask(loop, mid, end));
+                end = mid;
+            }
+            // Run loop indices in the next chunk
+            int64_t chunkEnd = std::min(start + loop->chunkSize, end);
+            for (int64_t index = start; index < chunkEnd; ++index) {
+                if (loop->func1D) {
+                    loop->func1D(index);
+                }
+                // Handle other types of loops
+                else {
+                    CHECK(loop->func2D);
+                    loop->func2D(Point2i(index % loop->nX, index / loop->nX));
+                }
+            }
+            start = chunkEnd;
+        }
     }
+
+  private:
+    ParallelForLoop *loop;
+    int64_t start, end;
+};
+
+class FunctionTask : public Task {
+  public:
+    FunctionTask(std::atomic<int64_t> *pending, std::function<void()> func)
+        : Task(pending), func(std::move(func)) {}
+    void Run() { func(); }
+
+  private:
+    std::function<void()> func;
 };
 
+static void Spawn(Task *task) {
+    ++*task->pending;
+    TaskDeque &deque = *taskDeques[ThreadIndex % nTaskDeques];
+    {
+        std::lock_guard<std::mutex> lock(deque.mutex);
+        deque.tasks.push_back(task);
+        ++deque.size;
+    }
+    // Wake up a sleeping worker, if any, to steal the task.  A worker that
+    // is about to sleep increments _nSleeping_ before it checks the deques
+    // for tasks, so either it finds this task or it is woken up here.
+    if (nSleeping > 0) {
+        std::lock_guard<std::mutex> lock(idleMutex);
+        idleCondition.notify_one();
+    }
+}
+
+// Returns a task from the calling thread's deque or, failing that, one
+// stolen from another thread.  Returns nullptr if no task is available.
+static Task *FindTask() {
+    int self = ThreadIndex % nTaskDeques;
+    {
+        TaskDeque &deque = *taskDeques[self];
+        std::lock_guard<std::mutex> lock(deque.mutex);
+        if (!deque.tasks.empty()) {
+            Task *task = deque.tasks.back();
+            deque.tasks.pop_back();
+            --deque.size;
+            return task;
+        }
+    }
+    // Start at a different victim on each attempt so that thieves spread
+    // out over the other threads' deques
+    static PBRT_THREAD_LOCAL uint32_t victimSeed = 0;
+    victimSeed = victimSeed * 1664525u + 1013904223u + self;
+    for (int i = 0; i < nTaskDeques; ++i) {
+        int victim = (victimSeed + i) % nTaskDeques;
+        if (victim == self) continue;
+        TaskDeque &deque = *taskDeques[victim];
+        if (deque.size.load(std::memory_order_relaxed) == 0) continue;
+        std::lock_guard<std::mutex> lock(deque.mutex);
+        if (!deque.tasks.empty()) {
+            Task *task = deque.tasks.front();
+            deque.tasks.pop_front();
+            --deque.size;
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+static bool OwnDequeEmpty() {
+    return taskDeques[ThreadIndex % nTaskDeques]->size.load(
+               std::memory_order_relaxed) == 0;
+}
+
+static bool AnyTaskQueued() {
+    for (int i = 0; i < nTaskDeques; ++i) {
+        std::lock_guard<std::mutex> lock(taskDeques[i]->mutex);
+        if (!taskDeques[i]->tasks.empty()) return true;
+    }
+    return false;
+}
+
+static void RunTask(Task *task) {
+    uint64_t oldState = ProfilerState;
+    ProfilerState = task->profilerState;
+    task->Run();
+    ProfilerState = oldState;
+    std::atomic<int64_t> *pending = task->pending;
+    delete task;
+    // This must come last: the loop or _TaskGroup_ that _pending_ belongs to
+    // may be destroyed as soon as it reaches zero.
+    --*pending;
+}
+
+// Runs tasks on the calling thread until _pending_ reaches zero.  Tasks of
+// other loops may be run in the meantime, which is what allows tasks to wait
+// for subtasks without deadlocking.
+static void RunTasksUntilDone(const std::atomic<int64_t> &pending) {
+    while (pending > 0) {
+        Task *task = FindTask();
+        if (task)
+            RunTask(task);
+        else
+            std::this_thread::yield();
+    }
+}
+
 void Barrier::Wait() {
     std::unique_lock<std::mutex> lock(mutex);
     CHECK_GT(count, 0);
@@ -107,11 +301,95 @@ void Barrier::Wait() {
         cv.wait(lock, [this] { return count == 0; });
 }
 
-static std::condition_variable workListCondition;
+#ifdef PBRT_HAVE_PTHREAD_AFFINITY
+// Parses a Linux CPU list like "0-7,16-23"
+static std::vector<int> ParseCPUList(const std::string &list) {
+    std::vector<int> cpus;
+    const char *s = list.c_str();
+    while (true) {
+        char *end;
+        long first = strtol(s, &end, 10), last = first;
+        if (end == s) break;
+        s = end;
+        if (*s == '-') {
+            last = strtol(s + 1, &end, 10);
+            s = end;
+        }
+        for (long cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+        if (*s != ',') break;
+        ++s;
+    }
+    return cpus;
+}
+#endif
+
+static void InitNumaNodes() {
+    numaNodes.clear();
+#ifdef PBRT_HAVE_PTHREAD_AFFINITY
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        Warning("Unable to get the CPU affinity of the process: %s",
+                strerror(errno));
+        CPU_ZERO(&allowed);
+        for (int cpu = 0; cpu < NumSystemCores(); ++cpu)
+            CPU_SET(cpu, &allowed);
+    }
+    std::vector<int> allowedCPUs;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        if (CPU_ISSET(cpu, &allowed)) allowedCPUs.push_back(cpu);
+
+    // Read the CPUs of each node from sysfs, ignoring nodes without CPUs
+    // that the process may use
+    for (int id = 0;; ++id) {
+        std::ifstream in(
+            StringPrintf("/sys/devices/system/node/node%d/cpulist", id));
+        if (!in) break;
+        std::string list;
+        std::getline(in, list);
+        NumaNode node{id, {}};
+        for (int cpu : ParseCPUList(list))
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+                node.cpus.push_back(cpu);
+        if (!node.cpus.empty()) numaNodes.push_back(std::move(node));
+    }
+    if (numaNodes.empty()) numaNodes.push_back({0, allowedCPUs});
+#else
+    // Without thread affinity support, treat the machine as a single node
+    // and never pin threads
+    numaNodes.push_back({0, {}});
+#endif
+    for (const NumaNode &node : numaNodes)
+        LOG(INFO) << StringPrintf("NUMA node %d has %d usable CPUs", node.id,
+                                  (int)node.cpus.size());
+}
+
+// Pins the calling thread to a single CPU. Consecutive thread indices go
+// to different NUMA nodes so that partially used machines still spread
+// their threads, and their memory bandwidth, over all sockets.
+static void PinThread(int tIndex) {
+#ifdef PBRT_HAVE_PTHREAD_AFFINITY
+    const NumaNode &node = numaNodes[tIndex % numaNodes.size()];
+    int cpu = node.cpus[(tIndex / numaNodes.size()) % node.cpus.size()];
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (err != 0) {
+        Warning("Unable to pin thread %d to CPU %d: %s", tIndex, cpu,
+                strerror(err));
+        return;
+    }
+    LOG(INFO) << StringPrintf("Pinned thread %d to CPU %d on NUMA node %d",
+                              tIndex, cpu, node.id);
+    std::lock_guard<std::mutex> lock(numaStatsMutex);
+    ++numaPinnedThreads[node.id];
+#endif
+}
 
 static void workerThreadFunc(int tIndex, std::shared_ptr<Barrier> barrier) {
     LOG(INFO) << "Started execution in worker thread " << tIndex;
     ThreadIndex = tIndex;
+    if (PbrtOptions.pinThreads) PinThread(tIndex);
 
     // Give the profiler a chance to do per-thread initialization for
     // the worker thread before the profiling system actually stops running.
@@ -126,56 +404,29 @@ static void workerThreadFunc(int tIndex, std::shared_ptr<Barrier> barrier) {
     // the threads have cleared it.
     barrier.reset();
 
-    std::unique_lock<std::mutex> lock(workListMutex);
-    while (!shutdownThreads) {
-        if (reportWorkerStats) {
+    int reportedGeneration = statsGeneration;
+    while (true) {
+        // Run tasks until there are none left to run or steal
+        if (Task *task = FindTask()) {
+            RunTask(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(idleMutex);
+        if (reportedGeneration != statsGeneration) {
             ReportThreadStats();
+            reportedGeneration = statsGeneration;
             if (--reporterCount == 0)
                 // Once all worker threads have merged their stats, wake up
                 // the main thread.
                 reportDoneCondition.notify_one();
-            // Now sleep again.
-            workListCondition.wait(lock);
-        } else if (!workList) {
-            // Sleep until there are more tasks to run
-            workListCondition.wait(lock);
-        } else {
-            // Get work from _workList_ and run loop iterations
-            ParallelForLoop &loop = *workList;
-
-            // Run a chunk of loop iterations for _loop_
-
-            // Find the set of loop iterations to run next
-            int64_t indexStart = loop.nextIndex;
-            int64_t indexEnd =
-                std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-            // Update _loop_ to reflect iterations this thread will run
-            loop.nextIndex = indexEnd;
-            if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-            loop.activeWorkers++;
-
-            // Run loop indices in _[indexStart, indexEnd)_
-            lock.unlock();
-            for (int64_t index = indexStart; index < indexEnd; ++index) {
-                uint64_t oldState = ProfilerState;
-                ProfilerState = loop.profilerState;
-                if (loop.func1D) {
-                    loop.func1D(index);
-                }
-                // Handle other types of loops
-                else {
-                    CHECK(loop.func2D);
-                    loop.func2D(Point2i(index % loop.nX, index / loop.nX));
-                }
-                ProfilerState = oldState;
-            }
-            lock.lock();
-
-            // Update _loop_ to reflect completion of iterations
-            loop.activeWorkers--;
-            if (loop.Finished()) workListCondition.notify_all();
+            continue;
         }
+        if (shutdownThreads) break;
+        // Sleep until there are more tasks to run
+        ++nSleeping;
+        if (!AnyTaskQueued()) idleCondition.wait(lock);
+        --nSleeping;
     }
     LOG(INFO) << "Exiting worker thread " << tIndex;
 }
@@ -191,51 +442,10 @@ void ParallelFor(std::function<void(int64_t)> func, int64_t count,
         return;
     }
 
-    // Create and enqueue _ParallelForLoop_ for this loop
-    ParallelForLoop loop(std::move(func), count, chunkSize,
-                         CurrentProfilerState());
-    workListMutex.lock();
-    loop.next = workList;
-    workList = &loop;
-    workListMutex.unlock();
-
-    // Notify worker threads of work to be done
-    std::unique_lock<std::mutex> lock(workListMutex);
-    workListCondition.notify_all();
-
-    // Help out with parallel loop iterations in the current thread
-    while (!loop.Finished()) {
-        // Run a chunk of loop iterations for _loop_
-
-        // Find the set of loop iterations to run next
-        int64_t indexStart = loop.nextIndex;
-        int64_t indexEnd = std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-        // Update _loop_ to reflect iterations this thread will run
-        loop.nextIndex = indexEnd;
-        if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-        loop.activeWorkers++;
-
-        // Run loop indices in _[indexStart, indexEnd)_
-        lock.unlock();
-        for (int64_t index = indexStart; index < indexEnd; ++index) {
-            uint64_t oldState = ProfilerState;
-            ProfilerState = loop.profilerState;
-            if (loop.func1D) {
-                loop.func1D(index);
-            }
-            // Handle other types of loops
-            else {
-                CHECK(loop.func2D);
-                loop.func2D(Point2i(index % loop.nX, index / loop.nX));
-            }
-            ProfilerState = oldState;
-        }
-        lock.lock();
-
-        // Update _loop_ to reflect completion of iterations
-        loop.activeWorkers--;
-    }
+    // Create a task for the whole loop and help run it in the current thread
+    ParallelForLoop loop(std::move(func), chunkSize);
+    Spawn(new ParallelForTask(&loop, 0, count));
+    RunTasksUntilDone(loop.pending);
 }
 
 PBRT_THREAD_LOCAL int ThreadIndex;
@@ -253,59 +463,96 @@ void ParallelFor2D(std::function<void(Point2i)> func, const Point2i &count) {
         return;
     }
 
-    ParallelForLoop loop(std::move(func), count, CurrentProfilerState());
-    {
-        std::lock_guard<std::mutex> lock(workListMutex);
-        loop.next = workList;
-        workList = &loop;
-    }
+    ParallelForLoop loop(std::move(func), count.x);
+    Spawn(new ParallelForTask(&loop, 0, int64_t(count.x) * count.y));
+    RunTasksUntilDone(loop.pending);
+}
 
-    std::unique_lock<std::mutex> lock(workListMutex);
-    workListCondition.notify_all();
-
-    // Help out with parallel loop iterations in the current thread
-    while (!loop.Finished()) {
-        // Run a chunk of loop iterations for _loop_
-
-        // Find the set of loop iterations to run next
-        int64_t indexStart = loop.nextIndex;
-        int64_t indexEnd = std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-        // Update _loop_ to reflect iterations this thread will run
-        loop.nextIndex = indexEnd;
-        if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-        loop.activeWorkers++;
-
-        // Run loop indices in _[indexStart, indexEnd)_
-        lock.unlock();
-        for (int64_t index = indexStart; index < indexEnd; ++index) {
-            uint64_t oldState = ProfilerState;
-            ProfilerState = loop.profilerState;
-            if (loop.func1D) {
-                loop.func1D(index);
-            }
-            // Handle other types of loops
-            else {
-                CHECK(loop.func2D);
-                loop.func2D(Point2i(index % loop.nX, index / loop.nX));
-            }
-            ProfilerState = oldState;
-        }
-        lock.lock();
+void TaskGroup::Run(std::function<void()> func) {
+    if (threads.empty())
+        func();
+    else
+        Spawn(new FunctionTask(&pending, std::move(func)));
+}
 
-        // Update _loop_ to reflect completion of iterations
-        loop.activeWorkers--;
-    }
+void TaskGroup::Wait() {
+    if (pending > 0) RunTasksUntilDone(pending);
 }
 
 int NumSystemCores() {
     return std::max(1u, std::thread::hardware_concurrency());
 }
 
+int NumNumaNodes() { return std::max<int>(1, numaNodes.size()); }
+
+void ParallelFirstTouch(void *ptr, size_t bytes) {
+    // Unpinned threads migrate between nodes, so spreading the pages isn't
+    // worth a parallel loop over every allocation
+    if (!PbrtOptions.pinThreads || NumNumaNodes() < 2) return;
+    // Each chunk is zeroed, and so with the operating system's first-touch
+    // policy placed, by whichever thread runs or steals it
+    const size_t chunkBytes = 64 * 1024;
+    ParallelFor([&](int64_t chunk) {
+        size_t offset = chunk * chunkBytes;
+        memset((char *)ptr + offset, 0, std::min(chunkBytes, bytes - offset));
+    }, (bytes + chunkBytes - 1) / chunkBytes);
+}
+
+std::vector<int64_t> NumaPlacement(const void *ptr, size_t bytes) {
+    std::vector<int64_t> nodeBytes;
+#ifdef PBRT_HAVE_PTHREAD_AFFINITY
+    if (numaNodes.size() < 2 || bytes == 0) return nodeBytes;
+    // Query the node of at most _maxPages_ evenly spaced pages
+    const size_t maxPages = 4096;
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)ptr & ~(pageSize - 1);
+    size_t nPages = ((uintptr_t)ptr + bytes - start + pageSize - 1) / pageSize;
+    size_t stride = (nPages + maxPages - 1) / maxPages;
+    std::vector<void *> pages;
+    for (size_t i = 0; i < nPages; i += stride)
+        pages.push_back((void *)(start + i * pageSize));
+    std::vector<int> status(pages.size());
+    if (syscall(SYS_move_pages, 0, pages.size(), pages.data(), nullptr,
+                status.data(), 0) != 0) {
+        LOG(WARNING) << "move_pages() failed: " << strerror(errno);
+        return nodeBytes;
+    }
+    for (int node : status) {
+        // Pages that were never touched report a negative error code
+        if (node < 0) continue;
+        if (node >= (int)nodeBytes.size()) nodeBytes.resize(node + 1);
+        nodeBytes[node] += bytes / pages.size();
+    }
+#endif
+    return nodeBytes;
+}
+
+void ReportNumaPlacement(const char *title, const void *ptr, size_t bytes) {
+    std::vector<int64_t> nodeBytes = NumaPlacement(ptr, bytes);
+    std::lock_guard<std::mutex> lock(numaStatsMutex);
+    for (size_t node = 0; node < nodeBytes.size(); ++node)
+        if (nodeBytes[node] > 0)
+            numaPlacementBytes[StringPrintf("NUMA/%s on node %d", title,
+                                            (int)node)] += nodeBytes[node];
+}
+
 void ParallelInit() {
     CHECK_EQ(threads.size(), 0);
     int nThreads = MaxThreadIndex();
     ThreadIndex = 0;
+    InitNumaNodes();
+#ifdef PBRT_HAVE_PTHREAD_AFFINITY
+    if (PbrtOptions.pinThreads && !mainThreadPinned &&
+        pthread_getaffinity_np(pthread_self(), sizeof(mainThreadAffinity),
+                               &mainThreadAffinity) == 0) {
+        mainThreadPinned = true;
+        PinThread(0);
+    }
+#endif
+    nTaskDeques = nThreads;
+    taskDeques.clear();
+    for (int i = 0; i < nThreads; ++i)
+        taskDeques.push_back(std::unique_ptr<TaskDeque>(new TaskDeque));
 
     // Create a barrier so that we can be sure all worker threads get past
     // their call to ProfilerWorkerThreadInit() before we return from this
@@ -322,12 +569,20 @@ void ParallelInit() {
 }
 
 void ParallelCleanup() {
+#ifdef PBRT_HAVE_PTHREAD_AFFINITY
+    // Let the main thread run anywhere again
+    if (mainThreadPinned) {
+        pthread_setaffinity_np(pthread_self(), sizeof(mainThreadAffinity),
+                               &mainThreadAffinity);
+        mainThreadPinned = false;
+    }
+#endif
     if (threads.empty()) return;
 
     {
-        std::lock_guard<std::mutex> lock(workListMutex);
+        std::lock_guard<std::mutex> lock(idleMutex);
         shutdownThreads = true;
-        workListCondition.notify_all();
+        idleCondition.notify_all();
     }
 
     for (std::thread &thread : threads) thread.join();
@@ -336,20 +591,17 @@ void ParallelCleanup() {
 }
 
 void MergeWorkerThreadStats() {
-    std::unique_lock<std::mutex> lock(workListMutex);
-    std::unique_lock<std::mutex> doneLock(reportDoneMutex);
+    std::unique_lock<std::mutex> lock(idleMutex);
     // Set up state so that the worker threads will know that we would like
     // them to report their thread-specific stats when they wake up.
-    reportWorkerStats = true;
     reporterCount = threads.size();
+    ++statsGeneration;
 
     // Wake up the worker threads.
-    workListCondition.notify_all();
+    idleCondition.notify_all();
 
     // Wait for all of them to merge their stats.
     reportDoneCondition.wait(lock, []() { return reporterCount == 0; });
-
-    reportWorkerStats = false;
 }
 
 }  // namespace pbrt
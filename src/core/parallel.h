@@ -117,11 +117,51 @@ private:
     int count;
 };
 
+// Runs a dynamic set of tasks in parallel; tasks may add further tasks to
+// the group, or create their own groups and wait for them.  The thread that
+// waits for a group runs pending tasks until all of the group's tasks are
+// done.
+// 任务组：任务可以继续向任务组中添加子任务，或创建并等待新的任务组（嵌套并行）。
+// 等待的线程会帮助执行尚未完成的任务
+class TaskGroup
+{
+public:
+    TaskGroup() : pending(0) {}
+    ~TaskGroup() { Wait(); }
+    void Run(std::function<void()> func);
+    void Wait();
+
+private:
+    std::atomic<int64_t> pending;
+};
+
 void ParallelFor(std::function<void(int64_t)> func, int64_t count, int chunkSize = 1);
 extern PBRT_THREAD_LOCAL int ThreadIndex;
 void ParallelFor2D(std::function<void(Point2i)> func, const Point2i &count);
 int MaxThreadIndex();
 int NumSystemCores();
+int NumNumaNodes();
+
+// Zeroes the given memory from all threads, a chunk of pages at a time.
+// With the operating system's first-touch page placement this spreads a
+// large read-mostly array over the NUMA nodes, rather than placing all of
+// it on the node of the thread that allocated it.  Placement only matters
+// when threads stay on their nodes, so this does nothing unless threads
+// are pinned on a machine with several NUMA nodes; callers must not rely
+// on the memory being zeroed.
+// 由所有线程分块清零内存；在操作系统的首次访问（first-touch）分配策略下，
+// 大块只读数组会分布到各个NUMA节点，而不是全部位于分配它的线程所在节点。
+// 只有线程被绑定且有多个NUMA节点时才执行，调用者不能依赖内存被清零
+void ParallelFirstTouch(void *ptr, size_t bytes);
+// Returns how many of the given bytes reside on each NUMA node, indexed by
+// node id and estimated from a sample of their pages; empty on machines
+// with a single node or if the placement can't be queried
+// 返回内存在各NUMA节点上的字节数（按节点编号索引）；单节点机器上返回空
+std::vector<int64_t> NumaPlacement(const void *ptr, size_t bytes);
+// Adds how many of the given bytes reside on each NUMA node to the
+// statistics; does nothing on machines with a single node
+// 在统计信息中记录内存在各NUMA节点上的分布；单节点机器上不做任何事
+void ReportNumaPlacement(const char *title, const void *ptr, size_t bytes);
 
 void ParallelInit();
 void ParallelCleanup();
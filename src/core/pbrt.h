@@ -171,6 +171,10 @@ struct Matrix4x4;   // 4x4矩阵
 class ParamSet;     // 变量集合
 template <typename T>
 struct ParamSetItem; // 变量集合项
+// Order in which the tiles of the image are rendered
+// 图像块的渲染顺序：逐行、沿希尔伯特曲线、从中心向外螺旋
+enum class TileOrder { Scanline, Hilbert, Spiral };
+
 struct Options
 { // 参数
     Options()
@@ -181,9 +185,16 @@ struct Options
         cropWindow[1][1] = 1;
     }
     int nThreads = 0;         // 线程数
+    bool pinThreads = false;  // 将线程绑定到各NUMA节点的CPU上
     bool quickRender = false; // 快速渲染模式
     bool quiet = false;       // 安静渲染模式
     bool cat = false, toPly = false;
+    int nFrames = 1;       // 快门时间分段渲染的帧数，场景只加载一次
+    TileOrder tileOrder = TileOrder::Hilbert; // 图像块的渲染顺序
+    int tileSize = 0; // 图像块边长，0表示根据分辨率和线程数自动选择
+    bool progressive = false; // 渐进渲染：所有图像块依次渲染1、2、4、8...个采样
+    Float writeInterval = 10; // 渐进渲染时写出中间图像的间隔秒数
+    Float timeLimit = 0;      // 渲染时间上限（秒），0表示不限制
     std::string imageFile; // 图片名称
     // x0, x1, y0, y1
     Float cropWindow[2][2]; // 裁剪
@@ -43,6 +43,25 @@ STAT_MEMORY_COUNTER("Memory/Primitives", primitiveMemory);
 
 // Primitive Method Definitions
 Primitive::~Primitive() {}
+Bounds3f Primitive::ClippedWorldBound(const Bounds3f &clip) const {
+    // Without knowledge of the underlying geometry, the best that can be
+    // done is to clip the primitive's bounds.
+    return pbrt::Intersect(WorldBound(), clip);
+}
+
+void Primitive::IntersectPacket(const Ray *rays, int nRays,
+                                SurfaceInteraction *isects,
+                                bool *hits) const {
+    // Aggregates that can trace coherent rays together override this; by
+    // default each ray is traced on its own.
+    for (int i = 0; i < nRays; ++i) hits[i] = Intersect(rays[i], &isects[i]);
+}
+
+void Primitive::IntersectPBatch(const Ray *rays, int nRays,
+                                bool *occluded) const {
+    for (int i = 0; i < nRays; ++i) occluded[i] = IntersectP(rays[i]);
+}
+
 const AreaLight *Aggregate::GetAreaLight() const {
     LOG(FATAL) <<
         "Aggregate::GetAreaLight() method"
@@ -66,6 +85,16 @@ void Aggregate::ComputeScatteringFunctions(SurfaceInteraction *isect,
         "called; should have gone to GeometricPrimitive";
 }
 
+Bounds3f Primitive::TransformedWorldBound(const Transform &t) const {
+    return t(WorldBound());
+}
+
+bool Primitive::SetTimeRange(Float time0, Float time1) {
+    // Primitives that don't move over the shutter interval have nothing to
+    // update.
+    return false;
+}
+
 // TransformedPrimitive Method Definitions
 TransformedPrimitive::TransformedPrimitive(std::shared_ptr<Primitive> &primitive,
                                            const AnimatedTransform &PrimitiveToWorld)
@@ -88,6 +117,13 @@ bool TransformedPrimitive::Intersect(const Ray &r,
     return true;
 }
 
+bool TransformedPrimitive::SetTimeRange(Float t0, Float t1) {
+    bool changed = primitive->SetTimeRange(t0, t1);
+    time0 = t0;
+    time1 = t1;
+    return changed || PrimitiveToWorld.IsAnimated();
+}
+
 bool TransformedPrimitive::IntersectP(const Ray &r) const {
     Transform InterpolatedPrimToWorld;
     PrimitiveToWorld.Interpolate(r.time, &InterpolatedPrimToWorld);
@@ -95,6 +131,103 @@ bool TransformedPrimitive::IntersectP(const Ray &r) const {
     return primitive->IntersectP(InterpolatedWorldToPrim(r));
 }
 
+// InstancePrimitive Method Definitions
+InstancePrimitive::InstancePrimitive(
+    const std::shared_ptr<Primitive> &primitive,
+    const Transform &InstanceToWorld)
+    : primitive(primitive) {
+    SetTransform(InstanceToWorld);
+    primitiveMemory += sizeof(*this);
+}
+
+bool InstancePrimitive::IsAffine(const Transform &t) {
+    // Both matrices must have $(0,0,0,1)$ as their last row so that they
+    // can be stored without it.
+    for (const Matrix4x4 *m : {&t.GetMatrix(), &t.GetInverseMatrix()})
+        if (m->m[3][0] != 0 || m->m[3][1] != 0 || m->m[3][2] != 0 ||
+            m->m[3][3] != 1)
+            return false;
+    return true;
+}
+
+void InstancePrimitive::SetTransform(const Transform &InstanceToWorld) {
+    CHECK(IsAffine(InstanceToWorld));
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 4; ++j) {
+            instanceToWorld[i][j] = InstanceToWorld.GetMatrix().m[i][j];
+            worldToInstance[i][j] =
+                InstanceToWorld.GetInverseMatrix().m[i][j];
+        }
+    worldBound = primitive->TransformedWorldBound(InstanceToWorld);
+}
+
+Transform InstancePrimitive::GetTransform() const {
+    const Float(&m)[3][4] = instanceToWorld;
+    const Float(&mInv)[3][4] = worldToInstance;
+    return Transform(
+        Matrix4x4(m[0][0], m[0][1], m[0][2], m[0][3], m[1][0], m[1][1],
+                  m[1][2], m[1][3], m[2][0], m[2][1], m[2][2], m[2][3], 0, 0,
+                  0, 1),
+        Matrix4x4(mInv[0][0], mInv[0][1], mInv[0][2], mInv[0][3], mInv[1][0],
+                  mInv[1][1], mInv[1][2], mInv[1][3], mInv[2][0], mInv[2][1],
+                  mInv[2][2], mInv[2][3], 0, 0, 0, 1));
+}
+
+bool InstancePrimitive::SetTimeRange(Float time0, Float time1) {
+    // The instance's transformation is static, but the primitives it
+    // refers to may be animated.
+    if (!primitive->SetTimeRange(time0, time1)) return false;
+    worldBound = primitive->TransformedWorldBound(GetTransform());
+    return true;
+}
+
+// Applies the affine transformation with the upper three rows _m_ to _r_,
+// with the same arithmetic as _Transform::operator()(const Ray &)_.
+static Ray TransformRay(const Float m[3][4], const Ray &r) {
+    Float x = r.o.x, y = r.o.y, z = r.o.z;
+    Point3f o(m[0][0] * x + m[0][1] * y + m[0][2] * z + m[0][3],
+              m[1][0] * x + m[1][1] * y + m[1][2] * z + m[1][3],
+              m[2][0] * x + m[2][1] * y + m[2][2] * z + m[2][3]);
+    Vector3f oError =
+        gamma(3) * Vector3f(std::abs(m[0][0] * x) + std::abs(m[0][1] * y) +
+                                std::abs(m[0][2] * z) + std::abs(m[0][3]),
+                            std::abs(m[1][0] * x) + std::abs(m[1][1] * y) +
+                                std::abs(m[1][2] * z) + std::abs(m[1][3]),
+                            std::abs(m[2][0] * x) + std::abs(m[2][1] * y) +
+                                std::abs(m[2][2] * z) + std::abs(m[2][3]));
+    x = r.d.x, y = r.d.y, z = r.d.z;
+    Vector3f d(m[0][0] * x + m[0][1] * y + m[0][2] * z,
+               m[1][0] * x + m[1][1] * y + m[1][2] * z,
+               m[2][0] * x + m[2][1] * y + m[2][2] * z);
+    // Offset ray origin to edge of error bounds and compute _tMax_
+    Float lengthSquared = d.LengthSquared();
+    Float tMax = r.tMax;
+    if (lengthSquared > 0) {
+        Float dt = Dot(Abs(d), oError) / lengthSquared;
+        o += d * dt;
+        tMax -= dt;
+    }
+    return Ray(o, d, tMax, r.time, r.medium);
+}
+
+bool InstancePrimitive::Intersect(const Ray &r,
+                                  SurfaceInteraction *isect) const {
+    // Compute _ray_ in the instance's coordinate system
+    Ray ray = TransformRay(worldToInstance, r);
+    if (!primitive->Intersect(ray, isect)) return false;
+    r.tMax = ray.tMax;
+    // Transform instance's intersection data to world space; the full
+    // _Transform_ is only needed for hits
+    Transform InstanceToWorld = GetTransform();
+    if (!InstanceToWorld.IsIdentity()) *isect = InstanceToWorld(*isect);
+    CHECK_GE(Dot(isect->n, isect->shading.n), 0);
+    return true;
+}
+
+bool InstancePrimitive::IntersectP(const Ray &r) const {
+    return primitive->IntersectP(TransformRay(worldToInstance, r));
+}
+
 // GeometricPrimitive Method Definitions
 GeometricPrimitive::GeometricPrimitive(const std::shared_ptr<Shape> &shape,
                                        const std::shared_ptr<Material> &material,
@@ -109,6 +242,10 @@ GeometricPrimitive::GeometricPrimitive(const std::shared_ptr<Shape> &shape,
 
 Bounds3f GeometricPrimitive::WorldBound() const { return shape->WorldBound(); }
 
+Bounds3f GeometricPrimitive::ClippedWorldBound(const Bounds3f &clip) const {
+    return shape->ClippedWorldBound(clip);
+}
+
 bool GeometricPrimitive::IntersectP(const Ray &r) const {
     return shape->IntersectP(r);
 }
@@ -117,6 +254,12 @@ bool GeometricPrimitive::Intersect(const Ray &r,
                                    SurfaceInteraction *isect) const {
     Float tHit;
     if (!shape->Intersect(r, &tHit, isect)) return false;
+    FinishIntersection(r, tHit, isect);
+    return true;
+}
+
+void GeometricPrimitive::FinishIntersection(const Ray &r, Float tHit,
+                                            SurfaceInteraction *isect) const {
     r.tMax = tHit;
     isect->primitive = this;
     CHECK_GE(Dot(isect->n, isect->shading.n), 0.);
@@ -126,7 +269,6 @@ bool GeometricPrimitive::Intersect(const Ray &r,
         isect->mediumInterface = mediumInterface;
     else
         isect->mediumInterface = MediumInterface(r.medium);
-    return true;
 }
 
 const AreaLight *GeometricPrimitive::GetAreaLight() const {
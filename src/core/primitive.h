@@ -47,14 +47,34 @@
 
 namespace pbrt {
 
+// Largest number of rays that may be passed to Primitive::IntersectPacket()
+static PBRT_CONSTEXPR int MaxRayPacketSize = 16;
+
 // Primitive Declarations
 class Primitive {
   public:
     // Primitive Interface
     virtual ~Primitive();
     virtual Bounds3f WorldBound() const = 0;
+    // Returns bounds of the part of the primitive inside _clip_; used for
+    // spatial splits when building a BVH.
+    virtual Bounds3f ClippedWorldBound(const Bounds3f &clip) const;
+    // Returns bounds of the primitive after it is transformed by _t_;
+    // aggregates can give tighter bounds than transforming _WorldBound()_.
+    virtual Bounds3f TransformedWorldBound(const Transform &t) const;
+    // Restricts the primitive to the times in $[time0, time1]$, the shutter
+    // interval of the frame being rendered, so that animated primitives can
+    // report tighter bounds. Rays outside that interval must not be traced.
+    // Returns true if the primitive's bounds may have changed.
+    virtual bool SetTimeRange(Float time0, Float time1);
     virtual bool Intersect(const Ray &r, SurfaceInteraction *) const = 0;
     virtual bool IntersectP(const Ray &r) const = 0;
+    virtual void IntersectPacket(const Ray *rays, int nRays,
+                                 SurfaceInteraction *isects, bool *hits) const;
+    // Sets _occluded[i]_ to whether _rays[i]_ hits anything; the rays may
+    // be traced in any order and need not be coherent.
+    virtual void IntersectPBatch(const Ray *rays, int nRays,
+                                 bool *occluded) const;
     virtual const AreaLight *GetAreaLight() const = 0;
     virtual const Material *GetMaterial() const = 0;
     virtual void ComputeScatteringFunctions(SurfaceInteraction *isect,
@@ -68,6 +88,7 @@ class GeometricPrimitive : public Primitive {
   public:
     // GeometricPrimitive Public Methods
     virtual Bounds3f WorldBound() const;
+    virtual Bounds3f ClippedWorldBound(const Bounds3f &clip) const;
     virtual bool Intersect(const Ray &r, SurfaceInteraction *isect) const;
     virtual bool IntersectP(const Ray &r) const;
     GeometricPrimitive(const std::shared_ptr<Shape> &shape,
@@ -76,6 +97,11 @@ class GeometricPrimitive : public Primitive {
                        const MediumInterface &mediumInterface);
     const AreaLight *GetAreaLight() const;
     const Material *GetMaterial() const;
+    const Shape *GetShape() const { return shape.get(); }
+    // Completes _isect_ for a hit on _shape_ at _tHit_ that the caller has
+    // already computed, as Intersect() does after intersecting the shape
+    void FinishIntersection(const Ray &r, Float tHit,
+                            SurfaceInteraction *isect) const;
     void ComputeScatteringFunctions(SurfaceInteraction *isect,
                                     MemoryArena &arena, TransportMode mode,
                                     bool allowMultipleLobes) const;
@@ -106,13 +132,51 @@ class TransformedPrimitive : public Primitive {
             "called";
     }
     Bounds3f WorldBound() const {
-        return PrimitiveToWorld.MotionBounds(primitive->WorldBound());
+        return PrimitiveToWorld.MotionBounds(primitive->WorldBound(), time0,
+                                             time1);
     }
+    bool SetTimeRange(Float time0, Float time1);
 
   private:
     // TransformedPrimitive Private Data
     std::shared_ptr<Primitive> primitive;
     const AnimatedTransform PrimitiveToWorld;
+    Float time0 = -Infinity, time1 = Infinity;
+};
+
+// InstancePrimitive Declarations
+// A shared primitive, usually the aggregate of an object instance, placed
+// with a static affine transformation.  Only the upper three rows of the
+// transformation and its inverse are stored, which makes instances much
+// smaller than _TransformedPrimitive_s and lets their transformation be
+// updated in place.
+class InstancePrimitive : public Primitive {
+  public:
+    // InstancePrimitive Public Methods
+    InstancePrimitive(const std::shared_ptr<Primitive> &primitive,
+                      const Transform &InstanceToWorld);
+    static bool IsAffine(const Transform &t);
+    void SetTransform(const Transform &InstanceToWorld);
+    Transform GetTransform() const;
+    bool Intersect(const Ray &r, SurfaceInteraction *in) const;
+    bool IntersectP(const Ray &r) const;
+    const AreaLight *GetAreaLight() const { return nullptr; }
+    const Material *GetMaterial() const { return nullptr; }
+    void ComputeScatteringFunctions(SurfaceInteraction *isect,
+                                    MemoryArena &arena, TransportMode mode,
+                                    bool allowMultipleLobes) const {
+        LOG(FATAL) <<
+            "InstancePrimitive::ComputeScatteringFunctions() shouldn't be "
+            "called";
+    }
+    Bounds3f WorldBound() const { return worldBound; }
+    bool SetTimeRange(Float time0, Float time1);
+
+  private:
+    // InstancePrimitive Private Data
+    std::shared_ptr<Primitive> primitive;
+    Float instanceToWorld[3][4], worldToInstance[3][4];
+    Bounds3f worldBound;
 };
 
 // Aggregate Declarations
@@ -666,6 +666,85 @@ Spectrum BxDF::rho(int nSamples, const Point2f *u1, const Point2f *u2) const {
     return r / (Pi * nSamples);
 }
 
+// BxDF Dispatch
+// Each of these calls one BxDF method. The templated operator() names the
+// method of the concrete BxDF type so that the call is direct and can be
+// inlined; the _BxDF_ overload is the virtual fallback.
+struct BxDFEval {
+    const Vector3f &wo, &wi;
+    template <typename T>
+    Spectrum operator()(const T *bxdf) const {
+        return bxdf->T::f(wo, wi);
+    }
+    Spectrum operator()(const BxDF *bxdf) const { return bxdf->f(wo, wi); }
+};
+
+struct BxDFPdf {
+    const Vector3f &wo, &wi;
+    template <typename T>
+    Float operator()(const T *bxdf) const {
+        return bxdf->T::Pdf(wo, wi);
+    }
+    Float operator()(const BxDF *bxdf) const { return bxdf->Pdf(wo, wi); }
+};
+
+struct BxDFSample {
+    const Vector3f &wo;
+    Vector3f *wi;
+    const Point2f &u;
+    Float *pdf;
+    BxDFType *sampledType;
+    template <typename T>
+    Spectrum operator()(const T *bxdf) const {
+        return bxdf->T::Sample_f(wo, wi, u, pdf, sampledType);
+    }
+    // The diffuse reflection models use _BxDF::Sample_f()_, which would
+    // call back into the virtual _f()_
+    Spectrum operator()(const LambertianReflection *bxdf) const {
+        return CosineSample(bxdf);
+    }
+    Spectrum operator()(const OrenNayar *bxdf) const {
+        return CosineSample(bxdf);
+    }
+    Spectrum operator()(const BxDF *bxdf) const {
+        return bxdf->Sample_f(wo, wi, u, pdf, sampledType);
+    }
+    template <typename T>
+    Spectrum CosineSample(const T *bxdf) const {
+        *wi = CosineSampleHemisphere(u);
+        if (wo.z < 0) wi->z *= -1;
+        *pdf = bxdf->BxDF::Pdf(wo, *wi);
+        return bxdf->T::f(wo, *wi);
+    }
+};
+
+template <typename Op>
+static inline auto DispatchBxDF(const BxDF *bxdf, BxDFKind kind, const Op &op)
+    -> decltype(op(bxdf)) {
+    switch (kind) {
+    case BxDFKind::SpecularReflection:
+        return op(static_cast<const SpecularReflection *>(bxdf));
+    case BxDFKind::SpecularTransmission:
+        return op(static_cast<const SpecularTransmission *>(bxdf));
+    case BxDFKind::FresnelSpecular:
+        return op(static_cast<const FresnelSpecular *>(bxdf));
+    case BxDFKind::LambertianReflection:
+        return op(static_cast<const LambertianReflection *>(bxdf));
+    case BxDFKind::LambertianTransmission:
+        return op(static_cast<const LambertianTransmission *>(bxdf));
+    case BxDFKind::OrenNayar:
+        return op(static_cast<const OrenNayar *>(bxdf));
+    case BxDFKind::MicrofacetReflection:
+        return op(static_cast<const MicrofacetReflection *>(bxdf));
+    case BxDFKind::MicrofacetTransmission:
+        return op(static_cast<const MicrofacetTransmission *>(bxdf));
+    case BxDFKind::FresnelBlend:
+        return op(static_cast<const FresnelBlend *>(bxdf));
+    default:
+        return op(bxdf);
+    }
+}
+
 // BSDF Method Definitions
 Spectrum BSDF::f(const Vector3f &woW, const Vector3f &wiW,
                  BxDFType flags) const {
@@ -678,7 +757,7 @@ Spectrum BSDF::f(const Vector3f &woW, const Vector3f &wiW,
         if (bxdfs[i]->MatchesFlags(flags) &&
             ((reflect && (bxdfs[i]->type & BSDF_REFLECTION)) ||
              (!reflect && (bxdfs[i]->type & BSDF_TRANSMISSION))))
-            f += bxdfs[i]->f(wo, wi);
+            f += DispatchBxDF(bxdfs[i], kinds[i], BxDFEval{wo, wi});
     return f;
 }
 
@@ -716,10 +795,12 @@ Spectrum BSDF::Sample_f(const Vector3f &woWorld, Vector3f *wiWorld,
 
     // Get _BxDF_ pointer for chosen component
     BxDF *bxdf = nullptr;
+    BxDFKind kind = BxDFKind::Virtual;
     int count = comp;
     for (int i = 0; i < nBxDFs; ++i)
         if (bxdfs[i]->MatchesFlags(type) && count-- == 0) {
             bxdf = bxdfs[i];
+            kind = kinds[i];
             break;
         }
     CHECK(bxdf != nullptr);
@@ -735,7 +816,8 @@ Spectrum BSDF::Sample_f(const Vector3f &woWorld, Vector3f *wiWorld,
     if (wo.z == 0) return 0.;
     *pdf = 0;
     if (sampledType) *sampledType = bxdf->type;
-    Spectrum f = bxdf->Sample_f(wo, &wi, uRemapped, pdf, sampledType);
+    Spectrum f = DispatchBxDF(
+        bxdf, kind, BxDFSample{wo, &wi, uRemapped, pdf, sampledType});
     VLOG(2) << "For wo = " << wo << ", sampled f = " << f << ", pdf = "
             << *pdf << ", ratio = " << ((*pdf > 0) ? (f / *pdf) : Spectrum(0.))
             << ", wi = " << wi;
@@ -749,7 +831,7 @@ Spectrum BSDF::Sample_f(const Vector3f &woWorld, Vector3f *wiWorld,
     if (!(bxdf->type & BSDF_SPECULAR) && matchingComps > 1)
         for (int i = 0; i < nBxDFs; ++i)
             if (bxdfs[i] != bxdf && bxdfs[i]->MatchesFlags(type))
-                *pdf += bxdfs[i]->Pdf(wo, wi);
+                *pdf += DispatchBxDF(bxdfs[i], kinds[i], BxDFPdf{wo, wi});
     if (matchingComps > 1) *pdf /= matchingComps;
 
     // Compute value of BSDF for sampled direction
@@ -760,7 +842,7 @@ Spectrum BSDF::Sample_f(const Vector3f &woWorld, Vector3f *wiWorld,
             if (bxdfs[i]->MatchesFlags(type) &&
                 ((reflect && (bxdfs[i]->type & BSDF_REFLECTION)) ||
                  (!reflect && (bxdfs[i]->type & BSDF_TRANSMISSION))))
-                f += bxdfs[i]->f(wo, wi);
+                f += DispatchBxDF(bxdfs[i], kinds[i], BxDFEval{wo, wi});
     }
     VLOG(2) << "Overall f = " << f << ", pdf = " << *pdf << ", ratio = "
             << ((*pdf > 0) ? (f / *pdf) : Spectrum(0.));
@@ -778,7 +860,7 @@ Float BSDF::Pdf(const Vector3f &woWorld, const Vector3f &wiWorld,
     for (int i = 0; i < nBxDFs; ++i)
         if (bxdfs[i]->MatchesFlags(flags)) {
             ++matchingComps;
-            pdf += bxdfs[i]->Pdf(wo, wi);
+            pdf += DispatchBxDF(bxdfs[i], kinds[i], BxDFPdf{wo, wi});
         }
     Float v = matchingComps > 0 ? pdf / matchingComps : 0.f;
     return v;
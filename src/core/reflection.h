@@ -41,6 +41,7 @@
 // core/reflection.h*
 #include "pbrt.h"
 #include "geometry.h"
+#include "memory.h"
 #include "microfacet.h"
 #include "shape.h"
 #include "spectrum.h"
@@ -126,6 +127,26 @@ enum BxDFType {
                BSDF_TRANSMISSION,
 };
 
+// BxDFKind identifies the built-in BxDFs that _BSDF_ calls directly rather
+// than through their virtual methods; all other BxDFs are _Virtual_.
+enum class BxDFKind : uint8_t {
+    Virtual,
+    SpecularReflection,
+    SpecularTransmission,
+    FresnelSpecular,
+    LambertianReflection,
+    LambertianTransmission,
+    OrenNayar,
+    MicrofacetReflection,
+    MicrofacetTransmission,
+    FresnelBlend
+};
+
+template <typename T>
+struct BxDFKindOf {
+    static PBRT_CONSTEXPR BxDFKind value = BxDFKind::Virtual;
+};
+
 struct FourierBSDFTable {
     // FourierBSDFTable Public Data
     Float eta;
@@ -159,10 +180,17 @@ class BSDF {
           ng(si.n),
           ss(Normalize(si.shading.dpdu)),
           ts(Cross(ns, ss)) {}
+    BSDF(const BSDF &) = delete;
+    BSDF &operator=(const BSDF &) = delete;
     void Add(BxDF *b) {
         CHECK_LT(nBxDFs, MaxBxDFs);
+        kinds[nBxDFs] = BxDFKind::Virtual;
         bxdfs[nBxDFs++] = b;
     }
+    // Constructs a _T_ in the BSDF's own storage, or in _arena_ if it does
+    // not fit; the built-in BxDFs added this way are called directly.
+    template <typename T, typename... Args>
+    T *Emplace(MemoryArena &arena, Args &&... args);
     int NumComponents(BxDFType flags = BSDF_ALL) const;
     Vector3f WorldToLocal(const Vector3f &v) const {
         return Vector3f(Dot(v, ss), Dot(v, ts), Dot(v, ns));
@@ -198,6 +226,12 @@ class BSDF {
     int nBxDFs = 0;
     static PBRT_CONSTEXPR int MaxBxDFs = 8;
     BxDF *bxdfs[MaxBxDFs];
+    BxDFKind kinds[MaxBxDFs];
+    // BxDFs added with Emplace() are stored here, next to the BSDF, as long
+    // as they fit; larger ones go to the arena.
+    static PBRT_CONSTEXPR int InlineBxDFBytes = 256;
+    int inlineBytesUsed = 0;
+    uint64_t inlineBxDFs[InlineBxDFBytes / sizeof(uint64_t)];
     friend class MixMaterial;
 };
 
@@ -516,7 +550,62 @@ class FourierBSDF : public BxDF {
     const TransportMode mode;
 };
 
+template <>
+struct BxDFKindOf<SpecularReflection> {
+    static PBRT_CONSTEXPR BxDFKind value = BxDFKind::SpecularReflection;
+};
+template <>
+struct BxDFKindOf<SpecularTransmission> {
+    static PBRT_CONSTEXPR BxDFKind value = BxDFKind::SpecularTransmission;
+};
+template <>
+struct BxDFKindOf<FresnelSpecular> {
+    static PBRT_CONSTEXPR BxDFKind value = BxDFKind::FresnelSpecular;
+};
+template <>
+struct BxDFKindOf<LambertianReflection> {
+    static PBRT_CONSTEXPR BxDFKind value = BxDFKind::LambertianReflection;
+};
+template <>
+struct BxDFKindOf<LambertianTransmission> {
+    static PBRT_CONSTEXPR BxDFKind value = BxDFKind::LambertianTransmission;
+};
+template <>
+struct BxDFKindOf<OrenNayar> {
+    static PBRT_CONSTEXPR BxDFKind value = BxDFKind::OrenNayar;
+};
+template <>
+struct BxDFKindOf<MicrofacetReflection> {
+    static PBRT_CONSTEXPR BxDFKind value = BxDFKind::MicrofacetReflection;
+};
+template <>
+struct BxDFKindOf<MicrofacetTransmission> {
+    static PBRT_CONSTEXPR BxDFKind value = BxDFKind::MicrofacetTransmission;
+};
+template <>
+struct BxDFKindOf<FresnelBlend> {
+    static PBRT_CONSTEXPR BxDFKind value = BxDFKind::FresnelBlend;
+};
+
 // BSDF Inline Method Definitions
+template <typename T, typename... Args>
+T *BSDF::Emplace(MemoryArena &arena, Args &&... args) {
+    CHECK_LT(nBxDFs, MaxBxDFs);
+    // Round the size up so that the next BxDF is aligned as well
+    int size = (sizeof(T) + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+    T *bxdf;
+    if (alignof(T) <= alignof(uint64_t) &&
+        inlineBytesUsed + size <= InlineBxDFBytes) {
+        bxdf = new ((uint8_t *)inlineBxDFs + inlineBytesUsed)
+            T(std::forward<Args>(args)...);
+        inlineBytesUsed += size;
+    } else
+        bxdf = ARENA_ALLOC(arena, T)(std::forward<Args>(args)...);
+    kinds[nBxDFs] = BxDFKindOf<T>::value;
+    bxdfs[nBxDFs++] = bxdf;
+    return bxdf;
+}
+
 inline int BSDF::NumComponents(BxDFType flags) const {
     int num = 0;
     for (int i = 0; i < nBxDFs; ++i)
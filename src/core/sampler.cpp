@@ -40,6 +40,19 @@
 namespace pbrt {
 
 // Sampler Method Definitions
+uint64_t PixelRNGSequence(const Point2i &p, int64_t stream) {
+    auto mixBits = [](uint64_t v) {
+        v ^= v >> 31;
+        v *= 0x7fb5d329728ea185ull;
+        v ^= v >> 27;
+        v *= 0x81dadef4bc2dd44dull;
+        v ^= v >> 33;
+        return v;
+    };
+    uint64_t pixel = (uint64_t(uint32_t(p.x)) << 32) | uint32_t(p.y);
+    return mixBits(mixBits(pixel) ^ uint64_t(stream));
+}
+
 Sampler::~Sampler() {}
 
 Sampler::Sampler(int64_t samplesPerPixel) : samplesPerPixel(samplesPerPixel) {}
@@ -71,6 +84,15 @@ bool Sampler::SetSampleNumber(int64_t sampleNum) {
     return currentPixelSampleIndex < samplesPerPixel;
 }
 
+size_t Sampler::PixelStateBytes() const {
+    size_t bytes = 0;
+    for (const std::vector<Float> &a : sampleArray1D)
+        bytes += a.size() * sizeof(Float);
+    for (const std::vector<Point2f> &a : sampleArray2D)
+        bytes += a.size() * sizeof(Point2f);
+    return bytes;
+}
+
 void Sampler::Request1DArray(int n) {
     CHECK_EQ(RoundCount(n), n);
     samples1DArraySizes.push_back(n);
@@ -105,16 +127,36 @@ PixelSampler::PixelSampler(int64_t samplesPerPixel, int nSampledDimensions)
     }
 }
 
+void PixelSampler::StartPixel(const Point2i &p) {
+    // Subclasses generate the pixel's samples from stream 0 before calling
+    // this; dimensions beyond them are drawn from the sample's stream
+    Sampler::StartPixel(p);
+    rng.SetSequence(PixelRNGSequence(p, 1));
+}
+
 bool PixelSampler::StartNextSample() {
     current1DDimension = current2DDimension = 0;
-    return Sampler::StartNextSample();
+    bool more = Sampler::StartNextSample();
+    rng.SetSequence(
+        PixelRNGSequence(currentPixel, currentPixelSampleIndex + 1));
+    return more;
 }
 
 bool PixelSampler::SetSampleNumber(int64_t sampleNum) {
     current1DDimension = current2DDimension = 0;
+    rng.SetSequence(PixelRNGSequence(currentPixel, sampleNum + 1));
     return Sampler::SetSampleNumber(sampleNum);
 }
 
+size_t PixelSampler::PixelStateBytes() const {
+    size_t bytes = Sampler::PixelStateBytes();
+    for (const std::vector<Float> &s : samples1D)
+        bytes += s.size() * sizeof(Float);
+    for (const std::vector<Point2f> &s : samples2D)
+        bytes += s.size() * sizeof(Point2f);
+    return bytes;
+}
+
 Float PixelSampler::Get1D() {
     ProfilePhase _(Prof::GetSample);
     CHECK_LT(currentPixelSampleIndex, samplesPerPixel);
@@ -49,6 +49,16 @@ namespace pbrt
 
 // Sampler Declarations
 // Sampler 声明
+// Returns an RNG sequence index that depends only on the pixel and
+// _stream_. Samplers that draw random numbers restart their RNG at such
+// sequences, stream 0 for the per-pixel samples and stream $i+1$ for
+// sample $i$, so that a pixel's sample values don't depend on the order in
+// which pixels and samples are rendered, e.g. in progressive passes.
+// 返回只由像素和 _stream_ 决定的随机数序列号。使用随机数的采样器在这些序列
+// 处重新开始，像素级采样用序列0，第i个采样用序列i+1，使像素的采样值与像素
+// 和采样的渲染顺序（例如渐进渲染的各遍）无关
+uint64_t PixelRNGSequence(const Point2i &p, int64_t stream);
+
 class Sampler
 {
 public:
@@ -74,6 +84,10 @@ public:
                             currentPixel.y, currentPixelSampleIndex);
     }
     int64_t CurrentSampleNumber() const { return currentPixelSampleIndex; }
+    // Returns the bytes of sample values the sampler stores for a pixel,
+    // which grow with the number of samples per pixel for some samplers
+    // 返回采样器为一个像素存储的采样值字节数，部分采样器随每像素采样数增长
+    virtual size_t PixelStateBytes() const;
 
     // Sampler Public Data
     // Sampler 公有数据
@@ -100,10 +114,12 @@ public:
     // PixelSampler Public Methods
     // PixelSampler 公有方法
     PixelSampler(int64_t samplesPerPixel, int nSampledDimensions);
+    void StartPixel(const Point2i &p);
     bool StartNextSample();
     bool SetSampleNumber(int64_t);
     Float Get1D();
     Point2f Get2D();
+    size_t PixelStateBytes() const;
 
 protected:
     // PixelSampler Protected Data
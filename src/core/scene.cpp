@@ -48,12 +48,32 @@ bool Scene::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
     return aggregate->Intersect(ray, isect);
 }
 
+void Scene::IntersectPacket(const Ray *rays, int nRays,
+                            SurfaceInteraction *isects, bool *hits) const {
+    nIntersectionTests += nRays;
+    for (int i = 0; i < nRays; ++i) DCHECK_NE(rays[i].d, Vector3f(0,0,0));
+    aggregate->IntersectPacket(rays, nRays, isects, hits);
+}
+
 bool Scene::IntersectP(const Ray &ray) const {
     ++nShadowTests;
     DCHECK_NE(ray.d, Vector3f(0,0,0));
     return aggregate->IntersectP(ray);
 }
 
+void Scene::IntersectPBatch(const Ray *rays, int nRays, bool *occluded) const {
+    nShadowTests += nRays;
+    for (int i = 0; i < nRays; ++i) DCHECK_NE(rays[i].d, Vector3f(0,0,0));
+    aggregate->IntersectPBatch(rays, nRays, occluded);
+}
+
+void Scene::SetTimeRange(Float time0, Float time1) {
+    if (!aggregate->SetTimeRange(time0, time1)) return;
+    worldBound = aggregate->WorldBound();
+    // Lights that depend on the scene's extent need to see the new bounds
+    for (const auto &light : lights) light->Preprocess(*this);
+}
+
 bool Scene::IntersectTr(Ray ray, Sampler &sampler, SurfaceInteraction *isect,
                         Spectrum *Tr) const {
     *Tr = Spectrum(1.f);
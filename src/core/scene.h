@@ -73,8 +73,18 @@ public:
     bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
     // 光线与场景求交，如果相交，返回true，但不计算相交信息，所以更快
     bool IntersectP(const Ray &ray) const;
+    // 一次求交多条光线，方向相近的光线（如相机光线）可以一起遍历加速结构
+    void IntersectPacket(const Ray *rays, int nRays,
+                         SurfaceInteraction *isects, bool *hits) const;
+    // 一次测试多条阴影光线是否被遮挡，每条光线遇到第一个交点即停止；
+    // BVH 按方向卦限排序后逐条遍历，使相邻光线访问相同的节点（提高缓存命中），
+    // 并不做打包遍历
+    void IntersectPBatch(const Ray *rays, int nRays, bool *occluded) const;
     bool IntersectTr(Ray ray, Sampler &sampler, SurfaceInteraction *isect,
                      Spectrum *transmittance) const;
+    // 将场景限制在 [time0, time1] 时间段（某一帧的快门时间），
+    // 重新计算运动图元的包围盒，而不需要重新构建加速结构
+    void SetTimeRange(Float time0, Float time1);
 
     // Scene Public Data
     // Scene 公有数据
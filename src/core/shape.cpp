@@ -54,6 +54,10 @@ Shape::Shape(const Transform *ObjectToWorld, const Transform *WorldToObject,
 
 Bounds3f Shape::WorldBound() const { return (*ObjectToWorld)(ObjectBound()); }
 
+Bounds3f Shape::ClippedWorldBound(const Bounds3f &clip) const {
+    return pbrt::Intersect(WorldBound(), clip);
+}
+
 Interaction Shape::Sample(const Interaction &ref, const Point2f &u,
                           Float *pdf) const
 {
@@ -60,6 +60,10 @@ public:
     virtual ~Shape();
     virtual Bounds3f ObjectBound() const = 0; // 模型空间包围盒
     virtual Bounds3f WorldBound() const;      // 世界空间包围盒，默认实现：将模型空间包围盒转换到世界空间，再求包围盒
+    // Bounds of the part of the shape inside _clip_, for BVH spatial
+    // splits; the default just intersects _clip_ with the world bounds.
+    // 形状在_clip_内部分的世界空间包围盒，用于BVH空间划分
+    virtual Bounds3f ClippedWorldBound(const Bounds3f &clip) const;
 
     // 求交，并返回交点信息，ray为世界空间表示，返回的信息也应为世界空间表示
     virtual bool Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
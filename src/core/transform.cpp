@@ -1151,6 +1151,12 @@ Vector3f AnimatedTransform::operator()(Float time, const Vector3f &v) const
 }
 
 Bounds3f AnimatedTransform::MotionBounds(const Bounds3f &b) const
+{
+    return MotionBounds(b, startTime, endTime);
+}
+
+Bounds3f AnimatedTransform::MotionBounds(const Bounds3f &b, Float time0,
+                                         Float time1) const
 {
     // 如果没有运动，直接返回起点的变换
     if (!actuallyAnimated)
@@ -1158,22 +1164,43 @@ Bounds3f AnimatedTransform::MotionBounds(const Bounds3f &b) const
 
     // 如果没有旋转，则只要计算包含起点和终点位置的包围盒
     if (hasRotation == false)
-        return Union((*startTransform)(b), (*endTransform)(b));
+    {
+        Transform t0, t1;
+        Interpolate(time0, &t0);
+        Interpolate(time1, &t1);
+        return Union(t0(b), t1(b));
+    }
 
     // Return motion bounds accounting for animated rotation
     // 如果包含旋转，则分别计算八个顶点在整个时间段运动轨迹的包围盒，再合并
     Bounds3f bounds;
     for (int corner = 0; corner < 8; ++corner)
-        bounds = Union(bounds, BoundPointMotion(b.Corner(corner)));
+        bounds = Union(bounds,
+                       BoundPointMotion(b.Corner(corner), time0, time1));
     return bounds;
 }
 
 // 计算一个顶点在整个时间段的运动轨迹的包围盒
 Bounds3f AnimatedTransform::BoundPointMotion(const Point3f &p) const
+{
+    return BoundPointMotion(p, startTime, endTime);
+}
+
+// 计算一个顶点在 [time0, time1] 时间段的运动轨迹的包围盒
+Bounds3f AnimatedTransform::BoundPointMotion(const Point3f &p, Float time0,
+                                             Float time1) const
 {
     if (!actuallyAnimated)
         return Bounds3f((*startTransform)(p));
-    Bounds3f bounds((*startTransform)(p), (*endTransform)(p));
+    Bounds3f bounds((*this)(time0, p), (*this)(time1, p));
+    // Map the time range to the $[0,1]$ parameterization of the motion
+    auto toMotionTime = [&](Float time) -> Float {
+        if (time <= startTime) return 0;
+        if (time >= endTime) return 1;
+        return (time - startTime) / (endTime - startTime);
+    };
+    Float u0 = toMotionTime(time0), u1 = toMotionTime(time1);
+    if (u0 >= u1) return bounds;
     Float cosTheta = Dot(R[0], R[1]);
     Float theta = std::acos(Clamp(cosTheta, -1, 1));
     for (int c = 0; c < 3; ++c)
@@ -1183,8 +1210,8 @@ Bounds3f AnimatedTransform::BoundPointMotion(const Point3f &p) const
         Float zeros[8];
         int nZeros = 0;
         IntervalFindZeros(c1[c].Eval(p), c2[c].Eval(p), c3[c].Eval(p),
-                          c4[c].Eval(p), c5[c].Eval(p), theta, Interval(0., 1.),
-                          zeros, &nZeros);
+                          c4[c].Eval(p), c5[c].Eval(p), theta,
+                          Interval(u0, u1), zeros, &nZeros);
         CHECK_LE(nZeros, sizeof(zeros) / sizeof(zeros[0]));
 
         // Expand bounding box for any motion derivative zeros found
@@ -560,8 +560,14 @@ public:
     {
         return startTransform->HasScale() || endTransform->HasScale();
     }
+    // 起点和终点变换是否不同
+    bool IsAnimated() const { return actuallyAnimated; }
     Bounds3f MotionBounds(const Bounds3f &b) const;
     Bounds3f BoundPointMotion(const Point3f &p) const;
+    // 只计算 [time0, time1] 时间段内的运动包围盒，用于逐帧渲染动画
+    Bounds3f MotionBounds(const Bounds3f &b, Float time0, Float time1) const;
+    Bounds3f BoundPointMotion(const Point3f &p, Float time0,
+                              Float time1) const;
 
 private:
     // AnimatedTransform Private Data
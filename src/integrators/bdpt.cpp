@@ -314,11 +314,24 @@ void BDPTIntegrator::Render(const Scene &scene) {
     // Partition the image into tiles
     Film *film = camera->film;
     const Bounds2i sampleBounds = film->GetSampleBounds();
-    const Vector2i sampleExtent = sampleBounds.Diagonal();
-    const int tileSize = 16;
-    const int nXTiles = (sampleExtent.x + tileSize - 1) / tileSize;
-    const int nYTiles = (sampleExtent.y + tileSize - 1) / tileSize;
-    ProgressReporter reporter(nXTiles * nYTiles, "Rendering");
+    TileSchedule schedule(sampleBounds);
+    const int64_t spp = sampler->samplesPerPixel;
+    Float limit = timeLimit;
+    if (film->Streaming()) {
+        // The streaming film needs each tile to be merged once; light
+        // tracing's splats are kept in its temporary files
+        if (limit > 0)
+            Warning("Ignoring the time limit, which the streaming film "
+                    "doesn't support.");
+        limit = 0;
+        std::vector<Bounds2i> tileBounds;
+        for (const Point2i &tile : schedule.Tiles())
+            tileBounds.push_back(schedule.TileBounds(tile));
+        film->StreamTiles(tileBounds, true);
+    }
+    RenderBudget budget(limit, spp);
+    ProgressReporter reporter(
+        schedule.TileCount() * (budget.Limited() ? spp : 1), "Rendering");
 
     // Allocate buffers for debug visualization
     const int bufferCount = (1 + maxDepth) * (6 + maxDepth) / 2;
@@ -343,17 +356,17 @@ void BDPTIntegrator::Render(const Scene &scene) {
 
     // Render and write the output image to disk
     if (scene.lights.size() > 0) {
-        ParallelFor2D([&](const Point2i tile) {
-            // Render a single tile using BDPT
-            MemoryArena arena;
-            int seed = tile.y * nXTiles + tile.x;
-            std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
-            int x0 = sampleBounds.pMin.x + tile.x * tileSize;
-            int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
-            int y0 = sampleBounds.pMin.y + tile.y * tileSize;
-            int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
-            Bounds2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
-            LOG(INFO) << "Starting image tile " << tileBounds;
+        // Each thread reuses one arena for all of its tiles
+        std::vector<MemoryArena> arenas(MaxThreadIndex());
+        auto renderTile = [&](const Point2i &tile, int64_t firstSample,
+                              int64_t endSample) {
+            // Render samples $[firstSample, endSample)$ of _tile_ using BDPT
+            MemoryArena &arena = arenas[ThreadIndex];
+            std::unique_ptr<Sampler> tileSampler =
+                sampler->Clone(schedule.Seed(tile));
+            Bounds2i tileBounds = schedule.TileBounds(tile);
+            LOG(INFO) << "Starting image tile " << tileBounds << ", samples "
+                      << firstSample << " to " << endSample;
 
             std::unique_ptr<FilmTile> filmTile =
                 camera->film->GetFilmTile(tileBounds);
@@ -361,6 +374,7 @@ void BDPTIntegrator::Render(const Scene &scene) {
                 tileSampler->StartPixel(pPixel);
                 if (!InsideExclusive(pPixel, pixelBounds))
                     continue;
+                if (firstSample > 0) tileSampler->SetSampleNumber(firstSample);
                 do {
                     // Generate a single sample using BDPT
                     Point2f pFilm = (Point2f)pPixel + tileSampler->Get2D();
@@ -423,19 +437,40 @@ void BDPTIntegrator::Render(const Scene &scene) {
                         ", (y: " << L.y() << ")";
                     filmTile->AddSample(pFilm, L);
                     arena.Reset();
-                } while (tileSampler->StartNextSample());
+                } while (tileSampler->StartNextSample() &&
+                         tileSampler->CurrentSampleNumber() < endSample);
             }
             film->MergeFilmTile(std::move(filmTile));
-            reporter.Update();
+            budget.AddSamples(OverlapArea(tileBounds, pixelBounds) *
+                              (endSample - firstSample));
+            reporter.Update(budget.Limited() ? endSample - firstSample : 1);
             LOG(INFO) << "Finished image tile " << tileBounds;
-        }, Point2i(nXTiles, nYTiles));
+        };
+
+        // With a time limit, render the samples of all tiles in passes of
+        // doubling size until the time is spent
+        int64_t firstSample = 0;
+        while (firstSample < spp && !budget.OutOfTime(firstSample)) {
+            int64_t endSample = budget.PassEnd(firstSample);
+            schedule.Reset();
+            ParallelFor([&](int64_t) {
+                Point2i tile = schedule.NextTile();
+                if (!budget.OutOfTime(firstSample))
+                    renderTile(tile, firstSample, endSample);
+            }, schedule.TileCount());
+            firstSample = endSample;
+        }
         reporter.Done();
     }
-    film->WriteImage(1.0f / sampler->samplesPerPixel);
+    // Splats are normalized by the mean number of samples taken per pixel,
+    // which also accounts for tiles that missed the last pass
+    budget.Report(film, pixelBounds.Area());
+    Float achievedSpp = budget.SamplesPerPixel(pixelBounds.Area());
+    const Float invSampleCount = achievedSpp > 0 ? 1 / achievedSpp : 0;
+    film->WriteImage(invSampleCount);
 
     // Write buffers for debug visualization
     if (visualizeStrategies || visualizeWeights) {
-        const Float invSampleCount = 1.0f / sampler->samplesPerPixel;
         for (size_t i = 0; i < weightFilms.size(); ++i)
             if (weightFilms[i]) weightFilms[i]->WriteImage(invSampleCount);
     }
@@ -50,8 +50,9 @@ PathIntegrator::PathIntegrator(int maxDepth,
                                std::shared_ptr<const Camera> camera,
                                std::shared_ptr<Sampler> sampler,
                                const Bounds2i &pixelBounds, Float rrThreshold,
-                               const std::string &lightSampleStrategy)
-    : SamplerIntegrator(camera, sampler, pixelBounds),
+                               const std::string &lightSampleStrategy,
+                               int packetSize)
+    : SamplerIntegrator(camera, sampler, pixelBounds, packetSize),
       maxDepth(maxDepth),
       rrThreshold(rrThreshold),
       lightSampleStrategy(lightSampleStrategy) {}
@@ -65,6 +66,18 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
                             Sampler &sampler, MemoryArena &arena,
                             int depth) const {
     ProfilePhase p(Prof::SamplerIntegratorLi);
+    RayDifferential ray(r);
+    SurfaceInteraction isect;
+    bool foundIntersection = scene.Intersect(ray, &isect);
+    return LiFromHit(ray, foundIntersection, isect, scene, sampler, arena);
+}
+
+Spectrum PathIntegrator::LiFromHit(const RayDifferential &r,
+                                   bool foundCameraIntersection,
+                                   const SurfaceInteraction &cameraIsect,
+                                   const Scene &scene, Sampler &sampler,
+                                   MemoryArena &arena) const {
+    ProfilePhase p(Prof::SamplerIntegratorLi);
     Spectrum L(0.f), beta(1.f);
     RayDifferential ray(r);
     bool specularBounce = false;
@@ -77,6 +90,7 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
     // avoid terminating refracted rays that are about to be refracted back
     // out of a medium and thus have their beta value increased.
     Float etaScale = 1;
+    bool useCameraIntersection = true;
 
     for (bounces = 0;; ++bounces) {
         // Find next path vertex and accumulate contribution
@@ -84,8 +98,15 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
                 << ", beta = " << beta;
 
         // Intersect _ray_ with scene and store intersection in _isect_
+        // (The first one has already been found by the caller.)
         SurfaceInteraction isect;
-        bool foundIntersection = scene.Intersect(ray, &isect);
+        bool foundIntersection;
+        if (useCameraIntersection) {
+            isect = cameraIsect;
+            foundIntersection = foundCameraIntersection;
+            useCameraIntersection = false;
+        } else
+            foundIntersection = scene.Intersect(ray, &isect);
 
         // Possibly add emitted light at intersection
         if (bounces == 0 || specularBounce) {
@@ -208,8 +229,14 @@ PathIntegrator *CreatePathIntegrator(const ParamSet &params,
     Float rrThreshold = params.FindOneFloat("rrthreshold", 1.);
     std::string lightStrategy =
         params.FindOneString("lightsamplestrategy", "spatial");
+    int packetSize = params.FindOneInt("packetsize", 1);
+    if (packetSize < 1 || packetSize > MaxRayPacketSize) {
+        Error("\"packetsize\" must be between 1 and %d. Got %d.",
+              MaxRayPacketSize, packetSize);
+        packetSize = Clamp(packetSize, 1, MaxRayPacketSize);
+    }
     return new PathIntegrator(maxDepth, camera, sampler, pixelBounds,
-                              rrThreshold, lightStrategy);
+                              rrThreshold, lightStrategy, packetSize);
 }
 
 }  // namespace pbrt
@@ -52,11 +52,15 @@ class PathIntegrator : public SamplerIntegrator {
     PathIntegrator(int maxDepth, std::shared_ptr<const Camera> camera,
                    std::shared_ptr<Sampler> sampler,
                    const Bounds2i &pixelBounds, Float rrThreshold = 1,
-                   const std::string &lightSampleStrategy = "spatial");
+                   const std::string &lightSampleStrategy = "spatial",
+                   int packetSize = 1);
 
     void Preprocess(const Scene &scene, Sampler &sampler);
     Spectrum Li(const RayDifferential &ray, const Scene &scene,
                 Sampler &sampler, MemoryArena &arena, int depth) const;
+    Spectrum LiFromHit(const RayDifferential &ray, bool foundIntersection,
+                       const SurfaceInteraction &isect, const Scene &scene,
+                       Sampler &sampler, MemoryArena &arena) const;
 
   private:
     // PathIntegrator Private Data
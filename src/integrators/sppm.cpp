@@ -130,9 +130,16 @@ void SPPMIntegrator::Render(const Scene &scene) {
     Point2i nTiles((pixelExtent.x + tileSize - 1) / tileSize,
                    (pixelExtent.y + tileSize - 1) / tileSize);
     ProgressReporter progress(2 * nIterations, "Rendering");
+    // With a time limit, iterations stop once the time is spent; the
+    // image is normalized by the number of iterations done
+    RenderBudget budget(timeLimit, nIterations);
+    // Per-thread arenas are reused by all iterations; those of the camera
+    // pass hold the visible points' BSDFs and grid nodes until the end of
+    // each iteration
+    std::vector<MemoryArena> perThreadArenas(MaxThreadIndex());
+    std::vector<MemoryArena> photonShootArenas(MaxThreadIndex());
     for (int iter = 0; iter < nIterations; ++iter) {
         // Generate SPPM visible points
-        std::vector<MemoryArena> perThreadArenas(MaxThreadIndex());
         {
             ProfilePhase _(Prof::SPPMCameraPass);
             ParallelFor2D([&](Point2i tile) {
@@ -303,7 +310,6 @@ void SPPMIntegrator::Render(const Scene &scene) {
         // Trace photons and accumulate contributions
         {
             ProfilePhase _(Prof::SPPMPhotonPass);
-            std::vector<MemoryArena> photonShootArenas(MaxThreadIndex());
             ParallelFor([&](int photonIndex) {
                 MemoryArena &arena = photonShootArenas[ThreadIndex];
                 // Follow photon path for _photonIndex_
@@ -440,26 +446,43 @@ void SPPMIntegrator::Render(const Scene &scene) {
                 p.vp.beta = 0.;
                 p.vp.bsdf = nullptr;
             }, nPixels, 4096);
+            for (MemoryArena &arena : perThreadArenas) arena.Reset();
         }
 
         // Periodically store SPPM image in film and write image
-        if (iter + 1 == nIterations || ((iter + 1) % writeFrequency) == 0) {
+        budget.AddSamples(nPixels);
+        bool lastIteration =
+            iter + 1 == nIterations || budget.OutOfTime(iter + 1);
+        if (lastIteration) budget.Report(camera->film, nPixels);
+        if (lastIteration || ((iter + 1) % writeFrequency) == 0) {
             int x0 = pixelBounds.pMin.x;
             int x1 = pixelBounds.pMax.x;
             uint64_t Np = (uint64_t)(iter + 1) * (uint64_t)photonsPerIteration;
-            std::unique_ptr<Spectrum[]> image(new Spectrum[pixelBounds.Area()]);
-            int offset = 0;
-            for (int y = pixelBounds.pMin.y; y < pixelBounds.pMax.y; ++y) {
-                for (int x = x0; x < x1; ++x) {
-                    // Compute radiance _L_ for SPPM pixel _pixel_
-                    const SPPMPixel &pixel =
-                        pixels[(y - pixelBounds.pMin.y) * (x1 - x0) + (x - x0)];
-                    Spectrum L = pixel.Ld / (iter + 1);
-                    L += pixel.tau / (Np * Pi * pixel.radius * pixel.radius);
-                    image[offset++] = L;
+            // Pass the image to the film one band of rows at a time, so
+            // that a streaming film can write each band's blocks before
+            // the next band is computed
+            int bandHeight = std::min(camera->film->ImageBandHeight(),
+                                      pixelBounds.pMax.y - pixelBounds.pMin.y);
+            std::unique_ptr<Spectrum[]> image(
+                new Spectrum[(x1 - x0) * bandHeight]);
+            for (int y0 = pixelBounds.pMin.y; y0 < pixelBounds.pMax.y;
+                 y0 += bandHeight) {
+                int y1 = std::min(y0 + bandHeight, pixelBounds.pMax.y);
+                int offset = 0;
+                for (int y = y0; y < y1; ++y) {
+                    for (int x = x0; x < x1; ++x) {
+                        // Compute radiance _L_ for SPPM pixel _pixel_
+                        const SPPMPixel &pixel =
+                            pixels[(y - pixelBounds.pMin.y) * (x1 - x0) +
+                                   (x - x0)];
+                        Spectrum L = pixel.Ld / (iter + 1);
+                        L += pixel.tau /
+                             (Np * Pi * pixel.radius * pixel.radius);
+                        image[offset++] = L;
+                    }
                 }
+                camera->film->SetImageRows(y0, y1, image.get());
             }
-            camera->film->SetImage(image.get());
             camera->film->WriteImage();
             // Write SPPM radius image, if requested
             if (getenv("SPPM_RADIUS")) {
@@ -495,6 +518,7 @@ void SPPMIntegrator::Render(const Scene &scene) {
                 WriteImage("sppm_radius.png", rimg.get(), pixelBounds, res);
             }
         }
+        if (lastIteration) break;
     }
     progress.Done();
 }
@@ -0,0 +1,624 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+// integrators/wavefront.cpp*
+#include "integrators/wavefront.h"
+#include "bssrdf.h"
+#include "camera.h"
+#include "film.h"
+#include "interaction.h"
+#include "parallel.h"
+#include "paramset.h"
+#include "progressreporter.h"
+#include "scene.h"
+#include "stats.h"
+#include <algorithm>
+
+namespace pbrt {
+
+STAT_COUNTER("Integrator/Camera rays traced", nCameraRays);
+STAT_COUNTER("Integrator/Shadow rays traced", nShadowRays);
+STAT_INT_DISTRIBUTION("Integrator/Path length", pathLength);
+STAT_INT_DISTRIBUTION("Integrator/Wavefront paths per intersection pass",
+                      wavefrontQueueLength);
+STAT_MEMORY_COUNTER("Memory/Wavefront path samplers", samplerMemory);
+
+// Number of queue entries handed to a thread at a time by the stages
+static PBRT_CONSTEXPR int WavefrontChunkSize = 256;
+
+// WorkQueue Declarations
+
+// Indices of the paths waiting for one stage of the wavefront integrator;
+// the previous stage appends to it from many threads at once.
+class WorkQueue {
+  public:
+    // WorkQueue Public Methods
+    explicit WorkQueue(int capacity) : items(capacity) {}
+    void Push(int path) { items[size++] = path; }
+    int Size() const { return size; }
+    int operator[](int i) const { return items[i]; }
+    void Clear() { size = 0; }
+    template <typename Compare>
+    void Sort(Compare comp) {
+        std::sort(items.begin(), items.begin() + size, comp);
+    }
+
+  private:
+    // WorkQueue Private Data
+    std::vector<int> items;
+    std::atomic<int> size{0};
+};
+
+// Runs _func_ for each of the paths in _queue_ in parallel
+template <typename Func>
+static void ForAllQueued(const WorkQueue &queue, Func func) {
+    int n = queue.Size();
+    ParallelFor([&](int64_t chunk) {
+        int end = std::min<int>(n, (chunk + 1) * WavefrontChunkSize);
+        for (int i = chunk * WavefrontChunkSize; i < end; ++i) func(queue[i]);
+    }, (n + WavefrontChunkSize - 1) / WavefrontChunkSize);
+}
+
+// WavefrontPaths Declarations
+
+// State of the paths of a wave, stored as one array per quantity and
+// indexed by path
+struct WavefrontPaths {
+    WavefrontPaths(int n, Sampler &sampler)
+        : pixel(n),
+          cameraSample(n),
+          rayWeight(n),
+          ray(n),
+          L(n),
+          beta(n),
+          etaScale(n),
+          specularBounce(n),
+          bounces(n),
+          isect(n),
+          sortKey(n),
+          shadowRay(n),
+          shadowLd(n),
+          bsdfRay(n),
+          bsdfLight(n),
+          bsdfLd(n) {
+        // Each path gets a sampler of its own, which follows the pixel
+        // that the path is assigned to
+        for (int i = 0; i < n; ++i) samplers.push_back(sampler.Clone(i));
+    }
+
+    // Camera sample and path throughput
+    std::vector<Point2i> pixel;
+    std::vector<CameraSample> cameraSample;
+    std::vector<Float> rayWeight;
+    std::vector<RayDifferential> ray;
+    std::vector<Spectrum> L, beta;
+    std::vector<Float> etaScale;
+    std::vector<uint8_t> specularBounce;
+    std::vector<int> bounces;
+    std::vector<SurfaceInteraction> isect;
+    std::vector<ShadingSortKey> sortKey;
+    std::vector<std::unique_ptr<Sampler>> samplers;
+
+    // Direct lighting: the contribution of the light sample, which counts
+    // if _shadowRay_ is unoccluded, and the weighted BSDF sample, which is
+    // multiplied by the radiance _bsdfLight_ emits along _bsdfRay_
+    std::vector<Ray> shadowRay;
+    std::vector<Spectrum> shadowLd;
+    std::vector<Ray> bsdfRay;
+    std::vector<const Light *> bsdfLight;
+    std::vector<Spectrum> bsdfLd;
+};
+
+// WavefrontPathIntegrator Method Definitions
+WavefrontPathIntegrator::WavefrontPathIntegrator(
+    int maxDepth, std::shared_ptr<const Camera> camera,
+    std::shared_ptr<Sampler> sampler, const Bounds2i &pixelBounds,
+    Float rrThreshold, const std::string &lightSampleStrategy,
+    int maxQueueSize, size_t maxSamplerBytes)
+    : camera(camera),
+      sampler(sampler),
+      pixelBounds(pixelBounds),
+      maxDepth(maxDepth),
+      rrThreshold(rrThreshold),
+      lightSampleStrategy(lightSampleStrategy),
+      maxQueueSize(maxQueueSize),
+      maxSamplerBytes(maxSamplerBytes) {}
+
+void WavefrontPathIntegrator::Render(const Scene &scene) {
+    lightDistribution =
+        CreateLightSampleDistribution(lightSampleStrategy, scene);
+    Film *film = camera->film;
+    TileSchedule schedule(film->GetSampleBounds());
+
+    // Group consecutive tiles of the schedule into waves of at most
+    // _maxQueueSize_ paths, one per pixel, but at least one tile each.
+    // Every path keeps a sampler for its pixel, and samplers that store all
+    // of a pixel's samples grow with the sample count, so the wave is also
+    // limited to the pixels whose samplers fit in _maxSamplerBytes_.
+    auto tilePixels = [&](int t) {
+        return OverlapArea(schedule.TileBounds(schedule.Tiles()[t]),
+                           pixelBounds);
+    };
+    size_t samplerBytes = std::max<size_t>(1, sampler->PixelStateBytes());
+    int64_t maxPaths = std::min<int64_t>(
+        maxQueueSize, std::max<size_t>(1, maxSamplerBytes / samplerBytes));
+    std::vector<int> waveStart(1, 0);
+    int64_t waveSize = 0, maxWaveSize = 0;
+    for (int t = 0; t < schedule.TileCount(); ++t) {
+        int64_t n = tilePixels(t);
+        if (waveSize > 0 && waveSize + n > maxPaths) {
+            waveStart.push_back(t);
+            waveSize = 0;
+        }
+        waveSize += n;
+        maxWaveSize = std::max(maxWaveSize, waveSize);
+    }
+    waveStart.push_back(schedule.TileCount());
+    WavefrontPaths paths((int)maxWaveSize, *sampler);
+    samplerMemory += maxWaveSize * sampler->PixelStateBytes();
+    // Per-thread arenas for the BSDFs of the current bounce, reused by
+    // every wave and pass
+    std::vector<MemoryArena> arenas(MaxThreadIndex());
+    LOG(INFO) << "Rendering " << schedule.TileCount() << " tiles in "
+              << waveStart.size() - 1 << " waves of up to " << maxWaveSize
+              << " paths";
+
+    // Like _SamplerIntegrator_, render the samples in passes of doubling
+    // size if there is a time limit or in progressive mode; a streaming
+    // film needs every tile to be merged once
+    bool progressive = PbrtOptions.progressive;
+    Float limit = timeLimit;
+    if (film->Streaming()) {
+        if (progressive || limit > 0)
+            Warning("Ignoring the progressive mode and time limit, which the "
+                    "streaming film doesn't support.");
+        progressive = false;
+        limit = 0;
+        std::vector<Bounds2i> tileBounds;
+        for (const Point2i &tile : schedule.Tiles())
+            tileBounds.push_back(schedule.TileBounds(tile));
+        film->StreamTiles(tileBounds, false);
+    }
+    const int64_t spp = sampler->samplesPerPixel;
+    RenderBudget budget(limit, spp, progressive);
+    if (film->Streaming()) budget.ReportPlanned(film);
+    const bool passes = progressive || budget.Limited();
+    ProgressReporter reporter(schedule.TileCount() * (passes ? spp : 1),
+                              "Rendering");
+    int64_t firstSample = 0;
+    while (firstSample < spp && !budget.OutOfTime(firstSample)) {
+        int64_t endSample = budget.PassEnd(firstSample);
+        for (size_t w = 0; w + 1 < waveStart.size(); ++w) {
+            if (budget.OutOfTime(firstSample)) break;
+            RenderWave(scene, schedule, waveStart[w], waveStart[w + 1],
+                       firstSample, endSample, paths, arenas);
+            int64_t nPixels = 0;
+            for (int t = waveStart[w]; t < waveStart[w + 1]; ++t)
+                nPixels += tilePixels(t);
+            budget.AddSamples(nPixels * (endSample - firstSample));
+            reporter.Update((waveStart[w + 1] - waveStart[w]) *
+                            (passes ? endSample - firstSample : 1));
+        }
+        firstSample = endSample;
+        if (progressive && firstSample < spp) film->WriteImage();
+    }
+    reporter.Done();
+    LOG(INFO) << "Rendering finished";
+    budget.Report(film, pixelBounds.Area());
+    film->WriteImage();
+}
+
+void WavefrontPathIntegrator::RenderWave(
+    const Scene &scene, const TileSchedule &schedule, int firstTile,
+    int endTile, int64_t firstSample, int64_t endSample, WavefrontPaths &paths,
+    std::vector<MemoryArena> &arenas) const {
+    // Assign a path to each pixel of the wave's tiles
+    std::vector<int> tilePathStart(1, 0);
+    std::vector<std::unique_ptr<FilmTile>> filmTiles;
+    int nPaths = 0;
+    for (int t = firstTile; t < endTile; ++t) {
+        Bounds2i tileBounds = schedule.TileBounds(schedule.Tiles()[t]);
+        for (Point2i pixel : tileBounds)
+            if (InsideExclusive(pixel, pixelBounds))
+                paths.pixel[nPaths++] = pixel;
+        tilePathStart.push_back(nPaths);
+        filmTiles.push_back(camera->film->GetFilmTile(tileBounds));
+    }
+
+    WorkQueue rayQueue0(nPaths), rayQueue1(nPaths);
+    WorkQueue hitQueue(nPaths), lightQueue(nPaths), scatterQueue(nPaths);
+    WorkQueue shadowQueue(2 * nPaths);
+    for (int64_t sampleNum = firstSample; sampleNum < endSample; ++sampleNum) {
+        WorkQueue *rayQueue = &rayQueue0, *nextRayQueue = &rayQueue1;
+        rayQueue->Clear();
+        GenerateCameraRays(paths, nPaths, sampleNum, sampleNum == firstSample,
+                           *rayQueue);
+
+        // Extend all of the paths by one vertex per iteration until none
+        // is left
+        while (rayQueue->Size() > 0) {
+            ReportValue(wavefrontQueueLength, rayQueue->Size());
+            hitQueue.Clear();
+            lightQueue.Clear();
+            scatterQueue.Clear();
+            shadowQueue.Clear();
+            nextRayQueue->Clear();
+            IntersectClosest(scene, paths, *rayQueue, hitQueue);
+            ShadeHits(paths, hitQueue, lightQueue, scatterQueue,
+                      *nextRayQueue, arenas);
+            SampleLights(scene, paths, lightQueue, shadowQueue);
+            TraceShadowRays(scene, paths, shadowQueue);
+            Scatter(scene, paths, scatterQueue, *nextRayQueue, arenas);
+            for (MemoryArena &arena : arenas) arena.Reset();
+            std::swap(rayQueue, nextRayQueue);
+        }
+
+        // Add the radiance of the finished paths to the wave's tiles
+        ParallelFor([&](int64_t t) {
+            for (int i = tilePathStart[t]; i < tilePathStart[t + 1]; ++i) {
+                Spectrum L = CheckRadiance(paths.L[i], paths.pixel[i],
+                                           sampleNum);
+                filmTiles[t]->AddSample(paths.cameraSample[i].pFilm, L,
+                                        paths.rayWeight[i]);
+            }
+        }, endTile - firstTile);
+    }
+    for (std::unique_ptr<FilmTile> &filmTile : filmTiles)
+        camera->film->MergeFilmTile(std::move(filmTile));
+}
+
+void WavefrontPathIntegrator::GenerateCameraRays(WavefrontPaths &paths,
+                                                 int nPaths, int64_t sampleNum,
+                                                 bool startPixel,
+                                                 WorkQueue &rayQueue) const {
+    Float scale = 1 / std::sqrt((Float)sampler->samplesPerPixel);
+    ParallelFor([&](int64_t chunk) {
+        int end = std::min<int>(nPaths, (chunk + 1) * WavefrontChunkSize);
+        for (int i = chunk * WavefrontChunkSize; i < end; ++i) {
+            // Move the path's sampler to sample _sampleNum_ of its pixel
+            Sampler &pathSampler = *paths.samplers[i];
+            if (startPixel) {
+                ProfilePhase pp(Prof::StartPixel);
+                pathSampler.StartPixel(paths.pixel[i]);
+                if (sampleNum > 0) pathSampler.SetSampleNumber(sampleNum);
+            } else
+                pathSampler.StartNextSample();
+
+            paths.cameraSample[i] =
+                pathSampler.GetCameraSample(paths.pixel[i]);
+            paths.rayWeight[i] = camera->GenerateRayDifferential(
+                paths.cameraSample[i], &paths.ray[i]);
+            paths.ray[i].ScaleDifferentials(scale);
+            ++nCameraRays;
+            paths.L[i] = Spectrum(0.f);
+            paths.beta[i] = Spectrum(1.f);
+            paths.etaScale[i] = 1;
+            paths.specularBounce[i] = false;
+            paths.bounces[i] = 0;
+            if (paths.rayWeight[i] > 0) rayQueue.Push(i);
+        }
+    }, (nPaths + WavefrontChunkSize - 1) / WavefrontChunkSize);
+}
+
+void WavefrontPathIntegrator::IntersectClosest(const Scene &scene,
+                                               WavefrontPaths &paths,
+                                               const WorkQueue &rayQueue,
+                                               WorkQueue &hitQueue) const {
+    ForAllQueued(rayQueue, [&](int i) {
+        SurfaceInteraction &isect = paths.isect[i];
+        RayDifferential &ray = paths.ray[i];
+        bool foundIntersection = scene.Intersect(ray, &isect);
+
+        // Possibly add emitted light at intersection
+        const Spectrum &beta = paths.beta[i];
+        if (paths.bounces[i] == 0 || paths.specularBounce[i]) {
+            if (foundIntersection)
+                paths.L[i] += beta * isect.Le(-ray.d);
+            else
+                for (const auto &light : scene.infiniteLights)
+                    paths.L[i] += beta * light->Le(ray);
+        }
+
+        // Terminate path if ray escaped or _maxDepth_ was reached
+        if (!foundIntersection || paths.bounces[i] >= maxDepth) {
+            ReportValue(pathLength, paths.bounces[i]);
+            return;
+        }
+        paths.sortKey[i] = ShadingSortKey(isect);
+        hitQueue.Push(i);
+    });
+}
+
+void WavefrontPathIntegrator::ShadeHits(WavefrontPaths &paths,
+                                        WorkQueue &hitQueue,
+                                        WorkQueue &lightQueue,
+                                        WorkQueue &scatterQueue,
+                                        WorkQueue &nextRayQueue,
+                                        std::vector<MemoryArena> &arenas) const {
+    // Sort the hits by material and texture coordinates so that each
+    // material's textures and BSDF construction are evaluated together
+    hitQueue.Sort([&](int a, int b) {
+        const ShadingSortKey &ka = paths.sortKey[a], &kb = paths.sortKey[b];
+        return ka < kb || (!(kb < ka) && a < b);
+    });
+
+    ForAllQueued(hitQueue, [&](int i) {
+        // Compute scattering functions and skip over medium boundaries
+        SurfaceInteraction &isect = paths.isect[i];
+        isect.ComputeScatteringFunctions(paths.ray[i], arenas[ThreadIndex],
+                                         true);
+        if (!isect.bsdf) {
+            paths.ray[i] = isect.SpawnRay(paths.ray[i].d);
+            nextRayQueue.Push(i);
+            return;
+        }
+        paths.shadowLd[i] = paths.bsdfLd[i] = Spectrum(0.f);
+
+        // Sample illumination from lights to find path contribution.
+        // (But skip this for perfectly specular BSDFs.)
+        if (isect.bsdf->NumComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) >
+            0)
+            lightQueue.Push(i);
+        scatterQueue.Push(i);
+    });
+}
+
+void WavefrontPathIntegrator::SampleLights(const Scene &scene,
+                                           WavefrontPaths &paths,
+                                           const WorkQueue &lightQueue,
+                                           WorkQueue &shadowQueue) const {
+    // This is _UniformSampleOneLight()_ and _EstimateDirect()_ for surface
+    // interactions, with the rays traced by the next stage; the sampler's
+    // dimensions are used in the same order
+    ForAllQueued(lightQueue, [&](int i) {
+        ProfilePhase p(Prof::DirectLighting);
+        const SurfaceInteraction &isect = paths.isect[i];
+        Sampler &pathSampler = *paths.samplers[i];
+
+        // Randomly choose a single light to sample, _light_
+        int nLights = int(scene.lights.size());
+        if (nLights == 0) return;
+        const Distribution1D *lightDistrib = lightDistribution->Lookup(isect.p);
+        int lightNum;
+        Float lightChoicePdf;
+        if (lightDistrib) {
+            lightNum = lightDistrib->SampleDiscrete(pathSampler.Get1D(),
+                                                    &lightChoicePdf);
+            if (lightChoicePdf == 0) return;
+        } else {
+            lightNum = std::min((int)(pathSampler.Get1D() * nLights),
+                                nLights - 1);
+            lightChoicePdf = Float(1) / nLights;
+        }
+        const Light &light = *scene.lights[lightNum];
+        Point2f uLight = pathSampler.Get2D();
+        Point2f uScattering = pathSampler.Get2D();
+        Spectrum beta = paths.beta[i] / lightChoicePdf;
+        BxDFType bsdfFlags = BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
+
+        // Sample light source with multiple importance sampling
+        Vector3f wi;
+        Float lightPdf = 0, scatteringPdf = 0;
+        VisibilityTester visibility;
+        Spectrum Li =
+            light.Sample_Li(isect, uLight, &wi, &lightPdf, &visibility);
+        if (lightPdf > 0 && !Li.IsBlack()) {
+            Spectrum f = isect.bsdf->f(isect.wo, wi, bsdfFlags) *
+                         AbsDot(wi, isect.shading.n);
+            scatteringPdf = isect.bsdf->Pdf(isect.wo, wi, bsdfFlags);
+            if (!f.IsBlack()) {
+                Float weight =
+                    IsDeltaLight(light.flags)
+                        ? 1
+                        : PowerHeuristic(1, lightPdf, 1, scatteringPdf);
+                paths.shadowLd[i] = beta * f * Li * weight / lightPdf;
+                paths.shadowRay[i] =
+                    visibility.P0().SpawnRayTo(visibility.P1());
+                shadowQueue.Push(2 * i);
+            }
+        }
+
+        // Sample BSDF with multiple importance sampling
+        if (!IsDeltaLight(light.flags)) {
+            BxDFType sampledType;
+            Spectrum f = isect.bsdf->Sample_f(isect.wo, &wi, uScattering,
+                                              &scatteringPdf, bsdfFlags,
+                                              &sampledType);
+            f *= AbsDot(wi, isect.shading.n);
+            if (!f.IsBlack() && scatteringPdf > 0) {
+                Float weight = 1;
+                if (!(sampledType & BSDF_SPECULAR)) {
+                    lightPdf = light.Pdf_Li(isect, wi);
+                    if (lightPdf == 0) return;
+                    weight = PowerHeuristic(1, scatteringPdf, 1, lightPdf);
+                }
+                paths.bsdfLd[i] = beta * f * weight / scatteringPdf;
+                paths.bsdfRay[i] = isect.SpawnRay(wi);
+                paths.bsdfLight[i] = &light;
+                shadowQueue.Push(2 * i + 1);
+            }
+        }
+    });
+}
+
+void WavefrontPathIntegrator::TraceShadowRays(
+    const Scene &scene, WavefrontPaths &paths,
+    const WorkQueue &shadowQueue) const {
+    // Even entries are light samples, which only need to know whether
+    // they are occluded, and odd entries are BSDF samples, which need the
+    // light's emitted radiance at the closest hit. Each chunk's light
+    // samples are tested together with _Scene::IntersectPBatch()_.
+    int n = shadowQueue.Size();
+    ParallelFor([&](int64_t chunk) {
+        Ray shadowRays[WavefrontChunkSize];
+        int shadowPaths[WavefrontChunkSize];
+        int nShadow = 0;
+        int end = std::min<int>(n, (chunk + 1) * WavefrontChunkSize);
+        for (int j = chunk * WavefrontChunkSize; j < end; ++j) {
+            int entry = shadowQueue[j], i = entry / 2;
+            ++nShadowRays;
+            if (entry % 2 == 0) {
+                shadowRays[nShadow] = paths.shadowRay[i];
+                shadowPaths[nShadow++] = i;
+                continue;
+            }
+            const Light &light = *paths.bsdfLight[i];
+            const Ray &ray = paths.bsdfRay[i];
+            SurfaceInteraction lightIsect;
+            Spectrum Li(0.f);
+            if (scene.Intersect(ray, &lightIsect)) {
+                if (lightIsect.primitive->GetAreaLight() == &light)
+                    Li = lightIsect.Le(-ray.d);
+            } else
+                Li = light.Le(ray);
+            paths.bsdfLd[i] *= Li;
+        }
+        bool occluded[WavefrontChunkSize];
+        scene.IntersectPBatch(shadowRays, nShadow, occluded);
+        for (int k = 0; k < nShadow; ++k)
+            if (occluded[k]) paths.shadowLd[shadowPaths[k]] = Spectrum(0.f);
+    }, (n + WavefrontChunkSize - 1) / WavefrontChunkSize);
+}
+
+void WavefrontPathIntegrator::Scatter(const Scene &scene,
+                                      WavefrontPaths &paths,
+                                      const WorkQueue &scatterQueue,
+                                      WorkQueue &nextRayQueue,
+                                      std::vector<MemoryArena> &arenas) const {
+    ForAllQueued(scatterQueue, [&](int i) {
+        const SurfaceInteraction &isect = paths.isect[i];
+        Sampler &pathSampler = *paths.samplers[i];
+        MemoryArena &arena = arenas[ThreadIndex];
+        Spectrum &beta = paths.beta[i];
+        RayDifferential &ray = paths.ray[i];
+        paths.L[i] += paths.shadowLd[i] + paths.bsdfLd[i];
+
+        // Sample BSDF to get new path direction
+        Vector3f wo = -ray.d, wi;
+        Float pdf;
+        BxDFType flags;
+        Spectrum f = isect.bsdf->Sample_f(wo, &wi, pathSampler.Get2D(), &pdf,
+                                          BSDF_ALL, &flags);
+        if (f.IsBlack() || pdf == 0.f) {
+            ReportValue(pathLength, paths.bounces[i]);
+            return;
+        }
+        beta *= f * AbsDot(wi, isect.shading.n) / pdf;
+        DCHECK(!std::isinf(beta.y()));
+        paths.specularBounce[i] = (flags & BSDF_SPECULAR) != 0;
+        if ((flags & BSDF_SPECULAR) && (flags & BSDF_TRANSMISSION)) {
+            Float eta = isect.bsdf->eta;
+            paths.etaScale[i] *=
+                (Dot(wo, isect.n) > 0) ? (eta * eta) : 1 / (eta * eta);
+        }
+        ray = isect.SpawnRay(wi);
+
+        // Account for subsurface scattering, if applicable; this is rare
+        // enough that the probe rays are traced right away
+        if (isect.bssrdf && (flags & BSDF_TRANSMISSION)) {
+            SurfaceInteraction pi;
+            Spectrum S = isect.bssrdf->Sample_S(scene, pathSampler.Get1D(),
+                                                pathSampler.Get2D(), arena,
+                                                &pi, &pdf);
+            if (S.IsBlack() || pdf == 0) {
+                ReportValue(pathLength, paths.bounces[i]);
+                return;
+            }
+            beta *= S / pdf;
+            paths.L[i] +=
+                beta * UniformSampleOneLight(pi, scene, arena, pathSampler,
+                                             false,
+                                             lightDistribution->Lookup(pi.p));
+            Spectrum f = pi.bsdf->Sample_f(pi.wo, &wi, pathSampler.Get2D(),
+                                           &pdf, BSDF_ALL, &flags);
+            if (f.IsBlack() || pdf == 0) {
+                ReportValue(pathLength, paths.bounces[i]);
+                return;
+            }
+            beta *= f * AbsDot(wi, pi.shading.n) / pdf;
+            paths.specularBounce[i] = (flags & BSDF_SPECULAR) != 0;
+            ray = pi.SpawnRay(wi);
+        }
+
+        // Possibly terminate the path with Russian roulette
+        Spectrum rrBeta = beta * paths.etaScale[i];
+        if (rrBeta.MaxComponentValue() < rrThreshold && paths.bounces[i] > 3) {
+            Float q = std::max((Float).05, 1 - rrBeta.MaxComponentValue());
+            if (pathSampler.Get1D() < q) {
+                ReportValue(pathLength, paths.bounces[i]);
+                return;
+            }
+            beta /= 1 - q;
+        }
+        ++paths.bounces[i];
+        nextRayQueue.Push(i);
+    });
+}
+
+WavefrontPathIntegrator *CreateWavefrontPathIntegrator(
+    const ParamSet &params, std::shared_ptr<Sampler> sampler,
+    std::shared_ptr<const Camera> camera) {
+    int maxDepth = params.FindOneInt("maxdepth", 5);
+    int np;
+    const int *pb = params.FindInt("pixelbounds", &np);
+    Bounds2i pixelBounds = camera->film->GetSampleBounds();
+    if (pb) {
+        if (np != 4)
+            Error("Expected four values for \"pixelbounds\" parameter. Got %d.",
+                  np);
+        else {
+            pixelBounds = Intersect(pixelBounds,
+                                    Bounds2i{{pb[0], pb[2]}, {pb[1], pb[3]}});
+            if (pixelBounds.Area() == 0)
+                Error("Degenerate \"pixelbounds\" specified.");
+        }
+    }
+    Float rrThreshold = params.FindOneFloat("rrthreshold", 1.);
+    std::string lightStrategy =
+        params.FindOneString("lightsamplestrategy", "spatial");
+    int maxQueueSize = params.FindOneInt("maxqueuesize", 1 << 16);
+    if (maxQueueSize < 1) {
+        Error("\"maxqueuesize\" must be positive. Got %d.", maxQueueSize);
+        maxQueueSize = 1 << 16;
+    }
+    Float maxSamplerMB = params.FindOneFloat("maxsamplermemory", 64);
+    if (maxSamplerMB <= 0) {
+        Error("\"maxsamplermemory\" must be positive. Got %f.", maxSamplerMB);
+        maxSamplerMB = 64;
+    }
+    return new WavefrontPathIntegrator(
+        maxDepth, camera, sampler, pixelBounds, rrThreshold, lightStrategy,
+        maxQueueSize, size_t(maxSamplerMB * (1 << 20)));
+}
+
+}  // namespace pbrt
@@ -0,0 +1,115 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_INTEGRATORS_WAVEFRONT_H
+#define PBRT_INTEGRATORS_WAVEFRONT_H
+
+// integrators/wavefront.h*
+#include "pbrt.h"
+#include "integrator.h"
+#include "lightdistrib.h"
+
+namespace pbrt {
+
+struct WavefrontPaths;
+class WorkQueue;
+
+// WavefrontPathIntegrator Declarations
+
+// Computes the same estimate as _PathIntegrator_, but follows a large
+// batch of paths at once: each stage of the path tracer (camera ray
+// generation, intersection, material evaluation, light sampling, shadow
+// rays and film accumulation) runs over all of the batch's paths before
+// the next one starts, and the path state is kept in arrays indexed by
+// path. Hits are sorted by material before shading.
+class WavefrontPathIntegrator : public Integrator {
+  public:
+    // WavefrontPathIntegrator Public Methods
+    WavefrontPathIntegrator(int maxDepth, std::shared_ptr<const Camera> camera,
+                            std::shared_ptr<Sampler> sampler,
+                            const Bounds2i &pixelBounds, Float rrThreshold = 1,
+                            const std::string &lightSampleStrategy = "spatial",
+                            int maxQueueSize = 1 << 16,
+                            size_t maxSamplerBytes = size_t(64) << 20);
+    void Render(const Scene &scene);
+
+  private:
+    // WavefrontPathIntegrator Private Methods
+    void RenderWave(const Scene &scene, const TileSchedule &schedule,
+                    int firstTile, int endTile, int64_t firstSample,
+                    int64_t endSample, WavefrontPaths &paths,
+                    std::vector<MemoryArena> &arenas) const;
+    void GenerateCameraRays(WavefrontPaths &paths, int nPaths,
+                            int64_t sampleNum, bool startPixel,
+                            WorkQueue &rayQueue) const;
+    void IntersectClosest(const Scene &scene, WavefrontPaths &paths,
+                          const WorkQueue &rayQueue, WorkQueue &hitQueue) const;
+    void ShadeHits(WavefrontPaths &paths, WorkQueue &hitQueue,
+                   WorkQueue &lightQueue, WorkQueue &scatterQueue,
+                   WorkQueue &nextRayQueue,
+                   std::vector<MemoryArena> &arenas) const;
+    void SampleLights(const Scene &scene, WavefrontPaths &paths,
+                      const WorkQueue &lightQueue,
+                      WorkQueue &shadowQueue) const;
+    void TraceShadowRays(const Scene &scene, WavefrontPaths &paths,
+                         const WorkQueue &shadowQueue) const;
+    void Scatter(const Scene &scene, WavefrontPaths &paths,
+                 const WorkQueue &scatterQueue, WorkQueue &nextRayQueue,
+                 std::vector<MemoryArena> &arenas) const;
+
+    // WavefrontPathIntegrator Private Data
+    std::shared_ptr<const Camera> camera;
+    std::shared_ptr<Sampler> sampler;
+    const Bounds2i pixelBounds;
+    const int maxDepth;
+    const Float rrThreshold;
+    const std::string lightSampleStrategy;
+    const int maxQueueSize;
+    // Upper bound for the pixel samples stored by the samplers of the paths
+    // in flight
+    const size_t maxSamplerBytes;
+    std::unique_ptr<LightDistribution> lightDistribution;
+};
+
+WavefrontPathIntegrator *CreateWavefrontPathIntegrator(
+    const ParamSet &params, std::shared_ptr<Sampler> sampler,
+    std::shared_ptr<const Camera> camera);
+
+}  // namespace pbrt
+
+#endif  // PBRT_INTEGRATORS_WAVEFRONT_H
@@ -46,12 +46,35 @@ static void usage(const char *msg = nullptr)
     fprintf(stderr, R"(usage: pbrt [<options>] <filename.pbrt...>
 Rendering options:
   --cropwindow <x0,x1,y0,y1> Specify an image crop window.
+  --frames <num>       Render the given number of shutter slices: frame i
+                       covers the i-th equal part of the camera shutter
+                       interval, with the motion given by the scene's
+                       transform start and end times. The scene is loaded
+                       once and its acceleration structures are refit for
+                       each frame.
   --help               Print this help text.
   --nthreads <num>     Use specified number of threads for rendering.
   --outfile <filename> Write the final image to the given filename.
+  --pinthreads         Pin each thread to a CPU, spreading the threads over
+                       the machine's NUMA nodes.
+  --progressive        Render all image tiles with 1 sample per pixel, then
+                       2, 4, 8 and so forth up to the sampler's count,
+                       writing the image after each pass.
   --quick              Automatically reduce a number of quality settings to
                        render more quickly.
   --quiet              Suppress all text output other than error messages.
+  --time-limit <sec>   Keep adding samples per pixel (or SPPM iterations)
+                       until the given number of seconds have passed, up to
+                       the scene's count; at least one sample per pixel is
+                       always rendered. Overrides the integrator's
+                       "timelimit" parameter.
+  --tileorder <order>  Order in which image tiles are rendered: "hilbert"
+                       (default), "spiral" (from the center outward) or
+                       "scanline".
+  --tilesize <num>     Width and height of image tiles in pixels. Default:
+                       chosen from the image resolution and thread count.
+  --writeinterval <sec> Also write the image every given number of seconds
+                       during progressive rendering. Default: 10.
 
 Logging options:
   --logdir <dir>       Specify directory that log files should be written to.
@@ -71,6 +94,18 @@ Reformatting options:
     exit(msg ? 1 : 0);
 }
 
+static TileOrder parseTileOrder(const char *order)
+{
+    if (!strcmp(order, "hilbert"))
+        return TileOrder::Hilbert;
+    else if (!strcmp(order, "spiral"))
+        return TileOrder::Spiral;
+    else if (!strcmp(order, "scanline"))
+        return TileOrder::Scanline;
+    usage("--tileorder must be \"hilbert\", \"spiral\" or \"scanline\"");
+    return TileOrder::Hilbert;
+}
+
 // main program
 int main(int argc, char *argv[])
 {
@@ -114,6 +149,81 @@ int main(int argc, char *argv[])
         {
             options.imageFile = &argv[i][10];
         }
+        else if (!strcmp(argv[i], "--frames") || !strcmp(argv[i], "-frames"))
+        { // 动画帧数
+            if (i + 1 == argc)
+                usage("missing value after --frames argument");
+            options.nFrames = atoi(argv[++i]);
+            if (options.nFrames < 1)
+                usage("--frames must be at least 1");
+        }
+        else if (!strncmp(argv[i], "--frames=", 9))
+        {
+            options.nFrames = atoi(&argv[i][9]);
+            if (options.nFrames < 1)
+                usage("--frames must be at least 1");
+        }
+        else if (!strcmp(argv[i], "--progressive") ||
+                 !strcmp(argv[i], "-progressive"))
+        { // 渐进渲染
+            options.progressive = true;
+        }
+        else if (!strcmp(argv[i], "--time-limit") ||
+                 !strcmp(argv[i], "-time-limit"))
+        { // 渲染时间上限
+            if (i + 1 == argc)
+                usage("missing value after --time-limit argument");
+            options.timeLimit = atof(argv[++i]);
+            if (options.timeLimit <= 0)
+                usage("--time-limit must be positive");
+        }
+        else if (!strncmp(argv[i], "--time-limit=", 13))
+        {
+            options.timeLimit = atof(&argv[i][13]);
+            if (options.timeLimit <= 0)
+                usage("--time-limit must be positive");
+        }
+        else if (!strcmp(argv[i], "--writeinterval") ||
+                 !strcmp(argv[i], "-writeinterval"))
+        { // 渐进渲染时写出中间图像的间隔
+            if (i + 1 == argc)
+                usage("missing value after --writeinterval argument");
+            options.writeInterval = atof(argv[++i]);
+            if (options.writeInterval <= 0)
+                usage("--writeinterval must be positive");
+        }
+        else if (!strncmp(argv[i], "--writeinterval=", 16))
+        {
+            options.writeInterval = atof(&argv[i][16]);
+            if (options.writeInterval <= 0)
+                usage("--writeinterval must be positive");
+        }
+        else if (!strcmp(argv[i], "--tileorder") ||
+                 !strcmp(argv[i], "-tileorder"))
+        { // 图像块渲染顺序
+            if (i + 1 == argc)
+                usage("missing value after --tileorder argument");
+            options.tileOrder = parseTileOrder(argv[++i]);
+        }
+        else if (!strncmp(argv[i], "--tileorder=", 12))
+        {
+            options.tileOrder = parseTileOrder(&argv[i][12]);
+        }
+        else if (!strcmp(argv[i], "--tilesize") ||
+                 !strcmp(argv[i], "-tilesize"))
+        { // 图像块边长
+            if (i + 1 == argc)
+                usage("missing value after --tilesize argument");
+            options.tileSize = atoi(argv[++i]);
+            if (options.tileSize < 1)
+                usage("--tilesize must be at least 1");
+        }
+        else if (!strncmp(argv[i], "--tilesize=", 11))
+        {
+            options.tileSize = atoi(&argv[i][11]);
+            if (options.tileSize < 1)
+                usage("--tilesize must be at least 1");
+        }
         else if (!strcmp(argv[i], "--logdir") ||
                  !strcmp(argv[i], "-logdir"))
         { // 日志目录
@@ -136,6 +246,11 @@ int main(int argc, char *argv[])
         {
             FLAGS_minloglevel = atoi(&argv[i][14]);
         }
+        else if (!strcmp(argv[i], "--pinthreads") ||
+                 !strcmp(argv[i], "-pinthreads"))
+        { // 绑定线程到CPU
+            options.pinThreads = true;
+        }
         else if (!strcmp(argv[i], "--quick") ||
                  !strcmp(argv[i], "-quick"))
         { // 快速模式
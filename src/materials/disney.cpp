@@ -506,34 +506,32 @@ void DisneyMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
             Float flat = flatness->Evaluate(*si);
             // Blend between DisneyDiffuse and fake subsurface based on
             // flatness.  Additionally, weight using diffTrans.
-            si->bsdf->Add(ARENA_ALLOC(arena, DisneyDiffuse)(
-                diffuseWeight * (1 - flat) * (1 - dt) * c));
-            si->bsdf->Add(ARENA_ALLOC(arena, DisneyFakeSS)(
-                diffuseWeight * flat * (1 - dt) * c, rough));
+            si->bsdf->Emplace<DisneyDiffuse>(
+                arena, diffuseWeight * (1 - flat) * (1 - dt) * c);
+            si->bsdf->Emplace<DisneyFakeSS>(
+                arena, diffuseWeight * flat * (1 - dt) * c, rough);
         } else {
             Spectrum sd = scatterDistance->Evaluate(*si);
             if (sd.IsBlack())
                 // No subsurface scattering; use regular (Fresnel modified)
                 // diffuse.
-                si->bsdf->Add(
-                    ARENA_ALLOC(arena, DisneyDiffuse)(diffuseWeight * c));
+                si->bsdf->Emplace<DisneyDiffuse>(arena, diffuseWeight * c);
             else {
                 // Use a BSSRDF instead.
-                si->bsdf->Add(ARENA_ALLOC(arena, SpecularTransmission)(
-                    1.f, 1.f, e, mode));
+                si->bsdf->Emplace<SpecularTransmission>(
+                    arena, 1.f, 1.f, e, mode);
                 si->bssrdf = ARENA_ALLOC(arena, DisneyBSSRDF)(
                     c * diffuseWeight, sd, *si, e, this, mode);
             }
         }
 
         // Retro-reflection.
-        si->bsdf->Add(
-            ARENA_ALLOC(arena, DisneyRetro)(diffuseWeight * c, rough));
+        si->bsdf->Emplace<DisneyRetro>(arena, diffuseWeight * c, rough);
 
         // Sheen (if enabled)
         if (sheenWeight > 0)
-            si->bsdf->Add(ARENA_ALLOC(arena, DisneySheen)(
-                diffuseWeight * sheenWeight * Csheen));
+            si->bsdf->Emplace<DisneySheen>(
+                arena, diffuseWeight * sheenWeight * Csheen);
     }
 
     // Create the microfacet distribution for metallic and/or specular
@@ -551,14 +549,13 @@ void DisneyMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
              SchlickR0FromEta(e) * Lerp(specTint, Spectrum(1.), Ctint), c);
     Fresnel *fresnel =
         ARENA_ALLOC(arena, DisneyFresnel)(Cspec0, metallicWeight, e);
-    si->bsdf->Add(
-        ARENA_ALLOC(arena, MicrofacetReflection)(c, distrib, fresnel));
+    si->bsdf->Emplace<MicrofacetReflection>(arena, c, distrib, fresnel);
 
     // Clearcoat
     Float cc = clearcoat->Evaluate(*si);
     if (cc > 0) {
-        si->bsdf->Add(ARENA_ALLOC(arena, DisneyClearcoat)(
-            cc, Lerp(clearcoatGloss->Evaluate(*si), .1, .001)));
+        si->bsdf->Emplace<DisneyClearcoat>(
+            arena, cc, Lerp(clearcoatGloss->Evaluate(*si), .1, .001));
     }
 
     // BTDF
@@ -574,15 +571,15 @@ void DisneyMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
             Float ay = std::max(Float(.001), sqr(rscaled) * aspect);
             MicrofacetDistribution *scaledDistrib =
                 ARENA_ALLOC(arena, TrowbridgeReitzDistribution)(ax, ay);
-            si->bsdf->Add(ARENA_ALLOC(arena, MicrofacetTransmission)(
-                T, scaledDistrib, 1., e, mode));
+            si->bsdf->Emplace<MicrofacetTransmission>(
+                arena, T, scaledDistrib, 1., e, mode);
         } else
-            si->bsdf->Add(ARENA_ALLOC(arena, MicrofacetTransmission)(
-                T, distrib, 1., e, mode));
+            si->bsdf->Emplace<MicrofacetTransmission>(
+                arena, T, distrib, 1., e, mode);
     }
     if (thin) {
         // Lambertian, weighted by (1 - diffTrans)
-        si->bsdf->Add(ARENA_ALLOC(arena, LambertianTransmission)(dt * c));
+        si->bsdf->Emplace<LambertianTransmission>(arena, dt * c);
     }
 }
 
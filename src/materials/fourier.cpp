@@ -218,7 +218,7 @@ void FourierMaterial::ComputeScatteringFunctions(
     // Checking for zero channels works as a proxy for checking whether the
     // table was successfully read from the file.
     if (bsdfTable->nChannels > 0)
-        si->bsdf->Add(ARENA_ALLOC(arena, FourierBSDF)(*bsdfTable, mode));
+        si->bsdf->Emplace<FourierBSDF>(arena, *bsdfTable, mode);
 }
 
 FourierMaterial *CreateFourierMaterial(const TextureParams &mp) {
@@ -163,7 +163,7 @@ void HairMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
 
     // Offset along width
     Float h = -1 + 2 * si->uv[1];
-    si->bsdf->Add(ARENA_ALLOC(arena, HairBSDF)(h, e, sig_a, bm, bn, a));
+    si->bsdf->Emplace<HairBSDF>(arena, h, e, sig_a, bm, bn, a);
 }
 
 HairMaterial *CreateHairMaterial(const TextureParams &mp) {
@@ -59,8 +59,7 @@ void KdSubsurfaceMaterial::ComputeScatteringFunctions(
 
     bool isSpecular = urough == 0 && vrough == 0;
     if (isSpecular && allowMultipleLobes) {
-        si->bsdf->Add(
-            ARENA_ALLOC(arena, FresnelSpecular)(R, T, 1.f, eta, mode));
+        si->bsdf->Emplace<FresnelSpecular>(arena, R, T, 1.f, eta, mode);
     } else {
         if (remapRoughness) {
             urough = TrowbridgeReitzDistribution::RoughnessToAlpha(urough);
@@ -73,19 +72,18 @@ void KdSubsurfaceMaterial::ComputeScatteringFunctions(
         if (!R.IsBlack()) {
             Fresnel *fresnel = ARENA_ALLOC(arena, FresnelDielectric)(1.f, eta);
             if (isSpecular)
-                si->bsdf->Add(
-                    ARENA_ALLOC(arena, SpecularReflection)(R, fresnel));
+                si->bsdf->Emplace<SpecularReflection>(arena, R, fresnel);
             else
-                si->bsdf->Add(ARENA_ALLOC(arena, MicrofacetReflection)(
-                    R, distrib, fresnel));
+                si->bsdf->Emplace<MicrofacetReflection>(
+                    arena, R, distrib, fresnel);
         }
         if (!T.IsBlack()) {
             if (isSpecular)
-                si->bsdf->Add(ARENA_ALLOC(arena, SpecularTransmission)(
-                    T, 1.f, eta, mode));
+                si->bsdf->Emplace<SpecularTransmission>(
+                    arena, T, 1.f, eta, mode);
             else
-                si->bsdf->Add(ARENA_ALLOC(arena, MicrofacetTransmission)(
-                    T, distrib, 1.f, eta, mode));
+                si->bsdf->Emplace<MicrofacetTransmission>(
+                    arena, T, distrib, 1.f, eta, mode);
         }
     }
 
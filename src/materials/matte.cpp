@@ -55,9 +55,9 @@ void MatteMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
     Float sig = Clamp(sigma->Evaluate(*si), 0, 90);
     if (!r.IsBlack()) {
         if (sig == 0)
-            si->bsdf->Add(ARENA_ALLOC(arena, LambertianReflection)(r));
+            si->bsdf->Emplace<LambertianReflection>(arena, r);
         else
-            si->bsdf->Add(ARENA_ALLOC(arena, OrenNayar)(r, sig));
+            si->bsdf->Emplace<OrenNayar>(arena, r, sig);
     }
 }
 
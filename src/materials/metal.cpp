@@ -76,7 +76,7 @@ void MetalMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
                                                          k->Evaluate(*si));
     MicrofacetDistribution *distrib =
         ARENA_ALLOC(arena, TrowbridgeReitzDistribution)(uRough, vRough);
-    si->bsdf->Add(ARENA_ALLOC(arena, MicrofacetReflection)(1., distrib, frMf));
+    si->bsdf->Emplace<MicrofacetReflection>(arena, 1., distrib, frMf);
 }
 
 const int CopperSamples = 56;
@@ -51,8 +51,8 @@ void MirrorMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
     si->bsdf = ARENA_ALLOC(arena, BSDF)(*si);
     Spectrum R = Kr->Evaluate(*si).Clamp();
     if (!R.IsBlack())
-        si->bsdf->Add(ARENA_ALLOC(arena, SpecularReflection)(
-            R, ARENA_ALLOC(arena, FresnelNoOp)()));
+        si->bsdf->Emplace<SpecularReflection>(
+            arena, R, ARENA_ALLOC(arena, FresnelNoOp)());
 }
 
 MirrorMaterial *CreateMirrorMaterial(const TextureParams &mp) {
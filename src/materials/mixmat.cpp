@@ -56,9 +56,11 @@ void MixMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
 
     // Initialize _si->bsdf_ with weighted mixture of _BxDF_s
     int n1 = si->bsdf->NumComponents(), n2 = si2.bsdf->NumComponents();
-    for (int i = 0; i < n1; ++i)
+    for (int i = 0; i < n1; ++i) {
         si->bsdf->bxdfs[i] =
             ARENA_ALLOC(arena, ScaledBxDF)(si->bsdf->bxdfs[i], s1);
+        si->bsdf->kinds[i] = BxDFKind::Virtual;
+    }
     for (int i = 0; i < n2; ++i)
         si->bsdf->Add(ARENA_ALLOC(arena, ScaledBxDF)(si2.bsdf->bxdfs[i], s2));
 }
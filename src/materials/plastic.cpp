@@ -51,7 +51,7 @@ void PlasticMaterial::ComputeScatteringFunctions(
     // Initialize diffuse component of plastic material
     Spectrum kd = Kd->Evaluate(*si).Clamp();
     if (!kd.IsBlack())
-        si->bsdf->Add(ARENA_ALLOC(arena, LambertianReflection)(kd));
+        si->bsdf->Emplace<LambertianReflection>(arena, kd);
 
     // Initialize specular component of plastic material
     Spectrum ks = Ks->Evaluate(*si).Clamp();
@@ -63,9 +63,7 @@ void PlasticMaterial::ComputeScatteringFunctions(
             rough = TrowbridgeReitzDistribution::RoughnessToAlpha(rough);
         MicrofacetDistribution *distrib =
             ARENA_ALLOC(arena, TrowbridgeReitzDistribution)(rough, rough);
-        BxDF *spec =
-            ARENA_ALLOC(arena, MicrofacetReflection)(ks, distrib, fresnel);
-        si->bsdf->Add(spec);
+        si->bsdf->Emplace<MicrofacetReflection>(arena, ks, distrib, fresnel);
     }
 }
 
@@ -60,7 +60,7 @@ void SubstrateMaterial::ComputeScatteringFunctions(
         }
         MicrofacetDistribution *distrib =
             ARENA_ALLOC(arena, TrowbridgeReitzDistribution)(roughu, roughv);
-        si->bsdf->Add(ARENA_ALLOC(arena, FresnelBlend)(d, s, distrib));
+        si->bsdf->Emplace<FresnelBlend>(arena, d, s, distrib);
     }
 }
 
@@ -57,9 +57,9 @@ void TranslucentMaterial::ComputeScatteringFunctions(
     Spectrum kd = Kd->Evaluate(*si).Clamp();
     if (!kd.IsBlack()) {
         if (!r.IsBlack())
-            si->bsdf->Add(ARENA_ALLOC(arena, LambertianReflection)(r * kd));
+            si->bsdf->Emplace<LambertianReflection>(arena, r * kd);
         if (!t.IsBlack())
-            si->bsdf->Add(ARENA_ALLOC(arena, LambertianTransmission)(t * kd));
+            si->bsdf->Emplace<LambertianTransmission>(arena, t * kd);
     }
     Spectrum ks = Ks->Evaluate(*si).Clamp();
     if (!ks.IsBlack() && (!r.IsBlack() || !t.IsBlack())) {
@@ -70,12 +70,12 @@ void TranslucentMaterial::ComputeScatteringFunctions(
             ARENA_ALLOC(arena, TrowbridgeReitzDistribution)(rough, rough);
         if (!r.IsBlack()) {
             Fresnel *fresnel = ARENA_ALLOC(arena, FresnelDielectric)(1.f, eta);
-            si->bsdf->Add(ARENA_ALLOC(arena, MicrofacetReflection)(
-                r * ks, distrib, fresnel));
+            si->bsdf->Emplace<MicrofacetReflection>(
+                arena, r * ks, distrib, fresnel);
         }
         if (!t.IsBlack())
-            si->bsdf->Add(ARENA_ALLOC(arena, MicrofacetTransmission)(
-                t * ks, distrib, 1.f, eta, mode));
+            si->bsdf->Emplace<MicrofacetTransmission>(
+                arena, t * ks, distrib, 1.f, eta, mode);
     }
 }
 
@@ -54,16 +54,12 @@ void UberMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
     Spectrum t = (-op + Spectrum(1.f)).Clamp();
     if (!t.IsBlack()) {
         si->bsdf = ARENA_ALLOC(arena, BSDF)(*si, 1.f);
-        BxDF *tr = ARENA_ALLOC(arena, SpecularTransmission)(t, 1.f, 1.f, mode);
-        si->bsdf->Add(tr);
+        si->bsdf->Emplace<SpecularTransmission>(arena, t, 1.f, 1.f, mode);
     } else
         si->bsdf = ARENA_ALLOC(arena, BSDF)(*si, e);
 
     Spectrum kd = op * Kd->Evaluate(*si).Clamp();
-    if (!kd.IsBlack()) {
-        BxDF *diff = ARENA_ALLOC(arena, LambertianReflection)(kd);
-        si->bsdf->Add(diff);
-    }
+    if (!kd.IsBlack()) si->bsdf->Emplace<LambertianReflection>(arena, kd);
 
     Spectrum ks = op * Ks->Evaluate(*si).Clamp();
     if (!ks.IsBlack()) {
@@ -83,21 +79,18 @@ void UberMaterial::ComputeScatteringFunctions(SurfaceInteraction *si,
         }
         MicrofacetDistribution *distrib =
             ARENA_ALLOC(arena, TrowbridgeReitzDistribution)(roughu, roughv);
-        BxDF *spec =
-            ARENA_ALLOC(arena, MicrofacetReflection)(ks, distrib, fresnel);
-        si->bsdf->Add(spec);
+        si->bsdf->Emplace<MicrofacetReflection>(arena, ks, distrib, fresnel);
     }
 
     Spectrum kr = op * Kr->Evaluate(*si).Clamp();
     if (!kr.IsBlack()) {
         Fresnel *fresnel = ARENA_ALLOC(arena, FresnelDielectric)(1.f, e);
-        si->bsdf->Add(ARENA_ALLOC(arena, SpecularReflection)(kr, fresnel));
+        si->bsdf->Emplace<SpecularReflection>(arena, kr, fresnel);
     }
 
     Spectrum kt = op * Kt->Evaluate(*si).Clamp();
     if (!kt.IsBlack())
-        si->bsdf->Add(
-            ARENA_ALLOC(arena, SpecularTransmission)(kt, 1.f, e, mode));
+        si->bsdf->Emplace<SpecularTransmission>(arena, kt, 1.f, e, mode);
 }
 
 UberMaterial *CreateUberMaterial(const TextureParams &mp) {
@@ -39,7 +39,8 @@
 
 namespace pbrt {
 
-RandomSampler::RandomSampler(int ns, int seed) : Sampler(ns), rng(seed) {}
+RandomSampler::RandomSampler(int ns, int seed)
+    : Sampler(ns), rng(seed), seed(seed) {}
 
 Float RandomSampler::Get1D() {
     ProfilePhase _(Prof::GetSample);
@@ -61,6 +62,7 @@ std::unique_ptr<Sampler> RandomSampler::Clone(int seed) {
 
 void RandomSampler::StartPixel(const Point2i &p) {
     ProfilePhase _(Prof::StartPixel);
+    rng.SetSequence(PixelRNGSequence(p, 0) ^ seed);
     for (size_t i = 0; i < sampleArray1D.size(); ++i)
         for (size_t j = 0; j < sampleArray1D[i].size(); ++j)
             sampleArray1D[i][j] = rng.UniformFloat();
@@ -69,6 +71,19 @@ void RandomSampler::StartPixel(const Point2i &p) {
         for (size_t j = 0; j < sampleArray2D[i].size(); ++j)
             sampleArray2D[i][j] = {rng.UniformFloat(), rng.UniformFloat()};
     Sampler::StartPixel(p);
+    rng.SetSequence(PixelRNGSequence(p, 1) ^ seed);
+}
+
+bool RandomSampler::StartNextSample() {
+    bool more = Sampler::StartNextSample();
+    rng.SetSequence(
+        PixelRNGSequence(currentPixel, currentPixelSampleIndex + 1) ^ seed);
+    return more;
+}
+
+bool RandomSampler::SetSampleNumber(int64_t sampleNum) {
+    rng.SetSequence(PixelRNGSequence(currentPixel, sampleNum + 1) ^ seed);
+    return Sampler::SetSampleNumber(sampleNum);
 }
 
 Sampler *CreateRandomSampler(const ParamSet &params) {
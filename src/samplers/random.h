@@ -48,12 +48,15 @@ class RandomSampler : public Sampler {
   public:
     RandomSampler(int ns, int seed = 0);
     void StartPixel(const Point2i &);
+    bool StartNextSample();
+    bool SetSampleNumber(int64_t sampleNum);
     Float Get1D();
     Point2f Get2D();
     std::unique_ptr<Sampler> Clone(int seed);
 
   private:
     RNG rng;
+    const int seed;
 };
 
 Sampler *CreateRandomSampler(const ParamSet &params);
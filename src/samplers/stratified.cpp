@@ -42,6 +42,7 @@ namespace pbrt {
 // StratifiedSampler Method Definitions
 void StratifiedSampler::StartPixel(const Point2i &p) {
     ProfilePhase _(Prof::StartPixel);
+    rng.SetSequence(PixelRNGSequence(p, 0));
     // Generate single stratified samples for the pixel
     for (size_t i = 0; i < samples1D.size(); ++i) {
         StratifiedSample1D(&samples1D[i][0], xPixelSamples * yPixelSamples, rng,
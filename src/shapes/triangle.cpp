@@ -210,20 +210,61 @@ Bounds3f Triangle::WorldBound() const
     return Union(Bounds3f(p0, p1), p2);
 }
 
-// 相交检测，计算相交信息
-bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
-                         bool testAlphaTexture) const
+// 在_clip_内部分的世界空间边界
+Bounds3f Triangle::ClippedWorldBound(const Bounds3f &clip) const
 {
-    ProfilePhase p(Prof::TriIntersect);
-    ++nTests;
     // Get triangle vertices in _p0_, _p1_, and _p2_
-    // 1. 获取顶点坐标
     const Point3f &p0 = mesh->p[v[0]];
     const Point3f &p1 = mesh->p[v[1]];
     const Point3f &p2 = mesh->p[v[2]];
 
-    // Perform ray--triangle intersection test
-    // 2. 射线——三角形相交检测
+    // Clip the triangle against the six planes of _clip_; each plane adds
+    // at most one vertex to the polygon
+    Point3f poly[9] = {p0, p1, p2}, clipped[9];
+    int nVertices = 3;
+    for (int axis = 0; axis < 3; ++axis)
+        for (int side = 0; side < 2; ++side) {
+            Float plane = clip[side][axis];
+            auto inside = [&](const Point3f &p) {
+                return side == 0 ? p[axis] >= plane : p[axis] <= plane;
+            };
+            int nClipped = 0;
+            for (int i = 0; i < nVertices; ++i) {
+                const Point3f &a = poly[i], &b = poly[(i + 1) % nVertices];
+                if (inside(a)) clipped[nClipped++] = a;
+                if (inside(a) != inside(b)) {
+                    // Add the point where edge _ab_ crosses the plane
+                    Float t = (plane - a[axis]) / (b[axis] - a[axis]);
+                    Point3f pc = Lerp(t, a, b);
+                    pc[axis] = plane;
+                    clipped[nClipped++] = pc;
+                }
+            }
+            if (nClipped == 0) return Bounds3f();
+            std::copy(clipped, clipped + nClipped, poly);
+            nVertices = nClipped;
+        }
+
+    // Bound the clipped polygon, padding for the rounding error of the
+    // computed crossing points
+    Bounds3f b;
+    for (int i = 0; i < nVertices; ++i) b = Union(b, poly[i]);
+    Vector3f maxAbs =
+        Max(Abs(Vector3f(p0)), Max(Abs(Vector3f(p1)), Abs(Vector3f(p2))));
+    Vector3f pad = 4 * gamma(3) * maxAbs;
+    b = Bounds3f(b.pMin - pad, b.pMax + pad);
+    return pbrt::Intersect(b, pbrt::Intersect(clip, WorldBound()));
+}
+
+// 相交检测，计算相交信息
+// Watertight ray--triangle intersection test shared by _Triangle_ and by
+// accelerators that store triangle vertices in their own layout
+// 水密射线——三角形相交检测
+bool IntersectTriangle(const Ray &ray, const Point3f &p0, const Point3f &p1,
+                       const Point3f &p2, Float *tHit, Float *b0, Float *b1,
+                       Float *b2)
+{
+    ++nTests;
 
     // Transform triangle vertices to ray coordinate space
     // 2.1. 顶点变换到射线坐标空间
@@ -304,9 +345,9 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
     // Compute barycentric coordinates and $t$ value for triangle intersection
     // 2.6. 
     Float invDet = 1 / det;
-    Float b0 = e0 * invDet;
-    Float b1 = e1 * invDet;
-    Float b2 = e2 * invDet;
+    *b0 = e0 * invDet;
+    *b1 = e1 * invDet;
+    *b2 = e2 * invDet;
     Float t = tScaled * invDet;
 
     // Ensure that computed triangle $t$ is conservatively greater than zero
@@ -333,6 +374,41 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
                    std::abs(invDet);
     if (t <= deltaT)
         return false;
+    // Hits are counted here, before any alpha test, so that accelerators
+    // calling IntersectTriangle() directly report the same statistics
+    ++nHits;
+    *tHit = t;
+    return true;
+}
+
+bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
+                         bool testAlphaTexture) const
+{
+    ProfilePhase p(Prof::TriIntersect);
+    // Get triangle vertices in _p0_, _p1_, and _p2_
+    // 1. 获取顶点坐标
+    const Point3f &p0 = mesh->p[v[0]];
+    const Point3f &p1 = mesh->p[v[1]];
+    const Point3f &p2 = mesh->p[v[2]];
+
+    // Perform ray--triangle intersection test
+    // 2. 射线——三角形相交检测
+    Float t, b0, b1, b2;
+    if (!IntersectTriangle(ray, p0, p1, p2, &t, &b0, &b1, &b2))
+        return false;
+    if (!InteractionFromHit(ray, b0, b1, b2, isect, testAlphaTexture))
+        return false;
+    *tHit = t;
+    return true;
+}
+
+bool Triangle::InteractionFromHit(const Ray &ray, Float b0, Float b1, Float b2,
+                                  SurfaceInteraction *isect,
+                                  bool testAlphaTexture) const
+{
+    const Point3f &p0 = mesh->p[v[0]];
+    const Point3f &p1 = mesh->p[v[1]];
+    const Point3f &p2 = mesh->p[v[2]];
 
     // Compute triangle partial derivatives
     Vector3f dpdu, dpdv;
@@ -480,119 +556,20 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
         isect->n = Faceforward(isect->n, isect->shading.n);
     else if (reverseOrientation ^ transformSwapsHandedness)
         isect->n = isect->shading.n = -isect->n;
-    *tHit = t;
-    ++nHits;
     return true;
 }
 
 bool Triangle::IntersectP(const Ray &ray, bool testAlphaTexture) const
 {
     ProfilePhase p(Prof::TriIntersectP);
-    ++nTests;
     // Get triangle vertices in _p0_, _p1_, and _p2_
     const Point3f &p0 = mesh->p[v[0]];
     const Point3f &p1 = mesh->p[v[1]];
     const Point3f &p2 = mesh->p[v[2]];
 
     // Perform ray--triangle intersection test
-
-    // Transform triangle vertices to ray coordinate space
-
-    // Translate vertices based on ray origin
-    Point3f p0t = p0 - Vector3f(ray.o);
-    Point3f p1t = p1 - Vector3f(ray.o);
-    Point3f p2t = p2 - Vector3f(ray.o);
-
-    // Permute components of triangle vertices and ray direction
-    int kz = MaxDimension(Abs(ray.d));
-    int kx = kz + 1;
-    if (kx == 3)
-        kx = 0;
-    int ky = kx + 1;
-    if (ky == 3)
-        ky = 0;
-    Vector3f d = Permute(ray.d, kx, ky, kz);
-    p0t = Permute(p0t, kx, ky, kz);
-    p1t = Permute(p1t, kx, ky, kz);
-    p2t = Permute(p2t, kx, ky, kz);
-
-    // Apply shear transformation to translated vertex positions
-    Float Sx = -d.x / d.z;
-    Float Sy = -d.y / d.z;
-    Float Sz = 1.f / d.z;
-    p0t.x += Sx * p0t.z;
-    p0t.y += Sy * p0t.z;
-    p1t.x += Sx * p1t.z;
-    p1t.y += Sy * p1t.z;
-    p2t.x += Sx * p2t.z;
-    p2t.y += Sy * p2t.z;
-
-    // Compute edge function coefficients _e0_, _e1_, and _e2_
-    Float e0 = p1t.x * p2t.y - p1t.y * p2t.x;
-    Float e1 = p2t.x * p0t.y - p2t.y * p0t.x;
-    Float e2 = p0t.x * p1t.y - p0t.y * p1t.x;
-
-    // Fall back to double precision test at triangle edges
-    if (sizeof(Float) == sizeof(float) &&
-        (e0 == 0.0f || e1 == 0.0f || e2 == 0.0f))
-    {
-        double p2txp1ty = (double)p2t.x * (double)p1t.y;
-        double p2typ1tx = (double)p2t.y * (double)p1t.x;
-        e0 = (float)(p2typ1tx - p2txp1ty);
-        double p0txp2ty = (double)p0t.x * (double)p2t.y;
-        double p0typ2tx = (double)p0t.y * (double)p2t.x;
-        e1 = (float)(p0typ2tx - p0txp2ty);
-        double p1txp0ty = (double)p1t.x * (double)p0t.y;
-        double p1typ0tx = (double)p1t.y * (double)p0t.x;
-        e2 = (float)(p1typ0tx - p1txp0ty);
-    }
-
-    // Perform triangle edge and determinant tests
-    if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
-        return false;
-    Float det = e0 + e1 + e2;
-    if (det == 0)
-        return false;
-
-    // Compute scaled hit distance to triangle and test against ray $t$ range
-    p0t.z *= Sz;
-    p1t.z *= Sz;
-    p2t.z *= Sz;
-    Float tScaled = e0 * p0t.z + e1 * p1t.z + e2 * p2t.z;
-    if (det < 0 && (tScaled >= 0 || tScaled < ray.tMax * det))
-        return false;
-    else if (det > 0 && (tScaled <= 0 || tScaled > ray.tMax * det))
-        return false;
-
-    // Compute barycentric coordinates and $t$ value for triangle intersection
-    Float invDet = 1 / det;
-    Float b0 = e0 * invDet;
-    Float b1 = e1 * invDet;
-    Float b2 = e2 * invDet;
-    Float t = tScaled * invDet;
-
-    // Ensure that computed triangle $t$ is conservatively greater than zero
-
-    // Compute $\delta_z$ term for triangle $t$ error bounds
-    Float maxZt = MaxComponent(Abs(Vector3f(p0t.z, p1t.z, p2t.z)));
-    Float deltaZ = gamma(3) * maxZt;
-
-    // Compute $\delta_x$ and $\delta_y$ terms for triangle $t$ error bounds
-    Float maxXt = MaxComponent(Abs(Vector3f(p0t.x, p1t.x, p2t.x)));
-    Float maxYt = MaxComponent(Abs(Vector3f(p0t.y, p1t.y, p2t.y)));
-    Float deltaX = gamma(5) * (maxXt + maxZt);
-    Float deltaY = gamma(5) * (maxYt + maxZt);
-
-    // Compute $\delta_e$ term for triangle $t$ error bounds
-    Float deltaE =
-        2 * (gamma(2) * maxXt * maxYt + deltaY * maxXt + deltaX * maxYt);
-
-    // Compute $\delta_t$ term for triangle $t$ error bounds and check _t_
-    Float maxE = MaxComponent(Abs(Vector3f(e0, e1, e2)));
-    Float deltaT = 3 *
-                   (gamma(3) * maxE * maxZt + deltaE * maxZt + deltaZ * maxE) *
-                   std::abs(invDet);
-    if (t <= deltaT)
+    Float t, b0, b1, b2;
+    if (!IntersectTriangle(ray, p0, p1, p2, &t, &b0, &b1, &b2))
         return false;
 
     // Test shadow ray intersection against alpha texture, if present
@@ -638,10 +615,21 @@ bool Triangle::IntersectP(const Ray &ray, bool testAlphaTexture) const
             mesh->shadowAlphaMask->Evaluate(isectLocal) == 0)
             return false;
     }
-    ++nHits;
     return true;
 }
 
+bool Triangle::GetIntersectionVertices(Point3f *p0, Point3f *p1,
+                                       Point3f *p2) const
+{
+    if (mesh->alphaMask || mesh->shadowAlphaMask)
+        return false;
+    *p0 = mesh->p[v[0]];
+    *p1 = mesh->p[v[1]];
+    *p2 = mesh->p[v[2]];
+    // Intersect() rejects hits on degenerate triangles after the hit test
+    return Cross(*p2 - *p0, *p1 - *p0).LengthSquared() != 0;
+}
+
 Float Triangle::Area() const
 {
     // Get triangle vertices in _p0_, _p1_, and _p2_
@@ -92,10 +92,31 @@ public:
     Bounds3f ObjectBound() const;
     // 世界空间边界
     Bounds3f WorldBound() const;
+    // 在_clip_内部分的世界空间边界
+    Bounds3f ClippedWorldBound(const Bounds3f &clip) const;
+    // 世界空间顶点
+    void GetVertices(Point3f *p0, Point3f *p1, Point3f *p2) const
+    {
+        *p0 = mesh->p[v[0]];
+        *p1 = mesh->p[v[1]];
+        *p2 = mesh->p[v[2]];
+    }
     
     bool Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
                    bool testAlphaTexture = true) const;
+    // Fills in _isect_ for the hit with barycentrics _b0_, _b1_, _b2_ that
+    // IntersectTriangle() found on this triangle's vertices; returns false
+    // if the alpha texture or a degenerate triangle rejects the hit.
+    // 根据IntersectTriangle()求得的交点计算相交信息，不再重复相交检测
+    bool InteractionFromHit(const Ray &ray, Float b0, Float b1, Float b2,
+                            SurfaceInteraction *isect,
+                            bool testAlphaTexture = true) const;
     bool IntersectP(const Ray &ray, bool testAlphaTexture = true) const;
+    // Returns the world-space vertices if hits found by IntersectTriangle()
+    // on them are exactly the hits Intersect() reports, i.e. the mesh has
+    // no alpha mask and the triangle isn't degenerate.
+    // 若可直接用IntersectTriangle()代替Intersect()，返回世界空间顶点
+    bool GetIntersectionVertices(Point3f *p0, Point3f *p1, Point3f *p2) const;
     
     Float Area() const;
 
@@ -132,6 +153,12 @@ private:
     int faceIndex;                      // 面索引
 };
 
+// Watertight ray--triangle test; returns the hit's $t$ and barycentrics.
+// 水密射线——三角形相交检测
+bool IntersectTriangle(const Ray &ray, const Point3f &p0, const Point3f &p1,
+                       const Point3f &p2, Float *tHit, Float *b0, Float *b1,
+                       Float *b2);
+
 std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
     const Transform *o2w, const Transform *w2o, bool reverseOrientation,
     int nTriangles, const int *vertexIndices, int nVertices, const Point3f *p,
@@ -15,6 +15,7 @@
 #include "integrators/mlt.h"
 #include "integrators/path.h"
 #include "integrators/volpath.h"
+#include "integrators/wavefront.h"
 #include "lights/diffuse.h"
 #include "lights/point.h"
 #include "materials/matte.h"
@@ -313,6 +314,48 @@ std::vector<TestIntegrator> GetIntegrators() {
                                    scene});
         }
 
+        // Wavefront path tracing integrators; a small queue splits the
+        // image into several waves
+        for (auto sampler : GetSamplers(Bounds2i(Point2i(0, 0), resolution))) {
+            std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5, 0.5)));
+            Film *film =
+                new Film(resolution, Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                         std::move(filter), 1., inTestDir("test.exr"), 1.);
+            std::shared_ptr<Camera> camera =
+                std::make_shared<PerspectiveCamera>(
+                    identity, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 1.,
+                    0., 10., 45, film, nullptr);
+
+            Integrator *integrator = new WavefrontPathIntegrator(
+                8, camera, sampler.first, film->croppedPixelBounds, 1,
+                "spatial", 64);
+            integrators.push_back({integrator, film,
+                                   "WavefrontPath, depth 8, Perspective, " +
+                                       sampler.second + ", " +
+                                       scene.description,
+                                   scene});
+        }
+
+        for (auto sampler : GetSamplers(Bounds2i(Point2i(0, 0), resolution))) {
+            std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5, 0.5)));
+            Film *film =
+                new Film(resolution, Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                         std::move(filter), 1., inTestDir("test.exr"), 1.);
+            std::shared_ptr<Camera> camera =
+                std::make_shared<OrthographicCamera>(
+                    identity, Bounds2f(Point2f(-.1, -.1), Point2f(.1, .1)), 0.,
+                    1., 0., 10., film, nullptr);
+
+            Integrator *integrator = new WavefrontPathIntegrator(
+                8, camera, sampler.first, film->croppedPixelBounds, 1,
+                "spatial", 64);
+            integrators.push_back({integrator, film,
+                                   "WavefrontPath, depth 8, Ortho, " +
+                                       sampler.second + ", " +
+                                       scene.description,
+                                   scene});
+        }
+
         // Volume path tracing integrators
         for (auto sampler : GetSamplers(Bounds2i(Point2i(0, 0), resolution))) {
             std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5, 0.5)));
@@ -438,3 +481,64 @@ TEST_P(RenderTest, RadianceMatches) {
 
 INSTANTIATE_TEST_CASE_P(AnalyticTestScenes, RenderTest,
                         testing::ValuesIn(GetIntegrators()));
+
+// With a Halton sampler, the wavefront integrator uses the same sample
+// values in the same order as PathIntegrator, so the images only differ by
+// floating-point round-off, with one or more threads, with small queues and
+// with a sampler memory budget that only allows one tile per wave.
+TEST(WavefrontPath, MatchesPath) {
+    for (int nThreads : {1, 4}) {
+        Options options;
+        options.quiet = true;
+        options.nThreads = nThreads;
+        pbrtInit(options);
+
+        Point2i resolution(10, 10);
+        AnimatedTransform identity(new Transform, 0, new Transform, 1);
+        for (const TestScene &scene : GetScenes()) {
+            std::unique_ptr<RGBSpectrum[]> images[3];
+            for (int variant = 0; variant < 3; ++variant) {
+                std::unique_ptr<Filter> filter(
+                    new BoxFilter(Vector2f(0.5, 0.5)));
+                Film *film = new Film(
+                    resolution, Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                    std::move(filter), 1., inTestDir("test.exr"), 1.);
+                std::shared_ptr<Camera> camera =
+                    std::make_shared<PerspectiveCamera>(
+                        identity, Bounds2f(Point2f(-1, -1), Point2f(1, 1)),
+                        0., 1., 0., 10., 45, film, nullptr);
+                std::shared_ptr<Sampler> sampler =
+                    std::make_shared<HaltonSampler>(
+                        16, Bounds2i(Point2i(0, 0), resolution));
+                std::unique_ptr<Integrator> integrator;
+                if (variant == 0)
+                    integrator.reset(new PathIntegrator(
+                        8, camera, sampler, film->croppedPixelBounds));
+                else if (variant == 1)
+                    integrator.reset(new WavefrontPathIntegrator(
+                        8, camera, sampler, film->croppedPixelBounds, 1,
+                        "spatial", 32));
+                else
+                    integrator.reset(new WavefrontPathIntegrator(
+                        8, camera, sampler, film->croppedPixelBounds, 1,
+                        "spatial", 1 << 16, 1));
+                integrator->Render(*scene.scene);
+                integrator.reset();
+                Point2i res;
+                images[variant] = ReadImage(inTestDir("test.exr"), &res);
+                ASSERT_TRUE(images[variant].get() != nullptr);
+                EXPECT_EQ(0, remove(inTestDir("test.exr").c_str()));
+            }
+            for (int variant = 1; variant < 3; ++variant)
+                for (int i = 0; i < resolution.x * resolution.y; ++i)
+                    for (int c = 0; c < 3; ++c)
+                        EXPECT_NEAR(images[0][i][c], images[variant][i][c],
+                                    1e-3f * std::max(1.f, images[0][i][c]))
+                            << scene.description << ", " << nThreads
+                            << " threads, variant " << variant << ", pixel "
+                            << i;
+        }
+
+        pbrtCleanup();
+    }
+}
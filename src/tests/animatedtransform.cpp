@@ -68,3 +68,40 @@ TEST(AnimatedTransform, Randoms) {
         }
     }
 }
+
+TEST(AnimatedTransform, TimeRange) {
+    RNG rng;
+    auto r = [&rng]() { return -10. + 20. * rng.UniformFloat(); };
+
+    for (int i = 0; i < 200; ++i) {
+        Transform t0 = RandomTransform(rng);
+        Transform t1 = RandomTransform(rng);
+        AnimatedTransform at(&t0, 0., &t1, 1.);
+
+        for (int j = 0; j < 5; ++j) {
+            // Bound the motion of a random box over a random subinterval.
+            Bounds3f bounds(Point3f(r(), r(), r()), Point3f(r(), r(), r()));
+            Float time0 = rng.UniformFloat(), time1 = rng.UniformFloat();
+            if (time0 > time1) std::swap(time0, time1);
+            Bounds3f motionBounds = at.MotionBounds(bounds, time0, time1);
+
+            for (Float t = time0; t <= time1;
+                 t += 1e-3 * rng.UniformFloat()) {
+                Transform tr;
+                at.Interpolate(t, &tr);
+                Bounds3f tb = tr(bounds);
+
+                // Allow for round-off error as in the test above.
+                tb.pMin += (Float)1e-4 * tb.Diagonal();
+                tb.pMax -= (Float)1e-4 * tb.Diagonal();
+
+                EXPECT_GE(tb.pMin.x, motionBounds.pMin.x);
+                EXPECT_LE(tb.pMax.x, motionBounds.pMax.x);
+                EXPECT_GE(tb.pMin.y, motionBounds.pMin.y);
+                EXPECT_LE(tb.pMax.y, motionBounds.pMax.y);
+                EXPECT_GE(tb.pMin.z, motionBounds.pMin.z);
+                EXPECT_LE(tb.pMax.z, motionBounds.pMax.z);
+            }
+        }
+    }
+}
@@ -554,3 +554,92 @@ TEST(BSDFSampling, TR_std_0p05_0p1) {
         createFresnelBlend(bsdf, arena, false, false, 0.05, 0.1);
     }, "Fresnel blend Trowbridge-Reitz, std sample, alpha = 0.05/0.1");
 }
+
+// Adds a _T_ to _bsdf_, either stored inline with BSDF::Emplace() or
+// allocated separately and called through its virtual methods.
+template <typename T, typename... Args>
+static void addBxDF(BSDF* bsdf, MemoryArena& arena, bool inlineBxDF,
+                    Args&&... args) {
+    if (inlineBxDF)
+        bsdf->Emplace<T>(arena, std::forward<Args>(args)...);
+    else
+        bsdf->Add(ARENA_ALLOC(arena, T)(std::forward<Args>(args)...));
+}
+
+// Adds each of the BxDFs that BSDF can call directly; FresnelSpecular goes
+// in a BSDF of its own since there are more of them than BSDF::MaxBxDFs.
+static void createAllBxDFs(BSDF* bsdf, MemoryArena& arena, bool inlineBxDF,
+                           bool fresnelSpecular) {
+    MicrofacetDistribution* distrib =
+        ARENA_ALLOC(arena, TrowbridgeReitzDistribution)(.3, .2);
+    Fresnel* fresnel = ARENA_ALLOC(arena, FresnelDielectric)(1.f, 1.5f);
+    TransportMode mode = TransportMode::Radiance;
+    if (fresnelSpecular) {
+        addBxDF<FresnelSpecular>(bsdf, arena, inlineBxDF, Spectrum(.8f),
+                                 Spectrum(.7f), 1.f, 1.5f, mode);
+        addBxDF<LambertianReflection>(bsdf, arena, inlineBxDF, Spectrum(.2f));
+        return;
+    }
+    addBxDF<LambertianReflection>(bsdf, arena, inlineBxDF, Spectrum(.2f));
+    addBxDF<LambertianTransmission>(bsdf, arena, inlineBxDF, Spectrum(.1f));
+    addBxDF<OrenNayar>(bsdf, arena, inlineBxDF, Spectrum(.3f), 20.f);
+    addBxDF<MicrofacetReflection>(bsdf, arena, inlineBxDF, Spectrum(.5f),
+                                  distrib, fresnel);
+    addBxDF<MicrofacetTransmission>(bsdf, arena, inlineBxDF, Spectrum(.5f),
+                                    distrib, 1.f, 1.5f, mode);
+    addBxDF<FresnelBlend>(bsdf, arena, inlineBxDF, Spectrum(.4f),
+                          Spectrum(.3f), distrib);
+    addBxDF<SpecularReflection>(bsdf, arena, inlineBxDF, Spectrum(.9f),
+                                fresnel);
+    addBxDF<SpecularTransmission>(bsdf, arena, inlineBxDF, Spectrum(.9f), 1.f,
+                                  1.5f, mode);
+}
+
+TEST(BSDF, InlineBxDFsMatchVirtual) {
+    MemoryArena arena;
+    Transform t = RotateX(-90);
+    Transform tInv = Inverse(t);
+    std::shared_ptr<Shape> disk(
+        new Disk(&t, &tInv, false, 0., 1., 0, 360.));
+    Float tHit;
+    SurfaceInteraction isect;
+    ASSERT_TRUE(disk->Intersect(Ray(Point3f(0.1, 1, 0), Vector3f(0, -1, 0)),
+                                &tHit, &isect));
+
+    for (bool fresnelSpecular : {false, true}) {
+        BSDF* inlineBSDF = ARENA_ALLOC(arena, BSDF)(isect);
+        createAllBxDFs(inlineBSDF, arena, true, fresnelSpecular);
+        BSDF* virtualBSDF = ARENA_ALLOC(arena, BSDF)(isect);
+        createAllBxDFs(virtualBSDF, arena, false, fresnelSpecular);
+        EXPECT_EQ(inlineBSDF->NumComponents(), virtualBSDF->NumComponents());
+
+        RNG rng;
+        for (int i = 0; i < 1000; ++i) {
+            Vector3f wo = UniformSampleSphere(
+                Point2f(rng.UniformFloat(), rng.UniformFloat()));
+            Point2f u(rng.UniformFloat(), rng.UniformFloat());
+            BxDFType flags = (i & 1) ? BSDF_ALL
+                                     : BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
+
+            Vector3f wiInline, wiVirtual;
+            Float pdfInline, pdfVirtual;
+            BxDFType typeInline, typeVirtual;
+            Spectrum fInline = inlineBSDF->Sample_f(wo, &wiInline, u,
+                                                    &pdfInline, flags,
+                                                    &typeInline);
+            Spectrum fVirtual = virtualBSDF->Sample_f(wo, &wiVirtual, u,
+                                                      &pdfVirtual, flags,
+                                                      &typeVirtual);
+            EXPECT_EQ(fVirtual, fInline);
+            EXPECT_EQ(pdfVirtual, pdfInline);
+            EXPECT_EQ(typeVirtual, typeInline);
+            if (pdfVirtual == 0) continue;
+            EXPECT_EQ(wiVirtual, wiInline);
+
+            EXPECT_EQ(virtualBSDF->f(wo, wiVirtual, flags),
+                      inlineBSDF->f(wo, wiInline, flags));
+            EXPECT_EQ(virtualBSDF->Pdf(wo, wiVirtual, flags),
+                      inlineBSDF->Pdf(wo, wiInline, flags));
+        }
+    }
+}
@@ -0,0 +1,523 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "rng.h"
+#include "sampling.h"
+#include "primitive.h"
+#include "interaction.h"
+#include "parallel.h"
+#include "accelerators/bvh.h"
+#include "shapes/triangle.h"
+#include "tests/randomtriangles.h"
+#ifndef PBRT_IS_WINDOWS
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+using namespace pbrt;
+
+// Traces packets of rays leaving a common origin, both through
+// IntersectPacket() and one at a time, and checks that the results match.
+static void TestPacketsMatch(const Primitive &accel, RNG &rng,
+                             Float spread) {
+    for (int trial = 0; trial < 200; ++trial) {
+        Point3f o(Lerp(rng.UniformFloat(), -3, 3), Lerp(rng.UniformFloat(), -3, 3),
+                  Lerp(rng.UniformFloat(), -3, 3));
+        Vector3f dir = Normalize(Point3f(0, 0, 0) - o);
+        int nRays = 1 + trial % MaxRayPacketSize;
+        Ray rays[MaxRayPacketSize], single[MaxRayPacketSize];
+        for (int i = 0; i < nRays; ++i) {
+            Point2f u(rng.UniformFloat(), rng.UniformFloat());
+            Vector3f d = Normalize(dir + spread * UniformSampleSphere(u));
+            rays[i] = single[i] = Ray(o, d);
+        }
+
+        SurfaceInteraction isects[MaxRayPacketSize];
+        bool hits[MaxRayPacketSize];
+        accel.IntersectPacket(rays, nRays, isects, hits);
+        for (int i = 0; i < nRays; ++i) {
+            SurfaceInteraction isect;
+            bool hit = accel.Intersect(single[i], &isect);
+            EXPECT_EQ(hit, hits[i]);
+            EXPECT_EQ(single[i].tMax, rays[i].tMax);
+            if (hit && hits[i]) {
+                EXPECT_EQ(isect.p, isects[i].p);
+                EXPECT_EQ(isect.primitive, isects[i].primitive);
+            }
+        }
+    }
+}
+
+TEST(BVH, PacketMatchesSingleRay) {
+    RNG rng;
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(2000, rng);
+    for (bool leafTriangles : {false, true}) {
+        BVHAccel bvh(prims, 4, BVHAccel::SplitMethod::SAH,
+                     BVHAccel::Layout::Binary, "", .3f, leafTriangles);
+        // Coherent packets exercise packet traversal; widely spread ones
+        // fall back to tracing rays individually.
+        TestPacketsMatch(bvh, rng, .01f);
+        TestPacketsMatch(bvh, rng, .2f);
+        TestPacketsMatch(bvh, rng, 2.f);
+    }
+}
+
+TEST(BVH, OcclusionBatchMatchesSingleRay) {
+    // Shadow rays from a few points to random targets, in every direction
+    // octant and with finite extents, as light sampling produces them.
+    RNG rng;
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(2000, rng);
+    BVHAccel binary(prims, 4);
+    BVHAccel bvh4(prims, 4, BVHAccel::SplitMethod::SAH, BVHAccel::Layout::BVH4);
+    for (int trial = 0; trial < 50; ++trial) {
+        Point3f o(Lerp(rng.UniformFloat(), -3, 3), Lerp(rng.UniformFloat(), -3, 3),
+                  Lerp(rng.UniformFloat(), -3, 3));
+        int nRays = 1 + rng.UniformUInt32(100);
+        std::vector<Ray> rays(nRays);
+        for (int i = 0; i < nRays; ++i) {
+            Point2f u(rng.UniformFloat(), rng.UniformFloat());
+            Float spread = trial % 2 ? .1f : 2.f;
+            Vector3f d = Normalize(Point3f(0, 0, 0) - o) +
+                         spread * UniformSampleSphere(u);
+            rays[i] = Ray(o, d, 4 * rng.UniformFloat());
+        }
+
+        for (const BVHAccel *bvh : {&binary, &bvh4}) {
+            std::unique_ptr<bool[]> occluded(new bool[nRays]);
+            bvh->IntersectPBatch(&rays[0], nRays, occluded.get());
+            for (int i = 0; i < nRays; ++i)
+                EXPECT_EQ(bvh->IntersectP(rays[i]), occluded[i]);
+        }
+    }
+}
+
+TEST(BVH, LeafTrianglesMatchPrimitives) {
+    // Leaves intersect triangles directly on their vertices; the results
+    // must match intersecting each primitive through the Primitive
+    // interface.
+    RNG rng;
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(500, rng);
+    BVHAccel binary(prims, 4, BVHAccel::SplitMethod::SAH,
+                    BVHAccel::Layout::Binary, "", .3f, true);
+    BVHAccel bvh8(prims, 4, BVHAccel::SplitMethod::SAH, BVHAccel::Layout::BVH8,
+                  "", .3f, true);
+    for (int trial = 0; trial < 2000; ++trial) {
+        Point3f o(Lerp(rng.UniformFloat(), -3, 3), Lerp(rng.UniformFloat(), -3, 3),
+                  Lerp(rng.UniformFloat(), -3, 3));
+        Point2f u(rng.UniformFloat(), rng.UniformFloat());
+        Ray ray(o, UniformSampleSphere(u));
+        Ray rayPrims = ray;
+        SurfaceInteraction isectPrims;
+        bool hitPrims = false;
+        for (const auto &prim : prims)
+            if (prim->Intersect(rayPrims, &isectPrims)) hitPrims = true;
+
+        for (const BVHAccel *bvh : {&binary, &bvh8}) {
+            Ray rayBVH = ray;
+            SurfaceInteraction isect;
+            EXPECT_EQ(hitPrims, bvh->Intersect(rayBVH, &isect));
+            EXPECT_EQ(hitPrims, bvh->IntersectP(ray));
+            EXPECT_EQ(rayPrims.tMax, rayBVH.tMax);
+            if (hitPrims) {
+                EXPECT_EQ(isectPrims.primitive, isect.primitive);
+                EXPECT_EQ(isectPrims.p, isect.p);
+                EXPECT_EQ(isectPrims.n, isect.n);
+                EXPECT_EQ(isectPrims.uv, isect.uv);
+                EXPECT_EQ(isectPrims.dpdu, isect.dpdu);
+            }
+        }
+    }
+}
+
+TEST(BVH, WideLayoutsMatchBinary) {
+    RNG rng;
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(2000, rng);
+    BVHAccel binary(prims, 4);
+    BVHAccel bvh4(prims, 4, BVHAccel::SplitMethod::SAH, BVHAccel::Layout::BVH4);
+    BVHAccel bvh8(prims, 4, BVHAccel::SplitMethod::SAH, BVHAccel::Layout::BVH8);
+    // Quantized bounds are conservative, so they must find the same hits.
+    BVHAccel quant8(prims, 4, BVHAccel::SplitMethod::SAH,
+                    BVHAccel::Layout::BVH8Quant8);
+    BVHAccel quant16(prims, 4, BVHAccel::SplitMethod::SAH,
+                     BVHAccel::Layout::BVH8Quant16);
+    EXPECT_EQ(binary.WorldBound(), bvh4.WorldBound());
+    EXPECT_EQ(binary.WorldBound(), bvh8.WorldBound());
+    EXPECT_EQ(binary.WorldBound(), quant8.WorldBound());
+    EXPECT_EQ(binary.WorldBound(), quant16.WorldBound());
+
+    for (int trial = 0; trial < 2000; ++trial) {
+        Point3f o(Lerp(rng.UniformFloat(), -3, 3), Lerp(rng.UniformFloat(), -3, 3),
+                  Lerp(rng.UniformFloat(), -3, 3));
+        Point2f u(rng.UniformFloat(), rng.UniformFloat());
+        Ray ray(o, UniformSampleSphere(u), Lerp(rng.UniformFloat(), 1, 6));
+
+        Ray rayBinary = ray;
+        SurfaceInteraction isectBinary;
+        bool hitBinary = binary.Intersect(rayBinary, &isectBinary);
+        EXPECT_EQ(hitBinary, binary.IntersectP(ray));
+
+        for (const BVHAccel *wide : {&bvh4, &bvh8, &quant8, &quant16}) {
+            Ray rayWide = ray;
+            SurfaceInteraction isectWide;
+            bool hitWide = wide->Intersect(rayWide, &isectWide);
+            EXPECT_EQ(hitBinary, hitWide);
+            EXPECT_EQ(hitBinary, wide->IntersectP(ray));
+            EXPECT_EQ(rayBinary.tMax, rayWide.tMax);
+            if (hitBinary && hitWide) {
+                EXPECT_EQ(isectBinary.p, isectWide.p);
+            }
+        }
+    }
+}
+
+TEST(BVH, ParallelBuildMatchesSerial) {
+    RNG rng;
+    // Enough primitives that the upper levels of the tree are binned in
+    // parallel.
+    std::vector<std::shared_ptr<Primitive>> prims =
+        RandomTriangles(100000, rng);
+
+    int nThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 1;
+    BVHAccel serial(prims, 4);
+    PbrtOptions.nThreads = 8;
+    ParallelInit();
+    BVHAccel parallel(prims, 4);
+    ParallelCleanup();
+    PbrtOptions.nThreads = nThreads;
+    EXPECT_EQ(serial.WorldBound(), parallel.WorldBound());
+    // The parallel build must produce exactly the serial tree, not just one
+    // that happens to give the same intersections.
+    EXPECT_TRUE(serial.SameNodes(parallel));
+
+    for (int trial = 0; trial < 2000; ++trial) {
+        Point3f o(Lerp(rng.UniformFloat(), -3, 3), Lerp(rng.UniformFloat(), -3, 3),
+                  Lerp(rng.UniformFloat(), -3, 3));
+        Point2f u(rng.UniformFloat(), rng.UniformFloat());
+        Ray raySerial(o, UniformSampleSphere(u)), rayParallel = raySerial;
+        SurfaceInteraction isectSerial, isectParallel;
+        bool hitSerial = serial.Intersect(raySerial, &isectSerial);
+        EXPECT_EQ(hitSerial, parallel.Intersect(rayParallel, &isectParallel));
+        EXPECT_EQ(raySerial.tMax, rayParallel.tMax);
+        if (hitSerial) EXPECT_EQ(isectSerial.primitive, isectParallel.primitive);
+    }
+}
+
+TEST(BVH, HLBVHMatchesSAH) {
+    RNG rng;
+    // Enough primitives that the Morton code sort and the treelet search
+    // are split across several chunks.
+    std::vector<std::shared_ptr<Primitive>> prims =
+        RandomTriangles(50000, rng);
+
+    int nThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 8;
+    ParallelInit();
+    BVHAccel sah(prims, 4);
+    BVHAccel hlbvh(prims, 4, BVHAccel::SplitMethod::HLBVH);
+    ParallelCleanup();
+    PbrtOptions.nThreads = nThreads;
+    EXPECT_EQ(sah.WorldBound(), hlbvh.WorldBound());
+
+    for (int trial = 0; trial < 2000; ++trial) {
+        Point3f o(Lerp(rng.UniformFloat(), -3, 3), Lerp(rng.UniformFloat(), -3, 3),
+                  Lerp(rng.UniformFloat(), -3, 3));
+        Point2f u(rng.UniformFloat(), rng.UniformFloat());
+        Ray raySAH(o, UniformSampleSphere(u)), rayHLBVH = raySAH;
+        SurfaceInteraction isectSAH, isectHLBVH;
+        EXPECT_EQ(sah.Intersect(raySAH, &isectSAH),
+                  hlbvh.Intersect(rayHLBVH, &isectHLBVH));
+        EXPECT_EQ(raySAH.tMax, rayHLBVH.tMax);
+        EXPECT_EQ(sah.IntersectP(raySAH), hlbvh.IntersectP(raySAH));
+    }
+}
+
+TEST(BVH, SBVHMatchesSAH) {
+    // Long, thin triangles crossing the scene diagonally overlap a lot,
+    // which is where spatial splits pay off.
+    static Transform identity;
+    RNG rng;
+    std::vector<Point3f> p;
+    std::vector<int> indices;
+    for (int i = 0; i < 500; ++i) {
+        Point3f p0(Lerp(rng.UniformFloat(), -1, 1), -1,
+                   Lerp(rng.UniformFloat(), -1, 1));
+        Point3f p1(Lerp(rng.UniformFloat(), -1, 1), 1,
+                   Lerp(rng.UniformFloat(), -1, 1));
+        Vector3f offset(Lerp(rng.UniformFloat(), -.02f, .02f), 0,
+                        Lerp(rng.UniformFloat(), -.02f, .02f));
+        for (const Point3f &v : {p0, p1, p1 + offset}) {
+            indices.push_back(p.size());
+            p.push_back(v);
+        }
+    }
+    std::vector<std::shared_ptr<Shape>> tris = CreateTriangleMesh(
+        &identity, &identity, false, indices.size() / 3, &indices[0],
+        p.size(), &p[0], nullptr, nullptr, nullptr, nullptr, nullptr);
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(1000, rng);
+    for (const auto &tri : tris)
+        prims.push_back(std::make_shared<GeometricPrimitive>(
+            tri, nullptr, nullptr, MediumInterface()));
+
+    BVHAccel sah(prims, 4);
+    BVHAccel sbvh(prims, 4, BVHAccel::SplitMethod::SBVH);
+    BVHAccel sbvh8(prims, 4, BVHAccel::SplitMethod::SBVH,
+                   BVHAccel::Layout::BVH8Quant8);
+    for (int trial = 0; trial < 2000; ++trial) {
+        Point3f o(Lerp(rng.UniformFloat(), -3, 3), Lerp(rng.UniformFloat(), -3, 3),
+                  Lerp(rng.UniformFloat(), -3, 3));
+        Point2f u(rng.UniformFloat(), rng.UniformFloat());
+        Ray raySAH(o, UniformSampleSphere(u));
+        SurfaceInteraction isectSAH;
+        bool hitSAH = sah.Intersect(raySAH, &isectSAH);
+        // Primitives referenced from several leaves must still give the
+        // closest hit.
+        for (const BVHAccel *accel : {&sbvh, &sbvh8}) {
+            Ray ray(o, raySAH.d);
+            SurfaceInteraction isect;
+            EXPECT_EQ(hitSAH, accel->Intersect(ray, &isect));
+            EXPECT_EQ(raySAH.tMax, ray.tMax);
+            EXPECT_EQ(hitSAH, accel->IntersectP(Ray(o, raySAH.d)));
+            if (hitSAH) EXPECT_EQ(isectSAH.primitive, isect.primitive);
+        }
+    }
+    TestPacketsMatch(sbvh, rng, .01f);
+}
+
+// Returns a random rotation and scale followed by a translation within
+// [-5,5]^3.
+static Transform RandomInstanceTransform(RNG &rng) {
+    Vector3f axis(rng.UniformFloat() - .5f, rng.UniformFloat() - .5f,
+                  rng.UniformFloat() - .5f);
+    return Translate(Vector3f(Lerp(rng.UniformFloat(), -5, 5),
+                              Lerp(rng.UniformFloat(), -5, 5),
+                              Lerp(rng.UniformFloat(), -5, 5))) *
+           Rotate(360 * rng.UniformFloat(), Normalize(axis)) *
+           Scale(.5f, .5f, .5f);
+}
+
+TEST(BVH, QuantizedBounds) {
+    // The quantized layouts keep the exact overall bounds, and the rounded
+    // bounds of their upper nodes, which transformed instances are bounded
+    // with, must still contain every primitive.
+    RNG rng;
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(2000, rng);
+    BVHAccel binary(prims, 4);
+    for (BVHAccel::Layout layout :
+         {BVHAccel::Layout::BVH8Quant8, BVHAccel::Layout::BVH8Quant16}) {
+        BVHAccel quant(prims, 4, BVHAccel::SplitMethod::SAH, layout);
+        EXPECT_EQ(binary.WorldBound(), quant.WorldBound());
+        for (int trial = 0; trial < 20; ++trial) {
+            Transform t = RandomInstanceTransform(rng);
+            Bounds3f tb = quant.TransformedWorldBound(t);
+            int nOutside = 0;
+            for (const auto &prim : prims)
+                if (Union(tb, t(prim->WorldBound())) != tb) ++nOutside;
+            EXPECT_EQ(0, nOutside);
+            // Rounding outward may only loosen the bounds a little
+            Bounds3f exact = t(binary.WorldBound());
+            EXPECT_LT(tb.SurfaceArea(), 1.1f * exact.SurfaceArea());
+        }
+    }
+}
+
+TEST(BVH, InstancesMatchTransformedPrimitives) {
+    RNG rng;
+    std::shared_ptr<Primitive> prototype =
+        std::make_shared<BVHAccel>(RandomTriangles(500, rng), 4);
+    std::vector<Transform> transforms;
+    for (int i = 0; i < 200; ++i)
+        transforms.push_back(RandomInstanceTransform(rng));
+    std::vector<std::shared_ptr<Primitive>> instances, transformed;
+    for (const Transform &t : transforms) {
+        instances.push_back(std::make_shared<InstancePrimitive>(prototype, t));
+        transformed.push_back(std::make_shared<TransformedPrimitive>(
+            prototype, AnimatedTransform(&t, 0, &t, 1)));
+        // Instance bounds come from the prototype's nodes, so they are
+        // contained in the transformed bounds of the whole prototype.
+        Bounds3f ib = instances.back()->WorldBound();
+        Bounds3f tb = transformed.back()->WorldBound();
+        EXPECT_EQ(tb, Union(tb, ib));
+    }
+    BVHAccel instanceBVH(instances, 4), transformedBVH(transformed, 4);
+
+    for (int trial = 0; trial < 2000; ++trial) {
+        Point3f o(Lerp(rng.UniformFloat(), -8, 8), Lerp(rng.UniformFloat(), -8, 8),
+                  Lerp(rng.UniformFloat(), -8, 8));
+        Point2f u(rng.UniformFloat(), rng.UniformFloat());
+        Ray rayI(o, UniformSampleSphere(u)), rayT = rayI;
+        SurfaceInteraction isectI, isectT;
+        bool hit = instanceBVH.Intersect(rayI, &isectI);
+        EXPECT_EQ(hit, transformedBVH.Intersect(rayT, &isectT));
+        EXPECT_EQ(hit, instanceBVH.IntersectP(Ray(o, rayI.d)));
+        EXPECT_EQ(rayT.tMax, rayI.tMax);
+        if (hit) {
+            EXPECT_EQ(isectT.p, isectI.p);
+            EXPECT_EQ(isectT.n, isectI.n);
+        }
+    }
+}
+
+TEST(BVH, Refit) {
+    RNG rng;
+    std::shared_ptr<Primitive> prototype =
+        std::make_shared<BVHAccel>(RandomTriangles(200, rng), 4);
+    std::vector<std::shared_ptr<InstancePrimitive>> instances;
+    std::vector<std::shared_ptr<Primitive>> prims;
+    for (int i = 0; i < 300; ++i) {
+        instances.push_back(std::make_shared<InstancePrimitive>(
+            prototype, RandomInstanceTransform(rng)));
+        prims.push_back(instances.back());
+    }
+    std::vector<std::unique_ptr<BVHAccel>> bvhs;
+    for (BVHAccel::Layout layout :
+         {BVHAccel::Layout::Binary, BVHAccel::Layout::BVH8,
+          BVHAccel::Layout::BVH8Quant8, BVHAccel::Layout::BVH8Quant16})
+        bvhs.emplace_back(
+            new BVHAccel(prims, 4, BVHAccel::SplitMethod::SAH, layout));
+
+    // Move every instance, refit, and compare with a new BVH
+    for (const auto &instance : instances)
+        instance->SetTransform(RandomInstanceTransform(rng));
+    for (const auto &bvh : bvhs) bvh->Refit();
+    BVHAccel rebuilt(prims, 4);
+    for (int trial = 0; trial < 1000; ++trial) {
+        Point3f o(Lerp(rng.UniformFloat(), -8, 8), Lerp(rng.UniformFloat(), -8, 8),
+                  Lerp(rng.UniformFloat(), -8, 8));
+        Point2f u(rng.UniformFloat(), rng.UniformFloat());
+        Ray ray(o, UniformSampleSphere(u));
+        Ray rayRebuilt = ray;
+        SurfaceInteraction isectRebuilt;
+        bool hit = rebuilt.Intersect(rayRebuilt, &isectRebuilt);
+        for (const auto &bvh : bvhs) {
+            EXPECT_EQ(rebuilt.WorldBound(), bvh->WorldBound());
+            Ray rayRefit = ray;
+            SurfaceInteraction isectRefit;
+            EXPECT_EQ(hit, bvh->Intersect(rayRefit, &isectRefit));
+            EXPECT_EQ(hit, bvh->IntersectP(ray));
+            EXPECT_EQ(rayRebuilt.tMax, rayRefit.tMax);
+        }
+    }
+}
+
+TEST(BVH, SetTimeRange) {
+    RNG rng;
+    std::shared_ptr<Primitive> prototype =
+        std::make_shared<BVHAccel>(RandomTriangles(200, rng), 4);
+    // _AnimatedTransform_ keeps pointers to its keyframes
+    std::vector<Transform> keyframes;
+    for (int i = 0; i < 600; ++i)
+        keyframes.push_back(RandomInstanceTransform(rng));
+    std::vector<std::shared_ptr<Primitive>> prims;
+    for (int i = 0; i < 300; ++i)
+        prims.push_back(std::make_shared<TransformedPrimitive>(
+            prototype, AnimatedTransform(&keyframes[2 * i], 0,
+                                         &keyframes[2 * i + 1], 1)));
+    BVHAccel bvh(prims, 4);
+    Bounds3f fullBounds = bvh.WorldBound();
+
+    const int nFrames = 4;
+    for (int frame = 0; frame < nFrames; ++frame) {
+        Float time0 = Float(frame) / nFrames;
+        Float time1 = Float(frame + 1) / nFrames;
+        EXPECT_TRUE(bvh.SetTimeRange(time0, time1));
+        EXPECT_LT(bvh.WorldBound().SurfaceArea(), fullBounds.SurfaceArea());
+
+        // A BVH built over the primitives restricted to the frame's time
+        // range must find the same intersections as the refit one.
+        BVHAccel rebuilt(prims, 4);
+        EXPECT_EQ(rebuilt.WorldBound(), bvh.WorldBound());
+        for (int trial = 0; trial < 1000; ++trial) {
+            Point3f o(Lerp(rng.UniformFloat(), -8, 8),
+                      Lerp(rng.UniformFloat(), -8, 8),
+                      Lerp(rng.UniformFloat(), -8, 8));
+            Point2f u(rng.UniformFloat(), rng.UniformFloat());
+            Ray ray(o, UniformSampleSphere(u), Infinity,
+                    Lerp(rng.UniformFloat(), time0, time1));
+            Ray rayRebuilt = ray, rayRefit = ray;
+            SurfaceInteraction isectRebuilt, isectRefit;
+            bool hit = rebuilt.Intersect(rayRebuilt, &isectRebuilt);
+            EXPECT_EQ(hit, bvh.Intersect(rayRefit, &isectRefit));
+            EXPECT_EQ(hit, bvh.IntersectP(ray));
+            EXPECT_EQ(rayRebuilt.tMax, rayRefit.tMax);
+        }
+    }
+}
+
+// Checks that two BVHs over the same primitives find the same
+// intersections.
+static void TestSameIntersections(const BVHAccel &a, const BVHAccel &b,
+                                  RNG &rng) {
+    EXPECT_EQ(a.WorldBound(), b.WorldBound());
+    for (int trial = 0; trial < 1000; ++trial) {
+        Point3f o(Lerp(rng.UniformFloat(), -3, 3), Lerp(rng.UniformFloat(), -3, 3),
+                  Lerp(rng.UniformFloat(), -3, 3));
+        Point2f u(rng.UniformFloat(), rng.UniformFloat());
+        Ray rayA(o, UniformSampleSphere(u)), rayB = rayA;
+        SurfaceInteraction isectA, isectB;
+        bool hitA = a.Intersect(rayA, &isectA);
+        EXPECT_EQ(hitA, b.Intersect(rayB, &isectB));
+        EXPECT_EQ(rayA.tMax, rayB.tMax);
+        if (hitA) EXPECT_EQ(isectA.primitive, isectB.primitive);
+    }
+}
+
+#ifndef PBRT_IS_WINDOWS
+TEST(BVH, Cache) {
+    // Use a fresh directory so that a previously aborted run can't leave
+    // stale cache files (or the directory itself) behind for this one.
+    char dirTemplate[] = "bvhcache_test_XXXXXX";
+    ASSERT_TRUE(mkdtemp(dirTemplate) != nullptr);
+    std::string cacheDir = dirTemplate;
+    auto nCacheFiles = [&]() {
+        int n = 0;
+        DIR *dir = opendir(cacheDir.c_str());
+        while (struct dirent *ent = readdir(dir))
+            if (ent->d_name[0] != '.') ++n;
+        closedir(dir);
+        return n;
+    };
+
+    RNG rng;
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(2000, rng);
+    BVHAccel uncached(prims, 4);
+    for (BVHAccel::Layout layout :
+         {BVHAccel::Layout::Binary, BVHAccel::Layout::BVH8}) {
+        // The first build writes the cache and the second one reads it.
+        BVHAccel written(prims, 4, BVHAccel::SplitMethod::SAH, layout,
+                         cacheDir);
+        BVHAccel read(prims, 4, BVHAccel::SplitMethod::SAH, layout,
+                      cacheDir);
+        TestSameIntersections(uncached, written, rng);
+        TestSameIntersections(uncached, read, rng);
+    }
+    EXPECT_EQ(2, nCacheFiles());
+
+    // Changing the geometry must not reuse the old cache.
+    prims.pop_back();
+    BVHAccel changed(prims, 4, BVHAccel::SplitMethod::SAH,
+                     BVHAccel::Layout::Binary, cacheDir);
+    TestSameIntersections(BVHAccel(prims, 4), changed, rng);
+    EXPECT_EQ(3, nCacheFiles());
+
+    // SBVH node bounds come from clipping the triangles, so triangles that
+    // change without changing their bounds must not reuse the cache either.
+    for (bool mirror : {false, true}) {
+        RNG triRNG;
+        std::vector<std::shared_ptr<Primitive>> tris =
+            RandomTriangles(2000, triRNG, mirror);
+        BVHAccel sbvh(tris, 4, BVHAccel::SplitMethod::SBVH,
+                      BVHAccel::Layout::Binary, cacheDir);
+        TestSameIntersections(BVHAccel(tris, 4), sbvh, rng);
+    }
+    EXPECT_EQ(5, nCacheFiles());
+
+    // Clean up
+    DIR *dir = opendir(cacheDir.c_str());
+    while (struct dirent *ent = readdir(dir))
+        if (ent->d_name[0] != '.')
+            EXPECT_EQ(0, remove((cacheDir + "/" + ent->d_name).c_str()));
+    closedir(dir);
+    EXPECT_EQ(0, rmdir(cacheDir.c_str()));
+}
+#endif  // !PBRT_IS_WINDOWS
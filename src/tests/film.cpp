@@ -0,0 +1,240 @@
+
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "film.h"
+#include "filters/box.h"
+#include "imageio.h"
+#include "parallel.h"
+#include "rng.h"
+
+using namespace pbrt;
+
+// A tile of up to 8x8 pixels with a single sample in it
+struct TestTile {
+    Bounds2i bounds;
+    Point2f pFilm;
+};
+
+static std::vector<TestTile> RandomTiles(int nTiles, const Point2i &res) {
+    RNG rng;
+    std::vector<TestTile> tiles;
+    for (int i = 0; i < nTiles; ++i) {
+        Point2i pMin(rng.UniformUInt32(res.x), rng.UniformUInt32(res.y));
+        Point2i pMax(std::min(res.x, pMin.x + 1 + (int)rng.UniformUInt32(8)),
+                     std::min(res.y, pMin.y + 1 + (int)rng.UniformUInt32(8)));
+        Point2f pFilm(Lerp(rng.UniformFloat(), pMin.x, pMax.x),
+                      Lerp(rng.UniformFloat(), pMin.y, pMax.y));
+        tiles.push_back({Bounds2i(pMin, pMax), pFilm});
+    }
+    return tiles;
+}
+
+// Reads back and removes the image that _film_ wrote
+static std::unique_ptr<RGBSpectrum[]> ReadFilmImage(const Film &film) {
+    Point2i res;
+    std::unique_ptr<RGBSpectrum[]> image = ReadImage(film.filename, &res);
+    EXPECT_EQ(0, remove(film.filename.c_str()));
+    EXPECT_EQ(film.fullResolution, res);
+    return image;
+}
+
+// Merges a tile for each of _tiles_ into a new film, either from a single
+// thread or from all of them, and returns the image that was written
+static std::unique_ptr<RGBSpectrum[]> MergeTiles(
+    const std::vector<TestTile> &tiles, const Point2i &res, bool parallel,
+    std::vector<int64_t> *sampleCounts) {
+    // With a box filter, every sample adds the same value to each pixel it
+    // overlaps, so the sums don't depend on the order of the merges
+    std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(1.5, 1.5)));
+    Film film(res, Bounds2f(Point2f(0, 0), Point2f(1, 1)), std::move(filter),
+              1., "merge.pfm", 1.);
+    film.EnablePixelStatistics();
+    Float rgb[3] = {.5, .25, .125};
+    Spectrum L = Spectrum::FromRGB(rgb);
+    auto mergeTile = [&](int64_t i) {
+        std::unique_ptr<FilmTile> tile = film.GetFilmTile(tiles[i].bounds);
+        tile->AddSample(tiles[i].pFilm, L);
+        film.MergeFilmTile(std::move(tile));
+    };
+    if (parallel)
+        ParallelFor(mergeTile, tiles.size());
+    else
+        for (size_t i = 0; i < tiles.size(); ++i) mergeTile(i);
+
+    for (Point2i p : film.croppedPixelBounds)
+        sampleCounts->push_back(film.PixelStatistics(p).SampleCount());
+    film.WriteImage();
+    return ReadFilmImage(film);
+}
+
+TEST(Film, ConcurrentMergeMatchesSerial) {
+    int oldThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 8;
+    ParallelInit();
+
+    Point2i res(24, 16);
+    std::vector<TestTile> tiles = RandomTiles(50000, res);
+    std::vector<int64_t> serialCounts, parallelCounts;
+    std::unique_ptr<RGBSpectrum[]> serial =
+        MergeTiles(tiles, res, false, &serialCounts);
+    std::unique_ptr<RGBSpectrum[]> parallel =
+        MergeTiles(tiles, res, true, &parallelCounts);
+    ASSERT_TRUE(serial && parallel);
+    EXPECT_EQ(serialCounts, parallelCounts);
+    for (int i = 0; i < res.x * res.y; ++i)
+        for (int c = 0; c < 3; ++c) EXPECT_EQ(serial[i][c], parallel[i][c]);
+
+    ParallelCleanup();
+    PbrtOptions.nThreads = oldThreads;
+}
+
+// Splats _nSplats_ copies of the same value at random points of a film
+// from all threads and returns the image that was written
+static std::unique_ptr<RGBSpectrum[]> SplatImage(Film::SplatMode mode,
+                                                 int nSplats) {
+    Point2i res(37, 23);
+    std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(.5, .5)));
+    Film film(res, Bounds2f(Point2f(0, 0), Point2f(1, 1)), std::move(filter),
+              1., "splat.pfm", 1., Infinity, mode);
+    Float rgb[3] = {.5, .25, .125};
+    Spectrum v = Spectrum::FromRGB(rgb);
+    const int chunkSize = 1000;
+    ParallelFor([&](int64_t chunk) {
+        RNG rng;
+        rng.SetSequence(chunk);
+        for (int i = 0; i < chunkSize; ++i)
+            film.AddSplat(Point2f(res.x * rng.UniformFloat(),
+                                  res.y * rng.UniformFloat()),
+                          v);
+    }, nSplats / chunkSize);
+    film.WriteImage();
+    return ReadFilmImage(film);
+}
+
+TEST(Film, PerThreadSplatsMatchAtomic) {
+    int oldThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 4;
+    ParallelInit();
+
+    // Enough splats that the per-thread buffers are flushed while
+    // splatting; adding copies of one value doesn't depend on the order
+    std::unique_ptr<RGBSpectrum[]> atomic =
+        SplatImage(Film::SplatMode::Atomic, 200000);
+    std::unique_ptr<RGBSpectrum[]> perThread =
+        SplatImage(Film::SplatMode::PerThread, 200000);
+    ASSERT_TRUE(atomic && perThread);
+    for (int i = 0; i < 37 * 23; ++i)
+        for (int c = 0; c < 3; ++c) {
+            EXPECT_GT(atomic[i][c], 0);
+            EXPECT_EQ(atomic[i][c], perThread[i][c]);
+        }
+
+    ParallelCleanup();
+    PbrtOptions.nThreads = oldThreads;
+}
+
+// Adds random samples to 16x16 tiles of the sample bounds of a film and
+// splats _nSplats_ random values, from all threads, and returns the image
+// that was written
+static std::unique_ptr<RGBSpectrum[]> RenderTiles(bool streaming,
+                                                  int nSplats) {
+    Point2i res(150, 70);
+    std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(1.5, 1.5)));
+    Film film(res, Bounds2f(Point2f(0, 0), Point2f(1, 1)), std::move(filter),
+              1., streaming ? "streamed.exr" : "memory.exr", 1., Infinity,
+              Film::SplatMode::Atomic, streaming);
+    EXPECT_EQ(streaming, film.Streaming());
+    Bounds2i sampleBounds = film.GetSampleBounds();
+    std::vector<Bounds2i> tiles;
+    for (int y = sampleBounds.pMin.y; y < sampleBounds.pMax.y; y += 16)
+        for (int x = sampleBounds.pMin.x; x < sampleBounds.pMax.x; x += 16)
+            tiles.push_back(Intersect(
+                Bounds2i(Point2i(x, y), Point2i(x + 16, y + 16)),
+                sampleBounds));
+    RNG rng;
+    for (size_t i = tiles.size() - 1; i > 0; --i)
+        std::swap(tiles[i], tiles[rng.UniformUInt32(i + 1)]);
+    film.StreamTiles(tiles, nSplats > 0);
+
+    int splatsPerTile = nSplats / tiles.size();
+    ParallelFor([&](int64_t i) {
+        RNG rng;
+        rng.SetSequence(i);
+        const Bounds2i &bounds = tiles[i];
+        std::unique_ptr<FilmTile> tile = film.GetFilmTile(bounds);
+        for (int s = 0; s < 1024; ++s) {
+            Point2f pFilm(
+                Lerp(rng.UniformFloat(), bounds.pMin.x, bounds.pMax.x),
+                Lerp(rng.UniformFloat(), bounds.pMin.y, bounds.pMax.y));
+            Float rgb[3] = {rng.UniformFloat(), .5, .25};
+            tile->AddSample(pFilm, Spectrum::FromRGB(rgb));
+        }
+        film.MergeFilmTile(std::move(tile));
+        for (int s = 0; s < splatsPerTile; ++s)
+            film.AddSplat(Point2f(res.x * rng.UniformFloat(),
+                                  res.y * rng.UniformFloat()),
+                          Spectrum(rng.UniformFloat()));
+    }, tiles.size());
+    film.WriteImage(.5);
+    return ReadFilmImage(film);
+}
+
+TEST(Film, StreamingMatchesInMemory) {
+    int oldThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 4;
+    ParallelInit();
+
+    // Blocks are written as soon as their last tile is merged, and with
+    // splats once all of them have been added; either way, the image only
+    // differs from the in-memory one by the order of the floating-point
+    // sums and by EXR's half-precision values
+    for (int nSplats : {0, 20000}) {
+        std::unique_ptr<RGBSpectrum[]> memory = RenderTiles(false, nSplats);
+        std::unique_ptr<RGBSpectrum[]> streamed = RenderTiles(true, nSplats);
+        ASSERT_TRUE(memory && streamed);
+        for (int i = 0; i < 150 * 70; ++i)
+            for (int c = 0; c < 3; ++c) {
+                EXPECT_GT(memory[i][c], 0);
+                EXPECT_NEAR(memory[i][c], streamed[i][c],
+                            2e-3f * std::max(1.f, memory[i][c]));
+            }
+    }
+
+    ParallelCleanup();
+    PbrtOptions.nThreads = oldThreads;
+}
+
+TEST(Film, StreamingSetImageRows) {
+    // Setting the image in bands of rows writes the same image as setting
+    // it at once, up to EXR's half-precision values
+    Point2i res(150, 70);
+    RNG rng;
+    std::unique_ptr<Spectrum[]> image(new Spectrum[res.x * res.y]);
+    for (int i = 0; i < res.x * res.y; ++i) {
+        Float rgb[3] = {rng.UniformFloat(), .5, .25};
+        image[i] = Spectrum::FromRGB(rgb);
+    }
+    std::unique_ptr<RGBSpectrum[]> images[2];
+    for (bool streaming : {false, true}) {
+        std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(.5, .5)));
+        Film film(res, Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                  std::move(filter), 1.,
+                  streaming ? "streamed.exr" : "memory.exr", 1., Infinity,
+                  Film::SplatMode::Atomic, streaming);
+        int bandHeight = film.ImageBandHeight();
+        EXPECT_EQ(streaming ? 64 : res.y, bandHeight);
+        if (streaming)
+            for (int y0 = 0; y0 < res.y; y0 += bandHeight)
+                film.SetImageRows(y0, std::min(y0 + bandHeight, res.y),
+                                  &image[y0 * res.x]);
+        else
+            film.SetImage(image.get());
+        film.WriteImage();
+        images[streaming] = ReadFilmImage(film);
+    }
+    ASSERT_TRUE(images[0] && images[1]);
+    for (int i = 0; i < res.x * res.y; ++i)
+        for (int c = 0; c < 3; ++c)
+            EXPECT_NEAR(images[0][i][c], images[1][i][c],
+                        2e-3f * std::max(1.f, images[0][i][c]));
+}
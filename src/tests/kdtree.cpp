@@ -0,0 +1,42 @@
+
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "rng.h"
+#include "sampling.h"
+#include "primitive.h"
+#include "interaction.h"
+#include "accelerators/kdtreeaccel.h"
+#include "shapes/triangle.h"
+#include "tests/randomtriangles.h"
+
+using namespace pbrt;
+
+TEST(KdTree, BinnedMatchesSAH) {
+    RNG rng;
+    // Enough triangles that the binned builder creates parallel subtree
+    // tasks; every fourth one is flat in z so that some split planes
+    // coincide with triangles
+    std::vector<std::shared_ptr<Primitive>> prims =
+        RandomTriangles(20000, rng, false, 4);
+    KdTreeAccel sah(prims);
+    KdTreeAccel binned(prims, 80, 1, 0.5, 1, -1,
+                       KdTreeAccel::SplitMethod::BinnedSAH);
+    EXPECT_EQ(sah.WorldBound(), binned.WorldBound());
+
+    for (int trial = 0; trial < 10000; ++trial) {
+        Point3f o(Lerp(rng.UniformFloat(), -3, 3), Lerp(rng.UniformFloat(), -3, 3),
+                  Lerp(rng.UniformFloat(), -3, 3));
+        Point2f u(rng.UniformFloat(), rng.UniformFloat());
+        Vector3f d = UniformSampleSphere(u);
+        // Also trace rays that lie in the planes of the flat triangles
+        if (trial % 8 == 0) d.z = 0;
+        if (d == Vector3f(0, 0, 0)) continue;
+        Ray ray(o, Normalize(d)), raySAH = ray, rayBinned = ray;
+        SurfaceInteraction isectSAH, isectBinned;
+        bool hit = sah.Intersect(raySAH, &isectSAH);
+        EXPECT_EQ(hit, binned.Intersect(rayBinned, &isectBinned));
+        EXPECT_EQ(hit, binned.IntersectP(ray));
+        EXPECT_EQ(raySAH.tMax, rayBinned.tMax);
+        if (hit) EXPECT_EQ(isectSAH.primitive, isectBinned.primitive);
+    }
+}
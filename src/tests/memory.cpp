@@ -0,0 +1,52 @@
+
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "memory.h"
+#include <set>
+
+using namespace pbrt;
+
+TEST(MemoryArena, ReusesBlocksAfterReset) {
+    // Fill several blocks, reset, and fill them again; no new memory should
+    // be allocated the second time, and the memory should be the same.
+    MemoryArena arena(1024);
+    std::set<void *> firstPass;
+    for (int i = 0; i < 10; ++i) firstPass.insert(arena.Alloc(512));
+    size_t total = arena.TotalAllocated();
+    EXPECT_EQ(5 * 1024, total);
+
+    for (int pass = 0; pass < 3; ++pass) {
+        arena.Reset();
+        for (int i = 0; i < 10; ++i)
+            EXPECT_TRUE(firstPass.count(arena.Alloc(512)) > 0);
+        EXPECT_EQ(total, arena.TotalAllocated());
+    }
+}
+
+TEST(MemoryArena, LargeAllocations) {
+    // Allocations larger than the block size get blocks of their own, which
+    // are reused only for allocations that fit in them.
+    MemoryArena arena(1024);
+    void *large = arena.Alloc(4096);
+    arena.Alloc(100);
+    EXPECT_EQ(4096 + 1024, arena.TotalAllocated());
+    arena.Reset();
+    // The first block is the current one again after a reset
+    arena.Alloc(900);
+    EXPECT_EQ(large, arena.Alloc(3000));
+    arena.Alloc(8192);
+    EXPECT_EQ(4096 + 1024 + 8192, arena.TotalAllocated());
+}
+
+TEST(MemoryArena, PeakUsage) {
+    MemoryArena arena(1024);
+    EXPECT_EQ(0, arena.PeakUsage());
+    for (int i = 0; i < 20; ++i) arena.Alloc(128);
+    EXPECT_EQ(20 * 128, arena.PeakUsage());
+    arena.Reset();
+    arena.Alloc(128);
+    EXPECT_EQ(20 * 128, arena.PeakUsage());
+    arena.Reset();
+    for (int i = 0; i < 30; ++i) arena.Alloc(128);
+    EXPECT_EQ(30 * 128, arena.PeakUsage());
+}
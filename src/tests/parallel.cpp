@@ -2,6 +2,8 @@
 #include "tests/gtest/gtest.h"
 #include "pbrt.h"
 #include "parallel.h"
+#include "memory.h"
+#include <algorithm>
 #include <atomic>
 
 using namespace pbrt;
@@ -37,3 +39,120 @@ TEST(Parallel, DoNothing) {
 
     ParallelCleanup();
 }
+
+// Runs _func_ with the thread pool started with _nThreads_ threads, so that
+// tasks are stolen even on machines with few cores.
+static void WithThreads(int nThreads, std::function<void()> func) {
+    int oldThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = nThreads;
+    ParallelInit();
+    func();
+    ParallelCleanup();
+    PbrtOptions.nThreads = oldThreads;
+}
+
+TEST(Parallel, Nested) {
+    WithThreads(4, []() {
+        std::atomic<int> counter{0};
+        ParallelFor([&](int64_t) {
+            ParallelFor([&](int64_t) { ++counter; }, 100, 7);
+        }, 50);
+        EXPECT_EQ(50 * 100, counter);
+
+        counter = 0;
+        ParallelFor2D([&](Point2i) {
+            ParallelFor([&](int64_t) { ++counter; }, 10);
+        }, Point2i(8, 9));
+        EXPECT_EQ(8 * 9 * 10, counter);
+    });
+}
+
+// Sums _[start, end)_ by recursively splitting the range into subtasks.
+static void RecursiveSum(int64_t start, int64_t end,
+                         std::atomic<int64_t> *sum) {
+    if (end - start <= 16) {
+        for (int64_t i = start; i < end; ++i) *sum += i;
+        return;
+    }
+    int64_t mid = (start + end) / 2;
+    TaskGroup group;
+    group.Run([=]() { RecursiveSum(start, mid, sum); });
+    group.Run([=]() { RecursiveSum(mid, end, sum); });
+    group.Wait();
+}
+
+TEST(Parallel, TaskGroup) {
+    WithThreads(4, []() {
+        std::atomic<int64_t> sum{0};
+        RecursiveSum(0, 100000, &sum);
+        EXPECT_EQ(int64_t(100000) * 99999 / 2, sum);
+
+        // Tasks that add tasks to their own group
+        std::atomic<int> counter{0};
+        TaskGroup group;
+        for (int i = 0; i < 10; ++i)
+            group.Run([&]() {
+                ++counter;
+                for (int j = 0; j < 10; ++j) group.Run([&]() { ++counter; });
+            });
+        group.Wait();
+        EXPECT_EQ(10 + 10 * 10, counter);
+    });
+}
+
+TEST(Parallel, PinnedFirstTouch) {
+    // Sizes that are and aren't a multiple of the chunk size
+    const size_t sizes[] = {1, 256 * 1024, 1000003};
+    // Without pinned threads, placement can't be controlled and the memory
+    // must be left alone
+    WithThreads(4, [&]() {
+        for (size_t bytes : sizes) {
+            std::vector<uint8_t> buf(bytes, 0xff);
+            ParallelFirstTouch(buf.data(), bytes);
+            EXPECT_EQ(bytes, std::count(buf.begin(), buf.end(), 0xff));
+        }
+    });
+
+    PbrtOptions.pinThreads = true;
+    WithThreads(4, [&]() {
+        bool spread = NumNumaNodes() > 1;
+        for (size_t bytes : sizes) {
+            std::vector<uint8_t> buf(bytes, 0xff);
+            ParallelFirstTouch(buf.data(), bytes);
+            EXPECT_EQ(bytes, std::count(buf.begin(), buf.end(),
+                                        spread ? 0 : 0xff));
+        }
+        if (!spread) {
+            // With a single NUMA node there is no placement to check;
+            // NumaPlacement() reports nothing
+            EXPECT_TRUE(NumaPlacement(sizes, sizeof(sizes)).empty());
+        } else {
+            // Freshly allocated pages must end up on more than one node
+            const size_t bytes = 64 * 1024 * 1024;
+            uint8_t *mem = AllocAligned<uint8_t>(bytes);
+            ParallelFirstTouch(mem, bytes);
+            std::vector<int64_t> nodeBytes = NumaPlacement(mem, bytes);
+            EXPECT_GE(std::count_if(nodeBytes.begin(), nodeBytes.end(),
+                                    [](int64_t b) { return b > 0; }),
+                      2);
+            FreeAligned(mem);
+        }
+    });
+    PbrtOptions.pinThreads = false;
+}
+
+// Loops with single-iteration chunks run every iteration once, however
+// many threads take chunks; src/tools/parallelbench.cpp measures their
+// scheduling cost
+TEST(Parallel, SingleIterationChunks) {
+    for (int nThreads : {1, 2, 4}) {
+        WithThreads(nThreads, []() {
+            const int64_t count = 1 << 20;
+            std::atomic<int64_t> counter{0};
+            ParallelFor([&](int64_t) {
+                counter.fetch_add(1, std::memory_order_relaxed);
+            }, count, 1);
+            EXPECT_EQ(count, counter);
+        });
+    }
+}
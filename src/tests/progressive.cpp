@@ -0,0 +1,525 @@
+
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+
+#include "accelerators/bvh.h"
+#include "cameras/perspective.h"
+#include "film.h"
+#include "filters/gaussian.h"
+#include "ext/lodepng.h"
+#include "imageio.h"
+#include "integrators/bdpt.h"
+#include "integrators/path.h"
+#include "integrators/sppm.h"
+#include "lights/point.h"
+#include "materials/matte.h"
+#include "parallel.h"
+#include "rng.h"
+#include "samplers/halton.h"
+#include "samplers/stratified.h"
+#include "scene.h"
+#include "shapes/sphere.h"
+#include "textures/constant.h"
+#include <functional>
+#include <map>
+
+using namespace pbrt;
+
+// Inside of a diffuse unit sphere lit by an off-center point light
+static std::unique_ptr<Scene> SphereScene() {
+    static Transform id;
+    std::shared_ptr<Shape> sphere = std::make_shared<Sphere>(
+        &id, &id, true /* reverse orientation */, 1, -1, 1, 360);
+    std::shared_ptr<Texture<Spectrum>> Kd =
+        std::make_shared<ConstantTexture<Spectrum>>(Spectrum(0.5));
+    std::shared_ptr<Texture<Float>> sigma =
+        std::make_shared<ConstantTexture<Float>>(0.);
+    std::shared_ptr<Material> material =
+        std::make_shared<MatteMaterial>(Kd, sigma, nullptr);
+    std::vector<std::shared_ptr<Primitive>> prims;
+    prims.push_back(std::make_shared<GeometricPrimitive>(
+        sphere, material, nullptr, MediumInterface()));
+    std::vector<std::shared_ptr<Light>> lights;
+    lights.push_back(std::make_shared<PointLight>(
+        Translate(Vector3f(.3, -.2, .5)), nullptr, Spectrum(Pi)));
+    return std::unique_ptr<Scene>(
+        new Scene(std::make_shared<BVHAccel>(prims), lights));
+}
+
+// Returns a camera at the center of the sphere whose film writes _filename_
+static std::shared_ptr<const Camera> MakeCamera(const Point2i &resolution,
+                                                const std::string &filename) {
+    std::unique_ptr<Filter> filter(
+        new GaussianFilter(Vector2f(1.5, 1.5), 2.f));
+    Film *film = new Film(resolution, Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                          std::move(filter), 1., filename, 1.);
+    AnimatedTransform identity(new Transform, 0, new Transform, 1);
+    return std::make_shared<PerspectiveCamera>(
+        identity, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 1., 0., 10.,
+        45, film, nullptr);
+}
+
+// Returns the text chunks of the PNG file _filename_
+static std::map<std::string, std::string> ReadPNGText(
+    const std::string &filename) {
+    std::map<std::string, std::string> text;
+    unsigned char *png = nullptr, *pixels = nullptr;
+    size_t pngSize;
+    unsigned int width, height;
+    LodePNGState state;
+    lodepng_state_init(&state);
+    if (lodepng_load_file(&png, &pngSize, filename.c_str()) == 0 &&
+        lodepng_decode(&pixels, &width, &height, &state, png, pngSize) == 0)
+        for (size_t i = 0; i < state.info_png.text_num; ++i)
+            text[state.info_png.text_keys[i]] = state.info_png.text_strings[i];
+    free(pixels);
+    free(png);
+    lodepng_state_cleanup(&state);
+    return text;
+}
+
+// Renders _scene_ with the integrator that _makeIntegrator_ returns for a
+// camera whose film writes _filename_ and returns the image that was
+// written; for PNG files, _metadata_ returns the image's text chunks
+static std::unique_ptr<RGBSpectrum[]> RenderWith(
+    const Scene &scene,
+    const std::function<Integrator *(std::shared_ptr<const Camera>)>
+        &makeIntegrator,
+    Float timeLimit, Point2i *resolution,
+    const std::string &filename = "progressive.pfm",
+    std::map<std::string, std::string> *metadata = nullptr) {
+    std::unique_ptr<Integrator> integrator(
+        makeIntegrator(MakeCamera(*resolution, filename)));
+    integrator->SetTimeLimit(timeLimit);
+    integrator->Render(scene);
+    integrator.reset();
+
+    std::unique_ptr<RGBSpectrum[]> image = ReadImage(filename, resolution);
+    if (metadata) *metadata = ReadPNGText(filename);
+    EXPECT_EQ(0, remove(filename.c_str()));
+    return image;
+}
+
+// Renders _scene_ with a path tracer and returns the image that was written
+static std::unique_ptr<RGBSpectrum[]> RenderImage(
+    const Scene &scene, std::shared_ptr<Sampler> sampler, bool progressive,
+    int packetSize, Point2i *resolution, Float timeLimit = 0,
+    Float adaptiveError = 0, int adaptiveMinSamples = 16,
+    bool sortShading = false) {
+    PbrtOptions.progressive = progressive;
+    std::shared_ptr<const Camera> camera =
+        MakeCamera(*resolution, "progressive.pfm");
+    const Film *film = camera->film;
+    PathIntegrator integrator(5, camera, sampler, film->croppedPixelBounds, 1,
+                              "power", packetSize);
+    integrator.SetTimeLimit(timeLimit);
+    if (adaptiveError > 0)
+        integrator.SetAdaptiveSampling(adaptiveError, adaptiveMinSamples);
+    integrator.SetSortedShading(sortShading);
+    integrator.Render(scene);
+    PbrtOptions.progressive = false;
+
+    std::unique_ptr<RGBSpectrum[]> image =
+        ReadImage("progressive.pfm", resolution);
+    EXPECT_EQ(0, remove("progressive.pfm"));
+    return image;
+}
+
+TEST(Progressive, MatchesSinglePass) {
+    int oldThreads = PbrtOptions.nThreads, oldTileSize = PbrtOptions.tileSize;
+    PbrtOptions.nThreads = 4;
+    PbrtOptions.tileSize = 8;
+    ParallelInit();
+
+    std::unique_ptr<Scene> scene = SphereScene();
+    Point2i resolution(37, 21);
+    Bounds2i sampleBounds(Point2i(-2, -2), resolution + Vector2i(2, 2));
+    std::vector<std::shared_ptr<Sampler>> samplers = {
+        std::make_shared<StratifiedSampler>(3, 4, true, 5),
+        std::make_shared<HaltonSampler>(11, sampleBounds)};
+    for (const std::shared_ptr<Sampler> &sampler : samplers) {
+        for (int packetSize : {1, 4}) {
+            // Progressive passes use the same samples as a single pass,
+            // so the images only differ by floating-point round-off
+            Point2i res = resolution;
+            std::unique_ptr<RGBSpectrum[]> single =
+                RenderImage(*scene, sampler, false, packetSize, &res);
+            std::unique_ptr<RGBSpectrum[]> progressive =
+                RenderImage(*scene, sampler, true, packetSize, &res);
+            ASSERT_TRUE(single && progressive);
+            for (int i = 0; i < res.x * res.y; ++i)
+                for (int c = 0; c < 3; ++c)
+                    EXPECT_NEAR(single[i][c], progressive[i][c],
+                                1e-4f * std::max(1.f, single[i][c]));
+        }
+    }
+
+    ParallelCleanup();
+    PbrtOptions.nThreads = oldThreads;
+    PbrtOptions.tileSize = oldTileSize;
+}
+
+TEST(Progressive, SortedShadingMatches) {
+    int oldThreads = PbrtOptions.nThreads, oldTileSize = PbrtOptions.tileSize;
+    PbrtOptions.nThreads = 4;
+    PbrtOptions.tileSize = 8;
+    ParallelInit();
+
+    // Sorted shading gives each pixel a sampler of its own. The Halton
+    // sampler's values only depend on the pixel and the sample number, so
+    // the images only differ by the order in which samples are added.
+    std::unique_ptr<Scene> scene = SphereScene();
+    Point2i resolution(37, 21);
+    Bounds2i sampleBounds(Point2i(-2, -2), resolution + Vector2i(2, 2));
+    std::shared_ptr<Sampler> sampler =
+        std::make_shared<HaltonSampler>(128, sampleBounds);
+    for (int packetSize : {1, 4}) {
+        for (bool progressive : {false, true}) {
+            Point2i res = resolution;
+            std::unique_ptr<RGBSpectrum[]> unsorted =
+                RenderImage(*scene, sampler, progressive, packetSize, &res);
+            std::unique_ptr<RGBSpectrum[]> sorted =
+                RenderImage(*scene, sampler, progressive, packetSize, &res, 0,
+                            0, 16, true);
+            ASSERT_TRUE(unsorted && sorted);
+            for (int i = 0; i < res.x * res.y; ++i)
+                for (int c = 0; c < 3; ++c)
+                    EXPECT_NEAR(unsorted[i][c], sorted[i][c],
+                                1e-4f * std::max(1.f, unsorted[i][c]));
+        }
+    }
+
+    ParallelCleanup();
+    PbrtOptions.nThreads = oldThreads;
+    PbrtOptions.tileSize = oldTileSize;
+}
+
+TEST(Progressive, CameraPacketsMatchSingleRays) {
+    int oldThreads = PbrtOptions.nThreads, oldTileSize = PbrtOptions.tileSize;
+    PbrtOptions.nThreads = 4;
+    PbrtOptions.tileSize = 8;
+    ParallelInit();
+
+    // Camera ray packets hold the same sample of neighbouring pixels, so
+    // they are full even with one sample per pixel. The Halton sampler's
+    // values only depend on the pixel and the sample number, so the images
+    // only differ by floating-point round-off.
+    std::unique_ptr<Scene> scene = SphereScene();
+    Point2i resolution(37, 21);
+    Bounds2i sampleBounds(Point2i(-2, -2), resolution + Vector2i(2, 2));
+    for (int spp : {1, 8}) {
+        std::shared_ptr<Sampler> sampler =
+            std::make_shared<HaltonSampler>(spp, sampleBounds);
+        Point2i res = resolution;
+        std::unique_ptr<RGBSpectrum[]> single =
+            RenderImage(*scene, sampler, false, 1, &res);
+        for (int packetSize : {4, 16}) {
+            std::unique_ptr<RGBSpectrum[]> packets =
+                RenderImage(*scene, sampler, false, packetSize, &res);
+            ASSERT_TRUE(single && packets);
+            for (int i = 0; i < res.x * res.y; ++i)
+                for (int c = 0; c < 3; ++c)
+                    EXPECT_NEAR(single[i][c], packets[i][c],
+                                1e-4f * std::max(1.f, single[i][c]));
+        }
+    }
+
+    ParallelCleanup();
+    PbrtOptions.nThreads = oldThreads;
+    PbrtOptions.tileSize = oldTileSize;
+}
+
+TEST(Progressive, TimeLimitFinishesFirstPass) {
+    int oldThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 4;
+    ParallelInit();
+
+    // A time limit that has passed by the end of the first pass leaves one
+    // sample per pixel. The Halton sampler's first sample in each pixel
+    // doesn't depend on the sample count, so the image matches a render
+    // with one sample per pixel.
+    std::unique_ptr<Scene> scene = SphereScene();
+    Point2i resolution(37, 21);
+    Bounds2i sampleBounds(Point2i(-2, -2), resolution + Vector2i(2, 2));
+    Point2i res = resolution;
+    std::unique_ptr<RGBSpectrum[]> oneSample = RenderImage(
+        *scene, std::make_shared<HaltonSampler>(1, sampleBounds), false, 1,
+        &res);
+    std::unique_ptr<RGBSpectrum[]> limited = RenderImage(
+        *scene, std::make_shared<HaltonSampler>(1024, sampleBounds), false, 1,
+        &res, 1e-6f);
+    ASSERT_TRUE(oneSample && limited);
+    for (int i = 0; i < res.x * res.y; ++i)
+        for (int c = 0; c < 3; ++c)
+            EXPECT_NEAR(oneSample[i][c], limited[i][c],
+                        1e-4f * std::max(1.f, oneSample[i][c]));
+
+    ParallelCleanup();
+    PbrtOptions.nThreads = oldThreads;
+}
+
+TEST(Progressive, BDPTTimeLimitFinishesFirstPass) {
+    int oldThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 4;
+    ParallelInit();
+
+    // As with the path tracer, a time limit that has passed by the end of
+    // the first pass leaves the Halton sampler's first sample in each
+    // pixel. Light tracing splats are normalized by the mean number of
+    // samples taken per pixel, so they match a render with one sample per
+    // pixel too, and the image's metadata records that sample count.
+    std::unique_ptr<Scene> scene = SphereScene();
+    Point2i resolution(37, 21);
+    Bounds2i sampleBounds(Point2i(-2, -2), resolution + Vector2i(2, 2));
+    auto bdpt = [&](int spp) {
+        return [=](std::shared_ptr<const Camera> camera) -> Integrator * {
+            return new BDPTIntegrator(
+                std::make_shared<HaltonSampler>(spp, sampleBounds), camera, 5,
+                false, false, camera->film->croppedPixelBounds);
+        };
+    };
+    Point2i res = resolution;
+    std::unique_ptr<RGBSpectrum[]> oneSample =
+        RenderWith(*scene, bdpt(1), 0, &res);
+    std::unique_ptr<RGBSpectrum[]> limited =
+        RenderWith(*scene, bdpt(1024), 1e-6f, &res);
+    ASSERT_TRUE(oneSample && limited);
+    for (int i = 0; i < res.x * res.y; ++i)
+        for (int c = 0; c < 3; ++c)
+            EXPECT_NEAR(oneSample[i][c], limited[i][c],
+                        1e-3f * std::max(1.f, oneSample[i][c]));
+
+    std::map<std::string, std::string> metadata;
+    RenderWith(*scene, bdpt(1024), 1e-6f, &res, "progressive.png", &metadata);
+    EXPECT_EQ("1", metadata["pbrt.samplesPerPixel"]);
+    EXPECT_EQ(1, metadata.count("pbrt.renderTime"));
+
+    ParallelCleanup();
+    PbrtOptions.nThreads = oldThreads;
+}
+
+TEST(Progressive, SPPMTimeLimitFinishesFirstIteration) {
+    int oldThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 4;
+    ParallelInit();
+
+    // SPPM's camera and photon samples of an iteration don't depend on the
+    // iteration count, so an SPPM render whose time limit has passed after
+    // its first iteration has to match a render of one iteration, with the
+    // photon count $N_p$ of that one iteration; the image's metadata
+    // records the iteration count as the samples per pixel
+    std::unique_ptr<Scene> scene = SphereScene();
+    Point2i resolution(37, 21);
+    auto sppm = [](int nIterations) {
+        return [=](std::shared_ptr<const Camera> camera) -> Integrator * {
+            return new SPPMIntegrator(camera, nIterations, 20000, 5, .1f,
+                                      1 << 30);
+        };
+    };
+    Point2i res = resolution;
+    std::unique_ptr<RGBSpectrum[]> oneIteration =
+        RenderWith(*scene, sppm(1), 0, &res);
+    std::unique_ptr<RGBSpectrum[]> limited =
+        RenderWith(*scene, sppm(1000), 1e-6f, &res);
+    ASSERT_TRUE(oneIteration && limited);
+    for (int i = 0; i < res.x * res.y; ++i)
+        for (int c = 0; c < 3; ++c) {
+            EXPECT_GT(oneIteration[i][c], 0);
+            EXPECT_NEAR(oneIteration[i][c], limited[i][c],
+                        1e-3f * std::max(1.f, oneIteration[i][c]));
+        }
+
+    std::map<std::string, std::string> metadata;
+    RenderWith(*scene, sppm(1000), 1e-6f, &res, "progressive.png", &metadata);
+    EXPECT_EQ("1", metadata["pbrt.samplesPerPixel"]);
+    EXPECT_EQ(1, metadata.count("pbrt.renderTime"));
+
+    ParallelCleanup();
+    PbrtOptions.nThreads = oldThreads;
+}
+
+TEST(Progressive, VarianceEstimatorMerge) {
+    // Merging the estimators of two halves of a set of values gives the
+    // same statistics as adding all of them to one estimator
+    RNG rng;
+    VarianceEstimator all, first, second;
+    for (int i = 0; i < 1000; ++i) {
+        Float x = 5 * rng.UniformFloat() * rng.UniformFloat();
+        all.Add(x);
+        (i < 300 ? first : second).Add(x);
+    }
+    first.Merge(second);
+    EXPECT_EQ(all.n, first.n);
+    EXPECT_NEAR(all.mean, first.mean, 1e-4f * all.mean);
+    EXPECT_NEAR(all.Variance(), first.Variance(), 1e-3f * all.Variance());
+}
+
+TEST(Progressive, AdaptiveSampling) {
+    int oldThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 4;
+    ParallelInit();
+
+    // The Halton sampler's first samples in each pixel don't depend on the
+    // sample count. With an error target that every pixel meets, pixels
+    // stop at the minimum sample count; with one that no pixel meets, they
+    // get all of the samples.
+    std::unique_ptr<Scene> scene = SphereScene();
+    Point2i resolution(37, 21);
+    Bounds2i sampleBounds(Point2i(-2, -2), resolution + Vector2i(2, 2));
+    auto halton = [&](int spp) {
+        return std::make_shared<HaltonSampler>(spp, sampleBounds);
+    };
+    struct {
+        Float error;
+        int expectedSpp;
+    } cases[] = {{1e6f, 4}, {1e-8f, 64}};
+    for (const auto &c : cases) {
+        Point2i res = resolution;
+        std::unique_ptr<RGBSpectrum[]> expected =
+            RenderImage(*scene, halton(c.expectedSpp), false, 1, &res);
+        std::unique_ptr<RGBSpectrum[]> adaptive = RenderImage(
+            *scene, halton(64), false, 1, &res, 0, c.error, 4);
+        ASSERT_TRUE(expected && adaptive);
+        for (int i = 0; i < res.x * res.y; ++i)
+            for (int c = 0; c < 3; ++c)
+                EXPECT_NEAR(expected[i][c], adaptive[i][c],
+                            1e-4f * std::max(1.f, expected[i][c]));
+    }
+
+    ParallelCleanup();
+    PbrtOptions.nThreads = oldThreads;
+}
+
+TEST(Progressive, PixelConvergenceNeedsVariance) {
+    // Pixels whose samples all had the same value have no error estimate;
+    // they only converge once they have $3 / e^2$ samples for the error
+    // target $e$. A few different samples make them measurable.
+    PixelConvergence zero, constant, varied;
+    for (int i = 0; i < 64; ++i) {
+        zero.Add(0);
+        constant.Add(1);
+        varied.Add(1 + (i % 4) * .01f);
+    }
+    EXPECT_EQ(64, zero.SampleCount());
+    EXPECT_EQ(Infinity, zero.RelativeError());
+    EXPECT_EQ(Infinity, constant.RelativeError());
+    EXPECT_LT(varied.RelativeError(), .01f);
+    EXPECT_FALSE(zero.Converged(.2f));
+    EXPECT_FALSE(constant.Converged(.2f));
+    EXPECT_TRUE(zero.Converged(.25f));
+    EXPECT_TRUE(constant.Converged(.25f));
+    EXPECT_TRUE(varied.Converged(.01f));
+
+    // A difference between the halves' means counts even when the
+    // standard error over all of the samples is small
+    PixelConvergence halves;
+    for (int i = 0; i < 1000; ++i) halves.Add((i & 1) ? 1.2f : 1.f);
+    EXPECT_GT(halves.RelativeError(), .05f);
+}
+
+// Returns a bright value for one sample of each pixel and black for the
+// others, like a caustic that only a few paths find
+class SparseIntegrator : public SamplerIntegrator {
+  public:
+    SparseIntegrator(std::shared_ptr<const Camera> camera,
+                     std::shared_ptr<Sampler> sampler,
+                     const Bounds2i &pixelBounds, int64_t brightSample)
+        : SamplerIntegrator(camera, sampler, pixelBounds),
+          brightSample(brightSample) {}
+    Spectrum Li(const RayDifferential &ray, const Scene &scene,
+                Sampler &sampler, MemoryArena &arena, int depth) const {
+        return Spectrum(sampler.CurrentSampleNumber() == brightSample ? 100.f
+                                                                      : 0.f);
+    }
+
+  private:
+    const int64_t brightSample;
+};
+
+TEST(Progressive, AdaptiveSamplingFindsSparseSamples) {
+    int oldThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 4;
+    ParallelInit();
+
+    // Every pixel's first 37 samples are black. With an error target of
+    // .25, pixels without variance need 48 samples to converge, so they
+    // must not stop after the pass that ends at 32 samples and the image
+    // matches a full render.
+    std::unique_ptr<Scene> scene = SphereScene();
+    Point2i resolution(13, 11);
+    Bounds2i sampleBounds(Point2i(-2, -2), resolution + Vector2i(2, 2));
+    auto render = [&](Float adaptiveError) {
+        std::unique_ptr<Filter> filter(
+            new GaussianFilter(Vector2f(1.5, 1.5), 2.f));
+        Film *film =
+            new Film(resolution, Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                     std::move(filter), 1., "sparse.pfm", 1.);
+        AnimatedTransform identity(new Transform, 0, new Transform, 1);
+        std::shared_ptr<Camera> camera = std::make_shared<PerspectiveCamera>(
+            identity, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 1., 0.,
+            10., 45, film, nullptr);
+        SparseIntegrator integrator(
+            camera, std::make_shared<HaltonSampler>(64, sampleBounds),
+            film->croppedPixelBounds, 37);
+        if (adaptiveError > 0) integrator.SetAdaptiveSampling(adaptiveError, 4);
+        integrator.Render(*scene);
+        Point2i res = resolution;
+        std::unique_ptr<RGBSpectrum[]> image = ReadImage("sparse.pfm", &res);
+        EXPECT_EQ(0, remove("sparse.pfm"));
+        return image;
+    };
+    std::unique_ptr<RGBSpectrum[]> full = render(0);
+    std::unique_ptr<RGBSpectrum[]> adaptive = render(.25f);
+    ASSERT_TRUE(full && adaptive);
+    for (int i = 0; i < resolution.x * resolution.y; ++i) {
+        EXPECT_GT(adaptive[i][0], 0.f);
+        for (int c = 0; c < 3; ++c)
+            EXPECT_NEAR(full[i][c], adaptive[i][c],
+                        1e-4f * std::max(1.f, full[i][c]));
+    }
+
+    ParallelCleanup();
+    PbrtOptions.nThreads = oldThreads;
+}
+
+// Returns the same radiance for every sample, like a flat sky
+class ConstantIntegrator : public SamplerIntegrator {
+  public:
+    ConstantIntegrator(std::shared_ptr<const Camera> camera,
+                       std::shared_ptr<Sampler> sampler,
+                       const Bounds2i &pixelBounds)
+        : SamplerIntegrator(camera, sampler, pixelBounds) {}
+    Spectrum Li(const RayDifferential &ray, const Scene &scene,
+                Sampler &sampler, MemoryArena &arena, int depth) const {
+        return Spectrum(.5f);
+    }
+};
+
+TEST(Progressive, AdaptiveSamplingStopsConstantPixels) {
+    int oldThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 4;
+    ParallelInit();
+
+    // With an error target of .1, pixels without variance converge after
+    // 300 samples, so they stop after the pass that ends at 512 samples
+    // instead of taking all 1024
+    std::unique_ptr<Scene> scene = SphereScene();
+    Point2i resolution(13, 11);
+    Bounds2i sampleBounds(Point2i(-2, -2), resolution + Vector2i(2, 2));
+    std::shared_ptr<const Camera> camera =
+        MakeCamera(resolution, "constant.pfm");
+    ConstantIntegrator integrator(
+        camera, std::make_shared<HaltonSampler>(1024, sampleBounds),
+        camera->film->croppedPixelBounds);
+    integrator.SetAdaptiveSampling(.1f, 16);
+    integrator.Render(*scene);
+    EXPECT_EQ(0, remove("constant.pfm"));
+    for (Point2i p : camera->film->croppedPixelBounds) {
+        int64_t n = camera->film->PixelStatistics(p).SampleCount();
+        EXPECT_GE(n, 300);
+        EXPECT_LT(n, 1024);
+    }
+
+    ParallelCleanup();
+    PbrtOptions.nThreads = oldThreads;
+}
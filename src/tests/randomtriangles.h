@@ -0,0 +1,55 @@
+#ifndef PBRT_TESTS_RANDOMTRIANGLES_H
+#define PBRT_TESTS_RANDOMTRIANGLES_H
+
+// tests/randomtriangles.h*
+#include "pbrt.h"
+#include "rng.h"
+#include "primitive.h"
+#include "shapes/triangle.h"
+#include <algorithm>
+
+namespace pbrt {
+
+// Returns primitives for a soup of random triangles inside [-1,1]^3, as
+// used by the acceleration structure tests. With _mirror_, each triangle is
+// mirrored in $x$ within its bounds, which leaves the bounds unchanged. If
+// _flatPeriod_ is positive, every _flatPeriod_th triangle lies in a plane
+// perpendicular to the $z$ axis.
+inline std::vector<std::shared_ptr<Primitive>> RandomTriangles(
+    int nTris, RNG &rng, bool mirror = false, int flatPeriod = 0) {
+    static Transform identity;
+    std::vector<Point3f> p;
+    std::vector<int> indices;
+    for (int i = 0; i < nTris; ++i) {
+        Point3f center(Lerp(rng.UniformFloat(), -1, 1),
+                       Lerp(rng.UniformFloat(), -1, 1),
+                       Lerp(rng.UniformFloat(), -1, 1));
+        for (int j = 0; j < 3; ++j) {
+            indices.push_back(p.size());
+            Vector3f offset(Lerp(rng.UniformFloat(), -1, 1),
+                            Lerp(rng.UniformFloat(), -1, 1),
+                            Lerp(rng.UniformFloat(), -1, 1));
+            if (flatPeriod > 0 && i % flatPeriod == 0) offset.z = 0;
+            p.push_back(center + .1f * offset);
+        }
+        if (mirror) {
+            Point3f *v = &p[p.size() - 3];
+            Float x0 = std::min({v[0].x, v[1].x, v[2].x});
+            Float x1 = std::max({v[0].x, v[1].x, v[2].x});
+            for (int j = 0; j < 3; ++j) v[j].x = x0 + x1 - v[j].x;
+        }
+    }
+    std::vector<std::shared_ptr<Shape>> tris =
+        CreateTriangleMesh(&identity, &identity, false, nTris, &indices[0],
+                           p.size(), &p[0], nullptr, nullptr, nullptr, nullptr,
+                           nullptr);
+    std::vector<std::shared_ptr<Primitive>> prims;
+    for (const auto &tri : tris)
+        prims.push_back(std::make_shared<GeometricPrimitive>(
+            tri, nullptr, nullptr, MediumInterface()));
+    return prims;
+}
+
+}  // namespace pbrt
+
+#endif  // PBRT_TESTS_RANDOMTRIANGLES_H
@@ -0,0 +1,70 @@
+
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "integrator.h"
+#include <set>
+
+using namespace pbrt;
+
+// Checks that _schedule_ hands out every tile of the image exactly once
+static void CheckCoversImage(TileSchedule &schedule) {
+    const Point2i &nTiles = schedule.NTiles();
+    EXPECT_EQ(nTiles.x * nTiles.y, schedule.TileCount());
+    std::set<std::pair<int, int>> seen;
+    for (int i = 0; i < schedule.TileCount(); ++i) {
+        Point2i tile = schedule.NextTile();
+        EXPECT_TRUE(tile.x >= 0 && tile.x < nTiles.x);
+        EXPECT_TRUE(tile.y >= 0 && tile.y < nTiles.y);
+        EXPECT_TRUE(seen.insert(std::make_pair(tile.x, tile.y)).second);
+    }
+}
+
+TEST(TileSchedule, Coverage) {
+    Bounds2i bounds(Point2i(-3, 5), Point2i(1917, 1085));
+    for (TileOrder order :
+         {TileOrder::Scanline, TileOrder::Hilbert, TileOrder::Spiral}) {
+        for (int tileSize : {7, 16, 64, 5000}) {
+            TileSchedule schedule(bounds, order, tileSize);
+            EXPECT_EQ(tileSize, schedule.TileSize());
+            CheckCoversImage(schedule);
+
+            // The tile bounds cover the image without overlapping
+            int64_t area = 0;
+            for (const Point2i &tile : schedule.Tiles()) {
+                Bounds2i tb = schedule.TileBounds(tile);
+                EXPECT_EQ(tb, Intersect(tb, bounds));
+                area += tb.Area();
+            }
+            EXPECT_EQ(bounds.Area(), area);
+        }
+    }
+}
+
+TEST(TileSchedule, Hilbert) {
+    // On a power-of-two grid consecutive tiles are always neighbors
+    TileSchedule schedule(Bounds2i(Point2i(0, 0), Point2i(256, 256)),
+                          TileOrder::Hilbert, 16);
+    const std::vector<Point2i> &tiles = schedule.Tiles();
+    for (size_t i = 1; i < tiles.size(); ++i)
+        EXPECT_EQ(1, std::abs(tiles[i].x - tiles[i - 1].x) +
+                         std::abs(tiles[i].y - tiles[i - 1].y));
+}
+
+TEST(TileSchedule, Spiral) {
+    // Tiles start at the center and get no closer to it afterward
+    TileSchedule schedule(Bounds2i(Point2i(0, 0), Point2i(90, 50)),
+                          TileOrder::Spiral, 10);
+    const std::vector<Point2i> &tiles = schedule.Tiles();
+    EXPECT_EQ(Point2i(4, 2), tiles[0]);
+    auto ring = [](const Point2i &t) {
+        return std::max(std::abs(2 * t.x - 8), std::abs(2 * t.y - 4));
+    };
+    for (size_t i = 1; i < tiles.size(); ++i)
+        EXPECT_LE(ring(tiles[i - 1]), ring(tiles[i]));
+}
+
+TEST(TileSchedule, AdaptiveTileSize) {
+    EXPECT_EQ(64, TileSchedule::AdaptiveTileSize(Vector2i(1920, 1080), 8));
+    EXPECT_EQ(32, TileSchedule::AdaptiveTileSize(Vector2i(1920, 1080), 32));
+    EXPECT_EQ(8, TileSchedule::AdaptiveTileSize(Vector2i(64, 64), 64));
+}
@@ -2,6 +2,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <chrono>
 
 #include "pbrt.h"
 #include "reflection.h"
@@ -16,6 +18,18 @@ using namespace pbrt;
 static MemoryArena arena;
 static RNG rng;
 
+// BxDFs are stored in the BSDF with BSDF::Emplace() unless this is false,
+// in which case they are allocated separately and always called virtually.
+static bool inlineBxDFs = true;
+
+template <typename T, typename... Args>
+static void addBxDF(BSDF* bsdf, Args&&... args) {
+    if (inlineBxDFs)
+        bsdf->Emplace<T>(arena, std::forward<Args>(args)...);
+    else
+        bsdf->Add(ARENA_ALLOC(arena, T)(std::forward<Args>(args)...));
+}
+
 // extract the red channel from a Spectrum class
 double spectrumRedValue(const Spectrum& s) { return s[0]; }
 
@@ -40,7 +54,20 @@ void Gen_CosHemisphere(BSDF* bsdf, const Vector3f& wo, Vector3f* wi, Float* pdf,
 void Gen_UniformHemisphere(BSDF* bsdf, const Vector3f& wo, Vector3f* wi,
                            Float* pdf, Spectrum* f);
 
+BSDF* makeBSDF(CreateBSDFFunc create);
+void benchmark(CreateBSDFFunc* models, const char** descrip, int numModels);
+
 int main(int argc, char* argv[]) {
+    bool bench = false;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--bench"))
+            bench = true;
+        else {
+            fprintf(stderr, "usage: bsdftest [--bench]\n");
+            return 1;
+        }
+    }
+
     Options opt;
     pbrtInit(opt);
 
@@ -161,30 +188,15 @@ int main(int argc, char* argv[]) {
         exit(1);
     }
 
+    if (bench) {
+        benchmark(BSDFFuncArray, BSDFFuncDescripArray, numModels);
+        pbrtCleanup();
+        return 0;
+    }
+
     // for each bsdf model
     for (int model = 0; model < numModels; model++) {
-        BSDF* bsdf;
-
-        // create BSDF which requires creating a Shape, casting a Ray
-        // that hits the shape to get a SurfaceInteraction object.
-        {
-            Transform t = RotateX(-90);
-            bool reverseOrientation = false;
-            ParamSet p;
-
-            std::shared_ptr<Shape> disk(
-                new Disk(new Transform(t), new Transform(Inverse(t)),
-                         reverseOrientation, 0., 1., 0, 360.));
-            Point3f origin(
-                0.1, 1, 0);  // offset slightly so we don't hit center of disk
-            Vector3f direction(0, -1, 0);
-            Float tHit;
-            Ray r(origin, direction);
-            SurfaceInteraction isect;
-            disk->Intersect(r, &tHit, &isect);
-            bsdf = ARENA_ALLOC(arena, BSDF)(isect);
-            (BSDFFuncArray[model])(bsdf);
-        }
+        BSDF* bsdf = makeBSDF(BSDFFuncArray[model]);
 
         // facing directly at normal
         Vector3f woL = Normalize(Vector3f(0, 0, 1));
@@ -291,6 +303,88 @@ int main(int argc, char* argv[]) {
     return 0;
 }
 
+BSDF* makeBSDF(CreateBSDFFunc create) {
+    // create BSDF which requires creating a Shape, casting a Ray
+    // that hits the shape to get a SurfaceInteraction object.
+    Transform t = RotateX(-90);
+    bool reverseOrientation = false;
+    ParamSet p;
+
+    std::shared_ptr<Shape> disk(
+        new Disk(new Transform(t), new Transform(Inverse(t)),
+                 reverseOrientation, 0., 1., 0, 360.));
+    Point3f origin(0.1, 1,
+                   0);  // offset slightly so we don't hit center of disk
+    Vector3f direction(0, -1, 0);
+    Float tHit;
+    Ray r(origin, direction);
+    SurfaceInteraction isect;
+    disk->Intersect(r, &tHit, &isect);
+    BSDF* bsdf = ARENA_ALLOC(arena, BSDF)(isect);
+    create(bsdf);
+    return bsdf;
+}
+
+// Calls BSDF::Sample_f(), and f() and Pdf() for the previously sampled
+// direction, _iterations_ times, cycling through _bsdfs_; returns the
+// number of millions of iterations per second.
+static double timeBSDFs(const std::vector<BSDF*>& bsdfs, int iterations) {
+    const int nSamples = 4096;
+    std::vector<Point2f> u(nSamples);
+    RNG sampleRNG;
+    for (Point2f& s : u)
+        s = Point2f(sampleRNG.UniformFloat(), sampleRNG.UniformFloat());
+    Vector3f wo = bsdfs[0]->LocalToWorld(Normalize(Vector3f(.3, .2, 1)));
+    Vector3f wi = bsdfs[0]->LocalToWorld(Vector3f(0, 0, 1));
+
+    Float sum = 0;
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        const BSDF* bsdf = bsdfs[i % bsdfs.size()];
+        sum += bsdf->f(wo, wi)[0] + bsdf->Pdf(wo, wi);
+        Float pdf;
+        Vector3f wiNew;
+        sum += bsdf->Sample_f(wo, &wiNew, u[i % nSamples], &pdf)[0] + pdf;
+        if (pdf > 0) wi = wiNew;
+    }
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    // Keep the compiler from discarding the loop
+    if (std::isnan(sum)) fprintf(stderr, "NaN BSDF values\n");
+    return 1e-6 * iterations / seconds;
+}
+
+// Compares the BSDF evaluation rate with the BxDFs added virtually and
+// stored inline, first for each model on its own, and then for a set of
+// BSDFs that mixes all of the models.
+void benchmark(CreateBSDFFunc* models, const char** descrip, int numModels) {
+    const int iterations = 2000000;
+    printf("%-40.40s %12s %12s %8s\n", "BSDF (M iterations/s)", "virtual",
+           "inline", "speedup");
+    double rates[2];
+    for (int model = 0; model <= numModels; ++model) {
+        for (int mode = 0; mode < 2; ++mode) {
+            inlineBxDFs = (mode == 1);
+            std::vector<BSDF*> bsdfs;
+            if (model < numModels)
+                bsdfs.push_back(makeBSDF(models[model]));
+            else {
+                RNG modelRNG;
+                for (int i = 0; i < 4096; ++i)
+                    bsdfs.push_back(
+                        makeBSDF(models[modelRNG.UniformUInt32(numModels)]));
+            }
+            rates[mode] = timeBSDFs(bsdfs, iterations);
+            arena.Reset();
+        }
+        printf("%-40.40s %12.2f %12.2f %7.2fx\n",
+               model < numModels ? descrip[model] : "Mixed (4096 BSDFs)",
+               rates[0], rates[1], rates[1] / rates[0]);
+    }
+}
+
 void Gen_Sample_f(BSDF* bsdf, const Vector3f& wo, Vector3f* wi, Float* pdf,
                   Spectrum* f) {
     // only glossy or diffuse reflections (no specular reflections)
@@ -347,7 +441,7 @@ void Gen_UniformHemisphere(BSDF* bsdf, const Vector3f& wo, Vector3f* wi,
 
 void createLambertian(BSDF* bsdf) {
     Spectrum Kd(1);
-    bsdf->Add(ARENA_ALLOC(arena, LambertianReflection)(Kd));
+    addBxDF<LambertianReflection>(bsdf, Kd);
 }
 
 void createMicrofacet(BSDF* bsdf, bool beckmann, bool samplevisible,
@@ -367,8 +461,7 @@ void createMicrofacet(BSDF* bsdf, bool beckmann, bool samplevisible,
                                                                samplevisible);
     }
     Fresnel* fresnel = ARENA_ALLOC(arena, FresnelNoOp)();
-    BxDF* bxdf = ARENA_ALLOC(arena, MicrofacetReflection)(Ks, distrib, fresnel);
-    bsdf->Add(bxdf);
+    addBxDF<MicrofacetReflection>(bsdf, Ks, distrib, fresnel);
 }
 
 void createFresnelBlend(BSDF* bsdf, bool beckmann, bool samplevisible,
@@ -389,8 +482,7 @@ void createFresnelBlend(BSDF* bsdf, bool beckmann, bool samplevisible,
       distrib = ARENA_ALLOC(arena, TrowbridgeReitzDistribution)(alphax, alphay,
                                                                samplevisible);
     }
-    BxDF* bxdf = ARENA_ALLOC(arena, FresnelBlend)(d, s, distrib);
-    bsdf->Add(bxdf);
+    addBxDF<FresnelBlend>(bsdf, d, s, distrib);
 }
 
 void createMicrofacet30and0(BSDF* bsdf, bool beckmann) {
@@ -416,24 +508,18 @@ void createMicrofacet30and0(BSDF* bsdf, bool beckmann) {
     }
 
     Fresnel* fresnel = ARENA_ALLOC(arena, FresnelNoOp)();
-    BxDF* bxdf1 =
-        ARENA_ALLOC(arena, MicrofacetReflection)(Ks, distrib1, fresnel);
-    bsdf->Add(bxdf1);
-    BxDF* bxdf2 =
-        ARENA_ALLOC(arena, MicrofacetReflection)(Ks, distrib2, fresnel);
-    bsdf->Add(bxdf2);
+    addBxDF<MicrofacetReflection>(bsdf, Ks, distrib1, fresnel);
+    addBxDF<MicrofacetReflection>(bsdf, Ks, distrib2, fresnel);
 }
 
 void createOrenNayar0(BSDF* bsdf) {
     Spectrum Kd(1);
     float sigma = 0.0;
-    BxDF* bxdf = ARENA_ALLOC(arena, OrenNayar)(Kd, sigma);
-    bsdf->Add(bxdf);
+    addBxDF<OrenNayar>(bsdf, Kd, sigma);
 }
 
 void createOrenNayar20(BSDF* bsdf) {
     Spectrum Kd(1);
     float sigma = 20.0;
-    BxDF* bxdf = ARENA_ALLOC(arena, OrenNayar)(Kd, sigma);
-    bsdf->Add(bxdf);
+    addBxDF<OrenNayar>(bsdf, Kd, sigma);
 }
@@ -0,0 +1,158 @@
+//
+// bvhbench.cpp
+//
+// Compares build time, node memory and traversal cost of the BVHAccel
+// node layouts on a random triangle soup.
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "pbrt.h"
+#include "interaction.h"
+#include "parallel.h"
+#include "primitive.h"
+#include "rng.h"
+#include "sampling.h"
+#include "stats.h"
+#include "accelerators/bvh.h"
+#include "shapes/triangle.h"
+
+using namespace pbrt;
+
+static void usage(const char *msg = nullptr, ...) {
+    if (msg) {
+        va_list args;
+        va_start(args, msg);
+        fprintf(stderr, "bvhbench: ");
+        vfprintf(stderr, msg, args);
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, R"(usage: bvhbench [options]
+
+options:
+    --leaftriangles    Intersect leaf triangles on copies of their vertices.
+    --nthreads <n>     Number of threads used to build the BVHs. Default: all
+    --rays <n>         Number of rays traced for each layout. Default: 1000000
+    --stats            Print the full statistics for each layout.
+    --tris <n>         Number of triangles in the scene. Default: 1000000
+)");
+    exit(1);
+}
+
+static double SecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+int main(int argc, char *argv[]) {
+    int nTris = 1000000, nRays = 1000000;
+    bool printStats = false, leafTriangles = false;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--tris") || !strcmp(argv[i], "--rays") ||
+            !strcmp(argv[i], "--nthreads")) {
+            if (i + 1 == argc) usage("missing value after %s", argv[i]);
+            int value = atoi(argv[i + 1]);
+            if (value <= 0) usage("%s must be positive", argv[i]);
+            if (!strcmp(argv[i], "--tris"))
+                nTris = value;
+            else if (!strcmp(argv[i], "--rays"))
+                nRays = value;
+            else
+                PbrtOptions.nThreads = value;
+            ++i;
+        } else if (!strcmp(argv[i], "--stats"))
+            printStats = true;
+        else if (!strcmp(argv[i], "--leaftriangles"))
+            leafTriangles = true;
+        else
+            usage("unknown argument \"%s\"", argv[i]);
+    }
+    ParallelInit();
+
+    // Create a soup of small random triangles inside $[-1,1]^3$
+    RNG rng;
+    std::vector<Point3f> p;
+    std::vector<int> indices;
+    for (int i = 0; i < nTris; ++i) {
+        Point3f center(Lerp(rng.UniformFloat(), -1, 1),
+                       Lerp(rng.UniformFloat(), -1, 1),
+                       Lerp(rng.UniformFloat(), -1, 1));
+        Float size = 4.f / std::pow(Float(nTris), Float(1) / 3);
+        for (int j = 0; j < 3; ++j) {
+            indices.push_back(p.size());
+            p.push_back(center + size * Vector3f(rng.UniformFloat() - .5f,
+                                                 rng.UniformFloat() - .5f,
+                                                 rng.UniformFloat() - .5f));
+        }
+    }
+    Transform identity;
+    std::vector<std::shared_ptr<Shape>> tris = CreateTriangleMesh(
+        &identity, &identity, false, nTris, &indices[0], p.size(), &p[0],
+        nullptr, nullptr, nullptr, nullptr, nullptr);
+    std::vector<std::shared_ptr<Primitive>> prims;
+    for (const auto &tri : tris)
+        prims.push_back(std::make_shared<GeometricPrimitive>(
+            tri, nullptr, nullptr, MediumInterface()));
+
+    // Generate rays from outside the scene toward random points inside it
+    std::vector<Ray> rays(nRays);
+    for (Ray &ray : rays) {
+        Point2f u(rng.UniformFloat(), rng.UniformFloat());
+        Point3f o = Point3f(0, 0, 0) + 3.f * UniformSampleSphere(u);
+        Point3f target(Lerp(rng.UniformFloat(), -1, 1),
+                       Lerp(rng.UniformFloat(), -1, 1),
+                       Lerp(rng.UniformFloat(), -1, 1));
+        ray = Ray(o, Normalize(target - o));
+    }
+
+    struct {
+        const char *name;
+        BVHAccel::Layout layout;
+    } layouts[] = {{"binary", BVHAccel::Layout::Binary},
+                   {"bvh4", BVHAccel::Layout::BVH4},
+                   {"bvh8", BVHAccel::Layout::BVH8},
+                   {"bvh8-quant16", BVHAccel::Layout::BVH8Quant16},
+                   {"bvh8-quant8", BVHAccel::Layout::BVH8Quant8}};
+    printf("%d triangles, %d rays, %d threads\n\n", nTris, nRays,
+           MaxThreadIndex());
+    printf("%-14s %10s %14s %14s %8s\n", "layout", "build (s)",
+           "Intersect (ns)", "IntersectP (ns)", "hits");
+    for (const auto &l : layouts) {
+        ClearStats();
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        BVHAccel bvh(prims, 4, BVHAccel::SplitMethod::SAH, l.layout, "", .3f,
+                     leafTriangles);
+        double buildTime = SecondsSince(start);
+
+        // Time closest-hit and any-hit traversal on a single thread
+        int nHits = 0;
+        start = std::chrono::steady_clock::now();
+        for (const Ray &r : rays) {
+            Ray ray = r;
+            SurfaceInteraction isect;
+            if (bvh.Intersect(ray, &isect)) ++nHits;
+        }
+        double intersectTime = SecondsSince(start);
+        start = std::chrono::steady_clock::now();
+        for (const Ray &ray : rays) bvh.IntersectP(ray);
+        double intersectPTime = SecondsSince(start);
+
+        printf("%-14s %10.3f %14.1f %14.1f %8d\n", l.name, buildTime,
+               1e9 * intersectTime / nRays, 1e9 * intersectPTime / nRays,
+               nHits);
+        if (printStats) {
+            MergeWorkerThreadStats();
+            ReportThreadStats();
+            PrintStats(stdout);
+            printf("\n");
+        }
+    }
+
+    ParallelCleanup();
+    return 0;
+}
@@ -0,0 +1,87 @@
+//
+// parallelbench.cpp
+//
+// Measures the cost of scheduling a single-iteration chunk of a
+// ParallelFor() loop with an empty body, for increasing thread counts.
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include "pbrt.h"
+#include "parallel.h"
+
+using namespace pbrt;
+
+static void usage(const char *msg = nullptr, ...) {
+    if (msg) {
+        va_list args;
+        va_start(args, msg);
+        fprintf(stderr, "parallelbench: ");
+        vfprintf(stderr, msg, args);
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, R"(usage: parallelbench [options]
+
+options:
+    --chunks <n>       Number of chunks scheduled for each thread count.
+                       Default: 1048576
+    --nthreads <n>     Only measure with this many threads. Default: 1, 2,
+                       4 and all cores
+)");
+    exit(1);
+}
+
+static double SecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+int main(int argc, char *argv[]) {
+    int64_t nChunks = 1 << 20;
+    std::vector<int> threadCounts;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--chunks") || !strcmp(argv[i], "--nthreads")) {
+            if (i + 1 == argc) usage("missing value after %s", argv[i]);
+            int64_t value = atoll(argv[i + 1]);
+            if (value <= 0) usage("%s must be positive", argv[i]);
+            if (!strcmp(argv[i], "--chunks"))
+                nChunks = value;
+            else
+                threadCounts = {int(value)};
+            ++i;
+        } else
+            usage("unknown argument \"%s\"", argv[i]);
+    }
+    if (threadCounts.empty()) {
+        threadCounts = {1, 2, 4};
+        if (NumSystemCores() > 4) threadCounts.push_back(NumSystemCores());
+    }
+
+    printf("%lld chunks\n\n", (long long)nChunks);
+    printf("%-8s %10s %14s\n", "threads", "time (s)", "ns per chunk");
+    for (int nThreads : threadCounts) {
+        PbrtOptions.nThreads = nThreads;
+        ParallelInit();
+        std::atomic<int64_t> counter{0};
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        ParallelFor([&](int64_t) {
+            counter.fetch_add(1, std::memory_order_relaxed);
+        }, nChunks, 1);
+        double time = SecondsSince(start);
+        ParallelCleanup();
+        if (counter != nChunks) {
+            fprintf(stderr, "parallelbench: ran %lld of %lld chunks\n",
+                    (long long)counter.load(), (long long)nChunks);
+            return 1;
+        }
+        printf("%-8d %10.3f %14.1f\n", nThreads, time, 1e9 * time / nChunks);
+    }
+    return 0;
+}
@@ -0,0 +1,234 @@
+//
+// shadebench.cpp
+//
+// Compares the time PathIntegrator takes to render a texture-heavy scene
+// when camera ray hits are shaded in pixel order and when they are first
+// sorted by material and texture coordinates.
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "pbrt.h"
+#include "camera.h"
+#include "film.h"
+#include "imageio.h"
+#include "parallel.h"
+#include "primitive.h"
+#include "rng.h"
+#include "scene.h"
+#include "accelerators/bvh.h"
+#include "cameras/perspective.h"
+#include "filters/box.h"
+#include "integrators/path.h"
+#include "lights/point.h"
+#include "materials/matte.h"
+#include "materials/uber.h"
+#include "samplers/halton.h"
+#include "shapes/triangle.h"
+#include "textures/constant.h"
+#include "textures/imagemap.h"
+
+using namespace pbrt;
+
+static void usage(const char *msg = nullptr, ...) {
+    if (msg) {
+        va_list args;
+        va_start(args, msg);
+        fprintf(stderr, "shadebench: ");
+        vfprintf(stderr, msg, args);
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, R"(usage: shadebench [options]
+
+options:
+    --nthreads <n>     Number of rendering threads. Default: all
+    --materials <n>    Number of materials, each with its own image
+                       textures. Default: 64
+    --texres <n>       Width and height of each image texture. Default: 256
+    --quads <n>        Number of quads along each side of the textured
+                       wall. Default: 256
+    --resolution <n>   Width and height of the image. Default: 512
+    --spp <n>          Samples per pixel. Default: 4
+    --maxdepth <n>     Maximum path depth. Default: 1
+)");
+    exit(1);
+}
+
+static double SecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+// Writes a noisy image texture to _filename_; each one gets its own tint
+// so that no two materials share texels.
+static void WriteNoiseTexture(const std::string &filename, int res, RNG &rng) {
+    Float tint[3] = {rng.UniformFloat(), rng.UniformFloat(),
+                     rng.UniformFloat()};
+    std::vector<Float> rgb(3 * res * res);
+    for (size_t i = 0; i < rgb.size(); ++i)
+        rgb[i] = tint[i % 3] * (.25f + .75f * rng.UniformFloat());
+    WriteImage(filename, &rgb[0], Bounds2i(Point2i(0, 0), Point2i(res, res)),
+               Point2i(res, res));
+}
+
+static std::shared_ptr<Texture<Spectrum>> ImageTextureFor(
+    const std::string &filename) {
+    std::unique_ptr<TextureMapping2D> map(new UVMapping2D);
+    return std::make_shared<ImageTexture<RGBSpectrum, Spectrum>>(
+        std::move(map), filename, false, 8.f, ImageWrap::Repeat, 1.f, false);
+}
+
+int main(int argc, char *argv[]) {
+    int nMaterials = 64, texRes = 256, nQuads = 256, res = 512, spp = 4;
+    int maxDepth = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--nthreads") || !strcmp(argv[i], "--materials") ||
+            !strcmp(argv[i], "--texres") || !strcmp(argv[i], "--quads") ||
+            !strcmp(argv[i], "--resolution") || !strcmp(argv[i], "--spp") ||
+            !strcmp(argv[i], "--maxdepth")) {
+            if (i + 1 == argc) usage("missing value after %s", argv[i]);
+            int value = atoi(argv[i + 1]);
+            if (value <= 0) usage("%s must be positive", argv[i]);
+            if (!strcmp(argv[i], "--nthreads"))
+                PbrtOptions.nThreads = value;
+            else if (!strcmp(argv[i], "--materials"))
+                nMaterials = value;
+            else if (!strcmp(argv[i], "--texres"))
+                texRes = value;
+            else if (!strcmp(argv[i], "--quads"))
+                nQuads = value;
+            else if (!strcmp(argv[i], "--resolution"))
+                res = value;
+            else if (!strcmp(argv[i], "--spp"))
+                spp = value;
+            else
+                maxDepth = value;
+            ++i;
+        } else
+            usage("unknown argument \"%s\"", argv[i]);
+    }
+    PbrtOptions.quiet = true;
+    ParallelInit();
+
+    // Half of the materials are matte and half are uber with a textured
+    // specular color, so that shading alternates between BSDFs as well as
+    // between textures
+    RNG rng;
+    std::vector<std::string> textureFiles;
+    std::vector<std::shared_ptr<Material>> materials;
+    std::shared_ptr<Texture<Float>> zero =
+        std::make_shared<ConstantTexture<Float>>(0.f);
+    std::shared_ptr<Texture<Float>> roughness =
+        std::make_shared<ConstantTexture<Float>>(.1f);
+    std::shared_ptr<Texture<Float>> eta =
+        std::make_shared<ConstantTexture<Float>>(1.5f);
+    std::shared_ptr<Texture<Spectrum>> black =
+        std::make_shared<ConstantTexture<Spectrum>>(Spectrum(0.f));
+    std::shared_ptr<Texture<Spectrum>> white =
+        std::make_shared<ConstantTexture<Spectrum>>(Spectrum(1.f));
+    for (int m = 0; m < nMaterials; ++m) {
+        std::string kdFile = StringPrintf("shadebench-kd-%d.pfm", m);
+        WriteNoiseTexture(kdFile, texRes, rng);
+        textureFiles.push_back(kdFile);
+        std::shared_ptr<Texture<Spectrum>> Kd = ImageTextureFor(kdFile);
+        if (m % 2 == 0) {
+            materials.push_back(
+                std::make_shared<MatteMaterial>(Kd, zero, nullptr));
+            continue;
+        }
+        std::string ksFile = StringPrintf("shadebench-ks-%d.pfm", m);
+        WriteNoiseTexture(ksFile, texRes, rng);
+        textureFiles.push_back(ksFile);
+        std::shared_ptr<Texture<Spectrum>> Ks = ImageTextureFor(ksFile);
+        materials.push_back(std::make_shared<UberMaterial>(
+            Kd, Ks, black, black, roughness, nullptr, nullptr, white, eta,
+            nullptr, true));
+    }
+
+    // The camera looks down +z at a wall of small quads that fills the
+    // image. Each quad has a random material and covers a random part of
+    // its textures, so neighboring pixels rarely shade with the same
+    // material or texels.
+    std::vector<Point3f> p;
+    std::vector<Point2f> uv;
+    std::vector<int> indices;
+    for (int y = 0; y < nQuads; ++y) {
+        for (int x = 0; x < nQuads; ++x) {
+            Float x0 = Lerp(Float(x) / nQuads, -1, 1);
+            Float x1 = Lerp(Float(x + 1) / nQuads, -1, 1);
+            Float y0 = Lerp(Float(y) / nQuads, -1, 1);
+            Float y1 = Lerp(Float(y + 1) / nQuads, -1, 1);
+            Point2f uv0(rng.UniformFloat(), rng.UniformFloat());
+            Float duv = .05f;
+            int v = p.size();
+            p.push_back(Point3f(x0, y0, 1));
+            p.push_back(Point3f(x1, y0, 1));
+            p.push_back(Point3f(x1, y1, 1));
+            p.push_back(Point3f(x0, y1, 1));
+            uv.push_back(uv0);
+            uv.push_back(uv0 + Vector2f(duv, 0));
+            uv.push_back(uv0 + Vector2f(duv, duv));
+            uv.push_back(uv0 + Vector2f(0, duv));
+            int quad[6] = {v, v + 1, v + 2, v, v + 2, v + 3};
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+    Transform identity;
+    std::vector<std::shared_ptr<Shape>> tris = CreateTriangleMesh(
+        &identity, &identity, false, indices.size() / 3, &indices[0],
+        p.size(), &p[0], nullptr, nullptr, &uv[0], nullptr, nullptr);
+    std::vector<std::shared_ptr<Primitive>> prims;
+    std::shared_ptr<Material> quadMaterial;
+    for (size_t i = 0; i < tris.size(); ++i) {
+        if (i % 2 == 0)
+            quadMaterial = materials[rng.UniformUInt32(nMaterials)];
+        prims.push_back(std::make_shared<GeometricPrimitive>(
+            tris[i], quadMaterial, nullptr, MediumInterface()));
+    }
+    std::vector<std::shared_ptr<Light>> lights;
+    lights.push_back(std::make_shared<PointLight>(
+        Translate(Vector3f(.5f, .5f, -.5f)), MediumInterface(),
+        Spectrum(2.f)));
+    Scene scene(std::make_shared<BVHAccel>(prims), lights);
+
+    printf("%d materials, %zu %dx%d textures, %d quads, %dx%d image, "
+           "%d spp, %d threads\n\n",
+           nMaterials, textureFiles.size(), texRes, texRes, nQuads * nQuads,
+           res, res, spp, MaxThreadIndex());
+    printf("%-10s %10s %14s\n", "shading", "time (s)", "Msamples/s");
+    struct {
+        const char *name;
+        bool sort;
+    } modes[] = {{"unsorted", false}, {"sorted", true}};
+    for (const auto &m : modes) {
+        std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(.5, .5)));
+        Film *film =
+            new Film(Point2i(res, res), Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                     std::move(filter), 35., "shadebench.exr", 1.);
+        AnimatedTransform cameraToWorld(&identity, 0, &identity, 1);
+        std::shared_ptr<const Camera> camera =
+            std::make_shared<PerspectiveCamera>(
+                cameraToWorld, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0.,
+                1., 0., 1e6, 90.f, film, nullptr);
+        std::shared_ptr<Sampler> sampler = std::make_shared<HaltonSampler>(
+            spp, film->GetSampleBounds());
+        PathIntegrator integrator(maxDepth, camera, sampler,
+                                  film->croppedPixelBounds);
+        integrator.SetSortedShading(m.sort);
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        integrator.Render(scene);
+        double time = SecondsSince(start);
+        printf("%-10s %10.3f %14.2f\n", m.name, time,
+               1e-6 * res * res * spp / time);
+    }
+
+    for (const std::string &f : textureFiles) remove(f.c_str());
+    remove("shadebench.exr");
+    ParallelCleanup();
+    return 0;
+}
@@ -0,0 +1,120 @@
+//
+// splatbench.cpp
+//
+// Compares the throughput of Film::AddSplat() with atomic adds to the
+// film's pixels and with per-thread splat buffers.
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "pbrt.h"
+#include "film.h"
+#include "parallel.h"
+#include "rng.h"
+#include "filters/box.h"
+
+using namespace pbrt;
+
+static void usage(const char *msg = nullptr, ...) {
+    if (msg) {
+        va_list args;
+        va_start(args, msg);
+        fprintf(stderr, "splatbench: ");
+        vfprintf(stderr, msg, args);
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, R"(usage: splatbench [options]
+
+options:
+    --nthreads <n>     Number of threads that add splats. Default: all
+    --splats <n>       Number of splats added for each mode. Default: 100000000
+    --xresolution <n>  Width of the film in pixels. Default: 1920
+    --yresolution <n>  Height of the film in pixels. Default: 1080
+)");
+    exit(1);
+}
+
+static double SecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+int main(int argc, char *argv[]) {
+    int64_t nSplats = 100000000;
+    Point2i res(1920, 1080);
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--splats") || !strcmp(argv[i], "--nthreads") ||
+            !strcmp(argv[i], "--xresolution") ||
+            !strcmp(argv[i], "--yresolution")) {
+            if (i + 1 == argc) usage("missing value after %s", argv[i]);
+            int64_t value = atoll(argv[i + 1]);
+            if (value <= 0) usage("%s must be positive", argv[i]);
+            if (!strcmp(argv[i], "--splats"))
+                nSplats = value;
+            else if (!strcmp(argv[i], "--nthreads"))
+                PbrtOptions.nThreads = value;
+            else if (!strcmp(argv[i], "--xresolution"))
+                res.x = value;
+            else
+                res.y = value;
+            ++i;
+        } else
+            usage("unknown argument \"%s\"", argv[i]);
+    }
+    ParallelInit();
+
+    // Splats either land anywhere on the film, like those of light
+    // tracing, or in a small bright region, like MLT's after it has found
+    // a caustic
+    struct {
+        const char *name;
+        Film::SplatMode mode;
+    } modes[] = {{"atomic", Film::SplatMode::Atomic},
+                 {"perthread", Film::SplatMode::PerThread}};
+    struct {
+        const char *name;
+        Bounds2f region;
+    } regions[] = {
+        {"whole film", Bounds2f(Point2f(0, 0), Point2f(res.x, res.y))},
+        {"32x32 pixels",
+         Bounds2f(Point2f(res.x / 2, res.y / 2),
+                  Point2f(res.x / 2 + 32, res.y / 2 + 32))}};
+    printf("%lld splats, %dx%d film, %d threads\n\n", (long long)nSplats,
+           res.x, res.y, MaxThreadIndex());
+    printf("%-14s %-10s %10s %14s\n", "region", "mode", "time (s)",
+           "Msplats/s");
+    const int64_t chunkSize = 65536;
+    for (const auto &r : regions) {
+        for (const auto &m : modes) {
+            std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(.5, .5)));
+            Film film(res, Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                      std::move(filter), 35., "splatbench.exr", 1., Infinity,
+                      m.mode);
+            std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            ParallelFor([&](int64_t chunk) {
+                RNG rng;
+                rng.SetSequence(chunk);
+                int64_t end = std::min(nSplats, (chunk + 1) * chunkSize);
+                for (int64_t i = chunk * chunkSize; i < end; ++i) {
+                    Point2f p(Lerp(rng.UniformFloat(), r.region.pMin.x,
+                                   r.region.pMax.x),
+                              Lerp(rng.UniformFloat(), r.region.pMin.y,
+                                   r.region.pMax.y));
+                    film.AddSplat(p, Spectrum(1.f));
+                }
+            }, (nSplats + chunkSize - 1) / chunkSize);
+            film.MergeSplatBuffers();
+            double time = SecondsSince(start);
+            printf("%-14s %-10s %10.3f %14.1f\n", r.name, m.name, time,
+                   1e-6 * nSplats / time);
+        }
+    }
+
+    ParallelCleanup();
+    return 0;
+}